@@ -0,0 +1,990 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// The microbenchmarks of the QuickTime and HEVC parsers used by `HEVCPlayerView`.
+// This program builds synthetic inputs (or reads the QuickTime files given in
+// its command line), measures each parser with them, and prints the results.
+//   parser_benchmark [--quick] [--json] [file.mov ...]
+// The `--quick` option runs each benchmark only once with small inputs, and
+// the `--json` option prints the results as a JSON array. This program exits
+// with 1 when the variants of a kernel return different results.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "base/cpu.h"
+#include "hevc/bitstream.h"
+#include "hevc/decoder.h"
+#include "hevc/rbsp.h"
+#include "mov/atom.h"
+#include "mov/atom_collection.h"
+
+namespace {
+
+/**
+ * Whether or not this program runs each benchmark only once.
+ * @type {int}
+ */
+int g_quick = 0;
+
+/**
+ * Whether or not this program prints the results as JSON.
+ * @type {int}
+ */
+int g_json = 0;
+
+/**
+ * The number of results printed so far.
+ * @type {int}
+ */
+int g_results = 0;
+
+/**
+ * The number of benchmarks whose variants have returned different results.
+ * @type {int}
+ */
+int g_mismatches = 0;
+
+/**
+ * Returns the current time of the monotonic clock (in nanoseconds).
+ * @return {uint64_t}
+ */
+uint64_t GetTime() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL +
+      static_cast<uint64_t>(now.tv_nsec);
+}
+
+/**
+ * Returns a pseudo-random number (xorshift64).
+ * @param {uint64_t*} state
+ * @return {uint32_t}
+ */
+uint32_t GetRandom(uint64_t* state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  *state = x;
+  return static_cast<uint32_t>(x >> 32);
+}
+
+/**
+ * Runs a benchmark and prints its result. The function `run` executes one
+ * operation and returns the time it has measured (in nanoseconds) so it can
+ * exclude preparations from the measurement. This function repeats the
+ * operation for at least 0.2 seconds and reports the fastest time.
+ * @param {const char*} name
+ * @param {const char*} variant
+ * @param {uint64_t} bytes
+ * @param {uint64_t} items
+ * @param {F} run
+ */
+template <typename F>
+void RunBenchmark(const char* name,
+                  const char* variant,
+                  uint64_t bytes,
+                  uint64_t items,
+                  F run) {
+  const uint64_t min_time = g_quick ? 0 : 200000000ULL;
+  uint64_t best = ~0ULL;
+  uint64_t total = 0;
+  uint64_t iterations = 0;
+  do {
+    const uint64_t elapsed = run();
+    best = elapsed < best ? elapsed : best;
+    total += elapsed;
+    ++iterations;
+  } while (total < min_time);
+  best = best ? best : 1;
+  const double seconds = static_cast<double>(best) * 1e-9;
+  const double megabytes_per_second = bytes / seconds / (1 << 20);
+  const double items_per_second = items / seconds;
+  if (g_json) {
+    printf("%s\n  {\"benchmark\": \"%s\", \"variant\": \"%s\", "
+           "\"iterations\": %llu, \"nanoseconds\": %llu, "
+           "\"bytesPerSecond\": %.0f, \"itemsPerSecond\": %.0f}",
+           g_results ? "," : "[", name, variant,
+           static_cast<unsigned long long>(iterations),
+           static_cast<unsigned long long>(best),
+           megabytes_per_second * (1 << 20), items_per_second);
+  } else {
+    printf("%-28s %-10s %12.3f us %10.1f MB/s %12.0f items/s\n",
+           name, variant, best * 1e-3, megabytes_per_second, items_per_second);
+  }
+  ++g_results;
+}
+
+/**
+ * Reports whether or not the result of a variant is the same as the one of the
+ * reference variant.
+ * @param {const char*} name
+ * @param {const char*} variant
+ * @param {int} same
+ */
+void CheckResult(const char* name, const char* variant, int same) {
+  if (!same) {
+    fprintf(stderr, "%s: %s returned a different result.\n", name, variant);
+    ++g_mismatches;
+  }
+}
+
+/**
+ * The class that writes a byte stream, e.g. a QuickTime file.
+ */
+struct ByteWriter {
+  /**
+   * Initializes an empty stream.
+   */
+  void Initialize() {
+    data_ = NULL;
+    size_ = 0;
+    capacity_ = 0;
+  }
+
+  /**
+   * Deletes the stream data.
+   */
+  void Destroy() {
+    free(data_);
+    Initialize();
+  }
+
+  /**
+   * Appends the specified bytes.
+   * @param {const void*} data
+   * @param {size_t} size
+   */
+  void Write(const void* data, size_t size) {
+    if (size_ + size > capacity_) {
+      capacity_ = (size_ + size) * 2;
+      data_ = static_cast<uint8_t*>(realloc(data_, capacity_));
+    }
+    memcpy(&data_[size_], data, size);
+    size_ += size;
+  }
+
+  /**
+   * Appends an unsigned 8-bit integer.
+   * @param {uint32_t} value
+   */
+  void WriteUINT8(uint32_t value) {
+    const uint8_t data = static_cast<uint8_t>(value);
+    Write(&data, 1);
+  }
+
+  /**
+   * Appends an unsigned 16-bit integer in the big-endian order.
+   * @param {uint32_t} value
+   */
+  void WriteUINT16BE(uint32_t value) {
+    const uint8_t data[2] = {
+      static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value),
+    };
+    Write(data, sizeof(data));
+  }
+
+  /**
+   * Appends an unsigned 32-bit integer in the big-endian order.
+   * @param {uint32_t} value
+   */
+  void WriteUINT32BE(uint32_t value) {
+    WriteUINT16BE(value >> 16);
+    WriteUINT16BE(value & 0xffff);
+  }
+
+  /**
+   * Starts writing an atom and returns the offset of its header.
+   * @param {const char*} type
+   * @return {size_t}
+   */
+  size_t BeginAtom(const char* type) {
+    const size_t offset = size_;
+    WriteUINT32BE(0);
+    Write(type, 4);
+    return offset;
+  }
+
+  /**
+   * Finishes writing the atom started at the specified offset.
+   * @param {size_t} offset
+   */
+  void EndAtom(size_t offset) {
+    const uint32_t size = static_cast<uint32_t>(size_ - offset);
+    data_[offset + 0] = static_cast<uint8_t>(size >> 24);
+    data_[offset + 1] = static_cast<uint8_t>(size >> 16);
+    data_[offset + 2] = static_cast<uint8_t>(size >> 8);
+    data_[offset + 3] = static_cast<uint8_t>(size);
+  }
+
+  /**
+   * The stream data.
+   * @type {uint8_t*}
+   */
+  uint8_t* data_;
+
+  /**
+   * The size of the stream data.
+   * @type {size_t}
+   */
+  size_t size_;
+
+  /**
+   * The capacity of the above buffer.
+   * @type {size_t}
+   */
+  size_t capacity_;
+};
+
+/**
+ * The class that writes a bit stream in the most-significant-bit first order.
+ */
+struct BitWriter {
+  /**
+   * Initializes this writer.
+   * @param {ByteWriter*} output
+   */
+  void Initialize(ByteWriter* output) {
+    output_ = output;
+    cache_ = 0;
+    length_ = 0;
+  }
+
+  /**
+   * Writes the specified number of bits (up to 32 bits).
+   * @param {uint32_t} value
+   * @param {uint32_t} length
+   */
+  void PutBits(uint32_t value, uint32_t length) {
+    cache_ = (cache_ << length) | (value & (length < 32 ?
+        (1ULL << length) - 1 : 0xffffffffULL));
+    length_ += length;
+    while (length_ >= 8) {
+      length_ -= 8;
+      output_->WriteUINT8(static_cast<uint32_t>(cache_ >> length_));
+    }
+  }
+
+  /**
+   * Writes an unsigned Exp-Golomb code.
+   * @param {uint32_t} value
+   */
+  void PutGolomb(uint32_t value) {
+    const uint32_t code = value + 1;
+    const uint32_t length = 32 - __builtin_clz(code);
+    PutBits(0, length - 1);
+    PutBits(code, length);
+  }
+
+  /**
+   * Writes the `rbsp_trailing_bits()` of an RBSP.
+   */
+  void PutTrailingBits() {
+    PutBits(1, 1);
+    if (length_ > 0) {
+      PutBits(0, 8 - length_);
+    }
+  }
+
+  /**
+   * The output stream.
+   * @type {ByteWriter*}
+   */
+  ByteWriter* output_;
+
+  /**
+   * The bits not written to the output stream.
+   * @type {uint64_t}
+   */
+  uint64_t cache_;
+
+  /**
+   * The number of the above bits.
+   * @type {uint32_t}
+   */
+  uint32_t length_;
+};
+
+/**
+ * The class that reads a bit stream one bit at a time, i.e. the reference
+ * implementation of `hevc::BitStreamReader`.
+ */
+struct ReferenceBitReader {
+  /**
+   * Initializes this reader.
+   * @param {const uint8_t*} data
+   */
+  void Initialize(const uint8_t* data) {
+    data_ = data;
+    position_ = 0;
+  }
+
+  /**
+   * Reads one bit.
+   * @return {uint32_t}
+   */
+  uint32_t GetBit() {
+    const uint32_t bit = (data_[position_ >> 3] >> (7 - (position_ & 7))) & 1;
+    ++position_;
+    return bit;
+  }
+
+  /**
+   * Reads the specified number of bits.
+   * @param {uint32_t} length
+   * @return {uint32_t}
+   */
+  uint32_t GetBits(uint32_t length) {
+    uint32_t code = 0;
+    for (uint32_t i = 0; i < length; ++i) {
+      code = (code << 1) | GetBit();
+    }
+    return code;
+  }
+
+  /**
+   * Reads an unsigned Exp-Golomb code.
+   * @return {uint32_t}
+   */
+  uint32_t GetGolomb() {
+    uint32_t zeros = 0;
+    while (!GetBit()) {
+      ++zeros;
+    }
+    return ((1U << zeros) | GetBits(zeros)) - 1;
+  }
+
+  /**
+   * The input data.
+   * @type {const uint8_t*}
+   */
+  const uint8_t* data_;
+
+  /**
+   * The read position (in bits).
+   * @type {uint64_t}
+   */
+  uint64_t position_;
+};
+
+/**
+ * The parameters of a synthetic QuickTime file.
+ */
+struct ClipParameters {
+  /**
+   * The number of samples.
+   * @type {uint32_t}
+   */
+  uint32_t number_of_samples;
+
+  /**
+   * The number of samples in a GOP (group of pictures).
+   * @type {uint32_t}
+   */
+  uint32_t gop_size;
+
+  /**
+   * The number of samples in a chunk.
+   * @type {uint32_t}
+   */
+  uint32_t chunk_size;
+
+  /**
+   * The number of `free` atoms added to each container atom of the `moov`
+   * atom, which makes the `moov` atom large.
+   * @type {uint32_t}
+   */
+  uint32_t extra_atoms;
+};
+
+/**
+ * Writes the slice NAL unit of a synthetic sample. A sample is an IDR picture
+ * at the start of a GOP, a P picture (TRAIL_R), or a B picture (TRAIL_N) in the
+ * decoding order `I0 P3 B1 B2 P6 B4 B5 ...`, i.e. the decoder has to reorder
+ * them.
+ * @param {uint32_t} index
+ * @param {uint32_t} gop_size
+ * @param {uint64_t*} random
+ * @param {ByteWriter*} output
+ */
+void WriteSample(uint32_t index,
+                 uint32_t gop_size,
+                 uint64_t* random,
+                 ByteWriter* output) {
+  ByteWriter nal;
+  nal.Initialize();
+  const uint32_t position = index % gop_size;
+  uint32_t picture_order_count = 0;
+  uint32_t nal_unit_type = hevc::NAL_IDR_W_RADL;
+  if (position > 0) {
+    const uint32_t group = (position - 1) / 3;
+    const uint32_t order = (position - 1) % 3;
+    picture_order_count = order == 0 ? group * 3 + 3 : group * 3 + order;
+    nal_unit_type = order == 0 ? hevc::NAL_TRAIL_R :
+        hevc::NAL_TRAIL_N;
+  }
+  nal.WriteUINT8(nal_unit_type << 1);
+  nal.WriteUINT8(1);
+  BitWriter writer;
+  writer.Initialize(&nal);
+  writer.PutBits(1, 1);  // first_slice_segment_in_pic_flag
+  if (position == 0) {
+    writer.PutBits(0, 1);  // no_output_of_prior_pics_flag
+  }
+  writer.PutGolomb(0);  // slice_pic_parameter_set_id
+  writer.PutGolomb(position == 0 ? 2 : 1);  // slice_type
+  if (position > 0) {
+    writer.PutBits(picture_order_count & 0xff, 8);  // slice_pic_order_cnt_lsb
+  }
+  writer.PutTrailingBits();
+  const uint32_t payload_size = 48 + GetRandom(random) % 64;
+  for (uint32_t i = 0; i < payload_size; ++i) {
+    nal.WriteUINT8(GetRandom(random) | 0x80);
+  }
+  output->WriteUINT32BE(static_cast<uint32_t>(nal.size_));
+  output->Write(nal.data_, nal.size_);
+  nal.Destroy();
+}
+
+/**
+ * Writes `free` atoms.
+ * @param {uint32_t} count
+ * @param {ByteWriter*} output
+ */
+void WriteFreeAtoms(uint32_t count, ByteWriter* output) {
+  for (uint32_t i = 0; i < count; ++i) {
+    const size_t atom = output->BeginAtom("free");
+    output->WriteUINT32BE(i);
+    output->EndAtom(atom);
+  }
+}
+
+/**
+ * Writes a synthetic QuickTime file consisting of an `ftyp` atom, an `mdat`
+ * atom, and a `moov` atom with the sample-table atoms of its samples.
+ * @param {const ClipParameters*} parameters
+ * @param {ByteWriter*} output
+ */
+void WriteClip(const ClipParameters* parameters, ByteWriter* output) {
+  const uint32_t number_of_samples = parameters->number_of_samples;
+  const uint32_t number_of_chunks =
+      (number_of_samples + parameters->chunk_size - 1) / parameters->chunk_size;
+  uint32_t* sizes =
+      static_cast<uint32_t*>(malloc(number_of_samples * sizeof(uint32_t)));
+  uint32_t* offsets =
+      static_cast<uint32_t*>(malloc(number_of_chunks * sizeof(uint32_t)));
+  uint64_t random = 0x9e3779b97f4a7c15ULL;
+
+  const size_t ftyp = output->BeginAtom("ftyp");
+  output->Write("qt  ", 4);
+  output->WriteUINT32BE(0);
+  output->Write("qt  ", 4);
+  output->EndAtom(ftyp);
+
+  const size_t mdat = output->BeginAtom("mdat");
+  for (uint32_t i = 0; i < number_of_samples; ++i) {
+    if (i % parameters->chunk_size == 0) {
+      offsets[i / parameters->chunk_size] =
+          static_cast<uint32_t>(output->size_);
+    }
+    const size_t offset = output->size_;
+    WriteSample(i, parameters->gop_size, &random, output);
+    sizes[i] = static_cast<uint32_t>(output->size_ - offset);
+  }
+  output->EndAtom(mdat);
+
+  const size_t moov = output->BeginAtom("moov");
+  WriteFreeAtoms(parameters->extra_atoms, output);
+  const size_t trak = output->BeginAtom("trak");
+  WriteFreeAtoms(parameters->extra_atoms, output);
+  const size_t mdia = output->BeginAtom("mdia");
+  const size_t mdhd = output->BeginAtom("mdhd");
+  output->WriteUINT32BE(0);  // version and flags
+  output->WriteUINT32BE(0);  // creation time
+  output->WriteUINT32BE(0);  // modification time
+  output->WriteUINT32BE(600);  // time scale
+  output->WriteUINT32BE(number_of_samples * 20);  // duration
+  output->WriteUINT16BE(0);  // language
+  output->WriteUINT16BE(0);  // quality
+  output->EndAtom(mdhd);
+  const size_t minf = output->BeginAtom("minf");
+  WriteFreeAtoms(parameters->extra_atoms, output);
+  const size_t stbl = output->BeginAtom("stbl");
+  WriteFreeAtoms(parameters->extra_atoms, output);
+  const size_t stsd = output->BeginAtom("stsd");
+  output->WriteUINT32BE(0);  // version and flags
+  output->WriteUINT32BE(0);  // number of entries
+  output->EndAtom(stsd);
+  const size_t stts = output->BeginAtom("stts");
+  output->WriteUINT32BE(0);
+  output->WriteUINT32BE(1);
+  output->WriteUINT32BE(number_of_samples);
+  output->WriteUINT32BE(20);
+  output->EndAtom(stts);
+  const size_t stss = output->BeginAtom("stss");
+  output->WriteUINT32BE(0);
+  output->WriteUINT32BE(
+      (number_of_samples + parameters->gop_size - 1) / parameters->gop_size);
+  for (uint32_t i = 0; i < number_of_samples; i += parameters->gop_size) {
+    output->WriteUINT32BE(i + 1);
+  }
+  output->EndAtom(stss);
+  const size_t stsc = output->BeginAtom("stsc");
+  const uint32_t last_chunk_size =
+      number_of_samples - (number_of_chunks - 1) * parameters->chunk_size;
+  const uint32_t number_of_entries =
+      last_chunk_size == parameters->chunk_size ? 1 : 2;
+  output->WriteUINT32BE(0);
+  output->WriteUINT32BE(number_of_entries);
+  output->WriteUINT32BE(1);
+  output->WriteUINT32BE(parameters->chunk_size);
+  output->WriteUINT32BE(1);
+  if (number_of_entries == 2) {
+    output->WriteUINT32BE(number_of_chunks);
+    output->WriteUINT32BE(last_chunk_size);
+    output->WriteUINT32BE(1);
+  }
+  output->EndAtom(stsc);
+  const size_t stsz = output->BeginAtom("stsz");
+  output->WriteUINT32BE(0);
+  output->WriteUINT32BE(0);
+  output->WriteUINT32BE(number_of_samples);
+  for (uint32_t i = 0; i < number_of_samples; ++i) {
+    output->WriteUINT32BE(sizes[i]);
+  }
+  output->EndAtom(stsz);
+  const size_t stco = output->BeginAtom("stco");
+  output->WriteUINT32BE(0);
+  output->WriteUINT32BE(number_of_chunks);
+  for (uint32_t i = 0; i < number_of_chunks; ++i) {
+    output->WriteUINT32BE(offsets[i]);
+  }
+  output->EndAtom(stco);
+  output->EndAtom(stbl);
+  output->EndAtom(minf);
+  output->EndAtom(mdia);
+  output->EndAtom(trak);
+  output->EndAtom(moov);
+
+  free(offsets);
+  free(sizes);
+}
+
+/**
+ * Creates a decoder with the specified QuickTime file and enumerates its
+ * atoms. This function copies the parameter sets in the `hvcC` extension when
+ * the file has one, and uses the ones of the synthetic files (8-bit picture
+ * order counts and two reorder pictures) otherwise.
+ * @param {const uint8_t*} data
+ * @param {size_t} size
+ * @param {hevc::Decoder*} decoder
+ * @param {mov::AtomCollection*} map
+ * @return {int}
+ */
+int PrepareDecoder(const uint8_t* data,
+                   size_t size,
+                   hevc::Decoder* decoder,
+                   mov::AtomCollection* map) {
+  decoder->Initialize();
+  if (!decoder->stream_.Copy(data, size)) {
+    return 0;
+  }
+  map->Initialize();
+  if (!map->Enumerate(decoder->stream_.GetData(), decoder->stream_.GetSize())) {
+    return 0;
+  }
+  if (map->GetSampleDescriptionAtom()->GetCount() > 0) {
+    return decoder->DecodeSampleDescription(map->GetSampleDescriptionAtom()) !=
+        NULL;
+  }
+  decoder->sps_[0].log2_max_pic_order_cnt_lsb = 8;
+  decoder->sps_[0].sps_max_num_reorder_pics = 2;
+  return 1;
+}
+
+/**
+ * Measures `mov::AtomCollection::Enumerate()` with the specified file.
+ * @param {const char*} name
+ * @param {const uint8_t*} data
+ * @param {size_t} size
+ */
+void BenchmarkEnumerate(const char* name, const uint8_t* data, size_t size) {
+  int same = 1;
+  RunBenchmark(name, "default", size, 1, [&]() {
+    mov::AtomCollection map;
+    map.Initialize();
+    const uint64_t start = GetTime();
+    const int enumerated = map.Enumerate(data, size);
+    const uint64_t elapsed = GetTime() - start;
+    same = same && enumerated;
+    return elapsed;
+  });
+  CheckResult(name, "default", same);
+}
+
+/**
+ * Measures `hevc::Decoder::InitializeSamples()` with the specified file, i.e.
+ * building the sample table and parsing the slice headers of all samples.
+ * @param {const char*} name
+ * @param {const uint8_t*} data
+ * @param {size_t} size
+ */
+void BenchmarkInitializeSamples(const char* name,
+                                const uint8_t* data,
+                                size_t size) {
+  hevc::Decoder decoder;
+  mov::AtomCollection map;
+  if (!PrepareDecoder(data, size, &decoder, &map)) {
+    CheckResult(name, "default", 0);
+    decoder.Destroy();
+    return;
+  }
+  const uint64_t number_of_samples = map.GetSampleSizeAtom()->GetCount();
+  decoder.Destroy();
+  int same = 1;
+  RunBenchmark(name, "default", size, number_of_samples, [&]() {
+    hevc::Decoder decoder;
+    mov::AtomCollection map;
+    PrepareDecoder(data, size, &decoder, &map);
+    const uint64_t start = GetTime();
+    const int initialized = decoder.InitializeSamples(&map, NULL);
+    const uint64_t elapsed = GetTime() - start;
+    same = same && initialized &&
+        decoder.GetNumberOfFrames() == static_cast<int>(number_of_samples);
+    decoder.Destroy();
+    return elapsed;
+  });
+  CheckResult(name, "default", same);
+}
+
+/**
+ * Creates a NAL-unit payload with emulation-prevention bytes. This function
+ * generates an RBSP whose bytes are zero at the specified probability and
+ * inserts `0x03` bytes into it as an encoder does.
+ * @param {uint32_t} rbsp_size
+ * @param {uint32_t} zero_percentage
+ * @param {ByteWriter*} rbsp
+ * @param {ByteWriter*} payload
+ */
+void CreatePayload(uint32_t rbsp_size,
+                   uint32_t zero_percentage,
+                   ByteWriter* rbsp,
+                   ByteWriter* payload) {
+  uint64_t random = 0x2545f4914f6cdd1dULL;
+  uint32_t zeros = 0;
+  for (uint32_t i = 0; i < rbsp_size; ++i) {
+    const uint32_t value = GetRandom(&random);
+    const uint32_t data_byte = value % 100 < zero_percentage ? 0 :
+        (value >> 8) & 0xff;
+    rbsp->WriteUINT8(data_byte);
+    if (zeros >= 2 && data_byte <= 3) {
+      payload->WriteUINT8(3);
+      zeros = 0;
+    }
+    payload->WriteUINT8(data_byte);
+    zeros = data_byte ? 0 : zeros + 1;
+  }
+  static const uint8_t padding[hevc::RBSP::PADDING_SIZE] = { 0 };
+  rbsp->Write(padding, sizeof(padding));
+  payload->Write(padding, sizeof(padding));
+  rbsp->size_ -= sizeof(padding);
+  payload->size_ -= sizeof(padding);
+}
+
+/**
+ * The signature of an RBSP-extraction function.
+ * @type {function(const uint8_t*, uintptr_t, uint8_t*): uintptr_t}
+ */
+typedef uintptr_t (*ExtractFunction)(const uint8_t*, uintptr_t, uint8_t*);
+
+/**
+ * Measures an RBSP-extraction function with the specified payload and
+ * verifies its output.
+ * @param {const char*} name
+ * @param {const char*} variant
+ * @param {ExtractFunction} extract
+ * @param {const ByteWriter*} rbsp
+ * @param {const ByteWriter*} payload
+ */
+void BenchmarkExtractRBSP(const char* name,
+                          const char* variant,
+                          ExtractFunction extract,
+                          const ByteWriter* rbsp,
+                          const ByteWriter* payload) {
+  uint8_t* output = static_cast<uint8_t*>(
+      malloc(payload->size_ + hevc::RBSP::PADDING_SIZE));
+  int same = 1;
+  RunBenchmark(name, variant, payload->size_, 1, [&]() {
+    const uint64_t start = GetTime();
+    const uintptr_t size = extract(payload->data_, payload->size_, output);
+    const uint64_t elapsed = GetTime() - start;
+    same = same && size == rbsp->size_ && !memcmp(output, rbsp->data_, size);
+    return elapsed;
+  });
+  CheckResult(name, variant, same);
+  free(output);
+}
+
+/**
+ * Measures all RBSP-extraction functions available on the host CPU.
+ * @param {uint32_t} rbsp_size
+ * @param {uint32_t} zero_percentage
+ * @param {const char*} name
+ */
+void BenchmarkExtractRBSPs(uint32_t rbsp_size,
+                           uint32_t zero_percentage,
+                           const char* name) {
+  ByteWriter rbsp;
+  ByteWriter payload;
+  rbsp.Initialize();
+  payload.Initialize();
+  CreatePayload(rbsp_size, zero_percentage, &rbsp, &payload);
+  BenchmarkExtractRBSP(name, "scalar", hevc::RBSP::ExtractScalar,
+                       &rbsp, &payload);
+#if __SIZEOF_SIZE_T__ == 8
+  BenchmarkExtractRBSP(name, "swar64", hevc::RBSP::ExtractSWAR,
+                       &rbsp, &payload);
+#endif
+#if __arm__ || __aarch64__
+  if (CPU::HaveNEON()) {
+    BenchmarkExtractRBSP(name, "neon", hevc::RBSP::ExtractNEON,
+                         &rbsp, &payload);
+    BenchmarkExtractRBSP(name, "neon16", hevc::RBSP::ExtractNEON16,
+                         &rbsp, &payload);
+  }
+#endif
+#if __SSE2__
+  BenchmarkExtractRBSP(name, "sse2", hevc::RBSP::ExtractSSE2,
+                       &rbsp, &payload);
+#endif
+#if __i386__ || __x86_64__
+  if (CPU::HaveAVX2()) {
+    BenchmarkExtractRBSP(name, "avx2", hevc::RBSP::ExtractAVX2,
+                         &rbsp, &payload);
+  }
+#endif
+  BenchmarkExtractRBSP(name, "default", hevc::RBSP::Extract, &rbsp, &payload);
+  payload.Destroy();
+  rbsp.Destroy();
+}
+
+/**
+ * Measures reading unsigned Exp-Golomb codes and fixed-length codes with
+ * `hevc::BitStreamReader` and with the reference reader.
+ * @param {uint32_t} number_of_codes
+ */
+void BenchmarkBitStreamReader(uint32_t number_of_codes) {
+  // Write Exp-Golomb codes of small values (as parameter sets have) and codes
+  // of 1 to 16 bits. (The reader may read 8 bytes beyond the end.)
+  ByteWriter golomb_data;
+  ByteWriter bits_data;
+  golomb_data.Initialize();
+  bits_data.Initialize();
+  uint8_t* lengths = static_cast<uint8_t*>(malloc(number_of_codes));
+  uint64_t random = 0xd1b54a32d192ed03ULL;
+  uint64_t golomb_sum = 0;
+  uint64_t bits_sum = 0;
+  BitWriter golomb_writer;
+  BitWriter bits_writer;
+  int same = 1;
+  golomb_writer.Initialize(&golomb_data);
+  bits_writer.Initialize(&bits_data);
+  for (uint32_t i = 0; i < number_of_codes; ++i) {
+    const uint32_t value = GetRandom(&random);
+    const uint32_t golomb = (value % 65535) >> (value >> 28);
+    golomb_writer.PutGolomb(golomb);
+    golomb_sum += golomb;
+    lengths[i] = static_cast<uint8_t>((value >> 16) % 16 + 1);
+    const uint32_t bits = value & ((1U << lengths[i]) - 1);
+    bits_writer.PutBits(bits, lengths[i]);
+    bits_sum += bits;
+  }
+  golomb_writer.PutTrailingBits();
+  bits_writer.PutTrailingBits();
+  static const uint8_t padding[16] = { 0 };
+  golomb_data.Write(padding, sizeof(padding));
+  bits_data.Write(padding, sizeof(padding));
+
+  same = 1;
+  RunBenchmark("ReadGolomb", "reference", golomb_data.size_, number_of_codes,
+               [&]() {
+    ReferenceBitReader reader;
+    reader.Initialize(golomb_data.data_);
+    uint64_t sum = 0;
+    const uint64_t start = GetTime();
+    for (uint32_t i = 0; i < number_of_codes; ++i) {
+      sum += reader.GetGolomb();
+    }
+    const uint64_t elapsed = GetTime() - start;
+    same = same && sum == golomb_sum;
+    return elapsed;
+  });
+  CheckResult("ReadGolomb", "reference", same);
+  same = 1;
+  RunBenchmark("ReadGolomb", "default", golomb_data.size_, number_of_codes,
+               [&]() {
+    hevc::BitStreamReader reader;
+    reader.Initialize(golomb_data.data_,
+                      golomb_data.data_ + golomb_data.size_);
+    uint64_t sum = 0;
+    const uint64_t start = GetTime();
+    for (uint32_t i = 0; i < number_of_codes; ++i) {
+      sum += reader.GetGolomb<uint32_t>();
+    }
+    const uint64_t elapsed = GetTime() - start;
+    same = same && sum == golomb_sum;
+    return elapsed;
+  });
+  CheckResult("ReadGolomb", "default", same);
+  same = 1;
+  RunBenchmark("GetBits", "reference", bits_data.size_, number_of_codes,
+               [&]() {
+    ReferenceBitReader reader;
+    reader.Initialize(bits_data.data_);
+    uint64_t sum = 0;
+    const uint64_t start = GetTime();
+    for (uint32_t i = 0; i < number_of_codes; ++i) {
+      sum += reader.GetBits(lengths[i]);
+    }
+    const uint64_t elapsed = GetTime() - start;
+    same = same && sum == bits_sum;
+    return elapsed;
+  });
+  CheckResult("GetBits", "reference", same);
+  same = 1;
+  RunBenchmark("GetBits", "default", bits_data.size_, number_of_codes,
+               [&]() {
+    hevc::BitStreamReader reader;
+    reader.Initialize(bits_data.data_, bits_data.data_ + bits_data.size_);
+    uint64_t sum = 0;
+    const uint64_t start = GetTime();
+    for (uint32_t i = 0; i < number_of_codes; ++i) {
+      sum += reader.GetBits<uint32_t>(lengths[i]);
+    }
+    const uint64_t elapsed = GetTime() - start;
+    same = same && sum == bits_sum;
+    return elapsed;
+  });
+  CheckResult("GetBits", "default", same);
+
+  free(lengths);
+  bits_data.Destroy();
+  golomb_data.Destroy();
+}
+
+/**
+ * Reads the specified file to memory.
+ * @param {const char*} path
+ * @param {ByteWriter*} output
+ * @return {int}
+ */
+int ReadFile(const char* path, ByteWriter* output) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    return 0;
+  }
+  uint8_t buffer[65536];
+  size_t size;
+  while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    output->Write(buffer, size);
+  }
+  fclose(file);
+  return 1;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int first_file = argc;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--quick")) {
+      g_quick = 1;
+    } else if (!strcmp(argv[i], "--json")) {
+      g_json = 1;
+    } else {
+      first_file = i;
+      break;
+    }
+  }
+
+  // Measure the QuickTime parsers with synthetic files: a 10k-sample clip with
+  // 30-frame GOPs (one chunk per GOP), a clip with one sample per chunk, and a
+  // clip whose `moov` atom has thousands of extra atoms.
+  const uint32_t scale = g_quick ? 100 : 1;
+  static const struct {
+    const char* enumerate_name;
+    const char* initialize_name;
+    ClipParameters parameters;
+  } clips[] = {
+    { "Enumerate/10k", "InitializeSamples/10k",
+      { 10000, 30, 30, 0 } },
+    { "Enumerate/10k-chunks", "InitializeSamples/10k-chunks",
+      { 10000, 30, 1, 0 } },
+    { "Enumerate/10k-atoms", "InitializeSamples/10k-atoms",
+      { 10000, 30, 30, 2500 } },
+  };
+  for (size_t i = 0; i < sizeof(clips) / sizeof(clips[0]); ++i) {
+    ClipParameters parameters = clips[i].parameters;
+    parameters.number_of_samples /= scale;
+    parameters.extra_atoms /= scale;
+    ByteWriter clip;
+    clip.Initialize();
+    WriteClip(&parameters, &clip);
+    BenchmarkEnumerate(clips[i].enumerate_name, clip.data_, clip.size_);
+    BenchmarkInitializeSamples(clips[i].initialize_name,
+                               clip.data_, clip.size_);
+    clip.Destroy();
+  }
+  for (int i = first_file; i < argc; ++i) {
+    ByteWriter clip;
+    clip.Initialize();
+    if (!ReadFile(argv[i], &clip)) {
+      fprintf(stderr, "%s: cannot read.\n", argv[i]);
+      ++g_mismatches;
+      continue;
+    }
+    BenchmarkEnumerate("Enumerate/file", clip.data_, clip.size_);
+    BenchmarkInitializeSamples("InitializeSamples/file",
+                               clip.data_, clip.size_);
+    clip.Destroy();
+  }
+
+  // Measure the RBSP extractors with payloads of slice size, where 1% (as
+  // typical slice data) or 40% (as emulation-prevention-heavy data) of the
+  // RBSP bytes are zero.
+  BenchmarkExtractRBSPs(262144 / scale, 1, "ExtractRBSP/256k-sparse");
+  BenchmarkExtractRBSPs(262144 / scale, 40, "ExtractRBSP/256k-dense");
+  BenchmarkExtractRBSPs(200, 40, "ExtractRBSP/200-dense");
+
+  // Measure the bit-stream readers.
+  BenchmarkBitStreamReader(1000000 / scale);
+
+  if (g_json) {
+    printf("%s]\n", g_results ? "\n" : "[");
+  }
+  return g_mismatches ? 1 : 0;
+}
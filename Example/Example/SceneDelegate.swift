@@ -23,11 +23,38 @@
  */
 
 import UIKit
+import HEVCPlayerBenchmark
 
 class SceneDelegate: UIResponder, UIWindowSceneDelegate {
   var window: UIWindow?
+  private var benchmark: HEVCPlayerBenchmark? = nil
+
   func scene(_ scene: UIScene, willConnectTo session: UISceneSession, options connectionOptions: UIScene.ConnectionOptions) {
       guard let _ = (scene as? UIWindowScene) else { return }
+      runBenchmark()
+  }
+
+  // Runs the benchmark corpus specified by the `-HEVCBenchmarkCorpus <path>`
+  // launch argument (relative to the Documents directory), and writes its
+  // report to "Documents/benchmark.json" and to the standard output.
+  private func runBenchmark() {
+    guard let corpus = UserDefaults.standard.string(forKey: "HEVCBenchmarkCorpus"),
+          let view = window?.rootViewController?.view else { return }
+    let documents = FileManager.default.urls(for: .documentDirectory, in: .userDomainMask)[0]
+    let url = corpus.hasPrefix("/") ? URL(fileURLWithPath: corpus) : documents.appendingPathComponent(corpus)
+    do {
+      benchmark = try HEVCPlayerBenchmark(corpusURL: url)
+    } catch {
+      print("Error: \(error)")
+      return
+    }
+    UIApplication.shared.isIdleTimerDisabled = true
+    benchmark?.run(in: view) { [weak self] report in
+      try? report.write(to: documents.appendingPathComponent("benchmark.json"))
+      print(String(data: report, encoding: .utf8) ?? "")
+      UIApplication.shared.isIdleTimerDisabled = false
+      self?.benchmark = nil
+    }
   }
 
   func sceneDidDisconnect(_ scene: UIScene) {
@@ -11,6 +11,10 @@ let package = Package(
             name: "HEVCPlayerView",
             targets: ["HEVCPlayerView"]
         ),
+        .library(
+            name: "HEVCPlayerBenchmark",
+            targets: ["HEVCPlayerBenchmark"]
+        ),
     ],
     targets: [
         .target(
@@ -18,12 +22,20 @@ let package = Package(
             resources: [.process("HEVCPlayerView.metal")],
             linkerSettings: [
                 .linkedFramework("SystemConfiguration"),
+                .linkedFramework("Accelerate"),
                 .linkedFramework("CoreMedia"),
                 .linkedFramework("CoreVideo"),
                 .linkedFramework("Metal"),
                 .linkedFramework("VideoToolbox"),
                 .linkedFramework("UIKit"),
             ]),
+        .target(
+            name: "HEVCPlayerBenchmark",
+            dependencies: ["HEVCPlayerView"],
+            linkerSettings: [
+                .linkedFramework("QuartzCore"),
+                .linkedFramework("UIKit"),
+            ]),
     ],
     cLanguageStandard: .gnu11,
     cxxLanguageStandard: .gnucxx11
@@ -0,0 +1,72 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef HEVC_PLAYER_BENCHMARK_H_
+#define HEVC_PLAYER_BENCHMARK_H_
+
+#import <UIKit/UIKit.h>
+
+/**
+ * The class that plays a corpus of HEVC-with-Alpha files with HEVCPlayerView
+ * objects and measures their performance. A corpus is a JSON file listing the
+ * benchmark cases and their files (relative to the JSON file) as below.
+ *   {
+ *     "cases": [
+ *       {
+ *         "name": "720p-gop30-x4",
+ *         "file": "720p-gop30.mov",
+ *         "fps": 30,
+ *         "players": 4,
+ *         "duration": 10,
+ *         "loop": true
+ *       }
+ *     ]
+ *   }
+ * This object runs the cases one by one and reports the time to the first
+ * frame, the sustained frame rate, the dropped frames, the peak memory
+ * footprint, and the energy used by this process as a JSON object.
+ */
+@interface HEVCPlayerBenchmark: NSObject
+
+/**
+ * Reads the specified corpus.
+ * @param {NSURL*} url
+ * @param {NSError**} error
+ * @return {HEVCPlayerBenchmark*}
+ */
+- (instancetype _Nullable) initWithCorpusURL:(NSURL* _Nonnull)url error:(NSError* _Nullable * _Nullable)error;
+
+/**
+ * Runs the benchmark cases in the specified view. This object adds players to
+ * the view and calls the completion handler on the main thread with the
+ * report (encoded in JSON) when it finishes all cases. This method must be
+ * called on the main thread.
+ * @param {UIView*} view
+ * @param {void(^)(NSData*)} completion
+ */
+- (void) runInView:(UIView* _Nonnull)view completion:(void (^ _Nonnull)(NSData* _Nonnull report))completion;
+
+@end
+
+#endif  // HEVC_PLAYER_BENCHMARK_H_
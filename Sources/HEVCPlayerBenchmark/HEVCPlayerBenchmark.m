@@ -0,0 +1,528 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#import "HEVCPlayerBenchmark.h"
+
+#import <QuartzCore/QuartzCore.h>
+#include <mach/mach.h>
+#include <math.h>
+#include <string.h>
+#include <sys/utsname.h>
+#import "HEVCPlayerView.h"
+
+/**
+ * The interval between two samples of the memory footprint (in seconds).
+ * @type {NSTimeInterval}
+ */
+static const NSTimeInterval HEVCBenchmarkSampleInterval = 0.1;
+
+/**
+ * The maximum time for which a benchmark case waits for all players to present
+ * their first frames before it starts measuring them (in seconds).
+ * @type {NSTimeInterval}
+ */
+static const NSTimeInterval HEVCBenchmarkLoadTimeout = 10.0;
+
+/**
+ * The time for which the benchmark waits for the players of a finished case to
+ * release their resources before it starts the next case (in seconds).
+ * @type {NSTimeInterval}
+ */
+static const NSTimeInterval HEVCBenchmarkCooldown = 1.0;
+
+/**
+ * The resource usage of this process.
+ */
+typedef struct HEVCBenchmarkUsage {
+  /**
+   * The CPU time used by this process (in nanoseconds).
+   * @type {uint64_t}
+   */
+  uint64_t cpuTime;
+
+  /**
+   * The GPU time used by this process (in nanoseconds).
+   * @type {uint64_t}
+   */
+  uint64_t gpuTime;
+
+  /**
+   * The energy used by this process (in nanojoules), which is 0 when the
+   * device does not report it.
+   * @type {uint64_t}
+   */
+  uint64_t energy;
+
+  /**
+   * The number of wakeups of the CPU caused by this process.
+   * @type {uint64_t}
+   */
+  uint64_t wakeups;
+} HEVCBenchmarkUsage;
+
+/**
+ * Returns the memory footprint of this process (in bytes), i.e. the value
+ * that the operating system uses for terminating processes.
+ * @return {uint64_t}
+ */
+static uint64_t HEVCGetMemoryFootprint(void) {
+  task_vm_info_data_t info;
+  mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+  if (task_info(mach_task_self(), TASK_VM_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+    return 0;
+  }
+  return info.phys_footprint;
+}
+
+/**
+ * Reads the resource usage of this process.
+ * @param {HEVCBenchmarkUsage*} usage
+ */
+static void HEVCGetUsage(HEVCBenchmarkUsage *usage) {
+  memset(usage, 0, sizeof(*usage));
+  task_power_info_v2_data_t info;
+  mach_msg_type_number_t count = TASK_POWER_INFO_V2_COUNT;
+  if (task_info(mach_task_self(), TASK_POWER_INFO_V2, (task_info_t)&info, &count) != KERN_SUCCESS) {
+    return;
+  }
+  usage->cpuTime = info.cpu_energy.total_user + info.cpu_energy.total_system;
+  usage->gpuTime = info.gpu_energy.task_gpu_utilisation;
+#if defined(__arm__) || defined(__arm64__)
+  usage->energy = info.task_energy;
+#endif
+  usage->wakeups = info.cpu_energy.task_interrupt_wakeups + info.cpu_energy.task_platform_idle_wakeups;
+}
+
+/**
+ * Returns the name of the specified thermal state.
+ * @param {NSProcessInfoThermalState} state
+ * @return {NSString*}
+ */
+static NSString *HEVCGetThermalStateName(NSProcessInfoThermalState state) {
+  switch (state) {
+    case NSProcessInfoThermalStateNominal:
+      return @"nominal";
+    case NSProcessInfoThermalStateFair:
+      return @"fair";
+    case NSProcessInfoThermalStateSerious:
+      return @"serious";
+    case NSProcessInfoThermalStateCritical:
+      return @"critical";
+  }
+  return @"unknown";
+}
+
+/**
+ * The inner class that observes the players of a benchmark case. (A player does
+ * not retain its delegate, and it calls `playerView:didUpdateFrame:` on a
+ * worker thread.)
+ */
+@interface HEVCBenchmarkObserver: NSObject <HEVCPlayerViewDelegate> {
+@public
+  /**
+   * The number of frames presented by the players.
+   * @type {NSUInteger}
+   */
+  NSUInteger _numberOfFrames;
+
+  /**
+   * The number of players that have finished playing their files.
+   * @type {NSUInteger}
+   */
+  NSUInteger _numberOfFinishedPlayers;
+}
+
+/**
+ * The description of the last error reported by the players.
+ * @type {NSString*}
+ */
+@property (atomic, copy) NSString *error;
+
+@end
+
+@implementation HEVCBenchmarkObserver
+
+- (void)playerView:(HEVCPlayerView *)hevcPlayerView didFail:(NSObject *)error {
+  self.error = [error description];
+}
+
+- (void)playerView:(HEVCPlayerView *)hevcPlayerView didFinish:(NSObject *)dummy {
+  __atomic_fetch_add(&_numberOfFinishedPlayers, 1, __ATOMIC_RELAXED);
+}
+
+- (void)playerView:(HEVCPlayerView *)hevcPlayerView didUpdateFrame:(NSInteger)index {
+  __atomic_fetch_add(&_numberOfFrames, 1, __ATOMIC_RELAXED);
+}
+
+@end
+
+@implementation HEVCPlayerBenchmark {
+  /**
+   * The benchmark cases read from the corpus.
+   * @type {NSArray<NSDictionary*>*}
+   * @private
+   */
+  NSArray<NSDictionary *> *_cases;
+
+  /**
+   * The directory containing the corpus.
+   * @type {NSURL*}
+   * @private
+   */
+  NSURL *_baseURL;
+
+  /**
+   * The view to which this object adds players.
+   * @type {UIView*}
+   * @private
+   */
+  UIView *_view;
+
+  /**
+   * The handler called when this object finishes all cases.
+   * @type {void(^)(NSData*)}
+   * @private
+   */
+  void (^_completion)(NSData *);
+
+  /**
+   * The results of the finished cases.
+   * @type {NSMutableArray<NSDictionary*>*}
+   * @private
+   */
+  NSMutableArray<NSDictionary *> *_results;
+
+  /**
+   * The index of the running case.
+   * @type {NSUInteger}
+   * @private
+   */
+  NSUInteger _caseIndex;
+
+  /**
+   * The players of the running case.
+   * @type {NSMutableArray<HEVCPlayerView*>*}
+   * @private
+   */
+  NSMutableArray<HEVCPlayerView *> *_players;
+
+  /**
+   * The delegate of the above players.
+   * @type {HEVCBenchmarkObserver*}
+   * @private
+   */
+  HEVCBenchmarkObserver *_observer;
+
+  /**
+   * The timer that samples the running case.
+   * @type {NSTimer*}
+   * @private
+   */
+  NSTimer *_timer;
+
+  /**
+   * The time when the running case started playing its files.
+   * @type {CFTimeInterval}
+   * @private
+   */
+  CFTimeInterval _startTime;
+
+  /**
+   * The time when the running case started measuring its players, or 0 while
+   * it waits for their first frames.
+   * @type {CFTimeInterval}
+   * @private
+   */
+  CFTimeInterval _measureTime;
+
+  /**
+   * The memory footprint before the running case started.
+   * @type {uint64_t}
+   * @private
+   */
+  uint64_t _baseFootprint;
+
+  /**
+   * The maximum memory footprint while the running case plays its files.
+   * @type {uint64_t}
+   * @private
+   */
+  uint64_t _peakFootprint;
+
+  /**
+   * The resource usage when the running case started measuring its players.
+   * @type {HEVCBenchmarkUsage}
+   * @private
+   */
+  HEVCBenchmarkUsage _baseUsage;
+
+  /**
+   * The number of presented frames when the running case started measuring
+   * its players.
+   * @type {NSUInteger}
+   * @private
+   */
+  NSUInteger _baseFrames;
+
+  /**
+   * The numbers of dropped and duplicated frames when the running case started
+   * measuring its players.
+   * @type {NSUInteger}
+   * @private
+   */
+  NSUInteger _baseDroppedFrames;
+  NSUInteger _baseDuplicatedFrames;
+
+  /**
+   * The numbers of decoded frames and decoder resets when the running case
+   * started measuring its players.
+   * @type {NSUInteger}
+   * @private
+   */
+  NSUInteger _baseDecodedFrames;
+  NSUInteger _baseDecoderResets;
+
+  /**
+   * The thermal state when the running case started.
+   * @type {NSProcessInfoThermalState}
+   * @private
+   */
+  NSProcessInfoThermalState _baseThermalState;
+}
+
+- (instancetype)initWithCorpusURL:(NSURL *)url error:(NSError **)error {
+  self = [super init];
+  if (self) {
+    NSData *data = [NSData dataWithContentsOfURL:url options:0 error:error];
+    if (!data) {
+      return nil;
+    }
+    NSDictionary *corpus = [NSJSONSerialization JSONObjectWithData:data options:0 error:error];
+    if (![corpus isKindOfClass:[NSDictionary class]] || ![corpus[@"cases"] isKindOfClass:[NSArray class]]) {
+      if (error && !*error) {
+        *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadCorruptFileError userInfo:@{NSURLErrorKey: url}];
+      }
+      return nil;
+    }
+    _cases = corpus[@"cases"];
+    _baseURL = [url URLByDeletingLastPathComponent];
+  }
+  return self;
+}
+
+- (void)runInView:(UIView *)view completion:(void (^)(NSData *))completion {
+  _view = view;
+  _completion = [completion copy];
+  _results = [NSMutableArray arrayWithCapacity:_cases.count];
+  _caseIndex = 0;
+  [self startCase];
+}
+
+#pragma mark - internal methods
+
+/**
+ * Returns the number value of the specified key in the running case.
+ * @param {NSString*} key
+ * @param {double} defaultValue
+ * @return {double}
+ */
+- (double)numberForKey:(NSString *)key defaultValue:(double)defaultValue {
+  id value = _cases[_caseIndex][key];
+  return [value isKindOfClass:[NSNumber class]] ? [value doubleValue] : defaultValue;
+}
+
+/**
+ * Starts the running case, i.e. adds its players to the view in a grid and
+ * plays its file with them. This method finishes the benchmark when there are
+ * no more cases.
+ */
+- (void)startCase {
+  if (_caseIndex >= _cases.count) {
+    [self finishBenchmark];
+    return;
+  }
+  NSDictionary *benchmarkCase = _cases[_caseIndex];
+  NSString *file = [benchmarkCase[@"file"] isKindOfClass:[NSString class]] ? benchmarkCase[@"file"] : @"";
+  NSURL *url = [_baseURL URLByAppendingPathComponent:file];
+  const NSInteger fps = (NSInteger)[self numberForKey:@"fps" defaultValue:30];
+  const NSInteger numberOfPlayers = MAX((NSInteger)[self numberForKey:@"players" defaultValue:1], 1);
+  const BOOL loop = [self numberForKey:@"loop" defaultValue:1] != 0;
+
+  _baseFootprint = HEVCGetMemoryFootprint();
+  _peakFootprint = _baseFootprint;
+  _baseThermalState = [NSProcessInfo processInfo].thermalState;
+  _observer = [[HEVCBenchmarkObserver alloc] init];
+  _players = [NSMutableArray arrayWithCapacity:numberOfPlayers];
+  const NSInteger columns = (NSInteger)ceil(sqrt((double)numberOfPlayers));
+  const NSInteger rows = (numberOfPlayers + columns - 1) / columns;
+  const CGSize size = CGSizeMake(_view.bounds.size.width / columns, _view.bounds.size.height / rows);
+  for (NSInteger i = 0; i < numberOfPlayers; ++i) {
+    const CGRect frame = CGRectMake((i % columns) * size.width, (i / columns) * size.height, size.width, size.height);
+    HEVCPlayerView *player = [[HEVCPlayerView alloc] initWithFrame:frame device:MTLCreateSystemDefaultDevice()];
+    player.delegate = _observer;
+    [_view addSubview:player];
+    [_players addObject:player];
+  }
+  _startTime = CACurrentMediaTime();
+  _measureTime = 0.0;
+  for (HEVCPlayerView *player in _players) {
+    [player playFileFromURL:url fps:fps loop:loop];
+  }
+  _timer = [NSTimer scheduledTimerWithTimeInterval:HEVCBenchmarkSampleInterval target:self selector:@selector(sampleCase:) userInfo:nil repeats:YES];
+}
+
+/**
+ * Called periodically while the running case plays its file. This method
+ * starts measuring the players when all of them present their first frames
+ * (or when they fail to do so in time), and it finishes the case when its
+ * duration has passed.
+ * @param {NSTimer*} timer
+ */
+- (void)sampleCase:(NSTimer *)timer {
+  const uint64_t footprint = HEVCGetMemoryFootprint();
+  _peakFootprint = footprint > _peakFootprint ? footprint : _peakFootprint;
+  const CFTimeInterval now = CACurrentMediaTime();
+  const NSUInteger finishedPlayers = __atomic_load_n(&_observer->_numberOfFinishedPlayers, __ATOMIC_RELAXED);
+  if (_measureTime == 0.0) {
+    BOOL loaded = YES;
+    for (HEVCPlayerView *player in _players) {
+      loaded = loaded && [player statistics].timeToFirstFrame > 0.0;
+    }
+    if (loaded || now - _startTime >= HEVCBenchmarkLoadTimeout || _observer.error) {
+      _measureTime = now;
+      HEVCGetUsage(&_baseUsage);
+      _baseFrames = __atomic_load_n(&_observer->_numberOfFrames, __ATOMIC_RELAXED);
+      _baseDroppedFrames = 0;
+      _baseDuplicatedFrames = 0;
+      _baseDecodedFrames = 0;
+      _baseDecoderResets = 0;
+      // Save the counters of the players and clear their latencies so the
+      // result excludes the frames decoded before they started measuring.
+      for (HEVCPlayerView *player in _players) {
+        HEVCPlayerStatistics *statistics = [player statistics];
+        _baseDroppedFrames += statistics.numberOfDroppedFrames;
+        _baseDuplicatedFrames += statistics.numberOfDuplicatedFrames;
+        _baseDecodedFrames += statistics.numberOfDecodedFrames;
+        _baseDecoderResets += statistics.numberOfDecoderResets;
+        [player resetDecodeLatencies];
+      }
+    }
+    return;
+  }
+  if (now - _measureTime < [self numberForKey:@"duration" defaultValue:10] && finishedPlayers < _players.count && !_observer.error) {
+    return;
+  }
+  [self finishCaseAtTime:now];
+}
+
+/**
+ * Writes the result of the running case, deletes its players, and starts the
+ * next case after the cooldown time.
+ * @param {CFTimeInterval} now
+ */
+- (void)finishCaseAtTime:(CFTimeInterval)now {
+  [_timer invalidate];
+  _timer = nil;
+  HEVCBenchmarkUsage usage;
+  HEVCGetUsage(&usage);
+  const NSUInteger numberOfFrames = __atomic_load_n(&_observer->_numberOfFrames, __ATOMIC_RELAXED);
+  const CFTimeInterval duration = now - _measureTime;
+  NSMutableArray<NSNumber *> *timesToFirstFrame = [NSMutableArray arrayWithCapacity:_players.count];
+  NSUInteger droppedFrames = 0;
+  NSUInteger duplicatedFrames = 0;
+  NSUInteger decodedFrames = 0;
+  NSUInteger decoderResets = 0;
+  CFTimeInterval decodeLatency50 = 0.0;
+  CFTimeInterval decodeLatency99 = 0.0;
+  uint64_t pictureCacheOccupancy = 0;
+  for (HEVCPlayerView *player in _players) {
+    HEVCPlayerStatistics *statistics = [player statistics];
+    [timesToFirstFrame addObject:@(statistics.timeToFirstFrame)];
+    droppedFrames += statistics.numberOfDroppedFrames;
+    duplicatedFrames += statistics.numberOfDuplicatedFrames;
+    decodedFrames += statistics.numberOfDecodedFrames;
+    decoderResets += statistics.numberOfDecoderResets;
+    decodeLatency50 = MAX(decodeLatency50, statistics.decodeLatency50);
+    decodeLatency99 = MAX(decodeLatency99, statistics.decodeLatency99);
+    pictureCacheOccupancy += statistics.pictureCacheOccupancy;
+  }
+  NSMutableDictionary *result = [NSMutableDictionary dictionaryWithDictionary:_cases[_caseIndex]];
+  result[@"timeToFirstFrame"] = @{
+    @"max": [timesToFirstFrame valueForKeyPath:@"@max.self"] ?: @0,
+    @"mean": [timesToFirstFrame valueForKeyPath:@"@avg.self"] ?: @0,
+  };
+  result[@"measuredDuration"] = @(duration);
+  result[@"sustainedFrameRate"] = @(duration > 0.0 ? (numberOfFrames - _baseFrames) / duration / _players.count : 0.0);
+  result[@"droppedFrames"] = @(droppedFrames - _baseDroppedFrames);
+  result[@"duplicatedFrames"] = @(duplicatedFrames - _baseDuplicatedFrames);
+  result[@"decodedFrames"] = @(decodedFrames - _baseDecodedFrames);
+  result[@"decoderResets"] = @(decoderResets - _baseDecoderResets);
+  result[@"decodeLatency50"] = @(decodeLatency50);
+  result[@"decodeLatency99"] = @(decodeLatency99);
+  result[@"pictureCacheOccupancy"] = @(pictureCacheOccupancy);
+  result[@"peakFootprint"] = @(_peakFootprint);
+  result[@"peakFootprintIncrease"] = @(_peakFootprint - _baseFootprint);
+  result[@"cpuTime"] = @((usage.cpuTime - _baseUsage.cpuTime) * 1e-9);
+  result[@"gpuTime"] = @((usage.gpuTime - _baseUsage.gpuTime) * 1e-9);
+  result[@"energy"] = @((usage.energy - _baseUsage.energy) * 1e-9);
+  result[@"wakeupsPerSecond"] = @(duration > 0.0 ? (usage.wakeups - _baseUsage.wakeups) / duration : 0.0);
+  result[@"thermalState"] = @{
+    @"start": HEVCGetThermalStateName(_baseThermalState),
+    @"end": HEVCGetThermalStateName([NSProcessInfo processInfo].thermalState),
+  };
+  result[@"qualityTier"] = @([HEVCPlayerView qualityTier]);
+  if (_observer.error) {
+    result[@"error"] = _observer.error;
+  }
+  [_results addObject:result];
+
+  for (HEVCPlayerView *player in _players) {
+    [player finish];
+    [player removeFromSuperview];
+  }
+  _players = nil;
+  _observer = nil;
+  ++_caseIndex;
+  [self performSelector:@selector(startCase) withObject:nil afterDelay:HEVCBenchmarkCooldown];
+}
+
+/**
+ * Calls the completion handler with the report of all cases.
+ */
+- (void)finishBenchmark {
+  struct utsname name;
+  uname(&name);
+  NSDictionary *report = @{
+    @"device": @(name.machine),
+    @"system": [UIDevice currentDevice].systemVersion,
+    @"cases": _results,
+  };
+  NSData *data = [NSJSONSerialization dataWithJSONObject:report options:NSJSONWritingPrettyPrinted | NSJSONWritingSortedKeys error:nil];
+  void (^completion)(NSData *) = _completion;
+  _completion = nil;
+  _view = nil;
+  completion(data ?: [NSData data]);
+}
+
+@end
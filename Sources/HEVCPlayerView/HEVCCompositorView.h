@@ -0,0 +1,93 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef HEVC_COMPOSITOR_VIEW_H_
+#define HEVC_COMPOSITOR_VIEW_H_
+
+#import <UIKit/UIKit.h>
+
+@class HEVCPlayerView;
+
+/**
+ * The view that draws the players registered to it as sprites on its own Metal
+ * layer. This view draws all sprites (sorted by their z-orders) in one render
+ * pass with one command buffer and one drawable for each display frame, and
+ * they share one render pipeline and one texture cache. A registered player
+ * keeps decoding its file as it does without this view, and it does not draw
+ * its images to its own layer, i.e. applications do not have to add registered
+ * players to view hierarchies. (This view draws the last image presented by
+ * each player, i.e. a sprite may be one display frame behind its player.)
+ */
+@interface HEVCCompositorView: UIView {
+}
+
+// UIView methods
+#if TARGET_OS_IPHONE
++ (Class _Nonnull) layerClass;
+#endif
+- (id _Nullable) initWithCoder:(NSCoder* _Nonnull)aDecoder;
+- (id _Nullable) initWithFrame:(CGRect)frame device:(id<MTLDevice> _Nonnull)device;
+- (void)dealloc;
+- (void)layoutSubviews;
+- (void)didMoveToWindow;
+
+/**
+ * Registers the specified player as a sprite of this view. The sprite fills
+ * the bounds of this view until the application sets its frame. (A player can
+ * be registered to one compositor at a time.)
+ * @param {HEVCPlayerView*} player
+ */
+- (void) addPlayer:(HEVCPlayerView* _Nonnull)player;
+
+/**
+ * Unregisters the specified player. The player draws its images to its own
+ * layer again.
+ * @param {HEVCPlayerView*} player
+ */
+- (void) removePlayer:(HEVCPlayerView* _Nonnull)player;
+
+/**
+ * Sets the geometry of the sprite of the specified player. The frame is in the
+ * coordinate space of this view, and the transform is applied around the
+ * center of the frame as `UIView.transform` is. This view draws sprites with
+ * greater z-orders over ones with smaller z-orders, and sprites with the same
+ * z-order in the order they were registered. The images of the player are
+ * scaled to fill the frame.
+ * @param {HEVCPlayerView*} player
+ * @param {CGRect} frame
+ * @param {CGAffineTransform} transform
+ * @param {NSInteger} zOrder
+ * @param {float} opacity
+ */
+- (void) setPlayer:(HEVCPlayerView* _Nonnull)player frame:(CGRect)frame transform:(CGAffineTransform)transform zOrder:(NSInteger)zOrder opacity:(float)opacity;
+
+/**
+ * Invalidates this view. This method unregisters all players and removes this
+ * view from the playback engine.
+ */
+- (void) invalidate;
+
+@end
+
+#endif  // HEVC_COMPOSITOR_VIEW_H_
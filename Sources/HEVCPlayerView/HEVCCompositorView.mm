@@ -0,0 +1,569 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#import "HEVCCompositorView.h"
+
+#import <CoreVideo/CoreVideo.h>
+#import <Metal/Metal.h>
+#import "HEVCPlaybackEngine.h"
+#import "HEVCPlayerView+Compositor.h"
+#import "HEVCRenderPipeline.h"
+
+#include <math.h>
+#include <pthread.h>
+#include "base/trace.h"
+
+/**
+ * The parameters of the vertex shader `HEVCCompositorVertex`. (This struct
+ * must be compatible with the one defined in "HEVCPlayerView.metal".)
+ */
+struct HEVCCompositorQuad {
+  /**
+   * The corners of a sprite in normalized device coordinates, ordered as a
+   * triangle strip (bottom-left, bottom-right, top-left, and top-right).
+   * @type {float[8]}
+   */
+  float positions[8];
+
+  /**
+   * The opacity of the sprite.
+   * @type {float}
+   */
+  float opacity;
+
+  /**
+   * The padding to the size of the struct in the Metal shading language.
+   * @type {float[3]}
+   */
+  float padding[3];
+};
+
+/**
+ * The class that encapsulates a player registered to a compositor and the
+ * geometry of its sprite. (A compositor replaces a sprite instead of changing
+ * it so its worker thread can read sprites without locking them.)
+ */
+@interface HEVCCompositorSprite: NSObject {
+ @public
+  /**
+   * The player.
+   * @type {HEVCPlayerView*}
+   */
+  __weak HEVCPlayerView *player;
+
+  /**
+   * The frame of the sprite in the coordinate space of the compositor.
+   * @type {CGRect}
+   */
+  CGRect frame;
+
+  /**
+   * Whether or not the application has set the above frame. (A sprite without
+   * a frame fills the bounds of the compositor.)
+   * @type {BOOL}
+   */
+  BOOL hasFrame;
+
+  /**
+   * The transform applied around the center of the frame.
+   * @type {CGAffineTransform}
+   */
+  CGAffineTransform transform;
+
+  /**
+   * The z-order of the sprite.
+   * @type {NSInteger}
+   */
+  NSInteger zOrder;
+
+  /**
+   * The opacity of the sprite.
+   * @type {float}
+   */
+  float opacity;
+}
+@end
+
+@implementation HEVCCompositorSprite
+@end
+
+@interface HEVCCompositorView () <HEVCPlaybackEngineClient>
+@end
+
+@implementation HEVCCompositorView {
+  /**
+   * The `CAMetalLayer` object associated with this view.
+   * @type {CAMetalLayer*}
+   * @private
+   */
+  CAMetalLayer *_metalLayer;
+
+  /**
+   * The command queue for drawing sprites to this view. (All views of a device
+   * share one command queue.)
+   * @type {id<MTLCommandQueue>}
+   * @private
+   */
+  id<MTLCommandQueue> _commandQueue;
+
+  /**
+   * The cache of the render pipelines shared by all views of a device. (This
+   * view selects a pipeline for each sprite, and the pipelines blend sprites
+   * with premultiplied alpha.)
+   * @type {HEVCRenderPipelineCache*}
+   * @private
+   */
+  HEVCRenderPipelineCache *_pipelineCache;
+
+  /**
+   * The texture cache that generates textures from the images of all sprites.
+   * @type {CVMetalTextureCacheRef}
+   * @private
+   */
+  CVMetalTextureCacheRef _textureCache;
+
+  /**
+   * The sprites, sorted in the order they were registered.
+   * @type {NSArray<HEVCCompositorSprite*>*}
+   * @private
+   */
+  NSArray<HEVCCompositorSprite *> *_sprites;
+
+  /**
+   * The bounds size of this view in points.
+   * @type {CGSize}
+   * @private
+   */
+  CGSize _boundsSize;
+
+  /**
+   * The scale factor of the screen showing this view.
+   * @type {CGFloat}
+   * @private
+   */
+  CGFloat _scale;
+
+  /**
+   * The mutex that allows only one thread to access the above sprites and
+   * sizes.
+   * @type {pthread_mutex_t}
+   * @private
+   */
+  pthread_mutex_t _spriteMutex;
+
+  /**
+   * The semaphore that bounds the number of drawables being rendered or
+   * presented. (This view skips a display frame instead of waiting for a
+   * drawable on a worker thread.)
+   * @type {dispatch_semaphore_t}
+   * @private
+   */
+  dispatch_semaphore_t _drawableSemaphore;
+
+  /**
+   * The size of the drawables of the `CAMetalLayer` object. (The worker thread
+   * changes the size only when the bounds of this view changes.)
+   * @type {CGSize}
+   * @private
+   */
+  CGSize _drawableSize;
+
+  /**
+   * Whether or not the host application is inactive.
+   * @type {BOOL}
+   * @private
+   */
+  BOOL _inactive;
+}
+
+#if TARGET_OS_IPHONE
++ (Class) layerClass {
+  return [CAMetalLayer class];
+}
+#endif
+
+- (id)initWithCoder:(NSCoder *)coder {
+  self = [super initWithCoder:coder];
+  if (self) {
+    id<MTLDevice> device = MTLCreateSystemDefaultDevice();
+    [self initViewWithDevice:device];
+  }
+  return self;
+}
+
+- (id)initWithFrame:(CGRect)frame device:(id<MTLDevice>)device {
+  self = [super initWithFrame:frame];
+  if (self) {
+    [self initViewWithDevice:device];
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [[HEVCPlaybackEngine sharedEngine] removeClient:self wait:NO];
+  for (HEVCCompositorSprite *sprite in _sprites) {
+    [sprite->player setComposited:NO];
+  }
+  if (_textureCache) {
+    CFRelease(_textureCache);
+  }
+  pthread_mutex_destroy(&_spriteMutex);
+  [[NSNotificationCenter defaultCenter] removeObserver:self];
+}
+
+- (void)layoutSubviews {
+  [super layoutSubviews];
+  [self updateBoundsSize];
+}
+
+- (void)didMoveToWindow {
+  [super didMoveToWindow];
+  [self updateBoundsSize];
+}
+
+- (void)addPlayer:(HEVCPlayerView *)player {
+  if ([self indexOfPlayer:player] != NSNotFound) {
+    return;
+  }
+  HEVCCompositorSprite *sprite = [[HEVCCompositorSprite alloc] init];
+  sprite->player = player;
+  sprite->frame = CGRectZero;
+  sprite->hasFrame = NO;
+  sprite->transform = CGAffineTransformIdentity;
+  sprite->zOrder = 0;
+  sprite->opacity = 1.0f;
+  pthread_mutex_lock(&_spriteMutex);
+  _sprites = [_sprites arrayByAddingObject:sprite];
+  pthread_mutex_unlock(&_spriteMutex);
+  [player setComposited:YES];
+  [self updateSpritePixelSize:sprite];
+  [self updateActive];
+}
+
+- (void)removePlayer:(HEVCPlayerView *)player {
+  const NSUInteger index = [self indexOfPlayer:player];
+  if (index == NSNotFound) {
+    return;
+  }
+  NSMutableArray<HEVCCompositorSprite *> *sprites = [_sprites mutableCopy];
+  [sprites removeObjectAtIndex:index];
+  pthread_mutex_lock(&_spriteMutex);
+  _sprites = sprites;
+  pthread_mutex_unlock(&_spriteMutex);
+  [player setComposited:NO];
+  [self updateActive];
+}
+
+- (void)setPlayer:(HEVCPlayerView *)player frame:(CGRect)frame transform:(CGAffineTransform)transform zOrder:(NSInteger)zOrder opacity:(float)opacity {
+  const NSUInteger index = [self indexOfPlayer:player];
+  if (index == NSNotFound) {
+    return;
+  }
+  HEVCCompositorSprite *sprite = [[HEVCCompositorSprite alloc] init];
+  sprite->player = player;
+  sprite->frame = frame;
+  sprite->hasFrame = YES;
+  sprite->transform = transform;
+  sprite->zOrder = zOrder;
+  sprite->opacity = opacity;
+  NSMutableArray<HEVCCompositorSprite *> *sprites = [_sprites mutableCopy];
+  sprites[index] = sprite;
+  pthread_mutex_lock(&_spriteMutex);
+  _sprites = sprites;
+  pthread_mutex_unlock(&_spriteMutex);
+  [self updateSpritePixelSize:sprite];
+}
+
+- (void)invalidate {
+  [[HEVCPlaybackEngine sharedEngine] removeClient:self wait:NO];
+  NSArray<HEVCCompositorSprite *> *sprites = _sprites;
+  pthread_mutex_lock(&_spriteMutex);
+  _sprites = @[];
+  pthread_mutex_unlock(&_spriteMutex);
+  for (HEVCCompositorSprite *sprite in sprites) {
+    [sprite->player setComposited:NO];
+  }
+}
+
+#pragma mark - internal methods
+
+/**
+ * Initializes this view. This method initializes all its internal variables.
+ * @param {id<MTLDevice>} device
+ */
+- (void)initViewWithDevice:(id<MTLDevice>)device {
+  _metalLayer = (CAMetalLayer *)[self layer];
+  _metalLayer.opaque = NO;
+  _metalLayer.drawsAsynchronously = YES;
+  _metalLayer.pixelFormat = MTLPixelFormatBGRA8Unorm;
+  _metalLayer.framebufferOnly = YES;
+  _metalLayer.presentsWithTransaction = NO;
+
+  // Create Metal resources shared by all sprites. (The shader library, the
+  // command queue, and the render pipelines are shared by all views.)
+  _pipelineCache = [HEVCRenderPipelineCache cacheWithDevice:device];
+  _commandQueue = _pipelineCache.commandQueue;
+  NSDictionary *attributes = [NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithInt:MTLTextureUsageShaderRead], kCVMetalTextureUsage, nil];
+  _textureCache = NULL;
+  CVMetalTextureCacheCreate(kCFAllocatorDefault, nil, device, (__bridge CFDictionaryRef)attributes, &_textureCache);
+  _drawableSemaphore = HEVCCreateDrawableSemaphore(_metalLayer);
+
+  // Observe a couple of application notifications to stop drawing sprites
+  // while the host application is inactive.
+  NSNotificationCenter *defaultCenter = [NSNotificationCenter defaultCenter];
+  [defaultCenter addObserver:self selector:@selector(willResignActive:) name:UIApplicationWillResignActiveNotification object:nil];
+  [defaultCenter addObserver:self selector:@selector(didBecomeActive:) name:UIApplicationDidBecomeActiveNotification object:nil];
+
+  _sprites = @[];
+  _boundsSize = CGSizeZero;
+  _scale = 1.0;
+  pthread_mutex_init(&_spriteMutex, NULL);
+  _drawableSize = CGSizeZero;
+  _inactive = NO;
+}
+
+- (void)willResignActive:(NSNotification *)notification {
+  _inactive = YES;
+  [self updateActive];
+}
+
+- (void)didBecomeActive:(NSNotification *)notification {
+  _inactive = NO;
+  [self updateActive];
+}
+
+/**
+ * Starts receiving display-link events while this view has sprites and the
+ * host application is active.
+ */
+- (void)updateActive {
+  [[HEVCPlaybackEngine sharedEngine] setClient:self active:(_sprites.count > 0 && !_inactive)];
+}
+
+/**
+ * Returns the index of the sprite of the specified player.
+ * @param {HEVCPlayerView*} player
+ * @return {NSUInteger}
+ */
+- (NSUInteger)indexOfPlayer:(HEVCPlayerView *)player {
+  NSUInteger index = 0;
+  for (HEVCCompositorSprite *sprite in _sprites) {
+    if (sprite->player == player) {
+      return index;
+    }
+    ++index;
+  }
+  return NSNotFound;
+}
+
+/**
+ * Updates the bounds size of this view and the scale factor of its screen.
+ * (UIKit does not set the scale factor of a view without `drawRect:`, e.g. this
+ * view.)
+ */
+- (void)updateBoundsSize {
+  UIScreen *screen = self.window ? self.window.screen : [UIScreen mainScreen];
+  const CGFloat scale = screen.nativeScale;
+  if (self.contentScaleFactor != scale) {
+    self.contentScaleFactor = scale;
+  }
+  pthread_mutex_lock(&_spriteMutex);
+  _boundsSize = self.bounds.size;
+  _scale = scale;
+  pthread_mutex_unlock(&_spriteMutex);
+  for (HEVCCompositorSprite *sprite in _sprites) {
+    [self updateSpritePixelSize:sprite];
+  }
+}
+
+/**
+ * Returns the frame of the specified sprite in the coordinate space of this
+ * view.
+ * @param {HEVCCompositorSprite*} sprite
+ * @return {CGRect}
+ */
+- (CGRect)frameOfSprite:(HEVCCompositorSprite *)sprite {
+  if (sprite->hasFrame) {
+    return sprite->frame;
+  }
+  return CGRectMake(0.0, 0.0, _boundsSize.width, _boundsSize.height);
+}
+
+/**
+ * Tells the player of the specified sprite the size of the sprite in pixels
+ * so it decodes its file at the smallest sufficient size.
+ * @param {HEVCCompositorSprite*} sprite
+ */
+- (void)updateSpritePixelSize:(HEVCCompositorSprite *)sprite {
+  const CGRect frame = [self frameOfSprite:sprite];
+  const CGAffineTransform t = sprite->transform;
+  const CGFloat scale = _scale * sqrt(fabs(t.a * t.d - t.b * t.c));
+  [sprite->player setSpritePixelWidth:(uint32_t)ceil(frame.size.width * scale) height:(uint32_t)ceil(frame.size.height * scale)];
+}
+
+#pragma mark - HEVCPlaybackEngineClient methods
+
+- (void)playbackEngine:(HEVCPlaybackEngine *)engine processFrameAtTime:(CFTimeInterval)timestamp {
+  if (!_commandQueue || !_textureCache) {
+    return;
+  }
+  pthread_mutex_lock(&_spriteMutex);
+  NSArray<HEVCCompositorSprite *> *sprites = _sprites;
+  const CGSize boundsSize = _boundsSize;
+  const CGFloat scale = _scale;
+  pthread_mutex_unlock(&_spriteMutex);
+  if (boundsSize.width <= 0.0 || boundsSize.height <= 0.0) {
+    return;
+  }
+  // Sort the sprites by their z-orders. (This sort is stable, i.e. sprites with
+  // the same z-order are sorted in the order they were registered.)
+  sprites = [sprites sortedArrayWithOptions:NSSortStable usingComparator:^NSComparisonResult(HEVCCompositorSprite *a, HEVCCompositorSprite *b) {
+    return a->zOrder < b->zOrder ? NSOrderedAscending : (a->zOrder > b->zOrder ? NSOrderedDescending : NSOrderedSame);
+  }];
+
+  @autoreleasepool {
+    // Change the size of the drawables only when the bounds of this view
+    // changes.
+    const CGSize drawableSize = CGSizeMake(ceil(boundsSize.width * scale), ceil(boundsSize.height * scale));
+    if (!CGSizeEqualToSize(drawableSize, _drawableSize)) {
+      _drawableSize = drawableSize;
+      _metalLayer.drawableSize = drawableSize;
+    }
+    if (dispatch_semaphore_wait(_drawableSemaphore, DISPATCH_TIME_NOW)) {
+      return;
+    }
+    HEVC_TRACE_BEGIN("WaitDrawable", HEVC_TRACE_EXCLUSIVE);
+    id<CAMetalDrawable> metalDrawable = [_metalLayer nextDrawable];
+    HEVC_TRACE_END("WaitDrawable", HEVC_TRACE_EXCLUSIVE);
+    id<MTLCommandBuffer> commandBuffer = metalDrawable ? [_commandQueue commandBuffer] : nil;
+    if (!commandBuffer) {
+      dispatch_semaphore_signal(_drawableSemaphore);
+      return;
+    }
+    MTLRenderPassDescriptor *renderPassDescriptor = [MTLRenderPassDescriptor renderPassDescriptor];
+    renderPassDescriptor.colorAttachments[0].texture = metalDrawable.texture;
+    renderPassDescriptor.colorAttachments[0].loadAction = MTLLoadActionClear;
+    renderPassDescriptor.colorAttachments[0].storeAction = MTLStoreActionStore;
+    renderPassDescriptor.colorAttachments[0].clearColor = MTLClearColorMake(0.0, 0.0, 0.0, 0.0);
+    id<MTLRenderCommandEncoder> commandEncoder = [commandBuffer renderCommandEncoderWithDescriptor:renderPassDescriptor];
+    if (!commandEncoder) {
+      dispatch_semaphore_signal(_drawableSemaphore);
+      return;
+    }
+#if HEVC_DEBUG
+    commandEncoder.label = @"Composite YUVA420 images";
+#endif
+
+    // Draw the images of all sprites in this render pass. (The images and their
+    // textures are retained until the GPU finishes reading them.)
+    NSMutableArray *resources = [NSMutableArray arrayWithCapacity:sprites.count * 4];
+    id<MTLRenderPipelineState> renderPipelineState = nil;
+    HEVCRenderPipelineOptions renderPipelineOptions = 0;
+    for (HEVCCompositorSprite *sprite in sprites) {
+      HEVCPlayerView *player = sprite->player;
+      if (!player || sprite->opacity <= 0.0f) {
+        continue;
+      }
+      CVImageBufferRef imageBuffer = [player copyCompositedImage];
+      if (!imageBuffer) {
+        continue;
+      }
+      [resources addObject:(__bridge_transfer id)imageBuffer];
+      const size_t width = CVPixelBufferGetWidth(imageBuffer);
+      const size_t height = CVPixelBufferGetHeight(imageBuffer);
+      CVMetalTextureRef textures[3];
+      const MTLPixelFormat formats[3] = {MTLPixelFormatR8Unorm, MTLPixelFormatRG8Unorm, MTLPixelFormatR8Unorm};
+      const size_t divisors[3] = {1, 2, 1};
+      int created = 0;
+      for (; created < 3; ++created) {
+        CVReturn result = CVMetalTextureCacheCreateTextureFromImage(kCFAllocatorDefault, _textureCache, imageBuffer, nil, formats[created], width / divisors[created], height / divisors[created], created, &textures[created]);
+        if (result != kCVReturnSuccess) {
+          break;
+        }
+        [resources addObject:(__bridge_transfer id)textures[created]];
+      }
+      if (created < 3) {
+        continue;
+      }
+
+      // Switch the render pipeline only when the color properties of this
+      // sprite differ from the ones of the previous sprite.
+      const HEVCRenderPipelineOptions options = HEVCGetRenderPipelineOptions(imageBuffer, [player hasPremultipliedAlpha]) | HEVCRenderPipelineCompositor;
+      if (!renderPipelineState || options != renderPipelineOptions) {
+        id<MTLRenderPipelineState> state = [_pipelineCache pipelineStateWithOptions:options];
+        if (!state) {
+          continue;
+        }
+        if (state != renderPipelineState) {
+          [commandEncoder setRenderPipelineState:state];
+          renderPipelineState = state;
+        }
+        renderPipelineOptions = options;
+      }
+
+      // Map the corners of the frame (transformed around its center) to
+      // normalized device coordinates.
+      const CGRect frame = sprite->hasFrame ? sprite->frame : CGRectMake(0.0, 0.0, boundsSize.width, boundsSize.height);
+      const CGAffineTransform t = sprite->transform;
+      const CGFloat halfWidth = frame.size.width * 0.5;
+      const CGFloat halfHeight = frame.size.height * 0.5;
+      const CGPoint corners[4] = {
+        CGPointMake(-halfWidth, halfHeight), CGPointMake(halfWidth, halfHeight),
+        CGPointMake(-halfWidth, -halfHeight), CGPointMake(halfWidth, -halfHeight),
+      };
+      HEVCCompositorQuad quad;
+      for (int i = 0; i < 4; ++i) {
+        const CGPoint point = CGPointApplyAffineTransform(corners[i], t);
+        quad.positions[i * 2] = (float)((CGRectGetMidX(frame) + point.x) / boundsSize.width * 2.0 - 1.0);
+        quad.positions[i * 2 + 1] = (float)(1.0 - (CGRectGetMidY(frame) + point.y) / boundsSize.height * 2.0);
+      }
+      quad.opacity = sprite->opacity < 1.0f ? sprite->opacity : 1.0f;
+      quad.padding[0] = quad.padding[1] = quad.padding[2] = 0.0f;
+      const CGFloat spriteScale = scale * sqrt(fabs(t.a * t.d - t.b * t.c));
+      const HEVCPlayerFilter filter = HEVCMakePlayerFilter((double)width, frame.size.width * spriteScale, frame.size.height * spriteScale);
+
+      [commandEncoder setVertexBytes:&quad length:sizeof(quad) atIndex:0];
+      [commandEncoder setFragmentTexture:CVMetalTextureGetTexture(textures[0]) atIndex:0];
+      [commandEncoder setFragmentTexture:CVMetalTextureGetTexture(textures[1]) atIndex:1];
+      [commandEncoder setFragmentTexture:CVMetalTextureGetTexture(textures[2]) atIndex:2];
+      [commandEncoder setFragmentBytes:&filter length:sizeof(filter) atIndex:0];
+      [commandEncoder drawPrimitives:MTLPrimitiveTypeTriangleStrip vertexStart:0 vertexCount:4];
+    }
+    [commandEncoder endEncoding];
+    const uint64_t signpostID = Trace::GenerateID();
+    [commandBuffer addCompletedHandler:^(id<MTLCommandBuffer> buffer) {
+      HEVC_TRACE_END("RenderFrame", signpostID);
+      [resources removeAllObjects];
+    }];
+    dispatch_semaphore_t drawableSemaphore = _drawableSemaphore;
+    [metalDrawable addPresentedHandler:^(id<MTLDrawable> drawable) {
+      dispatch_semaphore_signal(drawableSemaphore);
+    }];
+    [commandBuffer presentDrawable:metalDrawable atTime:timestamp];
+    HEVC_TRACE_BEGIN("RenderFrame", signpostID);
+    [commandBuffer commit];
+  }
+}
+
+@end
@@ -0,0 +1,129 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef HEVC_PLAYBACK_ENGINE_H_
+#define HEVC_PLAYBACK_ENGINE_H_
+
+#import <Foundation/Foundation.h>
+#import <QuartzCore/QuartzCore.h>
+
+@class HEVCPlaybackEngine;
+
+/**
+ * The protocol implemented by the objects played by the playback engine.
+ */
+@protocol HEVCPlaybackEngineClient <NSObject>
+
+/**
+ * Called by a worker thread of the playback engine when the client should
+ * render a frame or when it has scheduled work. The timestamp is the time
+ * when the next display frame is presented (or the current time when the
+ * client has scheduled work). The engine calls this method
+ * on one worker thread at a time for each client, i.e. the client does not
+ * have to serialize its calls.
+ * @param {HEVCPlaybackEngine*} engine
+ * @param {CFTimeInterval} timestamp
+ */
+- (void)playbackEngine:(HEVCPlaybackEngine* _Nonnull)engine processFrameAtTime:(CFTimeInterval)timestamp;
+
+@end
+
+/**
+ * The class that drives all players with one display link and a pool of
+ * worker threads. The display link dispatches an event to each active client
+ * as a task, and the workers run the tasks. Each worker has its own deque of
+ * tasks and an idle worker steals tasks from the others. The display link is
+ * paused when there are no active clients and idle workers sleep, i.e. idle
+ * clients cost no wakeups.
+ */
+@interface HEVCPlaybackEngine: NSObject
+
+/**
+ * The number of the worker threads.
+ * @type {NSUInteger}
+ */
+@property (readonly, nonatomic) NSUInteger numberOfWorkers;
+
+/**
+ * The interval between two display frames (in seconds) measured by the display
+ * link, i.e. the time a client has for preparing the next frame. (This value
+ * is 0 until the display link dispatches an event. It can be read from any
+ * thread.)
+ * @type {CFTimeInterval}
+ */
+@property (readonly, nonatomic) CFTimeInterval refreshInterval;
+
+/**
+ * Returns the engine shared by all players.
+ * @return {HEVCPlaybackEngine*}
+ */
++ (HEVCPlaybackEngine* _Nonnull)sharedEngine;
+
+/**
+ * Starts or stops dispatching display-link events to the specified client.
+ * (This engine does not retain its clients.)
+ * @param {id<HEVCPlaybackEngineClient>} client
+ * @param {BOOL} active
+ */
+- (void)setClient:(id<HEVCPlaybackEngineClient> _Nonnull)client active:(BOOL)active;
+
+/**
+ * Sets the frame rate of the content played by the specified client. This
+ * engine requests the display to refresh at the highest frame rate of the
+ * active clients. (0 means the client does not have preferences.)
+ * @param {id<HEVCPlaybackEngineClient>} client
+ * @param {float} frameRate
+ */
+- (void)setClient:(id<HEVCPlaybackEngineClient> _Nonnull)client frameRate:(float)frameRate;
+
+/**
+ * Schedules a task for the specified client regardless of whether or not it
+ * is active. (This method does nothing when the client has a pending task,
+ * which observes the latest state of the client.)
+ * @param {id<HEVCPlaybackEngineClient>} client
+ */
+- (void)scheduleClient:(id<HEVCPlaybackEngineClient> _Nonnull)client;
+
+/**
+ * Removes the specified client from this engine. This method optionally waits
+ * for the task of the client being run by a worker thread to finish. (A client
+ * must not wait for its own task.)
+ * @param {id<HEVCPlaybackEngineClient>} client
+ * @param {BOOL} wait
+ */
+- (void)removeClient:(id<HEVCPlaybackEngineClient> _Nonnull)client wait:(BOOL)wait;
+
+/**
+ * Stops the worker threads when no clients are active and no tasks are pending
+ * or running, e.g. when the host application is under critical memory
+ * pressure. This method waits for the workers to exit, and this engine starts
+ * them again when it schedules the next task. (This method returns NO without
+ * stopping the workers when they are busy.)
+ * @return {BOOL}
+ */
+- (BOOL)stopIdleWorkers;
+
+@end
+
+#endif  // HEVC_PLAYBACK_ENGINE_H_
@@ -0,0 +1,727 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#import "HEVCPlaybackEngine.h"
+
+#import <UIKit/UIKit.h>
+#import "HEVCWeakProxy.h"
+
+#include <math.h>
+#include <memory.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+/**
+ * The class that encapsulates a client of the playback engine and its state.
+ */
+@interface HEVCPlaybackEntry: NSObject {
+ @public
+  /**
+   * The client.
+   * @type {id<HEVCPlaybackEngineClient>}
+   */
+  __weak id<HEVCPlaybackEngineClient> client;
+
+  /**
+   * Whether or not the engine dispatches display-link events to the client.
+   * @type {BOOL}
+   */
+  BOOL active;
+
+  /**
+   * The frame rate of the content played by the client. (0 means the client
+   * does not have preferences.)
+   * @type {float}
+   */
+  float frameRate;
+
+  /**
+   * Whether or not the client has a task pending or running. (This flag is
+   * accessed with atomic operations.)
+   * @type {uint32_t}
+   */
+  uint32_t scheduled;
+
+  /**
+   * The worker that runs the tasks of the client unless another worker steals
+   * them.
+   * @type {uint32_t}
+   */
+  uint32_t worker;
+}
+@end
+
+@implementation HEVCPlaybackEntry
+@end
+
+namespace {
+
+/**
+ * The class that encapsulates a task run by a worker thread.
+ */
+struct HEVCPlaybackTask {
+  /**
+   * The retained `HEVCPlaybackEntry` object.
+   * @type {void*}
+   */
+  void* entry;
+
+  /**
+   * The timestamp of the display-link event.
+   * @type {CFTimeInterval}
+   */
+  CFTimeInterval timestamp;
+};
+
+/**
+ * The class that implements the deque owned by a worker thread. Its owner
+ * pushes and pops tasks at its back and the other workers steal tasks from
+ * its front.
+ */
+struct HEVCPlaybackTaskDeque {
+  /**
+   * Initializes an empty deque.
+   */
+  void Initialize() {
+    pthread_mutex_init(&mutex_, NULL);
+    tasks_ = NULL;
+    capacity_ = 0;
+    head_ = 0;
+    count_ = 0;
+  }
+
+  /**
+   * Adds a task to the back of this deque.
+   * @param {const HEVCPlaybackTask&} task
+   * @return {int}
+   */
+  int Push(const HEVCPlaybackTask& task) {
+    pthread_mutex_lock(&mutex_);
+    if (count_ == capacity_) {
+      // Expand the ring buffer and move its tasks to its beginning.
+      const uint32_t capacity = capacity_ ? capacity_ * 2 : 16;
+      HEVCPlaybackTask* tasks = static_cast<HEVCPlaybackTask*>(
+          malloc(capacity * sizeof(HEVCPlaybackTask)));
+      if (!tasks) {
+        pthread_mutex_unlock(&mutex_);
+        return 0;
+      }
+      for (uint32_t i = 0; i < count_; ++i) {
+        tasks[i] = tasks_[(head_ + i) % capacity_];
+      }
+      free(tasks_);
+      tasks_ = tasks;
+      capacity_ = capacity;
+      head_ = 0;
+    }
+    tasks_[(head_ + count_) % capacity_] = task;
+    ++count_;
+    pthread_mutex_unlock(&mutex_);
+    return 1;
+  }
+
+  /**
+   * Removes a task from the back of this deque.
+   * @param {HEVCPlaybackTask*} task
+   * @return {int}
+   */
+  int Pop(HEVCPlaybackTask* task) {
+    pthread_mutex_lock(&mutex_);
+    const int result = count_ > 0;
+    if (result) {
+      --count_;
+      *task = tasks_[(head_ + count_) % capacity_];
+    }
+    pthread_mutex_unlock(&mutex_);
+    return result;
+  }
+
+  /**
+   * Removes a task from the front of this deque.
+   * @param {HEVCPlaybackTask*} task
+   * @return {int}
+   */
+  int Steal(HEVCPlaybackTask* task) {
+    pthread_mutex_lock(&mutex_);
+    const int result = count_ > 0;
+    if (result) {
+      *task = tasks_[head_];
+      head_ = (head_ + 1) % capacity_;
+      --count_;
+    }
+    pthread_mutex_unlock(&mutex_);
+    return result;
+  }
+
+  /**
+   * The mutex that allows only one thread to access this deque.
+   * @type {pthread_mutex_t}
+   * @private
+   */
+  pthread_mutex_t mutex_;
+
+  /**
+   * The ring buffer of tasks.
+   * @type {HEVCPlaybackTask*}
+   * @private
+   */
+  HEVCPlaybackTask* tasks_;
+
+  /**
+   * The size of the ring buffer.
+   * @type {uint32_t}
+   * @private
+   */
+  uint32_t capacity_;
+
+  /**
+   * The index of the front task.
+   * @type {uint32_t}
+   * @private
+   */
+  uint32_t head_;
+
+  /**
+   * The number of tasks in this deque.
+   * @type {uint32_t}
+   * @private
+   */
+  uint32_t count_;
+};
+
+}  // namespace
+
+static void *HEVCPlaybackWorkerMain(void *arg);
+
+@implementation HEVCPlaybackEngine {
+  /**
+   * The display link that drives all active clients.
+   * @type {CADisplayLink*}
+   * @private
+   */
+  CADisplayLink *_displayLink;
+
+  /**
+   * The thread that receives events from the display link.
+   * @type {NSThread*}
+   * @private
+   */
+  NSThread *_thread;
+
+  /**
+   * The entries of the clients.
+   * @type {NSMutableArray<HEVCPlaybackEntry*>*}
+   * @private
+   */
+  NSMutableArray<HEVCPlaybackEntry *> *_entries;
+
+  /**
+   * The mutex that allows only one thread to access the above entries.
+   * @type {pthread_mutex_t}
+   * @private
+   */
+  pthread_mutex_t _entryMutex;
+
+  /**
+   * The worker threads.
+   * @type {pthread_t*}
+   * @private
+   */
+  pthread_t *_workers;
+
+  /**
+   * The deques of the worker threads.
+   * @type {HEVCPlaybackTaskDeque*}
+   * @private
+   */
+  HEVCPlaybackTaskDeque *_deques;
+
+  /**
+   * The mutex that guards the number of pending tasks.
+   * @type {pthread_mutex_t}
+   * @private
+   */
+  pthread_mutex_t _taskMutex;
+
+  /**
+   * The condition signaled when a task is added.
+   * @type {pthread_cond_t}
+   * @private
+   */
+  pthread_cond_t _taskCondition;
+
+  /**
+   * The condition signaled when a task finishes.
+   * @type {pthread_cond_t}
+   * @private
+   */
+  pthread_cond_t _doneCondition;
+
+  /**
+   * The number of tasks that have not been taken by worker threads.
+   * @type {uint32_t}
+   * @private
+   */
+  uint32_t _pendingTasks;
+
+  /**
+   * The number of tasks added to the deques so far. (A worker thread that finds
+   * no tasks in the deques while another thread is adding one waits until
+   * this value changes.)
+   * @type {uint32_t}
+   * @private
+   */
+  uint32_t _pushedTasks;
+
+  /**
+   * The number of tasks that have been taken by worker threads and have not
+   * finished.
+   * @type {uint32_t}
+   * @private
+   */
+  uint32_t _runningTasks;
+
+  /**
+   * The number of worker threads that have started. (This value is used for
+   * assigning a deque to each worker thread.)
+   * @type {uint32_t}
+   * @private
+   */
+  uint32_t _startedWorkers;
+
+  /**
+   * The number of the worker threads running now. (This value is 0 after this
+   * engine stops its workers until it schedules a task. The caller must acquire
+   * the entry mutex to access it.)
+   * @type {NSUInteger}
+   * @private
+   */
+  NSUInteger _runningWorkers;
+
+  /**
+   * Whether or not the worker threads should exit. (This flag is guarded by
+   * the task mutex.)
+   * @type {BOOL}
+   * @private
+   */
+  BOOL _stopWorkers;
+
+  /**
+   * The worker assigned to the next client.
+   * @type {uint32_t}
+   * @private
+   */
+  uint32_t _nextWorker;
+
+  /**
+   * The interval between two display frames. (This value is written by the
+   * display-link thread and read by the clients with atomic operations.)
+   * @type {CFTimeInterval}
+   * @private
+   */
+  CFTimeInterval _refreshInterval;
+}
+
++ (HEVCPlaybackEngine *)sharedEngine {
+  static HEVCPlaybackEngine *sharedEngine = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    sharedEngine = [[HEVCPlaybackEngine alloc] init];
+  });
+  return sharedEngine;
+}
+
+- (id)init {
+  self = [super init];
+  if (self) {
+    _entries = [NSMutableArray array];
+    pthread_mutex_init(&_entryMutex, NULL);
+    pthread_mutex_init(&_taskMutex, NULL);
+    pthread_cond_init(&_taskCondition, NULL);
+    pthread_cond_init(&_doneCondition, NULL);
+    _pendingTasks = 0;
+    _pushedTasks = 0;
+    _runningTasks = 0;
+    _startedWorkers = 0;
+    _runningWorkers = 0;
+    _stopWorkers = NO;
+    _nextWorker = 0;
+    _refreshInterval = 0.0;
+
+    // Create one worker thread for each active core. (Video Toolbox decodes
+    // samples asynchronously, i.e. a worker spends most of its time waiting
+    // for a drawable and more workers than cores do not help.)
+    NSUInteger numberOfWorkers = [[NSProcessInfo processInfo] activeProcessorCount];
+    numberOfWorkers = numberOfWorkers > 0 ? numberOfWorkers : 1;
+    _workers = static_cast<pthread_t *>(calloc(numberOfWorkers, sizeof(pthread_t)));
+    _deques = static_cast<HEVCPlaybackTaskDeque *>(calloc(numberOfWorkers, sizeof(HEVCPlaybackTaskDeque)));
+    _numberOfWorkers = 0;
+    if (_workers && _deques) {
+      for (NSUInteger i = 0; i < numberOfWorkers; ++i) {
+        _deques[i].Initialize();
+      }
+      _numberOfWorkers = numberOfWorkers;
+      [self startWorkers];
+      _numberOfWorkers = _runningWorkers;
+    }
+
+    // Create a display link and a thread that receives its events. (The
+    // display link is paused until a client becomes active.)
+    HEVCWeakProxy *weakProxy = [HEVCWeakProxy weakProxyWithObject:self];
+    _displayLink = [CADisplayLink displayLinkWithTarget:weakProxy selector:@selector(updateFrame:)];
+    _displayLink.paused = YES;
+    if (@available(iOS 10.0, *)) {
+      _displayLink.preferredFramesPerSecond = 0;
+    }
+    _thread = [[NSThread alloc] initWithTarget:self selector:@selector(threadMethod:) object:nil];
+    [_thread setName:@"com.dena.pokota.HEVCPlayerView.DisplayLinkThread"];
+    [_thread setQualityOfService:NSQualityOfServiceUserInteractive];
+    [_thread start];
+  }
+  return self;
+}
+
+- (CFTimeInterval)refreshInterval {
+  CFTimeInterval refreshInterval;
+  __atomic_load(&_refreshInterval, &refreshInterval, __ATOMIC_RELAXED);
+  return refreshInterval;
+}
+
+- (void)setClient:(id<HEVCPlaybackEngineClient>)client active:(BOOL)active {
+  pthread_mutex_lock(&_entryMutex);
+  HEVCPlaybackEntry *entry = [self entryForClient:client create:YES];
+  entry->active = active;
+  [self updateDisplayLink];
+  pthread_mutex_unlock(&_entryMutex);
+}
+
+- (void)setClient:(id<HEVCPlaybackEngineClient>)client frameRate:(float)frameRate {
+  pthread_mutex_lock(&_entryMutex);
+  HEVCPlaybackEntry *entry = [self entryForClient:client create:YES];
+  entry->frameRate = frameRate;
+  [self updateDisplayLink];
+  pthread_mutex_unlock(&_entryMutex);
+}
+
+- (void)scheduleClient:(id<HEVCPlaybackEngineClient>)client {
+  pthread_mutex_lock(&_entryMutex);
+  HEVCPlaybackEntry *entry = [self entryForClient:client create:YES];
+  [self scheduleEntry:entry timestamp:CACurrentMediaTime()];
+  pthread_mutex_unlock(&_entryMutex);
+}
+
+- (void)removeClient:(id<HEVCPlaybackEngineClient>)client wait:(BOOL)wait {
+  pthread_mutex_lock(&_entryMutex);
+  HEVCPlaybackEntry *entry = [self entryForClient:client create:NO];
+  if (entry) {
+    [_entries removeObjectIdenticalTo:entry];
+  }
+  [self updateDisplayLink];
+  pthread_mutex_unlock(&_entryMutex);
+
+  // Wait for the task of the removed client to finish. (A task does not start
+  // calling its client after its entry is removed because the entry is never
+  // scheduled again.)
+  if (entry && wait) {
+    pthread_mutex_lock(&_taskMutex);
+    while (__atomic_load_n(&entry->scheduled, __ATOMIC_ACQUIRE)) {
+      pthread_cond_wait(&_doneCondition, &_taskMutex);
+    }
+    pthread_mutex_unlock(&_taskMutex);
+  }
+}
+
+- (BOOL)stopIdleWorkers {
+  // Stop the workers only when no clients are active and no tasks are pending
+  // or running. No tasks are scheduled while the caller holds the entry mutex,
+  // and no running tasks wait for it, i.e. this method can join the workers
+  // while it holds the mutex.
+  pthread_mutex_lock(&_entryMutex);
+  BOOL idle = _runningWorkers > 0;
+  for (HEVCPlaybackEntry *entry in _entries) {
+    if (entry->active) {
+      idle = NO;
+      break;
+    }
+  }
+  if (idle) {
+    pthread_mutex_lock(&_taskMutex);
+    idle = _pendingTasks == 0 && _runningTasks == 0;
+    if (idle) {
+      _stopWorkers = YES;
+      pthread_cond_broadcast(&_taskCondition);
+    }
+    pthread_mutex_unlock(&_taskMutex);
+  }
+  if (idle) {
+    for (NSUInteger i = 0; i < _runningWorkers; ++i) {
+      pthread_join(_workers[i], NULL);
+    }
+    _runningWorkers = 0;
+    pthread_mutex_lock(&_taskMutex);
+    _stopWorkers = NO;
+    pthread_mutex_unlock(&_taskMutex);
+  }
+  pthread_mutex_unlock(&_entryMutex);
+  return idle;
+}
+
+#pragma mark - internal methods
+
+/**
+ * Creates the worker threads. Each worker takes the deque assigned in the
+ * order the workers start. (The caller must acquire the entry mutex unless it
+ * is the initializer.)
+ */
+- (void)startWorkers {
+  _startedWorkers = 0;
+  pthread_attr_t attributes;
+  pthread_attr_init(&attributes);
+  pthread_attr_set_qos_class_np(&attributes, QOS_CLASS_USER_INTERACTIVE, 0);
+  for (NSUInteger i = 0; i < _numberOfWorkers; ++i) {
+    if (pthread_create(&_workers[i], &attributes, HEVCPlaybackWorkerMain, (__bridge void *)self)) {
+      break;
+    }
+    ++_runningWorkers;
+  }
+  pthread_attr_destroy(&attributes);
+}
+
+/**
+ * Returns the entry of the specified client. (The caller must acquire the
+ * entry mutex.)
+ * @param {id<HEVCPlaybackEngineClient>} client
+ * @param {BOOL} create
+ * @return {HEVCPlaybackEntry*}
+ */
+- (HEVCPlaybackEntry *)entryForClient:(id<HEVCPlaybackEngineClient>)client create:(BOOL)create {
+  // Remove the entries of deleted clients while searching for the entry. (A
+  // client cannot find its entry while it is being deleted because its weak
+  // references have been cleared.)
+  HEVCPlaybackEntry *found = nil;
+  for (NSUInteger i = _entries.count; i > 0; --i) {
+    HEVCPlaybackEntry *entry = _entries[i - 1];
+    id<HEVCPlaybackEngineClient> entryClient = entry->client;
+    if (!entryClient) {
+      [_entries removeObjectAtIndex:i - 1];
+    } else if (entryClient == client) {
+      found = entry;
+    }
+  }
+  if (found) {
+    return found;
+  }
+  if (!create) {
+    return nil;
+  }
+  HEVCPlaybackEntry *entry = [[HEVCPlaybackEntry alloc] init];
+  entry->client = client;
+  entry->active = NO;
+  entry->frameRate = 0.0f;
+  entry->scheduled = 0;
+  entry->worker = _numberOfWorkers ? _nextWorker++ % _numberOfWorkers : 0;
+  [_entries addObject:entry];
+  return entry;
+}
+
+/**
+ * Pauses the display link when there are no active clients and requests the
+ * host OS to refresh the display at the highest frame rate of the contents
+ * played by the active clients. (The caller must acquire the entry mutex.)
+ */
+- (void)updateDisplayLink {
+  BOOL paused = YES;
+  float frameRate = 0.0f;
+  for (HEVCPlaybackEntry *item in _entries) {
+    if (item->active) {
+      paused = NO;
+      frameRate = item->frameRate > frameRate ? item->frameRate : frameRate;
+    }
+  }
+  if (!paused) {
+    // A display whose refresh rate is a multiple of the frame rate presents
+    // each frame for the same number of refreshes, e.g. a 120-Hz ProMotion
+    // display presents a 30-fps content at 120 Hz or 60 Hz without judder.
+    if (@available(iOS 15.0, *)) {
+      _displayLink.preferredFrameRateRange = frameRate > 0.0f ? CAFrameRateRangeMake(frameRate, frameRate * 2.0f, frameRate) : CAFrameRateRangeDefault;
+    } else {
+      _displayLink.preferredFramesPerSecond = (NSInteger)ceilf(frameRate);
+    }
+  }
+  _displayLink.paused = paused;
+}
+
+/**
+ * Adds a task for the specified entry to the deque of its worker unless the
+ * entry has a pending task. This method starts the workers again when this
+ * engine has stopped them. (The caller must acquire the entry mutex.)
+ * @param {HEVCPlaybackEntry*} entry
+ * @param {CFTimeInterval} timestamp
+ */
+- (void)scheduleEntry:(HEVCPlaybackEntry *)entry timestamp:(CFTimeInterval)timestamp {
+  if (!_runningWorkers && _numberOfWorkers) {
+    [self startWorkers];
+  }
+  if (!_runningWorkers) {
+    return;
+  }
+  if (__atomic_exchange_n(&entry->scheduled, 1, __ATOMIC_ACQ_REL)) {
+    return;
+  }
+  HEVCPlaybackTask task;
+  task.entry = (__bridge_retained void *)entry;
+  task.timestamp = timestamp;
+  pthread_mutex_lock(&_taskMutex);
+  ++_pendingTasks;
+  pthread_mutex_unlock(&_taskMutex);
+  if (!_deques[entry->worker].Push(task)) {
+    pthread_mutex_lock(&_taskMutex);
+    --_pendingTasks;
+    pthread_mutex_unlock(&_taskMutex);
+    __atomic_store_n(&entry->scheduled, 0, __ATOMIC_RELEASE);
+    CFRelease(task.entry);
+    return;
+  }
+  pthread_mutex_lock(&_taskMutex);
+  ++_pushedTasks;
+  pthread_mutex_unlock(&_taskMutex);
+  pthread_cond_signal(&_taskCondition);
+}
+
+/**
+ * Takes a task from the deque of the specified worker or steals one from the
+ * other deques. This method blocks the caller while there are no tasks, and it
+ * returns NO when the caller should exit.
+ * @param {NSUInteger} worker
+ * @param {HEVCPlaybackTask*} task
+ * @return {BOOL}
+ */
+- (BOOL)takeTaskForWorker:(NSUInteger)worker task:(HEVCPlaybackTask *)task {
+  // A producer counts its task as pending before it adds the task to a deque,
+  // and a worker counts a task as running after it takes the task, i.e. the
+  // deques may be empty while there are pending tasks. Wait until a producer
+  // adds a task in this case instead of scanning the deques again.
+  for (;;) {
+    pthread_mutex_lock(&_taskMutex);
+    while (_pendingTasks == 0 && !_stopWorkers) {
+      pthread_cond_wait(&_taskCondition, &_taskMutex);
+    }
+    const BOOL stopped = _stopWorkers;
+    const uint32_t pushedTasks = _pushedTasks;
+    pthread_mutex_unlock(&_taskMutex);
+    if (stopped) {
+      return NO;
+    }
+    int found = _deques[worker].Pop(task);
+    for (NSUInteger i = 1; !found && i < _numberOfWorkers; ++i) {
+      found = _deques[(worker + i) % _numberOfWorkers].Steal(task);
+    }
+    pthread_mutex_lock(&_taskMutex);
+    if (found) {
+      --_pendingTasks;
+      ++_runningTasks;
+      pthread_mutex_unlock(&_taskMutex);
+      return YES;
+    }
+    while (_pushedTasks == pushedTasks && !_stopWorkers) {
+      pthread_cond_wait(&_taskCondition, &_taskMutex);
+    }
+    pthread_mutex_unlock(&_taskMutex);
+  }
+}
+
+/**
+ * Runs the specified task and notifies waiters that it has finished.
+ * @param {const HEVCPlaybackTask*} task
+ */
+- (void)runTask:(const HEVCPlaybackTask *)task {
+  @autoreleasepool {
+    HEVCPlaybackEntry *entry = (__bridge_transfer HEVCPlaybackEntry *)task->entry;
+    id<HEVCPlaybackEngineClient> client = entry->client;
+    if (client) {
+      [client playbackEngine:self processFrameAtTime:task->timestamp];
+    }
+    __atomic_store_n(&entry->scheduled, 0, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_lock(&_taskMutex);
+  --_runningTasks;
+  pthread_cond_broadcast(&_doneCondition);
+  pthread_mutex_unlock(&_taskMutex);
+}
+
+/**
+ * The entry point function of the worker threads.
+ * @param {void*} arg
+ * @return {void*}
+ */
+static void *HEVCPlaybackWorkerMain(void *arg) {
+  HEVCPlaybackEngine *engine = (__bridge HEVCPlaybackEngine *)arg;
+  const NSUInteger worker = __atomic_fetch_add(&engine->_startedWorkers, 1, __ATOMIC_RELAXED);
+  pthread_setname_np("com.dena.pokota.HEVCPlayerView.WorkerThread");
+  HEVCPlaybackTask task;
+  while ([engine takeTaskForWorker:worker task:&task]) {
+    [engine runTask:&task];
+  }
+  return NULL;
+}
+
+/**
+ * The entry point function of the display-link thread.
+ * @param {id} arg
+ */
+- (void)threadMethod:(id)arg {
+  // Attach the display link to the run loop of this thread. (A port keeps the
+  // run loop alive while the display link is paused, in which case this thread
+  // sleeps without wakeups.)
+  NSRunLoop *runLoop = [NSRunLoop currentRunLoop];
+  [runLoop addPort:[NSMachPort port] forMode:NSDefaultRunLoopMode];
+  [_displayLink addToRunLoop:runLoop forMode:NSDefaultRunLoopMode];
+  [runLoop run];
+}
+
+/**
+ * Called when this engine receives a `CADisplayLink` event. This method
+ * schedules a task for each active client with the time when the next display
+ * frame is presented, i.e. the clients choose the frames presented at that
+ * time.
+ * @param {CADisplayLink*} sender
+ */
+- (void)updateFrame:(CADisplayLink *)sender {
+  CFTimeInterval timestamp = sender.timestamp;
+  CFTimeInterval refreshInterval = sender.duration;
+  if (@available(iOS 10.0, *)) {
+    timestamp = sender.targetTimestamp;
+    refreshInterval = timestamp - sender.timestamp;
+  }
+  __atomic_store(&_refreshInterval, &refreshInterval, __ATOMIC_RELAXED);
+  pthread_mutex_lock(&_entryMutex);
+  for (HEVCPlaybackEntry *entry in _entries) {
+    if (entry->active) {
+      [self scheduleEntry:entry timestamp:timestamp];
+    }
+  }
+  pthread_mutex_unlock(&_entryMutex);
+}
+
+@end
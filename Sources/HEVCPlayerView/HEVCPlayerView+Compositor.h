@@ -0,0 +1,157 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef HEVC_PLAYER_VIEW_COMPOSITOR_H_
+#define HEVC_PLAYER_VIEW_COMPOSITOR_H_
+
+#import <CoreVideo/CoreVideo.h>
+#import <QuartzCore/QuartzCore.h>
+#import "HEVCPlayerView.h"
+
+#include <math.h>
+#include <stdint.h>
+
+/**
+ * The parameters of the fragment shaders `HEVCPlayerFragment` and
+ * `HEVCCompositorFragment`, which average `taps` x `taps` bilinear samples of
+ * a decoded image to render a pixel of a drawable smaller than the image. (This
+ * struct must be compatible with the one defined in "HEVCPlayerView.metal".)
+ */
+struct HEVCPlayerFilter {
+  /**
+   * The distance between two adjacent samples in texture coordinates.
+   * @type {float[2]}
+   */
+  float step[2];
+
+  /**
+   * The number of samples in each direction. (1 means the shader reads only one
+   * bilinear sample.)
+   * @type {int32_t}
+   */
+  int32_t taps;
+
+  /**
+   * The padding to the size of the struct in the Metal shading language.
+   * @type {int32_t}
+   */
+  int32_t padding;
+};
+
+/**
+ * The maximum number of samples read by the fragment shaders in each
+ * direction. (Reading two-by-two texels with a bilinear sample, the shaders
+ * box-filter images shrunk to 1/8 or more.)
+ * @const {int32_t}
+ */
+static const int32_t HEVCMaxFilterTaps = 4;
+
+/**
+ * Returns the filter parameters for rendering an image of the specified width
+ * to a rectangle of the specified size in pixels. The filter covers the texels
+ * mapped to a pixel with bilinear samples, each of which averages two-by-two
+ * texels, i.e. it reads one bilinear sample when it shrinks the image to 1/2 or
+ * more.
+ * @param {double} imageWidth
+ * @param {double} width
+ * @param {double} height
+ * @return {HEVCPlayerFilter}
+ */
+static inline HEVCPlayerFilter HEVCMakePlayerFilter(double imageWidth, double width, double height) {
+  width = width > 1.0 ? width : 1.0;
+  height = height > 1.0 ? height : 1.0;
+  int32_t taps = (int32_t)ceil(imageWidth / width / 2.0);
+  taps = taps < HEVCMaxFilterTaps ? taps : HEVCMaxFilterTaps;
+  taps = taps > 1 ? taps : 1;
+  HEVCPlayerFilter filter;
+  filter.step[0] = (float)(1.0 / (width * taps));
+  filter.step[1] = (float)(1.0 / (height * taps));
+  filter.taps = taps;
+  filter.padding = 0;
+  return filter;
+}
+
+/**
+ * Creates the semaphore that bounds the number of drawables of the specified
+ * layer being rendered or waiting for being presented. A caller signals the
+ * semaphore when its drawable is presented. (This function keeps a drawable
+ * for the display, i.e. `[CAMetalLayer nextDrawable]` does not wait while a
+ * caller holds the semaphore. A semaphore must not be deleted while its value is
+ * less than its initial value, i.e. this function signals it instead of
+ * setting its initial value.)
+ * @param {CAMetalLayer*} layer
+ * @return {dispatch_semaphore_t}
+ */
+static inline dispatch_semaphore_t HEVCCreateDrawableSemaphore(CAMetalLayer *layer) {
+  dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+  const NSUInteger count = layer.maximumDrawableCount > 1 ? layer.maximumDrawableCount - 1 : 1;
+  for (NSUInteger i = 0; i < count; ++i) {
+    dispatch_semaphore_signal(semaphore);
+  }
+  return semaphore;
+}
+
+/**
+ * The methods used by an `HEVCCompositorView` object to draw the images of the
+ * players registered to it. (These methods are implemented in
+ * "HEVCPlayerView.mm" and they are not public.)
+ */
+@interface HEVCPlayerView ()
+
+/**
+ * Starts or stops compositing this player. A composited player does not draw
+ * its images to its own layer, and it publishes the image of its current frame
+ * to its compositor instead.
+ * @param {BOOL} composited
+ */
+- (void)setComposited:(BOOL)composited;
+
+/**
+ * Sets the size of the sprite of this player in pixels. A composited player
+ * decodes its file to images that cover this size instead of the size of its
+ * own layer.
+ * @param {uint32_t} width
+ * @param {uint32_t} height
+ */
+- (void)setSpritePixelWidth:(uint32_t)width height:(uint32_t)height;
+
+/**
+ * Returns the image of the frame presented by this player. This method returns
+ * NULL when this player does not have images to present. (The caller must call
+ * the `CFRelease()` function after it uses the returned image.)
+ * @return {CVImageBufferRef}
+ */
+- (CVImageBufferRef _Nullable)copyCompositedImage CF_RETURNS_RETAINED;
+
+/**
+ * Returns whether the images of this player have premultiplied alpha, i.e.
+ * whether its HEVC stream has an alpha-channel-information SEI message that
+ * tells so.
+ * @return {BOOL}
+ */
+- (BOOL)hasPremultipliedAlpha;
+
+@end
+
+#endif  // HEVC_PLAYER_VIEW_COMPOSITOR_H_
@@ -25,10 +25,179 @@
 #ifndef HEVC_PLAYER_VIEW_H_
 #define HEVC_PLAYER_VIEW_H_
 
+#import <CoreVideo/CoreVideo.h>
+#import <Metal/Metal.h>
 #import <UIKit/UIKit.h>
 
 @class HEVCPlayerView;
 
+/**
+ * The quality tiers applied to all players to reduce their power consumption
+ * and heat. Players choose a tier from the thermal state and the power mode of
+ * the device, i.e. each tier includes the reductions of the preceding tiers.
+ *  +------------------------+--------------------------------------------+
+ *  | tier                   | condition                                  |
+ *  +------------------------+--------------------------------------------+
+ *  | Full                   | otherwise                                  |
+ *  | HalfRate               | Low Power Mode                             |
+ *  | ReducedResolution      | `NSProcessInfoThermalStateSerious`         |
+ *  | LimitedPlayers         | `NSProcessInfoThermalStateCritical`        |
+ *  +------------------------+--------------------------------------------+
+ * @enum {NSInteger}
+ */
+typedef NS_ENUM(NSInteger, HEVCPlayerQualityTier) {
+  /**
+   * Players decode and present all frames at the sizes of their views.
+   */
+  HEVCPlayerQualityTierFull = 0,
+
+  /**
+   * Players skip odd discardable frames (i.e. non-reference pictures) and
+   * request a half display refresh rate.
+   */
+  HEVCPlayerQualityTierHalfRate = 1,
+
+  /**
+   * Players also decode files at most at their half sizes.
+   */
+  HEVCPlayerQualityTierReducedResolution = 2,
+
+  /**
+   * Players also stop playing files except the four visible players with the
+   * largest visible areas. (These players resume when the tier is lowered.)
+   */
+  HEVCPlayerQualityTierLimitedPlayers = 3,
+};
+
+/**
+ * The class that encapsulates a frame presented by an HEVCPlayerView object
+ * that provides its frames to the application. This object retains the decoded
+ * image and its textures, i.e. the application can read them (e.g. sample the
+ * textures in its own render pass or send the image to a video encoder) until
+ * it releases this object. (The player neither copies nor modifies the image.)
+ */
+@interface HEVCPlayerFrame: NSObject
+
+/**
+ * The decoded image, whose pixel format is
+ * `kCVPixelFormatType_420YpCbCr8VideoRange_8A_TriPlanar`.
+ * @type {CVPixelBufferRef}
+ */
+@property (readonly, nonatomic) CVPixelBufferRef _Nonnull pixelBuffer;
+
+/**
+ * The texture of the Y plane of the image (`MTLPixelFormatR8Unorm`). The
+ * textures are created with the Metal device of the player.
+ * @type {id<MTLTexture>}
+ */
+@property (readonly, nonatomic) id<MTLTexture> _Nullable textureY;
+
+/**
+ * The texture of the subsampled UV plane of the image
+ * (`MTLPixelFormatRG8Unorm`).
+ * @type {id<MTLTexture>}
+ */
+@property (readonly, nonatomic) id<MTLTexture> _Nullable textureUV;
+
+/**
+ * The texture of the alpha plane of the image (`MTLPixelFormatR8Unorm`).
+ * @type {id<MTLTexture>}
+ */
+@property (readonly, nonatomic) id<MTLTexture> _Nullable textureA;
+
+/**
+ * The host time (in the `CACurrentMediaTime()` clock) of the display frame
+ * for which the player presented this frame.
+ * @type {CFTimeInterval}
+ */
+@property (readonly, nonatomic) CFTimeInterval hostTime;
+
+/**
+ * The index of this frame in the file.
+ * @type {NSInteger}
+ */
+@property (readonly, nonatomic) NSInteger frameIndex;
+
+@end
+
+/**
+ * The class that encapsulates a snapshot of the statistics of an HEVCPlayerView
+ * object, e.g. for uploading them to a telemetry service. The counters are
+ * accumulated since the player was created.
+ */
+@interface HEVCPlayerStatistics: NSObject
+
+/**
+ * The time between the last request for playing a file and the presentation
+ * time of its first frame (in seconds). This value is 0 until the player
+ * presents the first frame.
+ * @type {CFTimeInterval}
+ */
+@property (readonly, nonatomic) CFTimeInterval timeToFirstFrame;
+
+/**
+ * The median of the decoding latencies of Video Toolbox, i.e. the times between
+ * submitting samples and receiving their images (in seconds). The latencies
+ * are collected into a histogram of 0.5-ms bins up to 32 ms, i.e. a percentile
+ * is the upper bound of a bin. A percentile exceeding 32 ms is out of the
+ * histogram and it is reported as `maxDecodeLatency`.
+ * @type {CFTimeInterval}
+ */
+@property (readonly, nonatomic) CFTimeInterval decodeLatency50;
+
+/**
+ * The 90th percentile of the decoding latencies.
+ * @type {CFTimeInterval}
+ */
+@property (readonly, nonatomic) CFTimeInterval decodeLatency90;
+
+/**
+ * The 99th percentile of the decoding latencies.
+ * @type {CFTimeInterval}
+ */
+@property (readonly, nonatomic) CFTimeInterval decodeLatency99;
+
+/**
+ * The maximum of the decoding latencies (in seconds).
+ * @type {CFTimeInterval}
+ */
+@property (readonly, nonatomic) CFTimeInterval maxDecodeLatency;
+
+/**
+ * The number of frames decoded by Video Toolbox.
+ * @type {NSUInteger}
+ */
+@property (readonly, nonatomic) NSUInteger numberOfDecodedFrames;
+
+/**
+ * The number of frames dropped without decoding them.
+ * @type {NSUInteger}
+ */
+@property (readonly, nonatomic) NSUInteger numberOfDroppedFrames;
+
+/**
+ * The number of display frames at which the player kept presenting the
+ * previous image instead of presenting a due frame, e.g. because the frame was
+ * not decoded or no drawables were available.
+ * @type {NSUInteger}
+ */
+@property (readonly, nonatomic) NSUInteger numberOfDuplicatedFrames;
+
+/**
+ * The number of bytes used by the decoded images in the picture cache.
+ * @type {NSUInteger}
+ */
+@property (readonly, nonatomic) NSUInteger pictureCacheOccupancy;
+
+/**
+ * The number of times the player has reset its decoder after Video Toolbox
+ * failed decoding a sample.
+ * @type {NSUInteger}
+ */
+@property (readonly, nonatomic) NSUInteger numberOfDecoderResets;
+
+@end
+
 @protocol HEVCPlayerViewDelegate <NSObject>
 
 /**
@@ -47,14 +216,34 @@
 
 /**
  * Called when the HEVCPlayerView object finishes rendering a frame. This
- * method is called by the decoder thread, i.e. the decoder thread cannot
- * decode frames until this method exits. So, applications should dispatch
- * time-consuming tasks to other threads.
+ * method is called by a worker thread of the playback engine shared by all
+ * HEVCPlayerView objects, i.e. the worker thread cannot decode frames until
+ * this method exits. So, applications should dispatch time-consuming tasks to
+ * other threads.
  * @param {HEVCPlayerView *} hevcPlayerView
  * @param {NSInteger} index
  */
 - (void) playerView:(HEVCPlayerView* _Nonnull)hevcPlayerView didUpdateFrame:(NSInteger)index;
 
+@optional
+
+/**
+ * Called when the HEVCPlayerView object finishes loading a file and starts
+ * playing it. This player opens the file, parses its sample table, and creates
+ * its decoder in the background, i.e. this method is called by a worker thread
+ * of the playback engine as `playerView:didUpdateFrame:` is.
+ * @param {HEVCPlayerView *} hevcPlayerView
+ */
+- (void) playerViewDidLoad:(HEVCPlayerView* _Nonnull)hevcPlayerView;
+
+/**
+ * Called on the main thread when the quality tier applied to all players
+ * changes, e.g. when the device becomes hot or enters Low Power Mode.
+ * @param {HEVCPlayerView *} hevcPlayerView
+ * @param {HEVCPlayerQualityTier} tier
+ */
+- (void) playerView:(HEVCPlayerView* _Nonnull)hevcPlayerView didChangeQualityTier:(HEVCPlayerQualityTier)tier;
+
 @end
 
 @interface HEVCPlayerView: UIView {
@@ -67,6 +256,119 @@
  */
 @property (nonatomic, weak) id<HEVCPlayerViewDelegate> _Nullable delegate;
 
+/**
+ * The maximum number of bytes used by the decoded images cached by this player.
+ * This player applies this value when it opens the next file. (This player
+ * caches at least the images required for reordering the decoded frames even
+ * when they exceed this budget.) 0 means no limit.
+ * @type {NSUInteger}
+ */
+@property (nonatomic) NSUInteger pictureCacheBudget;
+
+/**
+ * The number of times this player has looped the file being played.
+ * @type {NSUInteger}
+ */
+@property (readonly, nonatomic) NSUInteger numberOfLoops;
+
+/**
+ * The number of times this player has not decoded the first frame of a loop
+ * when it is due, i.e. the number of visible hitches at loop points. (This
+ * player decodes the first frames of the next loop in advance as it does the
+ * other frames, i.e. this value stays 0 unless the decoder cannot catch up.)
+ * @type {NSUInteger}
+ */
+@property (readonly, nonatomic) NSUInteger numberOfLoopStalls;
+
+/**
+ * The number of frames this player has skipped without decoding them. This
+ * player keeps enough frames decoded ahead to hide the latency of Video
+ * Toolbox it measures, and it drops discardable frames (i.e. frames no other
+ * frames refer to) instead of stalling when Video Toolbox cannot decode frames
+ * in time, e.g. when the device is throttled. (This value also counts the
+ * frames dropped by `HEVCPlayerQualityTierHalfRate`.)
+ * @type {NSUInteger}
+ */
+@property (readonly, nonatomic) NSUInteger numberOfDroppedFrames;
+
+/**
+ * Whether or not this player provides its frames to the application instead of
+ * drawing them to its own layer. A player providing its frames keeps decoding
+ * and presenting its file at the display refresh rate while it is playing the
+ * file, and the application retrieves its current frame with
+ * `frameForHostTime:`, i.e. the player does not have to be in a view
+ * hierarchy.
+ * @type {BOOL}
+ */
+@property (nonatomic) BOOL providesFrames;
+
+/**
+ * Creates an idle decoder session for the HEVC file referred by the specified
+ * URL in the background. All players share idle decoder sessions and a player
+ * re-uses one compatible with the file it plays (i.e. one with the same frame
+ * size and parameter sets) instead of creating a session. So, applications can
+ * call this method for files likely to be played next to remove the cost of
+ * creating their sessions. (Players also share the sessions of the files they
+ * have finished playing.)
+ * @param {NSURL*} url
+ */
++ (void) prewarmDecoderWithURL:(NSURL* _Nonnull)url;
+
+/**
+ * Sets the maximum number of bytes used by the decoded images cached by all
+ * players. Each player applies this value when it opens the next file. (Each
+ * player caches at least the images required for reordering its decoded frames
+ * even when they exceed this budget.) 0 means no limit.
+ * @param {NSUInteger} budget
+ */
++ (void) setPictureCacheBudget:(NSUInteger)budget;
+
+/**
+ * Returns the maximum number of bytes used by the decoded images cached by all
+ * players.
+ * @return {NSUInteger}
+ */
++ (NSUInteger) pictureCacheBudget;
+
+/**
+ * Sets the maximum number of bytes used by the decoded images shared by the
+ * players of the same file. Players playing a file at the same time share its
+ * bytes and its sample table, and a player shows an image decoded by another
+ * one instead of decoding it. The shared cache deletes the least recently used
+ * images when they exceed this budget. 0 means players do not share images.
+ * @param {NSUInteger} budget
+ */
++ (void) setSharedFrameCacheBudget:(NSUInteger)budget;
+
+/**
+ * Returns the maximum number of bytes used by the decoded images shared by the
+ * players of the same file.
+ * @return {NSUInteger}
+ */
++ (NSUInteger) sharedFrameCacheBudget;
+
+/**
+ * Sets the minimum size of the files played as windowed streams. A player of a
+ * windowed stream keeps only the samples around its current position in
+ * memory, i.e. it reads samples again when it loops or seeks. 0 means players
+ * play all files as windowed streams. (This value does not affect the files
+ * being played.)
+ * @param {NSUInteger} threshold
+ */
++ (void) setWindowedStreamThreshold:(NSUInteger)threshold;
+
+/**
+ * Returns the minimum size of the files played as windowed streams.
+ * @return {NSUInteger}
+ */
++ (NSUInteger) windowedStreamThreshold;
+
+/**
+ * Returns the quality tier applied to all players.
+ * @return {HEVCPlayerQualityTier}
+ */
++ (HEVCPlayerQualityTier) qualityTier;
+
 // UIView methods
 #if TARGET_OS_IPHONE
 + (Class _Nonnull) layerClass;
@@ -74,24 +376,103 @@
 - (id _Nullable) initWithCoder:(NSCoder* _Nonnull)aDecoder;
 - (id _Nullable) initWithFrame:(CGRect)frame device:(id<MTLDevice> _Nonnull)device;
 - (void)dealloc;
+- (void)layoutSubviews;
+- (void)didMoveToWindow;
+- (void)setHidden:(BOOL)hidden;
+- (void)setAlpha:(CGFloat)alpha;
+
+/**
+ * Starts playing an HEVC file referred by the specified URL. This player
+ * presents its frames at the presentation timestamps of the file, i.e. it
+ * honors the sample durations of a variable-frame-rate file. This method
+ * returns immediately and this player loads the file in the background, and it
+ * keeps playing the previous file until it finishes loading this file.
+ * @param {NSURL*} url
+ * @param {BOOL} loop
+ */
+- (void) playFileFromURL:(NSURL* _Nonnull)url loop:(BOOL)loop;
 
 /**
- * Starts playing an HEVC file referred by the specified URL.
+ * Starts playing an HEVC file referred by the specified URL at the specified
+ * frame rate. (0 means the frame rate of the file, i.e. this method works as
+ * `playFileFromURL:loop:`.)
  * @param {NSURL*} url
  * @param {NSInteger} fps
  * @param {BOOL} loop
  */
 - (void) playFileFromURL:(NSURL* _Nonnull)url fps:(NSInteger)fps loop:(BOOL)loop;
 
+/**
+ * Loads an HEVC file referred by the specified URL without playing it. This
+ * player reads and parses the file, creates its decoder session, and decodes
+ * the specified number of frames from its beginning in the background, i.e.
+ * it renders the first frame of the file on the next display refresh when the
+ * application calls `playFileFromURL:loop:` or `playFileFromURL:fps:loop:` for
+ * the file. (This player stops playing the previous file when it finishes
+ * loading this file.)
+ * @param {NSURL*} url
+ * @param {NSInteger} frames
+ */
+- (void) preloadFileFromURL:(NSURL* _Nonnull)url frames:(NSInteger)frames;
+
+/**
+ * Returns the frame presented by this player at the specified host time (in
+ * the `CACurrentMediaTime()` clock), i.e. the latest frame presented by this
+ * player or the previous one if the latest one is presented after the time.
+ * This method returns nil unless this player provides its frames and it has
+ * presented a frame. This method can be called from any thread.
+ * @param {CFTimeInterval} hostTime
+ * @return {HEVCPlayerFrame*}
+ */
+- (HEVCPlayerFrame* _Nullable) frameForHostTime:(CFTimeInterval)hostTime;
+
+/**
+ * Returns a snapshot of the statistics of this player. This method can be
+ * called from any thread. (This player also writes `os_signpost` intervals of
+ * its pipeline to the "Playback" category of the
+ * "com.dena.pokota.HEVCPlayerView" subsystem.)
+ * @return {HEVCPlayerStatistics*}
+ */
+- (HEVCPlayerStatistics* _Nonnull) statistics;
+
+/**
+ * Clears the decoding latencies collected by this player, i.e. the latency
+ * percentiles of its statistics describe only the samples decoded after this
+ * method is called. This method can be called from any thread.
+ */
+- (void) resetDecodeLatencies;
+
+/**
+ * Moves the position of the HEVC file being played to the specified frame.
+ * This player starts decoding the file from the sync sample preceding the
+ * frame, i.e. it decodes at most one GOP before it renders the frame. (This
+ * player applies the request when it plays the file next time, e.g. when the
+ * host application becomes active.)
+ * @param {NSInteger} frame
+ */
+- (void) seekToFrame:(NSInteger)frame;
+
+/**
+ * Moves the position of the HEVC file being played to the frame presented at
+ * the specified time (in seconds).
+ * @param {NSTimeInterval} time
+ */
+- (void) seekToTime:(NSTimeInterval)time;
+
+/**
+ * Cancels loading the HEVC file being loaded in the background. This player
+ * keeps playing the previous file, if any.
+ */
+- (void) cancelLoading;
+
 /**
  * Finishes playing the HEVC file being played.
  */
 - (void) finish;
 
 /**
- * Invalidates this player. An NSThread object retained by this player causes a
- * cycling dependency. This method detaches the NSThread object from this player
- * so ARC can delete this player.
+ * Invalidates this player. This method stops playing the HEVC file being
+ * played and removes this player from the playback engine.
  */
 -(void) invalidate;
 
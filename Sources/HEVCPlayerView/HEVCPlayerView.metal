@@ -24,6 +24,15 @@
 
 #include <metal_stdlib>
 
+// The parameters of the box filter applied by `HEVCPlayerFragment` when it
+// shrinks an image. (This struct must be compatible with the one defined in
+// "HEVCPlayerView.mm".)
+struct HEVCPlayerFilter {
+  float2 step;
+  int taps;
+  int padding;
+};
+
 struct HEVCPlayerColor {
   float4 position [[ position ]];
   float2 texture;
@@ -39,25 +48,152 @@ vertex HEVCPlayerColor HEVCPlayerVertex(uint vid [[ vertex_id ]]) {
   return vertices[vid];
 }
 
+// The function constants that specialize the fragment shaders for the decoded
+// images. `HEVCPlayerView` and `HEVCCompositorView` create render pipelines
+// with these constants from the attachments of the images, i.e. the shaders
+// do not branch on them at run time. (These indices must be compatible with
+// the ones defined in "HEVCRenderPipeline.h".)
+//   +-------+------------------------+-----------------------------------------+
+//   | index | name                   | value                                   |
+//   +-------+------------------------+-----------------------------------------+
+//   | 0     | HEVCFullRange          | whether the images are full-range ones  |
+//   | 1     | HEVCMatrix             | 0: BT.709, 1: BT.601, 2: BT.2020        |
+//   | 2     | HEVCPremultipliedAlpha | whether the images are premultiplied    |
+//   | 3     | HEVCHalfPrecision      | whether the conversion uses half floats |
+//   +-------+------------------------+-----------------------------------------+
+// (A function created without constants uses the default ones, i.e. it renders
+// video-range BT.709 images with straight alpha in single precision.)
+constant bool HEVCFullRangeValue [[ function_constant(0) ]];
+constant int HEVCMatrixValue [[ function_constant(1) ]];
+constant bool HEVCPremultipliedAlphaValue [[ function_constant(2) ]];
+constant bool HEVCHalfPrecisionValue [[ function_constant(3) ]];
+constant bool HEVCFullRange = metal::is_function_constant_defined(HEVCFullRangeValue) ? HEVCFullRangeValue : false;
+constant int HEVCMatrix = metal::is_function_constant_defined(HEVCMatrixValue) ? HEVCMatrixValue : 0;
+constant bool HEVCPremultipliedAlpha = metal::is_function_constant_defined(HEVCPremultipliedAlphaValue) ? HEVCPremultipliedAlphaValue : false;
+constant bool HEVCHalfPrecision = metal::is_function_constant_defined(HEVCHalfPrecisionValue) ? HEVCHalfPrecisionValue : false;
+
+// Converts an averaged YUVA sample to a color with premultiplied alpha in the
+// precision of `T`. This function expands video-range values to full-range
+// ones and applies the YCbCr->RGB matrix selected by the function constants.
+// (Core Animation composites `CAMetalLayer` objects with premultiplied alpha,
+// i.e. this function multiplies the color by the alpha unless the images are
+// premultiplied.)
+template <typename T>
+static float4 HEVCPlayerConvert(float video_y, float2 video_uv, float alpha) {
+  typedef metal::vec<T, 2> T2;
+  typedef metal::vec<T, 3> T3;
+  T y = T(video_y);
+  T2 uv = T2(video_uv);
+
+  // Apply the `420v`->`f420` conversion as written in Stack Overflow
+  // <https://stackoverflow.com/a/61219470> unless the images are full-range
+  // ones.
+  if (HEVCFullRange) {
+    uv -= T(0.5f);
+  } else {
+    y = (y - T(16.0f / 255.0f)) * T(255.0f / (235.0f - 16.0f));
+    uv = (uv - T(16.0f / 255.0f)) * T(255.0f / (240.0f - 16.0f)) - T(0.5f);
+  }
+
+  // Apply the YCbCr->RGB conversion of the matrix attached to the images.
+  // (Video Toolbox uses BT.709 to encode HEVC video clips by default.)
+  T3 rgb;
+  if (HEVCMatrix == 1) {
+    rgb = T3(y + T(1.402f) * uv.y, y - T(0.344136f) * uv.x - T(0.714136f) * uv.y, y + T(1.772f) * uv.x);
+  } else if (HEVCMatrix == 2) {
+    rgb = T3(y + T(1.4746f) * uv.y, y - T(0.164553f) * uv.x - T(0.571353f) * uv.y, y + T(1.8814f) * uv.x);
+  } else {
+    rgb = T3(y + T(1.5748f) * uv.y, y - T(0.187324f) * uv.x - T(0.468124f) * uv.y, y + T(1.8556f) * uv.x);
+  }
+  const T a = T(alpha);
+  rgb = metal::clamp(rgb, T3(0.0f), T3(1.0f));
+  if (!HEVCPremultipliedAlpha) {
+    rgb *= a;
+  }
+  return float4(float3(rgb), float(a));
+}
+
+// Returns the color of the decoded image at the specified position. This
+// function averages `taps` x `taps` bilinear samples around the position to
+// box-filter the image when the drawable is much smaller than it. (A bilinear
+// sample reads only two-by-two texels, i.e. it skips texels when the drawable
+// is smaller than a half of the image.) The conversions of `HEVCPlayerConvert`
+// are affine, i.e. this function can apply them to the averaged values.
+static float4 HEVCPlayerSample(float2 texture,
+                               metal::texture2d<float> textureY,
+                               metal::texture2d<float> textureUV,
+                               metal::texture2d<float> textureA,
+                               constant HEVCPlayerFilter &filter) {
+  constexpr metal::sampler sampler(metal::filter::linear, metal::address::clamp_to_edge);
+  if (filter.taps == 1) {
+    const float video_y = textureY.sample(sampler, texture).r;
+    const float2 video_uv = textureUV.sample(sampler, texture).rg;
+    const float alpha = textureA.sample(sampler, texture).r;
+    return HEVCHalfPrecision ? HEVCPlayerConvert<half>(video_y, video_uv, alpha) : HEVCPlayerConvert<float>(video_y, video_uv, alpha);
+  }
+  const float2 origin = texture - filter.step * (0.5f * (float)(filter.taps - 1));
+  float video_y = 0.0f;
+  float2 video_uv = float2(0.0f, 0.0f);
+  float alpha = 0.0f;
+  for (int j = 0; j < filter.taps; ++j) {
+    for (int i = 0; i < filter.taps; ++i) {
+      const float2 position = origin + filter.step * float2((float)i, (float)j);
+      video_y += textureY.sample(sampler, position).r;
+      video_uv += textureUV.sample(sampler, position).rg;
+      alpha += textureA.sample(sampler, position).r;
+    }
+  }
+  const float weight = 1.0f / (float)(filter.taps * filter.taps);
+  video_y *= weight;
+  video_uv *= weight;
+  alpha *= weight;
+  return HEVCHalfPrecision ? HEVCPlayerConvert<half>(video_y, video_uv, alpha) : HEVCPlayerConvert<float>(video_y, video_uv, alpha);
+}
+
 fragment float4 HEVCPlayerFragment(HEVCPlayerColor in [[ stage_in ]],
                                    metal::texture2d<float> textureY [[ texture(0) ]],
                                    metal::texture2d<float> textureUV [[ texture(1) ]],
-                                   metal::texture2d<float> textureA [[ texture(2) ]]) {
-  // Apply the `420v`->`f420` conversion as written in Stack Overflow
-  // <https://stackoverflow.com/a/61219470>.
-  constexpr metal::sampler sampler(metal::filter::linear);
-  const float video_y = textureY.sample(sampler, in.texture).r;
-  const float2 video_uv = textureUV.sample(sampler, in.texture).rg;
-  const float full_y = (video_y - 16.0f / 255.0f) * (255.0f / (235.0f - 16.0f));
-  const float2 full_uv = (video_uv - 16.0f / 255.0f) * (255.0f / (240.0f - 16.0f)) - 0.5f;
-
-  // Apply the BT.709 YUV->RGB conversion. (Video Toolbox uses BT.709 to encode
-  // HEVC video clips by default. That said, the color attachment of input
-  // `CVPixelBuffer` objects is `kCVImageBufferYCbCrMatrix_ITU_R_709_2` by
-  // default.
-  const metal::float3x3 bt709 = metal::float3x3(float3(1.0f, 1.0f, 1.0f), float3(0.0f, -0.21482f, 2.12798f), float3(1.28033f, -0.38059f, 0.0f));
-  // Convert the `kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange`
-  const float3 rgb = bt709 * float3(full_y, full_uv);
-  const float alpha = textureA.sample(sampler, in.texture).r;
-  return float4(rgb, alpha);
+                                   metal::texture2d<float> textureA [[ texture(2) ]],
+                                   constant HEVCPlayerFilter &filter [[ buffer(0) ]]) {
+  return HEVCPlayerSample(in.texture, textureY, textureUV, textureA, filter);
+}
+
+// The corners of a sprite drawn by `HEVCCompositorVertex` in normalized device
+// coordinates, ordered as a triangle strip (bottom-left, bottom-right,
+// top-left, and top-right). (This struct must be compatible with the one
+// defined in "HEVCCompositorView.mm".)
+struct HEVCCompositorQuad {
+  float2 positions[4];
+  float opacity;
+  float padding[3];
+};
+
+struct HEVCCompositorColor {
+  float4 position [[ position ]];
+  float2 texture;
+  float opacity;
+};
+
+vertex HEVCCompositorColor HEVCCompositorVertex(uint vid [[ vertex_id ]],
+                                                constant HEVCCompositorQuad &quad [[ buffer(0) ]]) {
+  const float2 textures[4] = {
+    float2(0.0f, 1.0f), float2(1.0f, 1.0f), float2(0.0f, 0.0f), float2(1.0f, 0.0f),
+  };
+  HEVCCompositorColor color;
+  color.position = float4(quad.positions[vid], 0.0f, 1.0f);
+  color.texture = textures[vid];
+  color.opacity = quad.opacity;
+  return color;
+}
+
+// Returns the color of a sprite with its alpha premultiplied so the render
+// pipeline of the compositor blends sprites with `(1, 1 - source alpha)`.
+// (`HEVCPlayerSample` returns premultiplied colors, i.e. this function applies
+// the opacity to all components.)
+fragment float4 HEVCCompositorFragment(HEVCCompositorColor in [[ stage_in ]],
+                                       metal::texture2d<float> textureY [[ texture(0) ]],
+                                       metal::texture2d<float> textureUV [[ texture(1) ]],
+                                       metal::texture2d<float> textureA [[ texture(2) ]],
+                                       constant HEVCPlayerFilter &filter [[ buffer(0) ]]) {
+  return HEVCPlayerSample(in.texture, textureY, textureUV, textureA, filter) * in.opacity;
 }
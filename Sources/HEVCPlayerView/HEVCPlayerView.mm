@@ -23,65 +23,100 @@
  */
 
 #import "HEVCPlayerView.h"
+#import "HEVCPlayerView+Compositor.h"
 
 #import <AVFoundation/AVFoundation.h>
 #import <CoreFoundation/CoreFoundation.h>
 #import <Metal/Metal.h>
-#import "HEVCWeakProxy.h"
+#import "HEVCPlaybackEngine.h"
+#import "HEVCRenderPipeline.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <memory.h>
 #include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "base/trace.h"
+#include "hevc/asset_cache.h"
 #include "hevc/decoder.h"
-
-#import "HEVCBundleHelper.h"
+#include "hevc/sample_index.h"
+#include "hevc/session_pool.h"
+#include "mov/atom_reader.h"
+#include "mov/stream.h"
 
 /**
- * The class that encapsulates an array of images decoded by the `hevc::Decoder`
- * object. This class is also used for sorting decoded images with their picture
- * order numbers. (That said, this player sorts decoded images by itself.)
+ * The class that encapsulates a ring buffer of images decoded by the
+ * `hevc::Decoder` object. This class stores a decoded image with its frame
+ * number (its index in the output order) at the slot `frame % count`, i.e.
+ * this class also sorts decoded images in the output order. The ring buffer
+ * must have at least `sps_max_num_reorder_pics + 1` slots because the decoder
+ * outputs up to `sps_max_num_reorder_pics` frames following the frame to be
+ * rendered before it outputs the frame.
+ *
+ * This class is a lock-free single-producer/single-consumer queue. The thread
+ * playing the view (the consumer) reserves slots, retrieves images, and clears
+ * the cache, and the output handler of Video Toolbox (the producer) attaches
+ * images to the reserved slots. Each slot has an atomic tag consisting of an
+ * epoch, a frame number, and a status, i.e. the producer attaches an image to
+ * a slot only when its tag has not been changed by the consumer since the
+ * consumer reserved it. (The consumer changes the epoch when it clears the
+ * cache so the producer discards images decoded before it.)
  */
 struct HEVCPictureArray {
   /**
-   * The inner class that encapsulates an image and its status.
+   * The status of a slot.
+   *  +----------+-------+--------------------------------------+
+   *  | name     | value | description                          |
+   *  +----------+-------+--------------------------------------+
+   *  | EMPTY    | 0     | not decoded                          |
+   *  | DECODING | 1     | decoding                             |
+   *  | DECODED  | 2     | decoded                              |
+   *  | WRITING  | 3     | the producer is attaching the image  |
+   *  +----------+-------+--------------------------------------+
+   * @enum {uint64_t}
+   */
+  enum {
+    EMPTY = 0,
+    DECODING = 1,
+    DECODED = 2,
+    WRITING = 3,
+    STATUS_MASK = 3,
+  };
+
+  /**
+   * The inner class that encapsulates an image and its tag.
    */
   struct Picture {
     /**
-     * The image buffer.
-     * @type {uintptr_t}
+     * The image buffer. (Only the producer writes this value while the slot is
+     * `WRITING` and only the consumer reads it while the slot is not.)
+     * @type {CVImageBufferRef}
      */
     CVImageBufferRef image;
 
     /**
-     * The image status.
-     *  +-------+-------------+
-     *  | value | description |
-     *  +-------+-------------+
-     *  | 0     | not decoded |
-     *  | 1     | decoding    |
-     *  | 2     | decoded     |
-     *  +-------+-------------+
-     * @type {uintptr_t}
+     * The tag of this slot, i.e. `((epoch << 32) | frame) << 2 | status`.
+     * @type {uint64_t}
      */
-    uintptr_t status;
+    uint64_t tag;
   };
 
   /**
    * Initializes an empty array.
    */
   void Initialize() {
-    pthread_mutex_init(&mutex_, NULL);
     count_ = 0;
-    session_ = 0;
+    epoch_ = 0;
     pictures_ = NULL;
   }
 
   /**
    * Deletes this array.
-   * @param {uintptr_t} count
    */
   void Destroy() {
     Reset();
-    pthread_mutex_destroy(&mutex_);
   }
 
   /**
@@ -90,31 +125,22 @@ struct HEVCPictureArray {
    */
   void Create(uintptr_t count) {
     count_ = count;
-    ++session_;
+    ++epoch_;
     pictures_ = static_cast<Picture*>(calloc(count, sizeof(Picture)));
   }
 
   /**
-   * Resets this array to its initial state. This function atomically deletes
-   * all cached images and deletes the array.
+   * Resets this array to its initial state. This function deletes all cached
+   * images and deletes the array. (The caller must destroy the decoder before
+   * calling this function so the producer does not access the deleted array.)
    */
   void Reset() {
-    pthread_mutex_lock(&mutex_);
-    ++session_;
+    ClearCache();
     if (pictures_) {
-      for (uintptr_t i = 0; i < count_; ++i) {
-        Picture* picture = &pictures_[i];
-        if (picture->image) {
-          CFRelease(picture->image);
-          picture->image = NULL;
-        }
-        picture->status = 0;
-      }
       free(pictures_);
     }
     pictures_ = NULL;
     count_ = 0;
-    pthread_mutex_unlock(&mutex_);
   }
 
   /**
@@ -122,19 +148,12 @@ struct HEVCPictureArray {
    * function is for re-playing the QuickTime stream being played by the view.)
    */
   void ClearCache() {
-    pthread_mutex_lock(&mutex_);
-    ++session_;
+    ++epoch_;
     if (pictures_) {
       for (uintptr_t i = 0; i < count_; ++i) {
-        Picture* picture = &pictures_[i];
-        if (picture->image) {
-          CFRelease(picture->image);
-          picture->image = NULL;
-        }
-        picture->status = 0;
+        Release(&pictures_[i], EMPTY);
       }
     }
-    pthread_mutex_unlock(&mutex_);
   }
 
   /**
@@ -146,641 +165,2991 @@ struct HEVCPictureArray {
   }
 
   /**
-   * Retrieves the image status at the specified index.
-   * @param {int} index
+   * Returns the number of the decoded images in this array. (Only the consumer
+   * can call this function.)
    * @return {uintptr_t}
    */
-  uintptr_t GetStatus(int index) {
-    pthread_mutex_lock(&mutex_);
-    const uintptr_t status = pictures_[index].status;
-    pthread_mutex_unlock(&mutex_);
-    return status;
+  uintptr_t GetNumberOfImages() const {
+    uintptr_t count = 0;
+    for (uintptr_t i = 0; i < count_; ++i) {
+      const uint64_t tag = __atomic_load_n(&pictures_[i].tag, __ATOMIC_ACQUIRE);
+      count += (tag & STATUS_MASK) == DECODED && pictures_[i].image;
+    }
+    return count;
   }
 
   /**
-   * Updates the image status at the specified index.
-   * @param {int} index
-   * @param {uintptr_t} status
+   * Retrieves the status of the specified frame. (This function returns 0 when
+   * the slot of the frame is used by another frame.)
+   * @param {int} frame
    * @return {uintptr_t}
    */
-  uintptr_t SetStatus(int index, uintptr_t status) {
-    pthread_mutex_lock(&mutex_);
-    const uintptr_t session = session_;
-    Picture* picture = &pictures_[index];
-    picture->status = status;
-    pthread_mutex_unlock(&mutex_);
-    return session;
+  uintptr_t GetStatus(int frame) const {
+    const Picture* picture = &pictures_[frame % count_];
+    const uint64_t tag = __atomic_load_n(&picture->tag, __ATOMIC_ACQUIRE);
+    if ((tag & ~static_cast<uint64_t>(STATUS_MASK)) != GetTag(frame)) {
+      return EMPTY;
+    }
+    const uintptr_t status = static_cast<uintptr_t>(tag & STATUS_MASK);
+    return status == WRITING ? DECODING : status;
   }
 
   /**
-   * Retrieves the image at the specified index. This function does not decrease
-   * the reference count of the retrieved image, i.e. the caller must call the
-   * `CFRelease()` function after it uses the returned image.
-   * @param {int} index
-   * @return {CVImageBufferRef}
+   * Reserves the slot of the specified frame for decoding it. This function
+   * assigns the slot to the frame and deletes the image of another frame in the
+   * slot. This function returns a token that the producer uses for attaching a
+   * decoded image to the slot.
+   * @param {int} frame
+   * @return {uint64_t}
    */
-  CVImageBufferRef GetImage(int index) {
-    pthread_mutex_lock(&mutex_);
-    Picture* picture = &pictures_[index];
-    CVImageBufferRef image = picture->image;
-    if (image) {
-      picture->image = NULL;
-    }
-    picture->status = 0;
-    pthread_mutex_unlock(&mutex_);
-    return image;
+  uint64_t Reserve(int frame) {
+    const uint64_t token = GetTag(frame);
+    Release(&pictures_[frame % count_], token | DECODING);
+    return token;
   }
 
   /**
-   * Attaches the specified image to the specified index. This function does not
-   * increases the reference count of the specified image, i.e. the caller must
-   * call the `CFRetain()` function to increase its reference count.
-   * @param {int} index
-   * @param {CVImageBufferRef} image
-   * @param {uintptr_t} status
-   * @param {uintptr_t} session
+   * Cancels decoding the frame reserved with the specified token, e.g. when the
+   * decoder fails decoding it. (This function does nothing when the consumer
+   * has assigned the slot to another frame.)
+   * @param {uint64_t} token
    */
-  void SetImage(int index,
-                CVImageBufferRef image,
-                uintptr_t status,
-                uintptr_t session) {
-    pthread_mutex_lock(&mutex_);
-    if (session == session_) {
-      Picture* picture = &pictures_[index];
-      picture->image = image;
-      picture->status = status;
-      CFRetain(image);
-    }
-    pthread_mutex_unlock(&mutex_);
+  void Cancel(uint64_t token) {
+    Picture* picture = GetPicture(token);
+    uint64_t expected = token | DECODING;
+    __atomic_compare_exchange_n(&picture->tag, &expected, token | EMPTY, false,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
   }
 
   /**
-   * The mutex that allows only one thread to access this object.
-   * @type {pthread_mutex_t}
-   * @private
+   * Marks the specified frame as dropped, i.e. as a decoded frame without an
+   * image, so the consumer skips it instead of waiting for it. (`GetImage()`
+   * returns NULL and empties the slot of a dropped frame.) This function
+   * deletes the image of another frame in the slot.
+   * @param {int} frame
    */
-  pthread_mutex_t mutex_;
+  void Drop(int frame) {
+    Release(&pictures_[frame % count_], GetTag(frame) | DECODED);
+  }
 
   /**
-   * The number of pictures in this array.
-   * @type {uintptr_t}
-   * @private
+   * Returns whether or not the specified frame has been dropped.
+   * @param {int} frame
+   * @return {int}
    */
-  uintptr_t count_;
+  int IsDropped(int frame) const {
+    const Picture* picture = &pictures_[frame % count_];
+    const uint64_t tag = __atomic_load_n(&picture->tag, __ATOMIC_ACQUIRE);
+    return tag == (GetTag(frame) | DECODED) && !picture->image;
+  }
 
   /**
-   * The session ID of this array.
-   * @type {uintptr_t}
-   * @private
+   * Retrieves the image of the specified frame. This function does not decrease
+   * the reference count of the retrieved image, i.e. the caller must call the
+   * `CFRelease()` function after it uses the returned image.
+   * @param {int} frame
+   * @return {CVImageBufferRef}
    */
-  uintptr_t session_;
+  CVImageBufferRef GetImage(int frame) {
+    Picture* picture = &pictures_[frame % count_];
+    const uint64_t tag = GetTag(frame);
+    if (__atomic_load_n(&picture->tag, __ATOMIC_ACQUIRE) != (tag | DECODED)) {
+      return NULL;
+    }
+    // The producer does not change a `DECODED` slot, i.e. this function can
+    // take its image without a compare-and-swap operation.
+    CVImageBufferRef image = picture->image;
+    picture->image = NULL;
+    __atomic_store_n(&picture->tag, tag | EMPTY, __ATOMIC_RELAXED);
+    return image;
+  }
 
   /**
-   * The pictures.
-   * @type {pthread_mutex_t}
-   * @private
+   * Attaches the specified image to the frame reserved with the specified
+   * token. This function increases the reference count of the specified image
+   * only when it attaches the image. (This function discards the image when the
+   * consumer has cleared the cache or assigned the slot to another frame since
+   * it reserved the slot.)
+   * @param {uint64_t} token
+   * @param {CVImageBufferRef} image
    */
-  Picture* pictures_;
-};
+  void SetImage(uint64_t token, CVImageBufferRef image) {
+    Picture* picture = GetPicture(token);
+    uint64_t expected = token | DECODING;
+    if (!__atomic_compare_exchange_n(&picture->tag, &expected, token | WRITING,
+                                     false, __ATOMIC_ACQUIRE,
+                                     __ATOMIC_RELAXED)) {
+      return;
+    }
+    CFRetain(image);
+    picture->image = image;
+    __atomic_store_n(&picture->tag, token | DECODED, __ATOMIC_RELEASE);
+  }
 
-@implementation HEVCPlayerView {
   /**
-   * The Metal layer to which this view draws decoded frames.
-   * @type {CAMetalLayer*}
+   * Returns the tag of the specified frame in the current epoch (without its
+   * status bits).
+   * @param {int} frame
+   * @return {uint64_t}
    * @private
    */
-  CAMetalLayer *_metalLayer;
+  uint64_t GetTag(int frame) const {
+    return ((epoch_ << 32) | static_cast<uint32_t>(frame)) << 2;
+  }
 
   /**
-   * The command queue for drawing an HEVC-with-Alpha stream to this view.
-   * @type {id<MTLCommandQueue>}
+   * Returns the slot of the frame reserved with the specified token.
+   * @param {uint64_t} token
+   * @return {Picture*}
    * @private
    */
-  id<MTLCommandQueue> _commandQueue;
+  Picture* GetPicture(uint64_t token) const {
+    const uint32_t frame = static_cast<uint32_t>(token >> 2);
+    return &pictures_[frame % count_];
+  }
 
   /**
-   * The render state that encapsulates the shader programs used by this
-   * view.
-   * @type {id<MTLRenderPipelineState>}
+   * Replaces the tag of the specified slot and deletes its image. This function
+   * waits for the producer while it is attaching an image to the slot, which
+   * finishes in a few instructions.
+   * @param {Picture*} picture
+   * @param {uint64_t} tag
    * @private
    */
-  id<MTLRenderPipelineState> _renderPipelineState;
+  static void Release(Picture* picture, uint64_t tag) {
+    uint64_t expected = __atomic_load_n(&picture->tag, __ATOMIC_RELAXED);
+    for (;;) {
+      if ((expected & STATUS_MASK) == WRITING) {
+        sched_yield();
+        expected = __atomic_load_n(&picture->tag, __ATOMIC_RELAXED);
+        continue;
+      }
+      if (__atomic_compare_exchange_n(&picture->tag, &expected, tag, false,
+                                      __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        break;
+      }
+    }
+    if (picture->image) {
+      CFRelease(picture->image);
+      picture->image = NULL;
+    }
+  }
 
   /**
-   * The texture cache that generates textures (from an HEVC-with-Alpha stream)
-   * used by this view.
-   * @type {CVMetalTextureCacheRef}
+   * The number of pictures in this array.
+   * @type {uintptr_t}
    * @private
    */
-  CVMetalTextureCacheRef _textureCache;
+  uintptr_t count_;
 
   /**
-   * The render-pass descriptor that writes textures (generated by the above
-   * texture cache) to this view.
-   * @type {MTLRenderPassDescriptor}
+   * The epoch of this array. (Only the consumer changes this value.)
+   * @type {uint64_t}
    * @private
    */
-  MTLRenderPassDescriptor *_renderPassDescriptor;
+  uint64_t epoch_;
 
   /**
-   * The HEVC-with-Alpha decoder.
-   * @type {hevc::Decoder}
+   * The pictures.
+   * @type {Picture*}
    * @private
    */
-  hevc::Decoder _decoder;
+  Picture* pictures_;
+};
 
-  /**
-   * The display link to synchronize this view to the refresh rate of the host
-   * display.
-   * @type {CADisplayLink*}
-   * @private
-   */
-  CADisplayLink *_displayLink;
+/**
+ * The maximum number of bytes used by the decoded images cached by all players.
+ * (0 means no limits.)
+ * @type {uint64_t}
+ */
+static uint64_t HEVCPictureCacheBudget = 0;
 
-  /**
-   * The interval period for decoding an HEVC-with-Alpha stream and rendering
-   * its output frames to this view repeatedly.
-   * @type {CFTimeInternal}
-   * @private
-   */
-  CFTimeInterval _timeInterval;
+/**
+ * The number of bytes reserved by the picture caches of all players.
+ * @type {uint64_t}
+ */
+static uint64_t HEVCPictureCacheUsage = 0;
 
-  /**
-   * The last time when this view decoded an HEVC-with-Alpha stream.
-   * @type {CFTimeInternal}
-   * @private
-   */
-  CFTimeInterval _lastTimestamp;
+/**
+ * The frame interval used for a QuickTime stream without sample durations.
+ * @type {CFTimeInterval}
+ */
+static const CFTimeInterval HEVCDefaultFrameInterval = 1.0 / 30.0;
 
-  /**
-   * The mutex that allows only one thread to attach it to the display link.
-   * @type {pthread_mutex_t}
-   * @private
-   */
-  pthread_mutex_t _mutex;
+/**
+ * The maximum difference between a display time and a presentation time that
+ * is regarded as the same time. (This value absorbs rounding errors of display
+ * times.)
+ * @type {CFTimeInterval}
+ */
+static const CFTimeInterval HEVCFrameTimeTolerance = 0.001;
 
-  /**
-   * The path to the HEVC-with-Alpha stream being decoded.
-   * @type {NSString*}
-   * @private
-   */
-  NSString *_path;
+/**
+ * The maximum delay of a frame from its presentation time. A player shifts its
+ * presentation times when it cannot render a frame within this delay, e.g.
+ * when it resumes playing a stream or when its decoder cannot catch up.
+ * @type {CFTimeInterval}
+ */
+static const CFTimeInterval HEVCMaxFrameDelay = 0.25;
 
-  /**
-   * The thread that decodes the HEVC-with-Alpha stream. This thread receives
-   * events from the `CADisplayLink` object.
-   * @type {NSString*}
-   * @private
-   */
-  NSThread *_thread;
+/**
+ * The minimum number of frames a player keeps decoded (or being decoded) ahead
+ * of the frame to be rendered, i.e. the current frame and the next one.
+ * @type {int}
+ */
+static const int HEVCMinDecodeAhead = 2;
 
-  /**
-   * The array of decoded pictures.
-   * @type {HEVCPictureArray}
-   * @private
-   */
-  HEVCPictureArray _pictures;
+/**
+ * The number of mean deviations added to the smoothed decoding latency to
+ * estimate the worst latency of Video Toolbox, as TCP estimates its
+ * retransmission timeout (RFC 6298).
+ * @type {double}
+ */
+static const double HEVCLatencyDeviations = 4.0;
 
-  /**
-   * The sample number being decoded by the HEVC-with-Alpha decoder.
-   * @type {int}
-   * @private
-   */
-  int _sample;
+/**
+ * The number of the bins of the histogram of decoding latencies. (The histogram
+ * has one more bin, which counts the latencies exceeding these bins.)
+ * @type {int}
+ */
+static const int HEVCLatencyBins = 64;
 
-  /**
-   * The picture number to be rendered by this view. (This value is a key for
-   * sorting decoded samples in the playing order.)
-   * @type {int}
-   * @private
-   */
-  int _picture;
+/**
+ * The width of a bin of the above histogram (in seconds).
+ * @type {CFTimeInterval}
+ */
+static const CFTimeInterval HEVCLatencyBinWidth = 0.0005;
+
+/**
+ * Returns the specified percentile of the latencies in the specified histogram,
+ * i.e. the upper bound of the bin containing it. This function returns the
+ * specified maximum latency when the percentile is in the overflow bin, which
+ * does not have an upper bound. (This function returns 0 when the histogram is
+ * empty.)
+ * @param {const uint32_t*} histogram
+ * @param {uint64_t} count
+ * @param {CFTimeInterval} maxLatency
+ * @param {double} ratio
+ * @return {CFTimeInterval}
+ */
+static CFTimeInterval HEVCGetLatencyPercentile(const uint32_t *histogram, uint64_t count, CFTimeInterval maxLatency, double ratio) {
+  const uint64_t rank = (uint64_t)ceil((double)count * ratio);
+  uint64_t sum = 0;
+  for (int i = 0; i <= HEVCLatencyBins; ++i) {
+    sum += histogram[i];
+    if (sum >= rank && sum > 0) {
+      return i < HEVCLatencyBins ? (i + 1) * HEVCLatencyBinWidth : maxLatency;
+    }
+  }
+  return 0.0;
+}
+
+/**
+ * The seek request representing a request of `seekToTime:`, which the worker
+ * thread converts to a frame number.
+ * @type {int}
+ */
+static const int HEVCSeekToTime = -2;
 
+/**
+ * The decoder prepared by a load request and the key of the sample index of
+ * its file.
+ */
+struct HEVCPreparedDecoder {
   /**
-   * The frame number rendered by this view. (This view caches decoded samples,
-   * i.e. a frame number is not always equal to a sample number.)
-   * @type {int}
-   * @private
+   * The decoder.
+   * @type {hevc::Decoder}
    */
-  int _frame;
+  hevc::Decoder decoder;
 
   /**
-   * Whether or not this player loops playing the QuickTime stream.
-   * @type {BOOL}
-   * @private
+   * The size of the file.
+   * @type {uint64_t}
    */
-  BOOL _loop;
+  uint64_t file_size;
 
   /**
-   * Whether or not this player should rewind its positions on idle. (This
-   * variable is used for playing the QuickTime stream being played at its
-   * beginning.)
-   * @type {BOOL}
-   * @private
+   * The modification time of the file.
+   * @type {int64_t}
    */
-  BOOL _rewind;
+  int64_t modified_time;
 
   /**
-   * Whether or not this player should reset its HEVC-with-Alpha decoder. (This
-   * variable is used for deleting an invalidated decoder and re-creating a new
-   * one.)
-   * @type {BOOL}
-   * @private
+   * The ID of the file in the asset cache. (This value is 0 when the decoder
+   * does not share the file with other players.)
+   * @type {uint32_t}
    */
-  BOOL _reset;
+  uint32_t asset_id;
 
   /**
-   * Whether or not this player is being inactive.
-   * @type {BOOL}
-   * @private
+   * The path to the sample index of the file.
+   * @type {char[]}
    */
-  BOOL _suspend;
-    
-  /**
-    * Whether or not this player is finshed.
-    * @type {BOOL}
-    * @private
-    */
-  BOOL _finished;
+  char index_path[PATH_MAX];
 
   /**
-   * The parameters provided to this player.
-   * @private
+   * Whether or not the decoder restores a file purged under memory pressure,
+   * i.e. whether the view should not notify its delegate.
+   * @type {int}
    */
-  struct {
-    /**
-     * The interval period for decoding an HEVC-with-Alpha stream and rendering
-     * its output frames to this view repeatedly.
-     * @type {NSTimeInterval}
-     */
-    NSTimeInterval interval;
-
-    /**
-     * Whether or not this player loops playing the QuickTime stream.
-     * @type {NSInteger}
-     */
-    BOOL loop;
-  } _parameters;
-}
-
-#if TARGET_OS_IPHONE
-+ (Class) layerClass {
-  return [CAMetalLayer class];
-}
-#endif
+  int restored;
+};
 
-- (id)initWithCoder:(NSCoder *)coder {
-  self = [super initWithCoder:coder];
-  if (self) {
-    id<MTLDevice> device = MTLCreateSystemDefaultDevice();
-    [self initViewWithDevice:device];
+/**
+ * Deletes the specified decoder created by a load request.
+ * @param {HEVCPreparedDecoder*} decoder
+ */
+static void HEVCDestroyDecoder(HEVCPreparedDecoder *decoder) {
+  decoder->decoder.Destroy();
+  if (decoder->asset_id) {
+    hevc::AssetCache::Release(decoder->asset_id);
   }
-  return self;
+  free(decoder);
 }
 
-- (id)initWithFrame:(CGRect)frame device:(id<MTLDevice>)device {
-  self = [super initWithFrame:frame];
-  if (self) {
-    [self initViewWithDevice:device];
+/**
+ * Returns the path to the sample index of the specified QuickTime file. This
+ * function puts sample indices in the cache directory of the application
+ * because the directories of bundled files are read-only. (A sample index has
+ * the size and the modification time of its file, i.e. a player does not use
+ * stale indices even when two files have the same hash.)
+ * @param {NSString*} path
+ * @return {NSString*}
+ */
+static NSString *HEVCSampleIndexPath(NSString *path) {
+  NSString *directory = [NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES) firstObject];
+  if (!directory) {
+    return nil;
   }
-  return self;
-}
-
-- (void)dealloc {
-  // TODO(hbono): Should this method wait for the background thread to finish
-  // and delete its `pthread_mutex_t` object?
-  [_displayLink invalidate];
-  _pictures.Destroy();
-  _decoder.Destroy();
-  [[NSNotificationCenter defaultCenter] removeObserver:self];
+  const char *name = [path fileSystemRepresentation];
+  const uint64_t hash = hevc::SampleIndex::Hash(hevc::SampleIndex::HASH_BASIS, name, strlen(name));
+  return [directory stringByAppendingPathComponent:[NSString stringWithFormat:@"HEVCSampleIndex/%016llx.idx", (unsigned long long)hash]];
 }
 
-- (void)playFileFromURL:(NSURL *)url fps:(NSInteger)fps loop:(BOOL)loop {
-  if (![NSThread isMainThread]) {
-    dispatch_async(dispatch_get_main_queue(), ^{
-      [self playFileFromURL:url fps:fps loop:loop];
-    });
-    return;
-  }
-  // Calculate the play interval in seconds. (It truncates the interval to
-  // milliseconds, e.g. 33.3 ms (0.0333 s) => 33 ms (0.0330 s))
-  _parameters.interval = floor(1000.0 / (CFTimeInterval)fps) / 1000.0;
-  _parameters.loop = loop;
-  _finished = NO;
-  NSString *path = [url path];
-  if ([_path isEqualToString:path]) {
-    // Notify the decoder thread to reset its positions when it becomes idle.
-    _rewind = YES;
-    _displayLink.paused = NO;
+/**
+ * Writes the specified sample index to the specified path. This function
+ * writes the index to a temporary file and renames it so players do not read
+ * incomplete indices.
+ * @param {const hevc::SampleIndex*} index
+ * @param {NSString*} path
+ */
+static void HEVCWriteSampleIndex(const hevc::SampleIndex *index, NSString *path) {
+  NSString *directory = [path stringByDeletingLastPathComponent];
+  [[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:nil];
+  NSString *temporaryPath = [path stringByAppendingFormat:@".%u", arc4random()];
+  int file = open([temporaryPath fileSystemRepresentation], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (file < 0) {
     return;
   }
-  // Load the file asynchronously and play it.
-  _path = path;
-  NSFileHandle *handle = [NSFileHandle fileHandleForReadingAtPath:path];
-  if (!handle) {
-    [self finishWithError:[NSError errorWithDomain:NSCocoaErrorDomain code:NSFileNoSuchFileError userInfo:nil]];
-    return;
+  const int written = index->Write(file);
+  close(file);
+  if (!written || rename([temporaryPath fileSystemRepresentation], [path fileSystemRepresentation])) {
+    unlink([temporaryPath fileSystemRepresentation]);
   }
-  NSNotificationCenter *defaultCenter = [NSNotificationCenter defaultCenter];
-  [defaultCenter addObserver:self selector:@selector(readToEndOfFile:) name:NSFileHandleReadToEndOfFileCompletionNotification object:handle];
-  [handle readToEndOfFileInBackgroundAndNotify];
 }
 
-- (void)finish {
-  _displayLink.paused = YES;
-  _finished = YES;
-  if (self.delegate) {
-    [self.delegate playerView:self didFinish:0];
-  }
-}
+/**
+ * The minimum alpha of a view that can be seen.
+ * @const {CGFloat}
+ */
+static const CGFloat HEVCMinVisibleAlpha = 0.01;
 
-- (void)finishWithError: (NSError *) error {
-  _displayLink.paused = YES;
-  _finished = YES;
-  if (self.delegate) {
-    [self.delegate playerView:self didFail:error];
-  }
+/**
+ * The interval between two visibility checks (in seconds). Views cannot observe
+ * changes of their ancestors (e.g. scrolling), i.e. they check whether or not
+ * they can be seen periodically while they are in windows.
+ * @const {NSTimeInterval}
+ */
+static const NSTimeInterval HEVCVisibilityInterval = 0.25;
+
+/**
+ * The views in windows, which check their visibility periodically. (This table
+ * is accessed only on the main thread and it does not retain views.)
+ * @type {NSHashTable*}
+ */
+static NSHashTable *HEVCVisibilityViews = nil;
+
+/**
+ * The timer that tells the above views to check their visibility. (This timer
+ * is invalidated when there are no views in windows.)
+ * @type {NSTimer*}
+ */
+static NSTimer *HEVCVisibilityTimer = nil;
+
+/**
+ * The maximum number of views playing files at the same time while the quality
+ * tier is `HEVCPlayerQualityTierLimitedPlayers`. (Views that are not playing
+ * files or that cannot be seen are not counted.)
+ * @const {NSUInteger}
+ */
+static const NSUInteger HEVCLimitedPlayers = 4;
+
+/**
+ * The quality tier applied to all views. (The main thread writes this value and
+ * the worker threads read it with atomic operations.)
+ * @type {NSInteger}
+ */
+static NSInteger HEVCQualityTier = 0;
+
+/**
+ * All views, which are notified when the quality tier or the memory-pressure
+ * stage changes. (This table is accessed only on the main thread and it does
+ * not retain views.)
+ * @type {NSHashTable*}
+ */
+static NSHashTable *HEVCQualityViews = nil;
+
+/**
+ * The stages of the memory-pressure response. Each stage also applies the
+ * preceding ones.
+ *  +---------------------------------+-------+-----------------------------------------+
+ *  | name                            | value | description                             |
+ *  +---------------------------------+-------+-----------------------------------------+
+ *  | HEVCMemoryStageNormal           | 0     | no memory pressure                      |
+ *  | HEVCMemoryStageTrimPictures     | 1     | drop decoded frames beyond the current  |
+ *  | HEVCMemoryStageReleaseSessions  | 2     | delete idle decoder sessions            |
+ *  | HEVCMemoryStagePurgeStreams     | 3     | delete the decoders of paused views     |
+ *  | HEVCMemoryStageStopWorkers      | 4     | stop the idle worker threads            |
+ *  +---------------------------------+-------+-----------------------------------------+
+ * @enum {NSInteger}
+ */
+enum {
+  HEVCMemoryStageNormal = 0,
+  HEVCMemoryStageTrimPictures = 1,
+  HEVCMemoryStageReleaseSessions = 2,
+  HEVCMemoryStagePurgeStreams = 3,
+  HEVCMemoryStageStopWorkers = 4,
+};
+
+/**
+ * The memory-pressure stage applied to all views. (The main thread writes this
+ * value and the worker threads read it with atomic operations.)
+ * @type {NSInteger}
+ */
+static NSInteger HEVCMemoryStage = HEVCMemoryStageNormal;
+
+/**
+ * The interval (in seconds) in which another memory warning escalates the
+ * memory-pressure response to its next stage, i.e. a warning received after
+ * this interval means the previous stages have released enough memory.
+ * @const {CFTimeInterval}
+ */
+static const CFTimeInterval HEVCMemoryWarningInterval = 10.0;
+
+/**
+ * The time (in seconds) after which views stop responding to a memory warning
+ * unless the host OS reports memory pressure. (UIKit does not tell when memory
+ * pressure ends.)
+ * @const {int64_t}
+ */
+static const int64_t HEVCMemoryWarningDuration = 30;
+
+/**
+ * The interval (in seconds) in which memory warnings are regarded as the same
+ * one. (The host application receives a UIKit notification and a
+ * memory-pressure event for the same warning.)
+ * @const {CFTimeInterval}
+ */
+static const CFTimeInterval HEVCMemoryWarningTolerance = 1.0;
+
+/**
+ * The interval (in milliseconds) between the attempts to stop the idle worker
+ * threads, and the maximum number of the attempts. (The workers are busy while
+ * they run the tasks scheduled by the views releasing their resources.)
+ * @const {int64_t}
+ */
+static const int64_t HEVCStopWorkersInterval = 100;
+static const int HEVCMaxStopWorkersAttempts = 10;
+
+/**
+ * The host time when the last memory warning was received.
+ * @type {CFTimeInterval}
+ */
+static CFTimeInterval HEVCMemoryWarningTime = 0.0;
+
+/**
+ * The memory-pressure level reported by the host OS last time, i.e. one of
+ * `DISPATCH_MEMORYPRESSURE_NORMAL`, `DISPATCH_MEMORYPRESSURE_WARN`, and
+ * `DISPATCH_MEMORYPRESSURE_CRITICAL`.
+ * @type {unsigned long}
+ */
+static unsigned long HEVCMemoryPressureLevel = DISPATCH_MEMORYPRESSURE_NORMAL;
+
+/**
+ * The dispatch source that receives memory-pressure events of the host OS.
+ * @type {dispatch_source_t}
+ */
+static dispatch_source_t HEVCMemoryPressureSource = nil;
+
+@interface HEVCPlayerView (Visibility)
++ (void)updateVisibilities;
+- (void)updateVisibility;
+- (void)qualityTierDidChange;
+- (void)didReceiveMemoryPressure:(NSInteger)stage;
+@end
+
+/**
+ * Returns the quality tier for the current thermal state and power mode. A
+ * device in Low Power Mode halves the frame rates of the views, a seriously hot
+ * device also decodes files at reduced resolutions, and a critically hot device
+ * also limits the number of views playing files.
+ * @return {HEVCPlayerQualityTier}
+ */
+static HEVCPlayerQualityTier HEVCGetQualityTier(void) {
+  NSProcessInfo *processInfo = [NSProcessInfo processInfo];
+  HEVCPlayerQualityTier tier = HEVCPlayerQualityTierFull;
+  switch (processInfo.thermalState) {
+    case NSProcessInfoThermalStateCritical:
+      tier = HEVCPlayerQualityTierLimitedPlayers;
+      break;
+    case NSProcessInfoThermalStateSerious:
+      tier = HEVCPlayerQualityTierReducedResolution;
+      break;
+    default:
+      break;
+  }
+  if (processInfo.lowPowerModeEnabled && tier < HEVCPlayerQualityTierHalfRate) {
+    tier = HEVCPlayerQualityTierHalfRate;
+  }
+  return tier;
+}
+
+/**
+ * Updates the quality tier and notifies all views when it changes. (This
+ * function is called on the main thread.)
+ */
+static void HEVCUpdateQualityTier(void) {
+  const HEVCPlayerQualityTier tier = HEVCGetQualityTier();
+  if (tier == __atomic_load_n(&HEVCQualityTier, __ATOMIC_RELAXED)) {
+    return;
+  }
+  __atomic_store_n(&HEVCQualityTier, tier, __ATOMIC_RELAXED);
+  [HEVCPlayerView updateVisibilities];
+  for (HEVCPlayerView *view in [HEVCQualityViews allObjects]) {
+    [view qualityTierDidChange];
+  }
+}
+
+/**
+ * Stops the idle worker threads while `HEVCMemoryStage` is the last stage. This
+ * function tries again after `HEVCStopWorkersInterval` while the workers are
+ * busy, e.g. running the tasks that delete the decoders of paused views, up to
+ * the specified number of attempts. (This function is called on the main
+ * thread.)
+ * @param {int} attempts
+ */
+static void HEVCStopIdleWorkers(int attempts) {
+  if (__atomic_load_n(&HEVCMemoryStage, __ATOMIC_RELAXED) < HEVCMemoryStageStopWorkers) {
+    return;
+  }
+  if ([[HEVCPlaybackEngine sharedEngine] stopIdleWorkers] || attempts <= 1) {
+    return;
+  }
+  dispatch_after(dispatch_time(DISPATCH_TIME_NOW, HEVCStopWorkersInterval * NSEC_PER_MSEC), dispatch_get_main_queue(), ^{
+    HEVCStopIdleWorkers(attempts - 1);
+  });
+}
+
+/**
+ * Applies the specified memory-pressure stage to all views. This function
+ * deletes the shared resources released by the stage and tells the views to
+ * release their own resources. (This function is called on the main thread
+ * whenever the host application receives a memory-pressure event, i.e. it
+ * releases the resources allocated since the previous event.)
+ * @param {NSInteger} stage
+ */
+static void HEVCApplyMemoryStage(NSInteger stage) {
+  __atomic_store_n(&HEVCMemoryStage, stage, __ATOMIC_RELAXED);
+  if (stage == HEVCMemoryStageNormal) {
+    return;
+  }
+  hevc::AssetCache::ClearFrames();
+  for (HEVCPlayerView *view in [HEVCQualityViews allObjects]) {
+    [view didReceiveMemoryPressure:stage];
+  }
+  if (stage >= HEVCMemoryStageReleaseSessions) {
+    hevc::SessionPool::Clear();
+  }
+  if (stage >= HEVCMemoryStageStopWorkers) {
+    HEVCStopIdleWorkers(HEVCMaxStopWorkersAttempts);
+  }
+}
+
+/**
+ * Called on the main thread when the host application receives a memory
+ * warning. The first warning trims the picture caches, and each warning
+ * received within `HEVCMemoryWarningInterval` of the previous one escalates
+ * the response to the next stage. Views stop responding to the warnings after
+ * `HEVCMemoryWarningDuration` unless the host OS still reports memory
+ * pressure.
+ */
+static void HEVCHandleMemoryWarning(void) {
+  const CFTimeInterval now = CACurrentMediaTime();
+  NSInteger stage = __atomic_load_n(&HEVCMemoryStage, __ATOMIC_RELAXED);
+  if (stage != HEVCMemoryStageNormal && now - HEVCMemoryWarningTime < HEVCMemoryWarningTolerance) {
+    return;
+  }
+  if (stage != HEVCMemoryStageNormal && now - HEVCMemoryWarningTime < HEVCMemoryWarningInterval) {
+    stage = stage < HEVCMemoryStageStopWorkers ? stage + 1 : stage;
+  } else {
+    stage = stage > HEVCMemoryStageTrimPictures ? stage : HEVCMemoryStageTrimPictures;
+  }
+  HEVCMemoryWarningTime = now;
+  HEVCApplyMemoryStage(stage);
+  dispatch_after(dispatch_time(DISPATCH_TIME_NOW, HEVCMemoryWarningDuration * NSEC_PER_SEC), dispatch_get_main_queue(), ^{
+    if (HEVCMemoryWarningTime == now && HEVCMemoryPressureLevel == DISPATCH_MEMORYPRESSURE_NORMAL) {
+      __atomic_store_n(&HEVCMemoryStage, HEVCMemoryStageNormal, __ATOMIC_RELAXED);
+    }
+  });
+}
+
+/**
+ * Starts observing memory warnings of UIKit and memory-pressure events of the
+ * host OS. A critical memory-pressure event applies all stages at once and a
+ * normal one ends the response, i.e. views decode ahead again.
+ */
+static void HEVCStartMemoryPressureResponder(void) {
+  [[NSNotificationCenter defaultCenter] addObserverForName:UIApplicationDidReceiveMemoryWarningNotification object:nil queue:[NSOperationQueue mainQueue] usingBlock:^(NSNotification *notification) {
+    HEVCHandleMemoryWarning();
+  }];
+  dispatch_source_t source = dispatch_source_create(DISPATCH_SOURCE_TYPE_MEMORYPRESSURE, 0, DISPATCH_MEMORYPRESSURE_NORMAL | DISPATCH_MEMORYPRESSURE_WARN | DISPATCH_MEMORYPRESSURE_CRITICAL, dispatch_get_main_queue());
+  if (!source) {
+    return;
+  }
+  dispatch_source_set_event_handler(source, ^{
+    const unsigned long level = dispatch_source_get_data(source);
+    if (level & DISPATCH_MEMORYPRESSURE_CRITICAL) {
+      HEVCMemoryPressureLevel = DISPATCH_MEMORYPRESSURE_CRITICAL;
+      HEVCMemoryWarningTime = CACurrentMediaTime();
+      HEVCApplyMemoryStage(HEVCMemoryStageStopWorkers);
+    } else if (level & DISPATCH_MEMORYPRESSURE_WARN) {
+      HEVCMemoryPressureLevel = DISPATCH_MEMORYPRESSURE_WARN;
+      HEVCHandleMemoryWarning();
+    } else {
+      HEVCMemoryPressureLevel = DISPATCH_MEMORYPRESSURE_NORMAL;
+      HEVCMemoryWarningTime = 0.0;
+      HEVCApplyMemoryStage(HEVCMemoryStageNormal);
+    }
+  });
+  dispatch_resume(source);
+  HEVCMemoryPressureSource = source;
+}
+
+/**
+ * Adds the specified view to the views notified when the quality tier changes.
+ * This function starts observing the thermal state, the power mode, and memory
+ * pressure when it adds the first view.
+ * @param {HEVCPlayerView*} view
+ */
+static void HEVCAddQualityView(HEVCPlayerView *view) {
+  if (!HEVCQualityViews) {
+    HEVCStartMemoryPressureResponder();
+    HEVCQualityViews = [NSHashTable weakObjectsHashTable];
+    // Process-information notifications are posted on arbitrary threads.
+    void (^block)(NSNotification *) = ^(NSNotification *notification) {
+      HEVCUpdateQualityTier();
+    };
+    NSNotificationCenter *defaultCenter = [NSNotificationCenter defaultCenter];
+    NSOperationQueue *mainQueue = [NSOperationQueue mainQueue];
+    [defaultCenter addObserverForName:NSProcessInfoThermalStateDidChangeNotification object:nil queue:mainQueue usingBlock:block];
+    [defaultCenter addObserverForName:NSProcessInfoPowerStateDidChangeNotification object:nil queue:mainQueue usingBlock:block];
+    __atomic_store_n(&HEVCQualityTier, HEVCGetQualityTier(), __ATOMIC_RELAXED);
+  }
+  [HEVCQualityViews addObject:view];
+}
+
+/**
+ * Adds the specified view to the views that check their visibility and starts
+ * the timer shared by them.
+ * @param {HEVCPlayerView*} view
+ */
+static void HEVCAddVisibilityView(HEVCPlayerView *view) {
+  if (!HEVCVisibilityViews) {
+    HEVCVisibilityViews = [NSHashTable weakObjectsHashTable];
+  }
+  [HEVCVisibilityViews addObject:view];
+  if (HEVCVisibilityTimer) {
+    return;
+  }
+  HEVCVisibilityTimer = [NSTimer scheduledTimerWithTimeInterval:HEVCVisibilityInterval repeats:YES block:^(NSTimer *timer) {
+    // Stop the timer when there are no views in windows.
+    [HEVCPlayerView updateVisibilities];
+    if (HEVCVisibilityViews.count == 0) {
+      [timer invalidate];
+      HEVCVisibilityTimer = nil;
+    }
+  }];
+  HEVCVisibilityTimer.tolerance = HEVCVisibilityInterval * 0.5;
+}
+
+/**
+ * The output mode of a view composited by an `HEVCCompositorView` object.
+ * @const {uint32_t}
+ */
+static const uint32_t HEVCOutputCompositor = 1;
+
+/**
+ * The output mode of a view that provides its frames to the application.
+ * @const {uint32_t}
+ */
+static const uint32_t HEVCOutputProvider = 2;
+
+/**
+ * The image of a frame published by a view instead of being drawn to its
+ * `CAMetalLayer` object.
+ */
+struct HEVCPublishedFrame {
+  /**
+   * The retained image. (NULL means the view has not published images.)
+   * @type {CVImageBufferRef}
+   */
+  CVImageBufferRef image;
+
+  /**
+   * The host time when the view presented the image.
+   * @type {CFTimeInterval}
+   */
+  CFTimeInterval hostTime;
+
+  /**
+   * The index of the frame in the file.
+   * @type {NSInteger}
+   */
+  NSInteger frameIndex;
+};
+
+/**
+ * The maximum ratio of the frame size of a file to the size of the images
+ * decoded from it. (A view decodes a file at 1/1, 1/2, or 1/4 of its frame
+ * size.)
+ * @const {int}
+ */
+static const int HEVCMaxOutputDivisor = 4;
+
+/**
+ * The margin required for decreasing the size of decoded images. A view decodes
+ * a file at a smaller size only when the size covers the view by this ratio,
+ * and it increases the size as soon as the images do not cover the view. (This
+ * hysteresis prevents a view being resized from re-creating decoder sessions
+ * on every GOP.)
+ * @const {double}
+ */
+static const double HEVCOutputSizeMargin = 1.25;
+
+/**
+ * The class that encapsulates a request for loading a QuickTime file in the
+ * background. A player cancels its request when it starts loading another file
+ * or when it is deleted, and the background task stops loading the file when
+ * it finds its request cancelled.
+ */
+@interface HEVCLoadRequest: NSObject {
+ @public
+  /**
+   * Whether or not this request has been cancelled. (This flag is accessed
+   * with atomic operations.)
+   * @type {uint32_t}
+   */
+  uint32_t cancelled;
+
+  /**
+   * Whether or not this request restores a file purged under memory pressure.
+   * (This flag is accessed only on the main thread.)
+   * @type {BOOL}
+   */
+  BOOL restoring;
+}
+@end
+
+@implementation HEVCLoadRequest
+@end
+
+@interface HEVCPlayerStatistics ()
+@property (readwrite, nonatomic) CFTimeInterval timeToFirstFrame;
+@property (readwrite, nonatomic) CFTimeInterval decodeLatency50;
+@property (readwrite, nonatomic) CFTimeInterval decodeLatency90;
+@property (readwrite, nonatomic) CFTimeInterval decodeLatency99;
+@property (readwrite, nonatomic) CFTimeInterval maxDecodeLatency;
+@property (readwrite, nonatomic) NSUInteger numberOfDecodedFrames;
+@property (readwrite, nonatomic) NSUInteger numberOfDroppedFrames;
+@property (readwrite, nonatomic) NSUInteger numberOfDuplicatedFrames;
+@property (readwrite, nonatomic) NSUInteger pictureCacheOccupancy;
+@property (readwrite, nonatomic) NSUInteger numberOfDecoderResets;
+@end
+
+@implementation HEVCPlayerStatistics
+@end
+
+@interface HEVCPlayerFrame ()
+
+/**
+ * Initializes this frame with the specified image. This frame retains the
+ * image and wraps its planes with textures created by the specified cache.
+ * @param {CVPixelBufferRef} pixelBuffer
+ * @param {CVMetalTextureCacheRef} textureCache
+ * @param {CFTimeInterval} hostTime
+ * @param {NSInteger} frameIndex
+ * @return {HEVCPlayerFrame*}
+ */
+- (id)initWithPixelBuffer:(CVPixelBufferRef)pixelBuffer textureCache:(CVMetalTextureCacheRef)textureCache hostTime:(CFTimeInterval)hostTime frameIndex:(NSInteger)frameIndex;
+
+@end
+
+@implementation HEVCPlayerFrame {
+  /**
+   * The textures of the Y, UV, and alpha planes of the image, which keep the
+   * above Metal textures valid.
+   * @type {CVMetalTextureRef[3]}
+   * @private
+   */
+  CVMetalTextureRef _textures[3];
+}
+
+- (id)initWithPixelBuffer:(CVPixelBufferRef)pixelBuffer textureCache:(CVMetalTextureCacheRef)textureCache hostTime:(CFTimeInterval)hostTime frameIndex:(NSInteger)frameIndex {
+  self = [super init];
+  if (self) {
+    CFRetain(pixelBuffer);
+    _pixelBuffer = pixelBuffer;
+    _hostTime = hostTime;
+    _frameIndex = frameIndex;
+
+    // Wrap the planes of the image with Metal textures without copying them.
+    // (The textures are nil when the texture cache cannot wrap them.)
+    const size_t width = CVPixelBufferGetWidth(pixelBuffer);
+    const size_t height = CVPixelBufferGetHeight(pixelBuffer);
+    const MTLPixelFormat formats[3] = {MTLPixelFormatR8Unorm, MTLPixelFormatRG8Unorm, MTLPixelFormatR8Unorm};
+    const size_t divisors[3] = {1, 2, 1};
+    for (size_t i = 0; i < 3; ++i) {
+      _textures[i] = NULL;
+      if (textureCache) {
+        CVMetalTextureCacheCreateTextureFromImage(kCFAllocatorDefault, textureCache, pixelBuffer, nil, formats[i], width / divisors[i], height / divisors[i], i, &_textures[i]);
+      }
+    }
+    _textureY = _textures[0] ? CVMetalTextureGetTexture(_textures[0]) : nil;
+    _textureUV = _textures[1] ? CVMetalTextureGetTexture(_textures[1]) : nil;
+    _textureA = _textures[2] ? CVMetalTextureGetTexture(_textures[2]) : nil;
+  }
+  return self;
+}
+
+- (void)dealloc {
+  for (size_t i = 0; i < 3; ++i) {
+    if (_textures[i]) {
+      CFRelease(_textures[i]);
+    }
+  }
+  CFRelease(_pixelBuffer);
+}
+
+@end
+
+@interface HEVCPlayerView () <HEVCPlaybackEngineClient>
+@end
+
+@implementation HEVCPlayerView {
+  /**
+   * The Metal layer to which this view draws decoded frames.
+   * @type {CAMetalLayer*}
+   * @private
+   */
+  CAMetalLayer *_metalLayer;
+
+  /**
+   * The command queue for drawing an HEVC-with-Alpha stream to this view. (All
+   * views of a device share one command queue.)
+   * @type {id<MTLCommandQueue>}
+   * @private
+   */
+  id<MTLCommandQueue> _commandQueue;
+
+  /**
+   * The cache of the render pipelines shared by all views of a device.
+   * @type {HEVCRenderPipelineCache*}
+   * @private
+   */
+  HEVCRenderPipelineCache *_pipelineCache;
+
+  /**
+   * The render state that encapsulates the shader programs specialized for the
+   * image rendered last time. (This view asks the pipeline cache for another
+   * state only when the color properties of its images change.)
+   * @type {id<MTLRenderPipelineState>}
+   * @private
+   */
+  id<MTLRenderPipelineState> _renderPipelineState;
+
+  /**
+   * The options of the above render state.
+   * @type {HEVCRenderPipelineOptions}
+   * @private
+   */
+  HEVCRenderPipelineOptions _renderPipelineOptions;
+
+  /**
+   * Whether the HEVC stream of the decoder has premultiplied alpha. (The worker
+   * thread writes this value when it installs a decoder and compositors read it
+   * with atomic operations.)
+   * @type {int}
+   * @private
+   */
+  int _premultipliedAlpha;
+
+  /**
+   * The texture cache that generates textures (from an HEVC-with-Alpha stream)
+   * used by this view.
+   * @type {CVMetalTextureCacheRef}
+   * @private
+   */
+  CVMetalTextureCacheRef _textureCache;
+
+  /**
+   * The render-pass descriptor that writes textures (generated by the above
+   * texture cache) to this view.
+   * @type {MTLRenderPassDescriptor}
+   * @private
+   */
+  MTLRenderPassDescriptor *_renderPassDescriptor;
+
+  /**
+   * The semaphore that bounds the number of drawables being rendered or
+   * presented. This view skips a display frame instead of waiting for a
+   * drawable when it has no free drawables, i.e. the worker thread does not
+   * block in `[CAMetalLayer nextDrawable]` and keeps decoding samples.
+   * @type {dispatch_semaphore_t}
+   * @private
+   */
+  dispatch_semaphore_t _drawableSemaphore;
+
+  /**
+   * The size of the `CAMetalLayer` object of this view in pixels, i.e. its
+   * bounds multiplied by its scale factor. The upper 32 bits are its width and
+   * the lower 32 bits are its height. (The main thread writes this value when
+   * it lays out this view and the worker thread reads it with atomic
+   * operations. 0 means this view has not been laid out.)
+   * @type {uint64_t}
+   * @private
+   */
+  uint64_t _layerSize;
+
+  /**
+   * The size of the drawables of the `CAMetalLayer` object. (This view changes
+   * the size only when the size of the layer or the decoded images changes to
+   * avoid re-allocating the drawables.)
+   * @type {CGSize}
+   * @private
+   */
+  CGSize _drawableSize;
+
+  /**
+   * The parameters of the fragment shader for shrinking the decoded images to
+   * the above drawable size.
+   * @type {HEVCPlayerFilter}
+   * @private
+   */
+  HEVCPlayerFilter _filter;
+
+  /**
+   * The consumers of the images presented by this view instead of its
+   * `CAMetalLayer` object, i.e. a bitwise OR of `HEVCOutputCompositor` and
+   * `HEVCOutputProvider`. (This value is accessed with atomic operations.)
+   * @type {uint32_t}
+   * @private
+   */
+  uint32_t _outputModes;
+
+  /**
+   * The images presented by this view while it has output modes. The first
+   * one is the latest one and the second one is the previous one, i.e. this
+   * view can return the image presented at a host time slightly before the
+   * latest display frame.
+   * @type {HEVCPublishedFrame[2]}
+   * @private
+   */
+  HEVCPublishedFrame _publishedFrames[2];
+
+  /**
+   * The mutex that allows only one thread to access the above images.
+   * @type {pthread_mutex_t}
+   * @private
+   */
+  pthread_mutex_t _publishedMutex;
+
+  /**
+   * The HEVC-with-Alpha decoder.
+   * @type {hevc::Decoder}
+   * @private
+   */
+  hevc::Decoder _decoder;
+
+  /**
+   * The fixed interval period for rendering output frames of an HEVC-with-Alpha
+   * stream to this view. (0 means this view renders the frames at their
+   * presentation timestamps.)
+   * @type {CFTimeInternal}
+   * @private
+   */
+  CFTimeInterval _timeInterval;
+
+  /**
+   * The display time when this view presents the beginning of the stream, i.e.
+   * this view presents a frame at this time plus its presentation timestamp.
+   * (A negative value means this view presents the next frame immediately.)
+   * @type {CFTimeInternal}
+   * @private
+   */
+  CFTimeInterval _baseTimestamp;
+
+  /**
+   * The path to the HEVC-with-Alpha stream being decoded.
+   * @type {NSString*}
+   * @private
+   */
+  NSString *_path;
+
+  /**
+   * The request for loading the file being loaded in the background. (This
+   * value is nil when this view is not loading files.)
+   * @type {HEVCLoadRequest*}
+   * @private
+   */
+  HEVCLoadRequest *_loadRequest;
+
+  /**
+   * The decoder prepared by a load request, which the worker thread installs
+   * when it plays this view next time. (This value is accessed with atomic
+   * operations.)
+   * @type {HEVCPreparedDecoder*}
+   * @private
+   */
+  HEVCPreparedDecoder *_pendingDecoder;
+
+  /**
+   * The ID of the file being played in the asset cache. (This value is 0 when
+   * this view does not share the file with other players.)
+   * @type {uint32_t}
+   * @private
+   */
+  uint32_t _assetID;
+
+  /**
+   * The position of the last sample the decoder has consumed, i.e. decoded or
+   * skipped as a sample no other samples refer to. The decoder is behind the
+   * current position when this view has copied images from the asset cache
+   * instead of decoding their samples. (This value is the position preceding
+   * the first sample to be decoded after this view starts decoding from a sync
+   * sample.)
+   * @type {int}
+   * @private
+   */
+  int _decodedSample;
+
+  /**
+   * The position of the sample at which this view started decoding the samples
+   * it has skipped again. This view decodes the samples before this position
+   * without copying their images from the asset cache.
+   * @type {int}
+   * @private
+   */
+  int _catchUpSample;
+
+  /**
+   * The position of the sync sample from which this view started decoding
+   * without the samples preceding it, e.g. after seeking a frame. This view
+   * skips the RASL (random access skipped leading) samples following this
+   * sync sample until the next one because their reference pictures have not
+   * been decoded, i.e. it decodes them as the HEVC specification does when
+   * `NoRaslOutputFlag` is 1. (This value is -1 after this view reaches the
+   * next sync sample.)
+   * @type {int}
+   * @private
+   */
+  int _randomAccessSample;
+
+  /**
+   * The smoothed latency of Video Toolbox in nanoseconds, i.e. the exponential
+   * moving average of the times between submitting samples and receiving their
+   * images. (The output handler writes this value and the worker thread reads
+   * it with atomic operations. 0 means no measurements.)
+   * @type {int64_t}
+   * @private
+   */
+  int64_t _decodeLatency;
+
+  /**
+   * The smoothed mean deviation of the above latency in nanoseconds.
+   * @type {int64_t}
+   * @private
+   */
+  int64_t _decodeDeviation;
+
+  /**
+   * The number of samples submitted to Video Toolbox whose output handlers have
+   * not been called. (This value is accessed with atomic operations.)
+   * @type {int32_t}
+   * @private
+   */
+  int32_t _decodingSamples;
+
+  /**
+   * Whether or not this view has stopped decoding ahead because too many
+   * samples are being decoded. The output handler schedules this view when it
+   * clears this value so this view decodes the next samples without waiting
+   * for the next display-link event. (This value is accessed with atomic
+   * operations.)
+   * @type {BOOL}
+   * @private
+   */
+  BOOL _throttled;
+
+  /**
+   * The frame before which this view drops discardable frames instead of
+   * decoding them, i.e. the end of the window of frames that Video Toolbox
+   * cannot decode in time. (This view drops frames after a frame is not decoded
+   * when it is due or when the estimated latency exceeds its picture cache.)
+   * @type {int}
+   * @private
+   */
+  int _dropFrame;
+
+  /**
+   * The number of frames this view has dropped without decoding them.
+   * @type {NSUInteger}
+   * @private
+   */
+  NSUInteger _numberOfDroppedFrames;
+
+  /**
+   * The histogram of the decoding latencies of Video Toolbox, followed by its
+   * overflow bin. (The output handler increments its bins with atomic
+   * operations.)
+   * @type {uint32_t[]}
+   * @private
+   */
+  uint32_t _latencyHistogram[HEVCLatencyBins + 1];
+
+  /**
+   * The maximum of the decoding latencies counted by the above histogram in
+   * nanoseconds. (The output handler writes this value with atomic operations.)
+   * @type {int64_t}
+   * @private
+   */
+  int64_t _maxDecodeLatency;
+
+  /**
+   * The number of frames decoded by Video Toolbox.
+   * @type {NSUInteger}
+   * @private
+   */
+  NSUInteger _numberOfDecodedFrames;
+
+  /**
+   * The number of display frames at which this view has not presented a due
+   * frame.
+   * @type {NSUInteger}
+   * @private
+   */
+  NSUInteger _numberOfDuplicatedFrames;
+
+  /**
+   * The number of times this view has reset its decoder.
+   * @type {NSUInteger}
+   * @private
+   */
+  NSUInteger _numberOfDecoderResets;
+
+  /**
+   * The number of bytes used by the decoded images in the picture cache, which
+   * the worker thread updates whenever it plays this view.
+   * @type {uint64_t}
+   * @private
+   */
+  uint64_t _pictureCacheOccupancy;
+
+  /**
+   * The time when the application requested playing the file being played.
+   * The worker thread clears this value when it presents the first frame of
+   * the file. (This value is accessed with atomic operations.)
+   * @type {CFTimeInterval}
+   * @private
+   */
+  CFTimeInterval _playTime;
+
+  /**
+   * The time between the above request and the first frame. (This value is
+   * accessed with atomic operations.)
+   * @type {CFTimeInterval}
+   * @private
+   */
+  CFTimeInterval _timeToFirstFrame;
+
+  /**
+   * The ratio of the frame size of the file being played to the size of the
+   * images decoded from it, i.e. 1, 2, or 4. (0 means Video Toolbox cannot
+   * decode the file at a reduced size and this view decodes it at its frame
+   * size.)
+   * @type {int}
+   * @private
+   */
+  int _outputDivisor;
+
+  /**
+   * Whether or not this view should create the sample index of the file being
+   * played.
+   * @type {BOOL}
+   * @private
+   */
+  BOOL _needsSampleIndex;
+
+  /**
+   * The path to the sample index of the file being played. The worker thread
+   * writes the index when it has read the whole file and clears this value.
+   * (This value is nil when this view has read the index of the file.)
+   * @type {NSString*}
+   * @private
+   */
+  NSString *_indexPath;
+
+  /**
+   * The size of the file being played.
+   * @type {uint64_t}
+   * @private
+   */
+  uint64_t _fileSize;
+
+  /**
+   * The modification time of the file being played.
+   * @type {int64_t}
+   * @private
+   */
+  int64_t _modifiedTime;
+
+  /**
+   * The time requested by `seekToTime:`.
+   * @type {NSTimeInterval}
+   * @private
+   */
+  NSTimeInterval _seekTime;
+
+  /**
+   * The array of decoded pictures.
+   * @type {HEVCPictureArray}
+   * @private
+   */
+  HEVCPictureArray _pictures;
+
+  /**
+   * The sample number being decoded by the HEVC-with-Alpha decoder. (This
+   * number is counted from the beginning of the first loop while this view
+   * loops playing the stream, i.e. the sample index is this number modulo the
+   * number of samples.)
+   * @type {int}
+   * @private
+   */
+  int _sample;
+
+  /**
+   * The frame number to be rendered by this view. (This view caches decoded
+   * samples, i.e. a frame number is not always equal to a sample number. This
+   * number is also counted from the beginning of the first loop so the picture
+   * cache can keep the frames of the next loop decoded in advance.)
+   * @type {int}
+   * @private
+   */
+  int _frame;
+
+  /**
+   * The number of times this view has looped the stream being played since it
+   * started playing it.
+   * @type {NSUInteger}
+   * @private
+   */
+  NSUInteger _numberOfLoops;
+
+  /**
+   * The number of times this view has not decoded the first frame of a loop
+   * when the frame is due.
+   * @type {NSUInteger}
+   * @private
+   */
+  NSUInteger _numberOfLoopStalls;
+
+  /**
+   * The last frame that was not decoded when it was due. (This view uses this
+   * value for counting each stall only once.)
+   * @type {int}
+   * @private
+   */
+  int _stalledFrame;
+
+  /**
+   * The frame number requested by `seekToFrame:`. (-1 means no requests. This
+   * value is accessed with atomic operations.)
+   * @type {int}
+   * @private
+   */
+  int _seekFrame;
+
+  /**
+   * The number of bytes reserved by the picture cache of this view from the
+   * budget shared by all players.
+   * @type {uint64_t}
+   * @private
+   */
+  uint64_t _pictureCacheSize;
+
+  /**
+   * Whether or not this player loops playing the QuickTime stream.
+   * @type {BOOL}
+   * @private
+   */
+  BOOL _loop;
+
+  /**
+   * Whether or not this player should rewind its positions on idle. (This
+   * variable is used for playing the QuickTime stream being played at its
+   * beginning.)
+   * @type {BOOL}
+   * @private
+   */
+  BOOL _rewind;
+
+  /**
+   * Whether or not this player should reset its HEVC-with-Alpha decoder. (This
+   * variable is used for deleting an invalidated decoder and re-creating a new
+   * one.)
+   * @type {BOOL}
+   * @private
+   */
+  BOOL _reset;
+
+  /**
+   * Whether or not this player is being inactive.
+   * @type {BOOL}
+   * @private
+   */
+  BOOL _suspend;
+
+  /**
+   * Whether or not this player should resume playing when the host application
+   * becomes active.
+   * @type {BOOL}
+   * @private
+   */
+  BOOL _resume;
+
+  /**
+   * Whether or not this view has deleted (or is deleting) its decoder and the
+   * stream data of its file under memory pressure. This view loads the file
+   * again and seeks to the position where it deleted the decoder when it
+   * starts playing the file. (This variable is accessed only on the main
+   * thread.)
+   * @type {BOOL}
+   * @private
+   */
+  BOOL _purged;
+
+  /**
+   * Whether or not the worker thread should delete the decoder of this view.
+   * (This flag is accessed with atomic operations.)
+   * @type {BOOL}
+   * @private
+   */
+  BOOL _purgeRequested;
+
+  /**
+   * Whether or not the worker thread should delete the decoded images of this
+   * view while it is not playing its file. (This flag is accessed with atomic
+   * operations.)
+   * @type {BOOL}
+   * @private
+   */
+  BOOL _trimRequested;
+
+  /**
+   * Whether or not this player stops receiving display-link events from the
+   * playback engine.
+   * @type {BOOL}
+   * @private
+   */
+  BOOL _paused;
+
+  /**
+   * Whether or not this view cannot be seen, e.g. when it is not in a window,
+   * it is hidden, it is transparent, or it is outside of the visible area of
+   * its window. This view stops receiving display-link events and deletes its
+   * decoded images while it cannot be seen. (The main thread writes this
+   * value and the worker thread reads it.)
+   * @type {BOOL}
+   * @private
+   */
+  BOOL _invisible;
+
+  /**
+   * Whether or not this view stops playing its file because other views are
+   * playing the maximum number of files allowed by the quality tier. (This
+   * view is suspended as a view that cannot be seen is. Only the main thread
+   * accesses this value.)
+   * @type {BOOL}
+   * @private
+   */
+  BOOL _parked;
+
+  /**
+   * The area of this view that can be seen, which the main thread uses for
+   * choosing the views parked by the quality tier.
+   * @type {CGFloat}
+   * @private
+   */
+  CGFloat _visibleArea;
+
+  /**
+   * Whether or not the quality tier has changed since the worker thread applied
+   * it. (This value is accessed with atomic operations.)
+   * @type {BOOL}
+   * @private
+   */
+  BOOL _qualityChanged;
+    
+  /**
+    * Whether or not this player is finshed.
+    * @type {BOOL}
+    * @private
+    */
+  BOOL _finished;
+
+  /**
+   * The parameters provided to this player.
+   * @private
+   */
+  struct {
+    /**
+     * The fixed interval period for rendering output frames of an
+     * HEVC-with-Alpha stream to this view. (0 means this view uses the
+     * presentation timestamps of the stream.)
+     * @type {NSTimeInterval}
+     */
+    NSTimeInterval interval;
+
+    /**
+     * Whether or not this player loops playing the QuickTime stream.
+     * @type {NSInteger}
+     */
+    BOOL loop;
+
+    /**
+     * Whether or not this player starts playing the QuickTime stream when it
+     * finishes loading it. (This value is NO when this player preloads it.)
+     * @type {BOOL}
+     */
+    BOOL play;
+
+    /**
+     * The number of frames decoded in advance when this player preloads the
+     * QuickTime stream.
+     * @type {NSInteger}
+     */
+    NSInteger frames;
+  } _parameters;
+}
+
+#if TARGET_OS_IPHONE
++ (Class) layerClass {
+  return [CAMetalLayer class];
+}
+#endif
+
+- (void)layoutSubviews {
+  [super layoutSubviews];
+  [self updateLayerSize];
+}
+
+- (void)didMoveToWindow {
+  [super didMoveToWindow];
+  [self updateLayerSize];
+  if (self.window) {
+    HEVCAddVisibilityView(self);
+  }
+  [self updateVisibility];
+}
+
+- (void)setHidden:(BOOL)hidden {
+  [super setHidden:hidden];
+  [self updateVisibility];
+}
+
+- (void)setAlpha:(CGFloat)alpha {
+  [super setAlpha:alpha];
+  [self updateVisibility];
+}
+
+- (id)initWithCoder:(NSCoder *)coder {
+  self = [super initWithCoder:coder];
+  if (self) {
+    id<MTLDevice> device = MTLCreateSystemDefaultDevice();
+    [self initViewWithDevice:device];
+  }
+  return self;
+}
+
+- (id)initWithFrame:(CGRect)frame device:(id<MTLDevice>)device {
+  self = [super initWithFrame:frame];
+  if (self) {
+    [self initViewWithDevice:device];
+  }
+  return self;
+}
+
+- (void)dealloc {
+  // Remove this view from the playback engine. (The engine does not retain this
+  // view and this view is not being played by a worker thread.)
+  [[HEVCPlaybackEngine sharedEngine] removeClient:self wait:NO];
+  [self cancelLoading];
+  HEVCPreparedDecoder *pendingDecoder = __atomic_exchange_n(&_pendingDecoder, (HEVCPreparedDecoder *)NULL, __ATOMIC_ACQUIRE);
+  if (pendingDecoder) {
+    HEVCDestroyDecoder(pendingDecoder);
+  }
+  _decoder.Destroy();
+  if (_assetID) {
+    hevc::AssetCache::Release(_assetID);
+  }
+  _pictures.Destroy();
+  __atomic_fetch_sub(&HEVCPictureCacheUsage, _pictureCacheSize, __ATOMIC_RELAXED);
+  for (int i = 0; i < 2; ++i) {
+    if (_publishedFrames[i].image) {
+      CFRelease(_publishedFrames[i].image);
+    }
+  }
+  pthread_mutex_destroy(&_publishedMutex);
+  [[NSNotificationCenter defaultCenter] removeObserver:self];
+}
+
+- (void)playFileFromURL:(NSURL *)url fps:(NSInteger)fps loop:(BOOL)loop {
+  if (![NSThread isMainThread]) {
+    dispatch_async(dispatch_get_main_queue(), ^{
+      [self playFileFromURL:url fps:fps loop:loop];
+    });
+    return;
+  }
+  // Calculate the play interval in seconds when the caller overrides the frame
+  // rate of the stream.
+  _parameters.interval = fps > 0 ? 1.0 / (CFTimeInterval)fps : 0.0;
+  _parameters.loop = loop;
+  _parameters.play = YES;
+  _finished = NO;
+  const CFTimeInterval playTime = CACurrentMediaTime();
+  __atomic_store(&_playTime, &playTime, __ATOMIC_RELAXED);
+  NSString *path = [url path];
+  if ([_path isEqualToString:path]) {
+    // Play the file with the new parameters when this view is still loading
+    // it. Otherwise, notify the worker thread to reset the positions of this
+    // view when it plays this view next time. (The worker thread keeps the
+    // decoded images when this view has not rendered any frames of the file,
+    // e.g. when it has preloaded the file.)
+    if (_loadRequest) {
+      return;
+    }
+    __atomic_store_n(&_seekFrame, -1, __ATOMIC_RELAXED);
+    _rewind = YES;
+    [self setPaused:NO];
+    return;
+  }
+  [self loadFileAtPath:path];
+}
+
+- (void)preloadFileFromURL:(NSURL *)url frames:(NSInteger)frames {
+  if (![NSThread isMainThread]) {
+    dispatch_async(dispatch_get_main_queue(), ^{
+      [self preloadFileFromURL:url frames:frames];
+    });
+    return;
+  }
+  // Load the file without playing it unless this view has loaded it or it is
+  // loading it.
+  NSString *path = [url path];
+  if ([_path isEqualToString:path] && !_purged) {
+    return;
+  }
+  _parameters.play = NO;
+  _parameters.frames = frames > 0 ? frames : 0;
+  _finished = NO;
+  [self loadFileAtPath:path];
+}
+
+/**
+ * Starts loading the specified QuickTime file in the background.
+ * @param {NSString*} path
+ */
+- (void)loadFileAtPath:(NSString *)path {
+  // Open the file as a progressive stream and create a decoder for it in the
+  // background, i.e. this view reads only the `moov` atom and the first GOP
+  // of the file, parses its sample table, and creates a decoder session before
+  // it starts playing the file, and it reads the rest of the file while playing
+  // it. The main thread only hands the prepared decoder to the worker thread,
+  // which swaps it in. (The background task stops loading the file when this
+  // view cancels the request.)
+  [self cancelLoading];
+  _path = path;
+  _purged = NO;
+  __atomic_store_n(&_purgeRequested, NO, __ATOMIC_RELAXED);
+  HEVCLoadRequest *request = [[HEVCLoadRequest alloc] init];
+  request->cancelled = 0;
+  request->restoring = NO;
+  _loadRequest = request;
+  __weak typeof(self) weakView = self;
+  dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+    const uint64_t signpostID = Trace::GenerateID();
+    HEVC_TRACE_BEGIN("LoadFile", signpostID);
+    NSError *error = nil;
+    HEVCPreparedDecoder *decoder = NULL;
+    // Open the file through the asset cache so this view shares its stream
+    // data and its sample index with the other players of the file.
+    mov::Stream stream;
+    stream.Initialize();
+    hevc::SampleIndex index;
+    index.Initialize();
+    hevc::AssetCache::Asset asset;
+    const int openError = hevc::AssetCache::Open([path fileSystemRepresentation], &stream, &index, &asset);
+    if (openError) {
+      error = [NSError errorWithDomain:NSCocoaErrorDomain code:openError == ENOENT ? NSFileNoSuchFileError : NSFileReadUnknownError userInfo:nil];
+    } else if (__atomic_load_n(&request->cancelled, __ATOMIC_RELAXED)) {
+      if (asset.id) {
+        hevc::AssetCache::Release(asset.id);
+      }
+    } else {
+      decoder = (HEVCPreparedDecoder *)malloc(sizeof(HEVCPreparedDecoder));
+      if (!decoder) {
+        if (asset.id) {
+          hevc::AssetCache::Release(asset.id);
+        }
+        error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
+      } else {
+        // Read the sample index of the file, if the asset cache does not have
+        // it, so the decoder does not read the slice headers of all samples.
+        decoder->file_size = asset.file_size;
+        decoder->modified_time = asset.modified_time;
+        decoder->asset_id = asset.id;
+        decoder->index_path[0] = '\0';
+        NSString *indexPath = HEVCSampleIndexPath(path);
+        if (indexPath && [indexPath getFileSystemRepresentation:decoder->index_path maxLength:sizeof(decoder->index_path)] && !index.GetNumberOfSamples()) {
+          int indexFile = open(decoder->index_path, O_RDONLY);
+          if (indexFile >= 0) {
+            if (index.Read(indexFile, decoder->file_size, decoder->modified_time) && asset.id) {
+              hevc::AssetCache::SetSampleIndex(asset.id, &index);
+            }
+            close(indexFile);
+          }
+        }
+        decoder->decoder.Initialize();
+        int status = decoder->decoder.Create(&stream, index.GetNumberOfSamples() ? &index : NULL, NULL, NULL);
+        if (status) {
+          HEVCDestroyDecoder(decoder);
+          decoder = NULL;
+          error = [NSError errorWithDomain:NSOSStatusErrorDomain code:status userInfo:nil];
+        }
+      }
+    }
+    index.Destroy();
+    stream.Destroy();
+    HEVC_TRACE_END("LoadFile", signpostID);
+    if (__atomic_load_n(&request->cancelled, __ATOMIC_RELAXED)) {
+      if (decoder) {
+        HEVCDestroyDecoder(decoder);
+      }
+      return;
+    }
+    dispatch_async(dispatch_get_main_queue(), ^{
+      typeof(self) view = weakView;
+      if (!view || view->_loadRequest != request) {
+        // Discard the prepared decoder in the background when this view is
+        // deleted or it starts loading another file while this block loads
+        // this file.
+        if (decoder) {
+          dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+            HEVCDestroyDecoder(decoder);
+          });
+        }
+        return;
+      }
+      view->_loadRequest = nil;
+      if (error) {
+        [view finishWithError:error];
+        return;
+      }
+      decoder->restored = request->restoring;
+      [view handOffDecoder:decoder];
+    });
+  });
+}
+
+- (void)cancelLoading {
+  if (_loadRequest) {
+    __atomic_store_n(&_loadRequest->cancelled, 1, __ATOMIC_RELAXED);
+    _loadRequest = nil;
+    _path = @"";
+  }
+}
+
+- (void)playFileFromURL:(NSURL *)url loop:(BOOL)loop {
+  [self playFileFromURL:url fps:0 loop:loop];
+}
+
+- (void)seekToFrame:(NSInteger)frame {
+  // Tell the worker thread to move the position of this view when it plays
+  // this view next time.
+  __atomic_store_n(&_seekFrame, frame > 0 ? (int)frame : 0, __ATOMIC_RELAXED);
+}
+
+- (void)seekToTime:(NSTimeInterval)time {
+  // Tell the worker thread to find the frame at the specified time. (The main
+  // thread does not access the decoder used by the worker thread.)
+  _seekTime = time > 0.0 ? time : 0.0;
+  __atomic_store_n(&_seekFrame, HEVCSeekToTime, __ATOMIC_RELEASE);
+}
+
+- (NSUInteger)numberOfLoops {
+  return __atomic_load_n(&_numberOfLoops, __ATOMIC_RELAXED);
+}
+
+- (NSUInteger)numberOfLoopStalls {
+  return __atomic_load_n(&_numberOfLoopStalls, __ATOMIC_RELAXED);
+}
+
+- (NSUInteger)numberOfDroppedFrames {
+  return __atomic_load_n(&_numberOfDroppedFrames, __ATOMIC_RELAXED);
+}
+
+- (HEVCPlayerStatistics *)statistics {
+  HEVCPlayerStatistics *statistics = [[HEVCPlayerStatistics alloc] init];
+  CFTimeInterval timeToFirstFrame;
+  __atomic_load(&_timeToFirstFrame, &timeToFirstFrame, __ATOMIC_RELAXED);
+  statistics.timeToFirstFrame = timeToFirstFrame;
+  uint32_t histogram[HEVCLatencyBins + 1];
+  uint64_t count = 0;
+  for (int i = 0; i <= HEVCLatencyBins; ++i) {
+    histogram[i] = __atomic_load_n(&_latencyHistogram[i], __ATOMIC_RELAXED);
+    count += histogram[i];
+  }
+  const CFTimeInterval maxLatency = (double)__atomic_load_n(&_maxDecodeLatency, __ATOMIC_RELAXED) * 1e-9;
+  statistics.decodeLatency50 = HEVCGetLatencyPercentile(histogram, count, maxLatency, 0.50);
+  statistics.decodeLatency90 = HEVCGetLatencyPercentile(histogram, count, maxLatency, 0.90);
+  statistics.decodeLatency99 = HEVCGetLatencyPercentile(histogram, count, maxLatency, 0.99);
+  statistics.maxDecodeLatency = maxLatency;
+  statistics.numberOfDecodedFrames = __atomic_load_n(&_numberOfDecodedFrames, __ATOMIC_RELAXED);
+  statistics.numberOfDroppedFrames = __atomic_load_n(&_numberOfDroppedFrames, __ATOMIC_RELAXED);
+  statistics.numberOfDuplicatedFrames = __atomic_load_n(&_numberOfDuplicatedFrames, __ATOMIC_RELAXED);
+  statistics.pictureCacheOccupancy = (NSUInteger)__atomic_load_n(&_pictureCacheOccupancy, __ATOMIC_RELAXED);
+  statistics.numberOfDecoderResets = __atomic_load_n(&_numberOfDecoderResets, __ATOMIC_RELAXED);
+  return statistics;
+}
+
+- (void)resetDecodeLatencies {
+  for (int i = 0; i <= HEVCLatencyBins; ++i) {
+    __atomic_store_n(&_latencyHistogram[i], 0, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&_maxDecodeLatency, 0, __ATOMIC_RELAXED);
+}
+
++ (HEVCPlayerQualityTier)qualityTier {
+  return (HEVCPlayerQualityTier)__atomic_load_n(&HEVCQualityTier, __ATOMIC_RELAXED);
+}
+
++ (void)prewarmDecoderWithURL:(NSURL *)url {
+  // Read only the header atoms of the file and create an idle decoder session
+  // for it asynchronously. (A decoder adds its session to the session pool
+  // when it is destroyed.)
+  NSString *path = [url path];
+  dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+    int file = open([path fileSystemRepresentation], O_RDONLY);
+    if (file < 0) {
+      return;
+    }
+    mov::AtomReader reader;
+    reader.Initialize();
+    if (reader.Read(file)) {
+      hevc::Decoder decoder;
+      decoder.Initialize();
+      decoder.Prewarm(reader.GetSampleDescriptionAtom());
+      decoder.Destroy();
+    }
+    reader.Destroy();
+    close(file);
+  });
+}
+
++ (void)setPictureCacheBudget:(NSUInteger)budget {
+  __atomic_store_n(&HEVCPictureCacheBudget, (uint64_t)budget, __ATOMIC_RELAXED);
+}
+
++ (NSUInteger)pictureCacheBudget {
+  return (NSUInteger)__atomic_load_n(&HEVCPictureCacheBudget, __ATOMIC_RELAXED);
+}
+
++ (void)setSharedFrameCacheBudget:(NSUInteger)budget {
+  hevc::AssetCache::SetFrameBudget((size_t)budget);
+}
+
++ (NSUInteger)sharedFrameCacheBudget {
+  return (NSUInteger)hevc::AssetCache::GetFrameBudget();
+}
+
++ (void)setWindowedStreamThreshold:(NSUInteger)threshold {
+  hevc::AssetCache::SetWindowThreshold((uint64_t)threshold);
+}
+
++ (NSUInteger)windowedStreamThreshold {
+  const uint64_t threshold = hevc::AssetCache::GetWindowThreshold();
+  return threshold < (uint64_t)NSUIntegerMax ?
+      (NSUInteger)threshold : NSUIntegerMax;
+}
+
+- (void)finish {
+  [self setPaused:YES];
+  _finished = YES;
+  if (self.delegate) {
+    [self.delegate playerView:self didFinish:0];
+  }
+}
+
+- (void)finishWithError: (NSError *) error {
+  [self setPaused:YES];
+  _finished = YES;
+  if (self.delegate) {
+    [self.delegate playerView:self didFail:error];
+  }
+}
+
+-(void)invalidate {
+  _paused = YES;
+  [self cancelLoading];
+  [[HEVCPlaybackEngine sharedEngine] removeClient:self wait:NO];
+}
+
+#pragma mark - internal methods
+
+/**
+ * Initializes this view. This method initializes all its internal variables.
+ * @param {id<MTLDevice>} device
+ */
+- (void)initViewWithDevice:(id<MTLDevice>)device {
+  // Initialize the `CAMetalLayer` object associated with this view and cache
+  // it to avoid retrieving it when this view renders decoded images. That said,
+  // this view caches the `CAMetalLayer` object to render images on the decoder
+  // thread.
+  _metalLayer = (CAMetalLayer *)[self layer];
+  _metalLayer.opaque = NO;
+  _metalLayer.drawsAsynchronously = YES;
+  _metalLayer.contentsGravity = kCAGravityResizeAspectFill;
+  _metalLayer.pixelFormat = MTLPixelFormatBGRA8Unorm;
+  _metalLayer.framebufferOnly = YES;
+  _metalLayer.presentsWithTransaction = NO;
+
+  // Create Metal resources. The shader library, the command queue, and the
+  // render pipelines are shared by all views, i.e. this view selects a
+  // pipeline when it renders an image.
+  _pipelineCache = [HEVCRenderPipelineCache cacheWithDevice:device];
+  _commandQueue = _pipelineCache.commandQueue;
+  _renderPipelineState = nil;
+  _renderPipelineOptions = 0;
+  _premultipliedAlpha = 0;
+  _renderPassDescriptor = [MTLRenderPassDescriptor renderPassDescriptor];
+  _renderPassDescriptor.colorAttachments[0].loadAction = MTLLoadActionDontCare;
+  _renderPassDescriptor.colorAttachments[0].storeAction = MTLStoreActionStore;
+  NSDictionary *attributes = [NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithInt:MTLTextureUsageShaderRead | MTLTextureUsageRenderTarget], kCVMetalTextureUsage, nil];
+  CVMetalTextureCacheCreate(kCFAllocatorDefault, nil, device, (__bridge CFDictionaryRef)attributes, &_textureCache);
+  _drawableSemaphore = HEVCCreateDrawableSemaphore(_metalLayer);
+
+  // Observe a couple of application notifications to stop rendering images
+  // while the host application is inactive.
+  NSNotificationCenter *defaultCenter = [NSNotificationCenter defaultCenter];
+  [defaultCenter addObserver:self selector:@selector(willResignActive:) name:UIApplicationWillResignActiveNotification object:nil];
+  [defaultCenter addObserver:self selector:@selector(didBecomeActive:) name:UIApplicationDidBecomeActiveNotification object:nil];
+
+  // Initialize the HEVC decoder and its resources.
+  _decoder.Initialize();
+  _path = @"";
+  _pictures.Initialize();
+  _sample = 0;
+  _frame = 0;
+  _seekFrame = -1;
+  _seekTime = 0.0;
+  _loadRequest = nil;
+  _pendingDecoder = NULL;
+  _assetID = 0;
+  _decodedSample = -1;
+  _catchUpSample = 0;
+  _randomAccessSample = 0;
+  _decodeLatency = 0;
+  _decodeDeviation = 0;
+  _decodingSamples = 0;
+  _throttled = NO;
+  _dropFrame = 0;
+  _numberOfDroppedFrames = 0;
+  memset(_latencyHistogram, 0, sizeof(_latencyHistogram));
+  _maxDecodeLatency = 0;
+  _numberOfDecodedFrames = 0;
+  _numberOfDuplicatedFrames = 0;
+  _numberOfDecoderResets = 0;
+  _pictureCacheOccupancy = 0;
+  _playTime = 0.0;
+  _timeToFirstFrame = 0.0;
+  _outputDivisor = 1;
+  _needsSampleIndex = NO;
+  _indexPath = nil;
+  _fileSize = 0;
+  _modifiedTime = 0;
+  _numberOfLoops = 0;
+  _numberOfLoopStalls = 0;
+  _layerSize = 0;
+  _drawableSize = CGSizeZero;
+  _filter.step[0] = 0.0f;
+  _filter.step[1] = 0.0f;
+  _filter.taps = 1;
+  _filter.padding = 0;
+  _outputModes = 0;
+  _invisible = YES;
+  _parked = NO;
+  _visibleArea = 0.0;
+  _qualityChanged = NO;
+  HEVCAddQualityView(self);
+  memset(_publishedFrames, 0, sizeof(_publishedFrames));
+  pthread_mutex_init(&_publishedMutex, NULL);
+  _stalledFrame = -1;
+  _pictureCacheSize = 0;
+  _pictureCacheBudget = 0;
+  _loop = NO;
+  _rewind = NO;
+  _reset = NO;
+  _suspend = NO;
+  _resume = NO;
+  _purged = NO;
+  _purgeRequested = NO;
+  _trimRequested = NO;
+  _paused = YES;
+  _finished = NO;
+  _parameters.interval = 0.0;
+  _parameters.loop = NO;
+  _parameters.play = NO;
+  _parameters.frames = 0;
+  _timeInterval = 0.0;
+  _baseTimestamp = -1.0;
+}
+
+/**
+ * Called when the host application becomes inactive.
+ * @param {NSNotification*} notification
+ */
+- (void)willResignActive:(NSNotification *)notification {
+  // Delete the idle decoder sessions, which the host OS may invalidate while
+  // the host application is inactive.
+  hevc::SessionPool::Clear();
+  hevc::AssetCache::ClearFrames();
+
+  // Stop receiving display-link events and schedule a task that deletes the
+  // cached images. (This view does not use the playback engine until the host
+  // application becomes active.)
+  if (!_paused && !_finished) {
+    _resume = YES;
+    _suspend = YES;
+    [self setPaused:YES];
+    [[HEVCPlaybackEngine sharedEngine] scheduleClient:self];
+  }
+}
+
+/**
+ * Called when the host application becomes active.
+ * @param {NSNotification*} notification
+ */
+- (void)didBecomeActive:(NSNotification *)notification {
+  // Tell the worker threads to reset the HEVC decoder only when this player was
+  // playing a file when the host application became inactive. (This method
+  // should ignore `didBecomeActive` events dispatched when this view is
+  // created.)
+  if (_resume) {
+    _resume = NO;
+    if (!_finished) {
+      _reset = YES;
+      [self setPaused:NO];
+    }
+  }
+}
+
+/**
+ * Starts or stops receiving display-link events from the playback engine. This
+ * view restores its purged file when it starts playing it. (The main thread
+ * owns the purged state and the load requests, i.e. this method checks them
+ * on the main thread when the worker thread calls it to play an installed
+ * decoder.)
+ * @param {BOOL} paused
+ */
+- (void)setPaused:(BOOL)paused {
+  _paused = paused;
+  if (!paused && ![NSThread isMainThread]) {
+    __weak typeof(self) weakView = self;
+    dispatch_async(dispatch_get_main_queue(), ^{
+      HEVCPlayerView *view = weakView;
+      if (view && !view->_paused && view->_purged && !view->_invisible) {
+        [view restorePurgedFile];
+      }
+    });
+  } else if (!paused && _purged && !_invisible) {
+    [self restorePurgedFile];
+    return;
+  }
+  [[HEVCPlaybackEngine sharedEngine] setClient:self active:!paused && !_invisible];
+}
+
+/**
+ * Loads the file purged under memory pressure again. The worker thread seeks
+ * to the position where it deleted the decoder (unless this view has another
+ * seek request) and this view starts playing the file when the worker thread
+ * installs the decoder, i.e. this view does not receive display-link events
+ * without a decoder. (This method does not notify the delegate.)
+ */
+- (void)restorePurgedFile {
+  if (!_path.length) {
+    _purged = NO;
+    return;
+  }
+  [self loadFileAtPath:_path];
+  _loadRequest->restoring = YES;
+}
+
+/**
+ * Called on the main thread when the host application receives a
+ * memory-pressure event. A view that is not playing its file deletes its
+ * decoded images, and it also deletes its decoder and the stream data of its
+ * file under heavier memory pressure. A view playing its file does not delete
+ * the images it has decoded ahead because it would have to decode them again
+ * before rendering them. Instead, `maxDecodeAheadFrames` stops it decoding
+ * beyond the next frames while `HEVCMemoryStage` is not normal, i.e. its
+ * picture cache shrinks to them as it renders the decoded ones.
+ * @param {NSInteger} stage
+ */
+- (void)didReceiveMemoryPressure:(NSInteger)stage {
+  if ((!_paused && !_invisible) || _purged) {
+    return;
+  }
+  // Do not purge the file while the worker thread has not installed the
+  // decoder handed off by a load request, which would start playing it.
+  if (stage >= HEVCMemoryStagePurgeStreams && _path.length && !_loadRequest &&
+      !__atomic_load_n(&_pendingDecoder, __ATOMIC_ACQUIRE)) {
+    _purged = YES;
+    __atomic_store_n(&_purgeRequested, YES, __ATOMIC_RELEASE);
+  } else {
+    __atomic_store_n(&_trimRequested, YES, __ATOMIC_RELEASE);
+  }
+  [[HEVCPlaybackEngine sharedEngine] scheduleClient:self];
+}
+
+/**
+ * Called on the main thread when this view finishes loading a file in the
+ * background. This method hands the prepared decoder to the worker thread and
+ * schedules a task that installs it.
+ * @param {hevc::Decoder*} decoder
+ */
+- (void)handOffDecoder:(HEVCPreparedDecoder *)decoder {
+  // Stop playing the previous file when this view preloads the file. (The
+  // worker thread does not start playing a preloaded file.)
+  if (!_parameters.play) {
+    [self setPaused:YES];
+  }
+  HEVCPreparedDecoder *replacedDecoder = __atomic_exchange_n(&_pendingDecoder, decoder, __ATOMIC_ACQ_REL);
+  if (replacedDecoder) {
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+      HEVCDestroyDecoder(replacedDecoder);
+    });
+  }
+  [[HEVCPlaybackEngine sharedEngine] scheduleClient:self];
+}
+
+/**
+ * Called by the worker thread to replace the decoder of this view with the one
+ * prepared by a load request. (The worker thread is the only thread that uses
+ * the decoder and the picture cache, i.e. this method does not have to stop
+ * playing this view.)
+ * @param {HEVCPreparedDecoder*} decoder
+ */
+- (void)installDecoder:(HEVCPreparedDecoder *)decoder {
+  // Delete the HEVC decoder and the picture cache of the previous file.
+  // (Destroying the decoder waits for its output handler so the handler does
+  // not access the deleted picture cache.)
+  _decoder.Destroy();
+  _pictures.Reset();
+  __atomic_fetch_sub(&HEVCPictureCacheUsage, _pictureCacheSize, __ATOMIC_RELAXED);
+  _pictureCacheSize = 0;
+  if (_assetID) {
+    hevc::AssetCache::Release(_assetID);
+  }
+
+  // Move the prepared decoder to this view. (A `hevc::Decoder` object does not
+  // have pointers to itself.) Then keep the key of the sample index of the
+  // file so this view can write it if the decoder has not read it.
+  _decoder = decoder->decoder;
+  _assetID = decoder->asset_id;
+  _fileSize = decoder->file_size;
+  _modifiedTime = decoder->modified_time;
+  __atomic_store_n(&_premultipliedAlpha, _decoder.IsPremultipliedAlpha(0), __ATOMIC_RELAXED);
+  _needsSampleIndex = !_decoder.HasSampleIndex();
+  _indexPath = nil;
+  if (_needsSampleIndex && decoder->index_path[0]) {
+    _indexPath = [NSString stringWithUTF8String:decoder->index_path];
+  }
+  const BOOL restored = decoder->restored;
+  free(decoder);
+
+  // Initialize the picture cache and the player parameters.
+  _pictures.Create([self pictureCacheCapacity]);
+  _timeInterval = _parameters.interval;
+  _baseTimestamp = -1.0;
+  _loop = _parameters.loop;
+  _sample = 0;
+  _frame = 0;
+  _decodedSample = -1;
+  _catchUpSample = 0;
+  _randomAccessSample = 0;
+  _decodeLatency = 0;
+  _decodeDeviation = 0;
+  _decodingSamples = 0;
+  _dropFrame = 0;
+  _outputDivisor = 1;
+  _rewind = NO;
+  _reset = NO;
+  _suspend = NO;
+  [self resetLoopStatistics];
+  [self updateFrameRateWithInterval:_timeInterval];
+  if (_parameters.play) {
+    [self setPaused:NO];
+  } else {
+    [self preloadFrames:(int)_parameters.frames];
+  }
+  id<HEVCPlayerViewDelegate> delegate = self.delegate;
+  if (!restored && [delegate respondsToSelector:@selector(playerViewDidLoad:)]) {
+    [delegate playerViewDidLoad:self];
+  }
+}
+
+/**
+ * Decodes the specified number of frames from the beginning of the file being
+ * played so this view can render its first frame as soon as it starts playing
+ * the file. (This method decodes only the frames that fit the picture cache
+ * with their reordered frames.)
+ * @param {int} frames
+ */
+- (void)preloadFrames:(int)frames {
+  const int numberOfFrames = _decoder.GetNumberOfFrames();
+  const int capacity = [self maxDecodeAheadFrames];
+  frames = frames < numberOfFrames ? frames : numberOfFrames;
+  frames = frames < capacity ? frames : capacity;
+  if (frames > 0) {
+    [self loadSamples];
+    [self decodeFrameAt:frames - 1];
+  }
+}
+
+/**
+ * Returns the area of this view that can be seen (in points), i.e. 0 when this
+ * view or one of its ancestors is hidden or transparent. Otherwise, this method
+ * returns the area of the intersection of this view and the visible area of
+ * its window. (The visible area is the intersection of the window bounds and
+ * the bounds of the ancestors clipping their subviews, e.g. scroll views.)
+ * @return {CGFloat}
+ */
+- (CGFloat)visibleAreaInWindow {
+  UIWindow *window = self.window;
+  if (!window || window.hidden) {
+    return 0.0;
+  }
+  CGRect visibleRect = window.bounds;
+  for (UIView *view = self; view; view = view.superview) {
+    if (view.hidden || view.alpha < HEVCMinVisibleAlpha) {
+      return 0.0;
+    }
+    if (view != self && view.clipsToBounds) {
+      visibleRect = CGRectIntersection(visibleRect, [view convertRect:view.bounds toView:nil]);
+    }
+  }
+  const CGRect rect = CGRectIntersection(visibleRect, [self convertRect:self.bounds toView:nil]);
+  return CGRectIsEmpty(rect) ? 0.0 : rect.size.width * rect.size.height;
+}
+
+/**
+ * Updates the visibility of all views in windows and removes views that have
+ * left their windows. While the quality tier limits the number of views playing
+ * files, this method parks the views playing files except the ones with the
+ * largest visible areas. (A view that is already playing wins a tie so views
+ * of the same size do not take turns.)
+ */
++ (void)updateVisibilities {
+  const BOOL limited = __atomic_load_n(&HEVCQualityTier, __ATOMIC_RELAXED) >= HEVCPlayerQualityTierLimitedPlayers;
+  NSMutableArray<HEVCPlayerView *> *players = [NSMutableArray array];
+  for (HEVCPlayerView *view in [HEVCVisibilityViews allObjects]) {
+    if (!view.window) {
+      [HEVCVisibilityViews removeObject:view];
+      continue;
+    }
+    view->_visibleArea = [view visibleAreaInWindow];
+    if (limited && view->_visibleArea > 0.0 && !view->_paused && !view->_finished) {
+      [players addObject:view];
+    } else {
+      view->_parked = NO;
+      [view updateVisibility];
+    }
+  }
+  [players sortUsingComparator:^NSComparisonResult(HEVCPlayerView *a, HEVCPlayerView *b) {
+    if (a->_visibleArea != b->_visibleArea) {
+      return a->_visibleArea > b->_visibleArea ? NSOrderedAscending : NSOrderedDescending;
+    }
+    if (a->_parked != b->_parked) {
+      return a->_parked ? NSOrderedDescending : NSOrderedAscending;
+    }
+    return NSOrderedSame;
+  }];
+  for (NSUInteger i = 0; i < players.count; ++i) {
+    HEVCPlayerView *view = players[i];
+    view->_parked = i >= HEVCLimitedPlayers;
+    [view updateVisibility];
+  }
+}
+
+/**
+ * Suspends this view when it cannot be seen and resumes it when it can be seen
+ * again. A suspended view deletes its decoded images as it does when the host
+ * application becomes inactive, and it resumes playing the file from the sync
+ * sample preceding its current frame. (A view with output modes is always
+ * visible because its images are drawn by others.)
+ */
+- (void)updateVisibility {
+  const BOOL invisible = !__atomic_load_n(&_outputModes, __ATOMIC_RELAXED) && (_parked || [self visibleAreaInWindow] <= 0.0);
+  if (invisible == _invisible) {
+    return;
+  }
+  _invisible = invisible;
+  if (_paused || _finished) {
+    return;
+  }
+  if (!invisible && _purged) {
+    [self restorePurgedFile];
+    return;
+  }
+  HEVCPlaybackEngine *engine = [HEVCPlaybackEngine sharedEngine];
+  [engine setClient:self active:!invisible];
+  if (invisible) {
+    _suspend = YES;
+    [engine scheduleClient:self];
+  }
+}
+
+/**
+ * Called on the main thread when the quality tier changes. This method tells
+ * the worker thread to apply the tier and notifies the delegate. (The worker
+ * thread applies the reduced resolution when it decodes the next sync sample.)
+ */
+- (void)qualityTierDidChange {
+  __atomic_store_n(&_qualityChanged, YES, __ATOMIC_RELEASE);
+  id<HEVCPlayerViewDelegate> delegate = self.delegate;
+  if ([delegate respondsToSelector:@selector(playerView:didChangeQualityTier:)]) {
+    [delegate playerView:self didChangeQualityTier:[HEVCPlayerView qualityTier]];
+  }
+}
+
+/**
+ * Updates the size of the `CAMetalLayer` object of this view in pixels. This
+ * view renders decoded images at this size so it does not write pixels the
+ * compositor discards when it shrinks them.
+ */
+- (void)updateLayerSize {
+  // Use the size of the sprite for a composited view.
+  if (__atomic_load_n(&_outputModes, __ATOMIC_RELAXED) & HEVCOutputCompositor) {
+    return;
+  }
+  // Apply the scale factor of the screen showing this view. (UIKit does not set
+  // the scale factor of a view without `drawRect:`, e.g. this view.)
+  UIScreen *screen = self.window ? self.window.screen : [UIScreen mainScreen];
+  const CGFloat scale = screen.nativeScale;
+  if (self.contentScaleFactor != scale) {
+    self.contentScaleFactor = scale;
+  }
+  const CGSize size = self.bounds.size;
+  const uint64_t width = (uint64_t)ceil(size.width * scale);
+  const uint64_t height = (uint64_t)ceil(size.height * scale);
+  __atomic_store_n(&_layerSize, (width << 32) | (height & 0xffffffff), __ATOMIC_RELAXED);
+}
+
+/**
+ * Updates the size of the drawables of the `CAMetalLayer` object of this view
+ * for the specified image size. This method shrinks the image (keeping its
+ * aspect ratio) so it covers the layer (whose contents gravity is
+ * `kCAGravityResizeAspectFill`) without enlarging it, and it updates the
+ * parameters of the fragment shader to box-filter the image.
+ * @param {size_t} width
+ * @param {size_t} height
+ */
+- (void)updateDrawableSizeWithWidth:(size_t)width height:(size_t)height {
+  const uint64_t layerSize = __atomic_load_n(&_layerSize, __ATOMIC_RELAXED);
+  const double layerWidth = (double)(layerSize >> 32);
+  const double layerHeight = (double)(layerSize & 0xffffffff);
+  double scale = 1.0;
+  if (layerWidth > 0.0 && layerHeight > 0.0) {
+    const double scaleX = layerWidth / (double)width;
+    const double scaleY = layerHeight / (double)height;
+    scale = scaleX > scaleY ? scaleX : scaleY;
+    scale = scale < 1.0 ? scale : 1.0;
+  }
+  CGFloat drawableWidth = ceil((double)width * scale);
+  CGFloat drawableHeight = ceil((double)height * scale);
+  drawableWidth = drawableWidth > 1.0 ? drawableWidth : 1.0;
+  drawableHeight = drawableHeight > 1.0 ? drawableHeight : 1.0;
+  // Update the filter before comparing the drawable sizes because images of
+  // different sizes (e.g. the images decoded before and after this view changes
+  // its decoding size) may have the same drawable size.
+  _filter = HEVCMakePlayerFilter((double)width, drawableWidth, drawableHeight);
+  if (drawableWidth == _drawableSize.width && drawableHeight == _drawableSize.height) {
+    return;
+  }
+  _drawableSize = CGSizeMake(drawableWidth, drawableHeight);
+  _metalLayer.drawableSize = _drawableSize;
+}
+
+/**
+ * Changes the size of the images decoded by this view to the smallest one that
+ * covers the `CAMetalLayer` object of this view. This method is called before
+ * this view decodes a sync sample because changing the size re-creates the
+ * decoder session, which does not have the references of the samples after a
+ * sync sample. (Video Toolbox decodes the samples at a reduced resolution so a
+ * small view does not need full-size images.)
+ */
+- (void)updateOutputSize {
+  const uint64_t layerSize = __atomic_load_n(&_layerSize, __ATOMIC_RELAXED);
+  const double layerWidth = (double)(layerSize >> 32);
+  const double layerHeight = (double)(layerSize & 0xffffffff);
+  if (_outputDivisor == 0 || layerWidth <= 0.0 || layerHeight <= 0.0) {
+    return;
+  }
+  // Decode the file at most at its half size while the quality tier reduces
+  // resolutions, even when the images do not cover this view.
+  const int minDivisor = __atomic_load_n(&HEVCQualityTier, __ATOMIC_RELAXED) >= HEVCPlayerQualityTierReducedResolution ? 2 : 1;
+  const int frameWidth = _decoder.GetFrameWidth();
+  const int frameHeight = _decoder.GetFrameHeight();
+  int divisor = _outputDivisor > minDivisor ? _outputDivisor : minDivisor;
+  while (divisor < HEVCMaxOutputDivisor &&
+         frameWidth / (divisor * 2) >= layerWidth * HEVCOutputSizeMargin &&
+         frameHeight / (divisor * 2) >= layerHeight * HEVCOutputSizeMargin) {
+    divisor *= 2;
+  }
+  while (divisor > minDivisor && (frameWidth / divisor < layerWidth || frameHeight / divisor < layerHeight)) {
+    divisor /= 2;
+  }
+  if (divisor == _outputDivisor) {
+    return;
+  }
+  // Round the size up to even numbers for the subsampled UV plane.
+  const int outputWidth = (frameWidth / divisor + 1) & ~1;
+  const int outputHeight = (frameHeight / divisor + 1) & ~1;
+  if (_decoder.SetOutputSize(outputWidth, outputHeight)) {
+    // Decode the file at its frame size when Video Toolbox cannot output images
+    // of the requested size, and stop changing the size.
+    _outputDivisor = 0;
+    _decoder.SetOutputSize(0, 0);
+    _reset = YES;
+    return;
+  }
+  _outputDivisor = divisor;
+}
+
+/**
+ * Resets the loop statistics of this view.
+ */
+- (void)resetLoopStatistics {
+  __atomic_store_n(&_numberOfLoops, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&_numberOfLoopStalls, 0, __ATOMIC_RELAXED);
+  _stalledFrame = -1;
+}
+
+/**
+ * Tells the playback engine the frame rate of the stream being played so the
+ * engine can request the display to refresh at a rate matching it.
+ * @param {CFTimeInterval} interval
+ */
+- (void)updateFrameRateWithInterval:(CFTimeInterval)interval {
+  float frameRate = 0.0f;
+  if (interval > 0.0) {
+    frameRate = (float)(1.0 / interval);
+  } else if (_decoder.GetTimeScale() && _decoder.GetDuration()) {
+    frameRate = (float)((double)_decoder.GetNumberOfFrames() * _decoder.GetTimeScale() / (double)_decoder.GetDuration());
+  } else {
+    frameRate = (float)(1.0 / HEVCDefaultFrameInterval);
+  }
+  // Request a half frame rate while the quality tier halves frame rates. (This
+  // view drops a half of its frames, i.e. it presents frames at this rate.)
+  if (__atomic_load_n(&HEVCQualityTier, __ATOMIC_RELAXED) >= HEVCPlayerQualityTierHalfRate) {
+    frameRate *= 0.5f;
+  }
+  [[HEVCPlaybackEngine sharedEngine] setClient:self frameRate:frameRate];
 }
 
--(void)invalidate {
-  [_thread cancel];
-  _thread = nil;
+/**
+ * Returns the presentation time of the specified frame in seconds from the
+ * beginning of the first loop. (This method returns the duration of the
+ * stream when the frame is the end of the stream.)
+ * @param {int} frame
+ * @return {CFTimeInterval}
+ */
+- (CFTimeInterval)presentationTimeOfFrame:(int)frame {
+  if (_timeInterval > 0.0) {
+    return frame * _timeInterval;
+  }
+  const uint32_t timeScale = _decoder.GetTimeScale();
+  const int numberOfFrames = _decoder.GetNumberOfFrames();
+  if (!timeScale || !_decoder.GetDuration() || !numberOfFrames) {
+    return frame * HEVCDefaultFrameInterval;
+  }
+  // Add the durations of the preceding loops to the presentation timestamp of
+  // the frame in its loop.
+  const uint64_t loop = (uint64_t)(frame / numberOfFrames);
+  const uint64_t timestamp = loop * _decoder.GetDuration() + _decoder.GetFrameTimestamp(frame % numberOfFrames);
+  return (CFTimeInterval)timestamp / timeScale;
 }
 
-#pragma mark - internal methods
+/**
+ * Calculates the number of frames cached by this view. This method uses the
+ * size of the decoded picture buffer of the stream and reduces it to fit the
+ * images into the budgets. (This view caches at least the frames required for
+ * reordering the decoded frames even when they exceed the budgets.)
+ * @return {uintptr_t}
+ */
+- (uintptr_t)pictureCacheCapacity {
+  // Each cached image consists of three 8-bit planes: Y, UV (subsampled), and
+  // alpha, i.e. it has 2.5 bytes per pixel.
+  const uint64_t imageSize = (uint64_t)_decoder.GetFrameWidth() * _decoder.GetFrameHeight() * 5 / 2;
+  const uint64_t minimum = _decoder.GetMaxNumReorderPictures() + 2;
+  uint64_t capacity = _decoder.GetMaxDecodedPictureBuffering() + 1;
+  capacity = capacity > minimum ? capacity : minimum;
+  if (imageSize) {
+    const uint64_t budget = _pictureCacheBudget;
+    if (budget) {
+      const uint64_t limit = budget / imageSize;
+      capacity = capacity < limit ? capacity : limit;
+    }
+    const uint64_t sharedBudget = __atomic_load_n(&HEVCPictureCacheBudget, __ATOMIC_RELAXED);
+    if (sharedBudget) {
+      const uint64_t usage = __atomic_load_n(&HEVCPictureCacheUsage, __ATOMIC_RELAXED);
+      const uint64_t limit = usage < sharedBudget ? (sharedBudget - usage) / imageSize : 0;
+      capacity = capacity < limit ? capacity : limit;
+    }
+  }
+  capacity = capacity > minimum ? capacity : minimum;
+  _pictureCacheSize = capacity * imageSize;
+  __atomic_fetch_add(&HEVCPictureCacheUsage, _pictureCacheSize, __ATOMIC_RELAXED);
+  return (uintptr_t)capacity;
+}
 
 /**
- * Initializes this view. This method initializes all its internal variables.
- * @param {id<MTLDevice>} device
+ * Called by a worker thread of the playback engine when this view receives a
+ * display-link event or when it has scheduled work. This method renders a
+ * decoded picture and decodes the next samples. (The engine calls this method
+ * on one worker thread at a time.)
+ * @param {HEVCPlaybackEngine*} engine
+ * @param {CFTimeInterval} timestamp
  */
-- (void)initViewWithDevice:(id<MTLDevice>)device {
-  // Initialize the `CAMetalLayer` object associated with this view and cache
-  // it to avoid retrieving it when this view renders decoded images. That said,
-  // this view caches the `CAMetalLayer` object to render images on the decoder
-  // thread.
-  _metalLayer = (CAMetalLayer *)[self layer];
-  _metalLayer.opaque = NO;
-  _metalLayer.drawsAsynchronously = YES;
-  _metalLayer.contentsGravity = kCAGravityResizeAspectFill;
-  _metalLayer.pixelFormat = MTLPixelFormatBGRA8Unorm;
-  _metalLayer.framebufferOnly = YES;
-  _metalLayer.presentsWithTransaction = NO;
+- (void)playbackEngine:(HEVCPlaybackEngine *)engine processFrameAtTime:(CFTimeInterval)timestamp {
+  // Delete the decoder or the decoded images of this view under memory
+  // pressure before installing a decoder, which may restore the purged file.
+  if (__atomic_exchange_n(&_purgeRequested, NO, __ATOMIC_ACQUIRE)) {
+    [self purgeDecoder];
+  } else if (__atomic_exchange_n(&_trimRequested, NO, __ATOMIC_ACQUIRE) && (_paused || _invisible)) {
+    [self releasePictures];
+  }
 
-  // Create Metal resources.
-  _commandQueue = [device newCommandQueue];
-  id<MTLLibrary> mtlLibrary = [device newDefaultLibraryWithBundle:[HEVCBundleHelper getBundle] error:nil];
-  if (mtlLibrary) {
-    MTLRenderPipelineDescriptor *descriptor = [MTLRenderPipelineDescriptor new];
-    if (descriptor) {
-      descriptor.colorAttachments[0].pixelFormat = MTLPixelFormatBGRA8Unorm;
-      descriptor.vertexFunction = [mtlLibrary newFunctionWithName: @"HEVCPlayerVertex"];
-      descriptor.fragmentFunction = [mtlLibrary newFunctionWithName: @"HEVCPlayerFragment"];
-      _renderPipelineState = [device newRenderPipelineStateWithDescriptor:descriptor error:nil];
-    }
-    _renderPassDescriptor = [MTLRenderPassDescriptor renderPassDescriptor];
-    _renderPassDescriptor.colorAttachments[0].loadAction = MTLLoadActionDontCare;
-    _renderPassDescriptor.colorAttachments[0].storeAction = MTLStoreActionStore;
+  // Install the decoder prepared by a load request.
+  HEVCPreparedDecoder *pendingDecoder = __atomic_exchange_n(&_pendingDecoder, (HEVCPreparedDecoder *)NULL, __ATOMIC_ACQUIRE);
+  if (pendingDecoder) {
+    [self installDecoder:pendingDecoder];
   }
-  NSDictionary *attributes = [NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithInt:MTLTextureUsageShaderRead | MTLTextureUsageRenderTarget], kCVMetalTextureUsage, nil];
-  CVMetalTextureCacheCreate(kCFAllocatorDefault, nil, device, (__bridge CFDictionaryRef)attributes, &_textureCache);
 
-  // Observe a couple of application notifications to stop rendering images
-  // while the host application is inactive.
-  NSNotificationCenter *defaultCenter = [NSNotificationCenter defaultCenter];
-  [defaultCenter addObserver:self selector:@selector(willResignActive:) name:UIApplicationWillResignActiveNotification object:nil];
-  [defaultCenter addObserver:self selector:@selector(didBecomeActive:) name:UIApplicationDidBecomeActiveNotification object:nil];
+  // Apply the quality tier changed since the last call.
+  if (__atomic_exchange_n(&_qualityChanged, NO, __ATOMIC_ACQUIRE)) {
+    [self updateFrameRateWithInterval:_timeInterval];
+  }
 
-  // Initialize the HEVC decoder and its resources.
-  _decoder.Initialize();
-  _path = @"";
-  _thread = nil;
-  _pictures.Initialize();
-  _sample = 0;
-  _picture = 0;
-  _frame = 0;
-  _loop = NO;
-  _rewind = NO;
-  _reset = NO;
-  _suspend = NO;
-  _finished = NO;
-  _parameters.interval = 0.0;
-  _parameters.loop = NO;
+  // Render a decoded picture.
+  if (!_paused && !_invisible) {
+    [self renderFrameAtTime:timestamp];
+  }
 
-  // Create a display link so the caller thread can own it.
-  pthread_mutex_init(&_mutex, NULL);
-  HEVCWeakProxy *weakProxy = [HEVCWeakProxy weakProxyWithObject:self];
-  _displayLink = [CADisplayLink displayLinkWithTarget:weakProxy selector:@selector(updateFrame:)];
-  _timeInterval = 0.0;
-  _lastTimestamp = -1.0;
+  if (_finished && _sample != 0) {
+    _pictures.ClearCache();
+    _sample = 0;
+    _frame = 0;
+    _decodedSample = -1;
+    _catchUpSample = 0;
+    _randomAccessSample = 0;
+    _loop = _parameters.loop;
+    _timeInterval = _parameters.interval;
+    _baseTimestamp = -1.0;
+    [self clearScreen];
+  }
+
+  // Delete all resources used by this view and clear the output screen when
+  // this player is being inactive. (This view resumes playing the stream from
+  // the current frame unless it has another seek request.)
+  if (_suspend) {
+    _suspend = NO;
+    [self releasePictures];
+    [self clearScreen];
+  }
+  // Reset the positions and decode samples after rendering a picture. (This
+  // view renders images once in 33 ms, i.e. it is sufficiently idle to decode
+  // samples.)
+  if (!_paused && !_invisible) {
+    if (_rewind) {
+      // Keep the decoded images when this view has not rendered any frames,
+      // e.g. when it has preloaded the file, whose positions are at the
+      // beginning of the file.
+      _rewind = NO;
+      if (_frame != 0) {
+        _pictures.ClearCache();
+        _sample = 0;
+        _frame = 0;
+        _decodedSample = -1;
+        _catchUpSample = 0;
+        _randomAccessSample = 0;
+      }
+      [self resetLoopStatistics];
+      _loop = _parameters.loop;
+      _timeInterval = _parameters.interval;
+      _baseTimestamp = -1.0;
+      [self updateFrameRateWithInterval:_timeInterval];
+    }
+    [self loadSamples];
+    if (__atomic_load_n(&_seekFrame, __ATOMIC_RELAXED) != -1) {
+      [self seekToRequestedFrame];
+    }
+    [self decodeAheadOfFrame:_frame];
+  }
+
+  // Update the size of the decoded images for `statistics`. (An image has an
+  // alpha plane in addition to its NV12 planes.)
+  const uint64_t imageSize = (uint64_t)_decoder.GetOutputWidth() * _decoder.GetOutputHeight() * 5 / 2;
+  __atomic_store_n(&_pictureCacheOccupancy, _pictures.GetNumberOfImages() * imageSize, __ATOMIC_RELAXED);
 }
 
 /**
- * Called when the host application becomes inactive.
- * @param {NSNotification*} notification
+ * Deletes the decoded images of this view and resets its positions. This
+ * method requests seeking to the current frame (unless this view has another
+ * seek request) so this view resumes playing its file from the sync sample
+ * preceding the frame.
  */
-- (void)willResignActive:(NSNotification *)notification {
-  _displayLink.paused = YES;
-  if(!_finished) {
-    _suspend = YES;
-  }
+- (void)releasePictures {
+  _pictures.ClearCache();
+  const int numberOfFrames = _decoder.GetNumberOfFrames();
+  int noRequest = -1;
+  __atomic_compare_exchange_n(&_seekFrame, &noRequest, numberOfFrames ? _frame % numberOfFrames : 0, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+  _sample = 0;
+  _frame = 0;
+  _decodedSample = -1;
+  _catchUpSample = 0;
+  _randomAccessSample = 0;
 }
 
 /**
- * Called when the host application becomes active.
- * @param {NSNotification*} notification
+ * Deletes the decoder, the picture cache, and the stream data of this view
+ * under memory pressure. The main thread loads the file again before this view
+ * receives display-link events, and the worker thread seeks to the frame
+ * requested by this method. (Destroying the decoder adds its session to the
+ * session pool, i.e. this method deletes the idle sessions again.)
  */
-- (void)didBecomeActive:(NSNotification *)notification {
-  // Read the `_displayLink.paused` value and tell the decoder thread to reset
-  // the HEVC decoder only when it is `YES`, i.e. this player is becoming back
-  // from an inactive state. (This method should ignore `didBecomeActive` events
-  // dispatched when this view is created.)
-  if (_displayLink.isPaused && !_finished) {
-    _reset = YES;
-    _displayLink.paused = NO;
+- (void)purgeDecoder {
+  [self releasePictures];
+  _decoder.Destroy();
+  _decoder.Initialize();
+  _pictures.Reset();
+  __atomic_fetch_sub(&HEVCPictureCacheUsage, _pictureCacheSize, __ATOMIC_RELAXED);
+  _pictureCacheSize = 0;
+  if (_assetID) {
+    hevc::AssetCache::Release(_assetID);
+    _assetID = 0;
   }
+  __atomic_store_n(&_decodingSamples, 0, __ATOMIC_RELAXED);
+  hevc::SessionPool::Clear();
 }
 
 /**
- * Called when the `NSFileHandle` object finishes reading all data from the
- * QuickTime file being played.
- * @param {NSNotification*} notification
+ * Moves the position of this view to the frame requested by `seekToFrame:`.
+ * This method moves the sample position to the last sync sample preceding the
+ * requested frame so this view decodes at most one GOP before rendering it.
+ * (This method keeps the request until this view reads the samples required
+ * for finding the sync sample.)
  */
-- (void)readToEndOfFile:(NSNotification *)notification {
-  NSNotificationCenter *defaultCenter = [NSNotificationCenter defaultCenter];
-  [defaultCenter removeObserver:self name:NSFileHandleReadToEndOfFileCompletionNotification object:[notification object]];
-
-  NSDictionary *userInfo = [notification userInfo];
-  NSData *data = [userInfo objectForKey:NSFileHandleNotificationDataItem];
-  if (!data) {
-    [self finishWithError:[NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:nil]];
+- (void)seekToRequestedFrame {
+  int frame = __atomic_load_n(&_seekFrame, __ATOMIC_ACQUIRE);
+  if (frame == HEVCSeekToTime) {
+    // Convert a request of `seekToTime:` to a frame number.
+    const int seekFrame = _decoder.GetFrame((float)_seekTime);
+    if (!__atomic_compare_exchange_n(&_seekFrame, &frame, seekFrame, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      return;
+    }
+    frame = seekFrame;
+  }
+  const int numberOfFrames = _decoder.GetNumberOfFrames();
+  const int target = frame < numberOfFrames ? frame : numberOfFrames - 1;
+  const int sample = _decoder.GetSeekSample(target);
+  if (sample < 0) {
     return;
   }
-  // Tell the decoder thread to exit when this decoder is decoding another file
-  // and wait for the thread to exit. (This method temporarily acquires the
-  // mutex owned by the decoder thread to wait.)
-  [_thread cancel];
-  pthread_mutex_lock(&_mutex);
-  pthread_mutex_unlock(&_mutex);
-
-  // Delete the picture cache and the HEVC decoder after the decoder thread
-  // exits.
-  _pictures.Reset();
-  _decoder.Destroy();
-
-  // Re-initialize the HEVC decoder and create a decoder thread.
-  int status = _decoder.Create(data.bytes, data.length, NULL, NULL);
-  if (status) {
-    [self finishWithError: [NSError errorWithDomain:NSOSStatusErrorDomain code:status userInfo:nil]];
+  if (!__atomic_compare_exchange_n(&_seekFrame, &frame, -1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
     return;
   }
-  // Initialize the picture cache and the player parameters.
-  _pictures.Create(_decoder.GetMaxPictureOrderCount() + 1);
-  _timeInterval = _parameters.interval;
-  _lastTimestamp = -1.0;
-  _loop = _parameters.loop;
-  _sample = 0;
-  _picture = 0;
-  _frame = 0;
-  _thread = [[NSThread alloc] initWithTarget:self selector:@selector(threadMethod:) object:nil];
-  [_thread setName:@"com.dena.pokota.HEVCPlayerView.DecoderThread"];
-  [_thread start];
-}
-
-/**
- * The entry point function of the rendering thread. (This thread also decodes
- * QuickTime streams.)
- * @param {id} arg
- */
-- (void)threadMethod:(id)arg {
-  // Acquire the mutex and synchronize this thread to the refresh rate of the
-  // display. (This method must be executed atomically to prevent multiple
-  // threads from attaching it to one `CADisplayLink` object.)
-  pthread_mutex_lock(&_mutex);
-  [_displayLink addToRunLoop:[NSRunLoop currentRunLoop] forMode:NSDefaultRunLoopMode];
-  _displayLink.paused = NO;
-  if (@available(iOS 10.0, *)) {
-    _displayLink.preferredFramesPerSecond = 0;
-  }
-
-  // Decode the QuickTime stream and render its pictures.
-  NSThread* thread = _thread;
-  while (thread.cancelled == NO) {
-    // Render a decoded picture when this thread receives a `CADisplayLink` event.
-    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow: 1.0f / 60.0f]];
-      
-    if (_finished && _sample != 0) {
-      _pictures.ClearCache();
-      _sample = 0;
-      _picture = 0;
-      _frame = 0;
-      _loop = _parameters.loop;
-      _timeInterval = _parameters.interval;
-      _lastTimestamp = -1.0;
-      [self clearScreen];
-    }
-
-    // Delete all resources used by this thread and clear the output screen when
-    // this player is being inactive.
-    if (_suspend) {
-      _suspend = NO;
-      _pictures.ClearCache();
-      _sample = 0;
-      _picture = 0;
-      _frame = 0;
-      [self clearScreen];
-    }
-    // Reset the positions and decode samples on idle. (This thread renders
-    // images once in 33 ms, i.e. it is sufficiently idle to decode samples.)
-    if (!_displayLink.isPaused) {
-      if (_rewind) {
-        _rewind = NO;
-        _pictures.ClearCache();
-        _sample = 0;
-        _picture = 0;
-        _frame = 0;
-        _loop = _parameters.loop;
-        _timeInterval = _parameters.interval;
-        _lastTimestamp = -1.0;
+  _pictures.ClearCache();
+  _sample = sample;
+  _decodedSample = sample - 1;
+  _catchUpSample = 0;
+  _randomAccessSample = sample;
+  _frame = target;
+  _baseTimestamp = -1.0;
+}
+
+/**
+ * Reads the next chunks of the QuickTime stream being played. (This method
+ * reads chunks on idle so this view can decode samples without waiting for
+ * the whole file.)
+ */
+- (void)loadSamples {
+  if (_decoder.HasAllSamples()) {
+    // Create the sample index of the file when the decoder has read all
+    // samples, and pass it to the asset cache and write it in the background
+    // so players do not read their slice headers when they play the file next
+    // time.
+    if (_needsSampleIndex) {
+      _needsSampleIndex = NO;
+      NSString *indexPath = _indexPath;
+      _indexPath = nil;
+      hevc::SampleIndex index;
+      index.Initialize();
+      if (_decoder.CreateSampleIndex(_fileSize, _modifiedTime, &index)) {
+        if (_assetID) {
+          hevc::AssetCache::SetSampleIndex(_assetID, &index);
+        }
+        if (!indexPath) {
+          index.Destroy();
+          return;
+        }
+        dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+          hevc::SampleIndex writtenIndex = index;
+          HEVCWriteSampleIndex(&writtenIndex, indexPath);
+          writtenIndex.Destroy();
+        });
       }
-      [self decodePictureAt:_picture];
     }
+    return;
+  }
+  if (_decoder.LoadSamples(4) < 0) {
+    [self finishWithError:[NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadCorruptFileError userInfo:nil]];
+    return;
   }
-
-  // Detach this thread from the `CADisplayLink` object and release the mutex so
-  // another thread can use the `CADisplayLink` object.
-  [_displayLink removeFromRunLoop:[NSRunLoop currentRunLoop] forMode:NSDefaultRunLoopMode];
-  pthread_mutex_unlock(&_mutex);
 }
 
 /**
  * Decodes HEVC samples to fill the image cache.
- * @param {int} picture
+ * @param {int} frame
  */
-- (void)decodePictureAt:(int)picture {
+- (void)decodeFrameAt:(int)frame {
   // Reset the HEVC decoder to prevent using invalidated objects.
   if (_reset) {
     _reset = NO;
     _decoder.Reset();
+    __atomic_store_n(&_decodingSamples, 0, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&_numberOfDecoderResets, 1, __ATOMIC_RELAXED);
   }
-  // Decode all samples until the HEVC decoder decodes the specified picture.
-  // For an HEVC stream, its samples are not sorted in the playing (frame) order
-  // as listed in the following table.
-  //   +---------+----------+-----------+
-  //   | frame # | sample # | picture # |
-  //   +---------+----------+-----------+
-  //   | 0       | 0        | 0         |
-  //   | 1       | 1        | 4         |
-  //   | 2       | 2        | 2         |
-  //   | 3       | 3        | 1         |
-  //   | 4       | 4        | 3         |
-  //   | 5       | 5        | 8         |
+  // Decode all samples until the HEVC decoder decodes the specified frame. For
+  // an HEVC stream, its samples are not sorted in the playing (frame) order as
+  // listed in the following table.
+  //   +----------+---------+-----------+
+  //   | sample # | frame # | picture # |
+  //   +----------+---------+-----------+
+  //   | 0        | 0       | 0         |
+  //   | 1        | 4       | 4         |
+  //   | 2        | 2       | 2         |
+  //   | 3        | 1       | 1         |
+  //   | 4        | 3       | 3         |
+  //   | 5        | 8       | 8         |
   //     ...
-  //   | 28      | 28       | 27        |
-  //   | 29      | 29       | 29        |
-  //   | 30      | 30       | 0         |
-  //   | 31      | 31       | 4         |
+  //   | 28       | 27      | 27        |
+  //   | 29       | 29      | 29        |
+  //   | 30       | 30      | 0         |
+  //   | 31       | 34      | 4         |
   //     ...
-  //   | 119     | 119      | 29        |
-  //   | 120     | 0        | 0         |
-  //     ...
-  //   +---------+----------+-----------+
+  //   +----------+---------+-----------+
   // To render samples in the playing order, this method decodes samples until
-  // it decodes a sample with the specified picture # in advance. For example,
-  // this method decodes four samples (0, 1, 2, and 3) if `picture` is 1 and
-  // `_sample` is 0.
-  while (!_pictures.GetStatus(picture)) {
+  // it decodes a sample with the specified frame # in advance. For example,
+  // this method decodes four samples (0, 1, 2, and 3) if `frame` is 1 and
+  // `_sample` is 0. (The picture cache is a ring indexed by frame numbers and
+  // its size is bounded by the reorder depth of the stream, i.e. this method
+  // never decodes a sample whose frame does not fit the cache. After seeking a
+  // frame, this method decodes the samples preceding it in the output order
+  // only as references. This method also stops decoding samples when it
+  // reaches a sample that has not been read yet and resumes decoding them
+  // after this view reads it. For a windowed stream, this method also makes
+  // each sample readable before decoding it, which moves the window of the
+  // decoder when the sample is out of its first GOP.)
+  // When this view loops playing the stream, this method continues decoding
+  // the samples of the next loop after the last sample so the first frame of
+  // the next loop is decoded in advance as the other frames are.
+  const int numberOfSamples = _decoder.GetNumberOfSamples();
+  while (!_pictures.GetStatus(frame)) {
+    if (numberOfSamples == 0 || (_sample >= numberOfSamples && !_loop)) {
+      break;
+    }
+    const int status = _decoder.LoadSample(_sample % numberOfSamples);
+    if (status == 0) {
+      break;
+    }
+    if (status < 0) {
+      [self finishWithError:[NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadCorruptFileError userInfo:nil]];
+      break;
+    }
     [self decodeSampleAt:_sample];
-    _sample = (_sample + 1) % _decoder.GetNumberOfSamples();
+    ++_sample;
   }
 }
 
 /**
- * Decodes an HEVC sample at the specified index.
- * @param {int} sample
+ * Returns the maximum number of frames this view can decode ahead of the frame
+ * to be rendered. (The picture cache is a ring indexed by frame numbers, i.e.
+ * the decoder may output frames following the last one in the window by the
+ * reorder depth of the stream.)
+ * @return {int}
  */
-- (void)decodeSampleAt:(int)sample {
-  const int picture = _decoder.GetPictureOrderCount(sample);
-  if (_pictures.GetStatus(picture) == 0) {
-    __weak typeof(self) weakView = self;
-    const uintptr_t session = _pictures.SetStatus(picture, 1);
+- (int)maxDecodeAheadFrames {
+  // Keep only the current frame and the next one under memory pressure.
+  int frames = (int)_pictures.GetCount() - _decoder.GetMaxNumReorderPictures() - 1;
+  if (__atomic_load_n(&HEVCMemoryStage, __ATOMIC_RELAXED) != HEVCMemoryStageNormal) {
+    frames = frames < HEVCMinDecodeAhead ? frames : HEVCMinDecodeAhead;
+  }
+  return frames > 1 ? frames : 1;
+}
+
+/**
+ * Returns the number of frames this view should keep decoded ahead of the
+ * specified frame. This view estimates the worst latency of Video Toolbox from
+ * its smoothed latency and mean deviation, adds the refresh interval of the
+ * display (by which a frame should be decoded before it is due), and divides
+ * it by the frame interval. This method also starts dropping discardable
+ * frames when the picture cache is too small for the estimated latency, e.g.
+ * when the device is throttled or many views are decoding their files.
+ * @param {int} frame
+ * @return {int}
+ */
+- (int)decodeAheadFramesOfFrame:(int)frame {
+  const int limit = [self maxDecodeAheadFrames];
+  CFTimeInterval frameInterval = [self presentationTimeOfFrame:frame + 1] - [self presentationTimeOfFrame:frame];
+  frameInterval = frameInterval > 0.0 ? frameInterval : HEVCDefaultFrameInterval;
+  const double latency = (double)__atomic_load_n(&_decodeLatency, __ATOMIC_RELAXED);
+  const double deviation = (double)__atomic_load_n(&_decodeDeviation, __ATOMIC_RELAXED);
+  const CFTimeInterval deadline = (latency + HEVCLatencyDeviations * deviation) * 1e-9 + [HEVCPlaybackEngine sharedEngine].refreshInterval;
+  const int frames = (int)ceil(deadline / frameInterval) + 1;
+  if (frames > limit) {
+    _dropFrame = frame + limit;
+    return limit;
+  }
+  return frames > HEVCMinDecodeAhead ? frames : (HEVCMinDecodeAhead < limit ? HEVCMinDecodeAhead : limit);
+}
+
+/**
+ * Decodes HEVC samples so the specified frame and the frames following it are
+ * decoded (or being decoded) in advance. This view stops submitting samples
+ * when Video Toolbox has as many samples as the frames it keeps decoded, i.e.
+ * when decoded frames are piling up in Video Toolbox, and it resumes when the
+ * output handler receives their images.
+ * @param {int} frame
+ */
+- (void)decodeAheadOfFrame:(int)frame {
+  [self decodeFrameAt:frame];
+  const int frames = [self decodeAheadFramesOfFrame:frame];
+  for (int next = frame + 1; next < frame + frames && _pictures.GetStatus(next - 1); ++next) {
+    // Set the throttle flag before reading the number of samples being decoded
+    // so an output handler called in between sees it.
+    __atomic_store_n(&_throttled, YES, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&_decodingSamples, __ATOMIC_SEQ_CST) >= frames) {
+      return;
+    }
+    __atomic_store_n(&_throttled, NO, __ATOMIC_RELAXED);
+    [self decodeFrameAt:next];
+  }
+}
+
+/**
+ * Updates the smoothed latency of Video Toolbox and its mean deviation with
+ * the specified latency as TCP updates its round-trip time (RFC 6298), i.e.
+ * `deviation += (|latency - smoothed| - deviation) / 4` and
+ * `smoothed += (latency - smoothed) / 8`. (This method is called by the output
+ * handler of Video Toolbox, which calls it on one thread at a time.)
+ * @param {CFTimeInterval} latency
+ */
+- (void)updateDecodeLatency:(CFTimeInterval)latency {
+  const double bin = latency / HEVCLatencyBinWidth;
+  __atomic_fetch_add(&_latencyHistogram[bin < HEVCLatencyBins ? (int)bin : HEVCLatencyBins], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&_numberOfDecodedFrames, 1, __ATOMIC_RELAXED);
+  const int64_t sample = (int64_t)(latency * 1e9);
+  if (sample > __atomic_load_n(&_maxDecodeLatency, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&_maxDecodeLatency, sample, __ATOMIC_RELAXED);
+  }
+  int64_t smoothed = __atomic_load_n(&_decodeLatency, __ATOMIC_RELAXED);
+  int64_t deviation = __atomic_load_n(&_decodeDeviation, __ATOMIC_RELAXED);
+  if (smoothed == 0) {
+    smoothed = sample;
+    deviation = sample / 2;
+  } else {
+    const int64_t error = sample - smoothed;
+    deviation += ((error >= 0 ? error : -error) - deviation) / 4;
+    smoothed += error / 8;
+  }
+  __atomic_store_n(&_decodeDeviation, deviation, __ATOMIC_RELAXED);
+  __atomic_store_n(&_decodeLatency, smoothed > 0 ? smoothed : 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Called by the output handler of Video Toolbox when it finishes decoding a
+ * sample. This method schedules this view when it has stopped decoding ahead
+ * for waiting for Video Toolbox.
+ */
+- (void)didDecodeSample {
+  __atomic_fetch_sub(&_decodingSamples, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_exchange_n(&_throttled, NO, __ATOMIC_SEQ_CST)) {
+    [[HEVCPlaybackEngine sharedEngine] scheduleClient:self];
+  }
+}
+
+/**
+ * Decodes an HEVC sample at the specified position, the sample number counted
+ * from the beginning of the first loop.
+ * @param {int} position
+ */
+- (void)decodeSampleAt:(int)position {
+  // Decode a sample preceding the frame to be rendered (i.e. a sample between
+  // a sync sample and a seek target) without outputting its image. This view
+  // also decodes a sample without outputting its image when it decodes the
+  // samples it has skipped again and it has the image of the sample.
+  const int numberOfSamples = _decoder.GetNumberOfSamples();
+  const int sample = position % numberOfSamples;
+  const int fileFrame = _decoder.GetFrameNumber(sample);
+  const int frame = position - sample + fileFrame;
+  const BOOL catchingUp = position < _catchUpSample;
+  if (_decoder.GetSyncSample(sample) == sample) {
+    [self updateOutputSize];
+    if (position != _randomAccessSample) {
+      _randomAccessSample = -1;
+    }
+  }
+  // Skip the RASL samples of the sync sample at which this view started
+  // decoding. (They refer to the pictures preceding the sync sample, and no
+  // samples except RASL ones refer to them.) A skipped sample that should be
+  // output is dropped so this view does not wait for its image.
+  if (_randomAccessSample >= 0 && _decoder.IsRandomAccessSkippedSample(sample)) {
+    if (frame >= _frame && !_pictures.GetStatus(frame)) {
+      _pictures.Drop(frame);
+    }
+    _decodedSample = position;
+    return;
+  }
+  __weak typeof(self) weakView = self;
+  if (frame < _frame || (catchingUp && _pictures.GetStatus(frame))) {
+    // Skip a discardable sample, which is not a reference of any samples.
+    _decodedSample = position;
+    if (_decoder.IsDiscardableSample(sample)) {
+      return;
+    }
+    const uint64_t signpostID = Trace::GenerateID();
+    HEVC_TRACE_BEGIN("DecodeSample", signpostID);
+    __atomic_fetch_add(&_decodingSamples, 1, __ATOMIC_SEQ_CST);
+    int status = _decoder.DecodeSample(sample, kVTDecodeFrame_DoNotOutputFrame, ^(OSStatus status,
+                                                                                 VTDecodeInfoFlags flags,
+                                                                                 CVImageBufferRef imageBuffer,
+                                                                                 CMTime timestamp,
+                                                                                 CMTime duration) {
+      HEVC_TRACE_END("DecodeSample", signpostID);
+      [weakView didDecodeSample];
+    });
+    if (status) {
+      HEVC_TRACE_END("DecodeSample", signpostID);
+      __atomic_fetch_sub(&_decodingSamples, 1, __ATOMIC_SEQ_CST);
+      _reset = YES;
+    }
+    return;
+  }
+  if (_pictures.GetStatus(frame) == 0) {
+    // Copy the image of this frame from the asset cache when another player of
+    // the file has decoded it. Then, when this view needs to decode a frame
+    // after skipping samples, move the position back to the first sample the
+    // decoder has not consumed (or to their sync sample when the decoder has
+    // not consumed it) so the decoder has the references of the frame. (This
+    // view decodes each skipped sample at most once in this case.)
+    if (_assetID && !catchingUp) {
+      CVImageBufferRef image = hevc::AssetCache::CopyFrame(_assetID, fileFrame, (uint32_t)_decoder.GetOutputWidth());
+      if (image) {
+        _pictures.SetImage(_pictures.Reserve(frame), image);
+        CFRelease(image);
+        return;
+      }
+    }
+    // Drop a discardable frame instead of decoding it when Video Toolbox cannot
+    // decode frames in time, or drop odd discardable frames when the quality
+    // tier halves frame rates. (The decoder does not need the sample as a
+    // reference of the following samples.)
+    const BOOL late = frame < _dropFrame && frame + [self maxDecodeAheadFrames] >= _dropFrame;
+    const BOOL halfRate = (frame & 1) && __atomic_load_n(&HEVCQualityTier, __ATOMIC_RELAXED) >= HEVCPlayerQualityTierHalfRate;
+    if ((late || halfRate) && _decoder.IsDiscardableSample(sample)) {
+      _pictures.Drop(frame);
+      __atomic_fetch_add(&_numberOfDroppedFrames, 1, __ATOMIC_RELAXED);
+      _decodedSample = position;
+      return;
+    }
+    if (_decodedSample < position - 1) {
+      const int syncSample = position - sample + _decoder.GetSyncSample(sample);
+      const int resumeSample = _decodedSample >= syncSample ? _decodedSample + 1 : syncSample;
+      if (resumeSample < position) {
+        if (resumeSample == syncSample && _decodedSample != syncSample - 1) {
+          _randomAccessSample = syncSample;
+        }
+        _catchUpSample = position;
+        _sample = resumeSample - 1;
+        return;
+      }
+    }
+    _decodedSample = position;
+    const uint64_t token = _pictures.Reserve(frame);
+    const uint32_t assetID = _assetID;
+    const size_t imageSize = (size_t)_decoder.GetOutputWidth() * _decoder.GetOutputHeight() * 5 / 2;
+    const CFTimeInterval submitTime = CACurrentMediaTime();
+    const uint64_t signpostID = Trace::GenerateID();
+    HEVC_TRACE_BEGIN("DecodeSample", signpostID);
+    __atomic_fetch_add(&_decodingSamples, 1, __ATOMIC_SEQ_CST);
     int status = _decoder.DecodeSample(sample, ^(OSStatus status,
                                                  VTDecodeInfoFlags flags,
                                                  CVImageBufferRef imageBuffer,
                                                  CMTime timestamp,
                                                  CMTime duration) {
+      HEVC_TRACE_END("DecodeSample", signpostID);
       typeof(self) view = weakView;
       if (view) {
+        // Measure the latency of Video Toolbox before attaching the image so
+        // the worker thread decoding the next samples sees it.
         HEVCPictureArray* pictures = &view->_pictures;
+        if (!status && imageBuffer) {
+          [view updateDecodeLatency:CACurrentMediaTime() - submitTime];
+        }
+        [view didDecodeSample];
         if (status) {
           // Just write the error code to the console. (Unfortunately, the
           // `NSError` interface cannot stringify Video Toolbox errors.)
           NSLog(@"%s:error: status=%d\n", __FUNCTION__, status);
-          pictures->SetStatus(picture, 0);
+          pictures->Cancel(token);
           _reset = YES;
           return;
         }
         if (imageBuffer) {
-          pictures->SetImage(picture, imageBuffer, 2, session);
+          pictures->SetImage(token, imageBuffer);
+          if (assetID) {
+            hevc::AssetCache::AddFrame(assetID, (uint32_t)fileFrame, imageBuffer, imageSize);
+          }
         }
       }
     });
@@ -788,7 +3157,9 @@ struct HEVCPictureArray {
     // inactive application decodes samples. In this case, this player discards
     // all cached images and re-decodes them next time when it becomes active.)
     if (status) {
-      _pictures.SetStatus(picture, 0);
+      HEVC_TRACE_END("DecodeSample", signpostID);
+      __atomic_fetch_sub(&_decodingSamples, 1, __ATOMIC_SEQ_CST);
+      _pictures.Cancel(token);
       _reset = YES;
       return;
     }
@@ -796,125 +3167,259 @@ struct HEVCPictureArray {
 }
 
 /**
- * Called when this player receives a `CADisplayLink` event. This method
- * retrieves the next frame from the cache and draws it. (This player decodes
- * samples on idle or after rendering a frame so it can render frames
- * immediately when it receives `CADisplayLink` events.)
- * @param {CADisplayLink*} sender
+ * Called when this player receives a display-link event. This method retrieves
+ * the next frame from the cache and draws it. (This player decodes samples
+ * after rendering a frame so it can render frames immediately when it receives
+ * display-link events.)
+ * @param {CFTimeInterval} timestamp
  */
-- (void)updateFrame:(CADisplayLink*)sender {
-  // Measure time elapsed since the last time when this player renders a picture
-  // to render pictures at the specified interval.
-  const CFTimeInterval timestamp = sender.timestamp;
-  if (_lastTimestamp >= 0.0) {
-    if (timestamp - _lastTimestamp < _timeInterval) {
-      return;
-    }
-  }
-  _lastTimestamp = timestamp;
-
+- (void)renderFrameAtTime:(CFTimeInterval)timestamp {
   // Exit this method if this player is inactive, i.e. if this player cannot use
   // Metal.
-  if (_displayLink.isPaused) {
+  if (_paused) {
     return;
   }
 
   // Stop playing the QuickTime stream when this player has rendered its final
   // frame.
-  if (_frame >= _decoder.GetNumberOfFrames()) {
+  if (!_loop && _frame >= _decoder.GetNumberOfFrames()) {
     [self finish];
     return;
   }
 
+  // Skip the frames dropped by the decoder, i.e. keep presenting the image of
+  // their preceding frame until the next decoded frame is due.
+  while ((_loop || _frame < _decoder.GetNumberOfFrames()) && _pictures.IsDropped(_frame)) {
+    _pictures.GetImage(_frame);
+    ++_frame;
+    if (_loop && _frame % _decoder.GetNumberOfFrames() == 0) {
+      __atomic_fetch_add(&_numberOfLoops, 1, __ATOMIC_RELAXED);
+    }
+  }
+
+  // Choose the frame presented at the given display time. This view keeps
+  // presenting the current image (i.e. duplicates it) until the presentation
+  // time of the next frame, and it drops decoded frames whose following frames
+  // are also due. (This view shifts its presentation times when it starts
+  // playing the stream or when the next frame is too late.)
+  const int numberOfFrames = _decoder.GetNumberOfFrames();
+  const CFTimeInterval presentationTime = [self presentationTimeOfFrame:_frame];
+  if (_baseTimestamp < 0.0 || timestamp - _baseTimestamp - presentationTime > HEVCMaxFrameDelay) {
+    _baseTimestamp = timestamp - presentationTime;
+  }
+  if (timestamp + HEVCFrameTimeTolerance < _baseTimestamp + presentationTime) {
+    return;
+  }
+  while ((_loop || _frame + 1 < numberOfFrames) && _pictures.GetStatus(_frame) == HEVCPictureArray::DECODED && _pictures.GetStatus(_frame + 1) == HEVCPictureArray::DECODED) {
+    if (timestamp + HEVCFrameTimeTolerance < _baseTimestamp + [self presentationTimeOfFrame:_frame + 1]) {
+      break;
+    }
+    CVImageBufferRef droppedBuffer = _pictures.GetImage(_frame);
+    if (droppedBuffer) {
+      CFRelease(droppedBuffer);
+    }
+    ++_frame;
+  }
+
   @autoreleasepool {
-    // Render the `_picture`-th picture in the picture cache. (This view decodes
+    // Render the `_frame`-th frame in the picture cache. (This view decodes
     // samples of the HEVC-with-Alpha stream on idle so this method can render
     // decoded images immediately.)
-    CVImageBufferRef imageBuffer = _pictures.GetImage(_picture);
+    CVImageBufferRef imageBuffer = _pictures.GetImage(_frame);
+    if (!imageBuffer && _stalledFrame != _frame) {
+      // Count a loop stall when the first frame of a loop is not decoded when
+      // it is due.
+      _stalledFrame = _frame;
+      if (_frame > 0 && _frame % numberOfFrames == 0) {
+        __atomic_fetch_add(&_numberOfLoopStalls, 1, __ATOMIC_RELAXED);
+      }
+      // Drop discardable frames in the next window when Video Toolbox has not
+      // finished decoding this frame in time (instead of waiting for the frame
+      // to be read from the file).
+      if (_pictures.GetStatus(_frame) == HEVCPictureArray::DECODING) {
+        _dropFrame = _frame + [self maxDecodeAheadFrames];
+      }
+    }
+    if (!imageBuffer) {
+      __atomic_fetch_add(&_numberOfDuplicatedFrames, 1, __ATOMIC_RELAXED);
+    }
     if (imageBuffer) {
-      const size_t width = CVPixelBufferGetWidth(imageBuffer);
-      const size_t height = CVPixelBufferGetHeight(imageBuffer);
-#if HEVC_DEBUG
-      int is_planar = CVPixelBufferIsPlanar(imageBuffer);
-      OSType pixel_format_type = CVPixelBufferGetPixelFormatType(imageBuffer);
-      size_t bytes_per_row = CVPixelBufferGetBytesPerRow(imageBuffer);
-      NSLog(@"is_planar=%d, pixel_format_type=%d\n",
-            is_planar, pixel_format_type);
-      NSLog(@"width=%zu, height=%zu, bytes_per_row=%zu\n",
-            width, height, bytes_per_row);
-#endif
-      // Create a `CAMetalDrawable` object for the next display frame and draw the
-      // decoded image (consisting of three planes (Y, UV, and alpha)) onto it.
-      // (`[CAMetalLayer nextDrawable:]` is a blocking method and it should not be
-      // executed on the main thread.)
-      CAMetalLayer *metalLayer = _metalLayer;
-      metalLayer.drawableSize = CGSizeMake((float)width, (float)height);
-      id<CAMetalDrawable> metalDrawable = [metalLayer nextDrawable];
-      if (metalDrawable) {
-        CVMetalTextureRef textureY;
-        CVMetalTextureCacheRef textureCache = _textureCache;
-        CVReturn resultY = CVMetalTextureCacheCreateTextureFromImage(kCFAllocatorDefault, textureCache, imageBuffer, nil, MTLPixelFormatR8Unorm, width, height, 0, &textureY);
-        if (resultY == kCVReturnSuccess) {
-          CVMetalTextureRef textureUV;
-          CVReturn resultUV = CVMetalTextureCacheCreateTextureFromImage(kCFAllocatorDefault, textureCache, imageBuffer, nil, MTLPixelFormatRG8Unorm, width / 2, height / 2, 1, &textureUV);
-          if (resultUV == kCVReturnSuccess) {
-            CVMetalTextureRef textureA;
-            CVReturn resultA = CVMetalTextureCacheCreateTextureFromImage(kCFAllocatorDefault, textureCache, imageBuffer, nil, MTLPixelFormatR8Unorm, width, height, 2, &textureA);
-            if (resultA == kCVReturnSuccess) {
-              MTLRenderPassDescriptor *renderPassDescriptor = _renderPassDescriptor;
-              renderPassDescriptor.colorAttachments[0].texture = metalDrawable.texture;
-              id<MTLCommandBuffer> commandBuffer = [_commandQueue commandBuffer];
-              if (commandBuffer) {
-                id<MTLRenderCommandEncoder> commandEncoder = [commandBuffer renderCommandEncoderWithDescriptor:renderPassDescriptor];
-                if (commandEncoder) {
-#if HEVC_DEBUG
-                  commandEncoder.label = @"Render an YUVA420 image";
-#endif
-                  [commandEncoder setRenderPipelineState:_renderPipelineState];
-                  [commandEncoder setFragmentTexture:CVMetalTextureGetTexture(textureY) atIndex:0];
-                  [commandEncoder setFragmentTexture:CVMetalTextureGetTexture(textureUV) atIndex:1];
-                  [commandEncoder setFragmentTexture:CVMetalTextureGetTexture(textureA) atIndex:2];
-                  [commandEncoder drawPrimitives:MTLPrimitiveTypeTriangleStrip vertexStart:0 vertexCount:4];
-                  [commandEncoder endEncoding];
-                  [commandBuffer presentDrawable:metalDrawable];
-                  [commandBuffer commit];
-                }
-              }
-              CFRelease(textureA);
-            }
-            CFRelease(textureUV);
-          }
-          CFRelease(textureY);
+      // Hand the image to the compositor (which draws it with the images of
+      // the other players in one render pass) or to the application (which
+      // draws it in its own render pass) when this view has output modes.
+      // This view presents the image at the presentation time of its frame (or
+      // on the next display frame if the time has passed), and it keeps the
+      // frame when it cannot draw the image without waiting for a drawable.
+      const CFTimeInterval presentTime = _baseTimestamp + [self presentationTimeOfFrame:_frame];
+      BOOL presented = YES;
+      if (__atomic_load_n(&_outputModes, __ATOMIC_RELAXED)) {
+        [self publishImage:imageBuffer hostTime:timestamp frameIndex:_frame % numberOfFrames];
+      } else {
+        presented = [self drawImage:imageBuffer atTime:presentTime > timestamp ? presentTime : timestamp];
+      }
+      if (!presented && _finished) {
+        // Drop the image when this view has stopped playing the file because
+        // it cannot draw the image.
+        CFRelease(imageBuffer);
+        return;
+      }
+      if (!presented) {
+        // Put the image back to its slot so this view draws it on the next
+        // display-link event. (`GetImage()` has emptied the slot.)
+        _pictures.SetImage(_pictures.Reserve(_frame), imageBuffer);
+        CFRelease(imageBuffer);
+        __atomic_fetch_add(&_numberOfDuplicatedFrames, 1, __ATOMIC_RELAXED);
+        if (!_paused) {
+          [self decodeAheadOfFrame:_frame];
         }
+        return;
       }
       CFRelease(imageBuffer);
 
-      // Increase the picture number so it refers to the next input image, and
-      // increase the frame number so it refers to the next output image.
-      _picture = (_picture + 1) % _pictures.GetCount();
+      // Measure the time to the first frame of the file.
+      CFTimeInterval playTime = 0.0;
+      CFTimeInterval noTime = 0.0;
+      __atomic_exchange(&_playTime, &noTime, &playTime, __ATOMIC_RELAXED);
+      if (playTime > 0.0) {
+        const CFTimeInterval timeToFirstFrame = (presentTime > timestamp ? presentTime : timestamp) - playTime;
+        __atomic_store(&_timeToFirstFrame, &timeToFirstFrame, __ATOMIC_RELAXED);
+      }
+
+      // Increase the frame number so it refers to the next output image. (This
+      // view does not reset the frame number when it loops the stream, i.e.
+      // the first frame of the next loop is in the picture cache as the other
+      // frames are.)
       ++_frame;
+      NSInteger index = _frame;
       if (_loop) {
-        if (_frame == _decoder.GetNumberOfFrames()) {
-          _frame = 0;
-          _picture = 0;
-          _sample = 0;
+        index = _frame % numberOfFrames;
+        if (index == 0) {
+          __atomic_fetch_add(&_numberOfLoops, 1, __ATOMIC_RELAXED);
         }
       }
       if (self.delegate) {
-        [self.delegate playerView:self didUpdateFrame:(NSInteger)_frame];
+        [self.delegate playerView:self didUpdateFrame:index];
       }
 
       // Decode the next samples in advance if this player is still active.
       // (This player may become inactive while it renders an image above. In
       // this case, it decodes the next samples when it becomes active again.)
-      if (!_displayLink.isPaused) {
-        [self decodePictureAt:_picture];
+      if (!_paused) {
+        [self decodeAheadOfFrame:_frame];
+      }
+    }
+  }
+}
+
+/**
+ * Draws the specified image to the `CAMetalLayer` object of this view and
+ * schedules presenting it at the specified host time. This method returns NO
+ * without drawing the image when all drawables are in flight, and it also
+ * finishes playing the file with an error when the device cannot create the
+ * render pipeline for the image.
+ * @param {CVImageBufferRef} imageBuffer
+ * @param {CFTimeInterval} presentTime
+ * @return {BOOL}
+ */
+- (BOOL)drawImage:(CVImageBufferRef)imageBuffer atTime:(CFTimeInterval)presentTime {
+  // Select the render pipeline specialized for the color properties of the
+  // image. (They rarely change, i.e. this view usually reuses the pipeline
+  // used last time.)
+  const HEVCRenderPipelineOptions options = HEVCGetRenderPipelineOptions(imageBuffer, _decoder.IsPremultipliedAlpha(0));
+  if (!_renderPipelineState || options != _renderPipelineOptions) {
+    _renderPipelineState = [_pipelineCache pipelineStateWithOptions:options];
+    _renderPipelineOptions = options;
+    if (!_renderPipelineState) {
+      // Stop playing the file because the pipeline cache does not try creating
+      // the pipeline again, i.e. this view cannot draw its images.
+      [self finishWithError:[NSError errorWithDomain:NSCocoaErrorDomain code:NSFeatureUnsupportedError userInfo:nil]];
+      return NO;
+    }
+  }
+  if (dispatch_semaphore_wait(_drawableSemaphore, DISPATCH_TIME_NOW)) {
+    return NO;
+  }
+  BOOL committed = NO;
+  const size_t width = CVPixelBufferGetWidth(imageBuffer);
+  const size_t height = CVPixelBufferGetHeight(imageBuffer);
+#if HEVC_DEBUG
+  int is_planar = CVPixelBufferIsPlanar(imageBuffer);
+  OSType pixel_format_type = CVPixelBufferGetPixelFormatType(imageBuffer);
+  size_t bytes_per_row = CVPixelBufferGetBytesPerRow(imageBuffer);
+  NSLog(@"is_planar=%d, pixel_format_type=%d\n",
+        is_planar, pixel_format_type);
+  NSLog(@"width=%zu, height=%zu, bytes_per_row=%zu\n",
+        width, height, bytes_per_row);
+#endif
+  // Create a `CAMetalDrawable` object for the next display frame and draw the
+  // decoded image (consisting of three planes (Y, UV, and alpha)) onto it.
+  // (`[CAMetalLayer nextDrawable:]` is a blocking method and it should not be
+  // executed on the main thread.) The drawable has the size of the layer in
+  // pixels so a small view does not allocate or write full-size drawables.
+  [self updateDrawableSizeWithWidth:width height:height];
+  CAMetalLayer *metalLayer = _metalLayer;
+  HEVC_TRACE_BEGIN("WaitDrawable", HEVC_TRACE_EXCLUSIVE);
+  id<CAMetalDrawable> metalDrawable = [metalLayer nextDrawable];
+  HEVC_TRACE_END("WaitDrawable", HEVC_TRACE_EXCLUSIVE);
+  if (metalDrawable) {
+    CVMetalTextureRef textureY;
+    CVMetalTextureCacheRef textureCache = _textureCache;
+    CVReturn resultY = CVMetalTextureCacheCreateTextureFromImage(kCFAllocatorDefault, textureCache, imageBuffer, nil, MTLPixelFormatR8Unorm, width, height, 0, &textureY);
+    if (resultY == kCVReturnSuccess) {
+      CVMetalTextureRef textureUV;
+      CVReturn resultUV = CVMetalTextureCacheCreateTextureFromImage(kCFAllocatorDefault, textureCache, imageBuffer, nil, MTLPixelFormatRG8Unorm, width / 2, height / 2, 1, &textureUV);
+      if (resultUV == kCVReturnSuccess) {
+        CVMetalTextureRef textureA;
+        CVReturn resultA = CVMetalTextureCacheCreateTextureFromImage(kCFAllocatorDefault, textureCache, imageBuffer, nil, MTLPixelFormatR8Unorm, width, height, 2, &textureA);
+        if (resultA == kCVReturnSuccess) {
+          MTLRenderPassDescriptor *renderPassDescriptor = _renderPassDescriptor;
+          renderPassDescriptor.colorAttachments[0].texture = metalDrawable.texture;
+          id<MTLCommandBuffer> commandBuffer = [_commandQueue commandBuffer];
+          if (commandBuffer) {
+            id<MTLRenderCommandEncoder> commandEncoder = [commandBuffer renderCommandEncoderWithDescriptor:renderPassDescriptor];
+            if (commandEncoder) {
+#if HEVC_DEBUG
+              commandEncoder.label = @"Render an YUVA420 image";
+#endif
+              [commandEncoder setRenderPipelineState:_renderPipelineState];
+              [commandEncoder setFragmentTexture:CVMetalTextureGetTexture(textureY) atIndex:0];
+              [commandEncoder setFragmentTexture:CVMetalTextureGetTexture(textureUV) atIndex:1];
+              [commandEncoder setFragmentTexture:CVMetalTextureGetTexture(textureA) atIndex:2];
+              [commandEncoder setFragmentBytes:&_filter length:sizeof(_filter) atIndex:0];
+              [commandEncoder drawPrimitives:MTLPrimitiveTypeTriangleStrip vertexStart:0 vertexCount:4];
+              [commandEncoder endEncoding];
+              dispatch_semaphore_t drawableSemaphore = _drawableSemaphore;
+              [metalDrawable addPresentedHandler:^(id<MTLDrawable> drawable) {
+                dispatch_semaphore_signal(drawableSemaphore);
+              }];
+              [commandBuffer presentDrawable:metalDrawable atTime:presentTime];
+              const uint64_t signpostID = Trace::GenerateID();
+              [commandBuffer addCompletedHandler:^(id<MTLCommandBuffer> buffer) {
+                HEVC_TRACE_END("RenderFrame", signpostID);
+              }];
+              HEVC_TRACE_BEGIN("RenderFrame", signpostID);
+              [commandBuffer commit];
+              committed = YES;
+            }
+          }
+          CFRelease(textureA);
+        }
+        CFRelease(textureUV);
       }
+      CFRelease(textureY);
     }
   }
+  if (!committed) {
+    dispatch_semaphore_signal(_drawableSemaphore);
+  }
+  return YES;
 }
 
 - (void)clearScreen {
+  if (__atomic_load_n(&_outputModes, __ATOMIC_RELAXED)) {
+    [self clearPublishedImages];
+    return;
+  }
   @autoreleasepool {
     // Commit an empty command buffer to clear the `CAMetalLayer` object.
     CAMetalLayer *metalLayer = _metalLayer;
@@ -936,4 +3441,122 @@ struct HEVCPictureArray {
   }
 }
 
+#pragma mark - compositor methods
+
+- (void)setComposited:(BOOL)composited {
+  [self setOutputMode:HEVCOutputCompositor enabled:composited];
+  if (!composited) {
+    [self updateLayerSize];
+  }
+}
+
+- (void)setSpritePixelWidth:(uint32_t)width height:(uint32_t)height {
+  __atomic_store_n(&_layerSize, ((uint64_t)width << 32) | height, __ATOMIC_RELAXED);
+}
+
+- (BOOL)hasPremultipliedAlpha {
+  return __atomic_load_n(&_premultipliedAlpha, __ATOMIC_RELAXED) ? YES : NO;
+}
+
+- (CVImageBufferRef)copyCompositedImage {
+  pthread_mutex_lock(&_publishedMutex);
+  CVImageBufferRef image = _publishedFrames[0].image;
+  if (image) {
+    CFRetain(image);
+  }
+  pthread_mutex_unlock(&_publishedMutex);
+  return image;
+}
+
+/**
+ * Enables or disables the specified output mode. This view deletes its
+ * published images when it does not have output modes.
+ * @param {uint32_t} mode
+ * @param {BOOL} enabled
+ */
+- (void)setOutputMode:(uint32_t)mode enabled:(BOOL)enabled {
+  if (enabled) {
+    __atomic_fetch_or(&_outputModes, mode, __ATOMIC_RELAXED);
+  } else if (!(__atomic_and_fetch(&_outputModes, ~mode, __ATOMIC_RELAXED))) {
+    [self clearPublishedImages];
+  }
+  // Resume or suspend this view because a view with output modes is always
+  // visible. (The visibility of a view is updated on the main thread.)
+  if ([NSThread isMainThread]) {
+    [self updateVisibility];
+  } else {
+    __weak typeof(self) weakView = self;
+    dispatch_async(dispatch_get_main_queue(), ^{
+      [weakView updateVisibility];
+    });
+  }
+}
+
+/**
+ * Publishes the specified image presented at the specified host time. This
+ * view keeps the previous image so the application can retrieve the image for
+ * a host time before the latest one.
+ * @param {CVImageBufferRef} image
+ * @param {CFTimeInterval} hostTime
+ * @param {NSInteger} frameIndex
+ */
+- (void)publishImage:(CVImageBufferRef)image hostTime:(CFTimeInterval)hostTime frameIndex:(NSInteger)frameIndex {
+  CFRetain(image);
+  pthread_mutex_lock(&_publishedMutex);
+  CVImageBufferRef droppedImage = _publishedFrames[1].image;
+  _publishedFrames[1] = _publishedFrames[0];
+  _publishedFrames[0].image = image;
+  _publishedFrames[0].hostTime = hostTime;
+  _publishedFrames[0].frameIndex = frameIndex;
+  pthread_mutex_unlock(&_publishedMutex);
+  if (droppedImage) {
+    CFRelease(droppedImage);
+  }
+}
+
+/**
+ * Deletes the published images.
+ */
+- (void)clearPublishedImages {
+  pthread_mutex_lock(&_publishedMutex);
+  HEVCPublishedFrame frames[2] = {_publishedFrames[0], _publishedFrames[1]};
+  memset(_publishedFrames, 0, sizeof(_publishedFrames));
+  pthread_mutex_unlock(&_publishedMutex);
+  for (int i = 0; i < 2; ++i) {
+    if (frames[i].image) {
+      CFRelease(frames[i].image);
+    }
+  }
+}
+
+#pragma mark - frame provider methods
+
+- (BOOL)providesFrames {
+  return (__atomic_load_n(&_outputModes, __ATOMIC_RELAXED) & HEVCOutputProvider) != 0;
+}
+
+- (void)setProvidesFrames:(BOOL)providesFrames {
+  [self setOutputMode:HEVCOutputProvider enabled:providesFrames];
+}
+
+- (HEVCPlayerFrame *)frameForHostTime:(CFTimeInterval)hostTime {
+  // Return the latest image unless it is presented after the given time and
+  // the previous one is not.
+  pthread_mutex_lock(&_publishedMutex);
+  HEVCPublishedFrame published = _publishedFrames[0];
+  if (published.hostTime > hostTime + HEVCFrameTimeTolerance && _publishedFrames[1].image) {
+    published = _publishedFrames[1];
+  }
+  if (published.image) {
+    CFRetain(published.image);
+  }
+  pthread_mutex_unlock(&_publishedMutex);
+  if (!published.image) {
+    return nil;
+  }
+  HEVCPlayerFrame *frame = [[HEVCPlayerFrame alloc] initWithPixelBuffer:published.image textureCache:_textureCache hostTime:published.hostTime frameIndex:published.frameIndex];
+  CFRelease(published.image);
+  return frame;
+}
+
 @end
@@ -41,7 +41,32 @@
 @property (readonly, nonatomic) NSInteger height;
 
 /**
- * Initializes this asset.
+ * The duration in seconds.
+ * @type {NSTimeInterval}
+ */
+@property (readonly, nonatomic) NSTimeInterval duration;
+
+/**
+ * The number of frames.
+ * @type {NSInteger}
+ */
+@property (readonly, nonatomic) NSInteger frameCount;
+
+/**
+ * The average frame rate in frames per second.
+ * @type {double}
+ */
+@property (readonly, nonatomic) double fps;
+
+/**
+ * Whether or not the HEVC stream has an alpha-channel-information SEI.
+ * @type {BOOL}
+ */
+@property (readonly, nonatomic) BOOL hasAlpha;
+
+/**
+ * Initializes this asset. This method reads only the header atoms of the
+ * QuickTime file, i.e. it does not read its sample data.
  * @param {NSURL*} url
  */
 - (id _Nullable)initWithURL:(NSURL* _Nonnull)url;
@@ -27,8 +27,11 @@
 #import <AVFoundation/AVFoundation.h>
 #import <CoreFoundation/CoreFoundation.h>
 
+#include <fcntl.h>
+#include <unistd.h>
+#include "hevc/decoder.h"
 #include "mov/atom.h"
-#include "mov/atom_collection.h"
+#include "mov/atom_reader.h"
 
 @implementation HEVCQuickTimeAsset {
 }
@@ -38,36 +41,60 @@
   if (self) {
     _width = 0;
     _height = 0;
+    _duration = 0.0;
+    _frameCount = 0;
+    _fps = 0.0;
+    _hasAlpha = NO;
 
-    // Search for a VideoSampleDescription atom in the QuickTime file to
-    // retrieve its sample size.
-    NSFileHandle *handle = [NSFileHandle fileHandleForReadingAtPath:[url path]];
-    if (handle) {
-      NSData *data;
-      if (@available(iOS 13.0, *)) {
-        data = [handle readDataToEndOfFileAndReturnError:nil];
-      } else {
-        data = [handle readDataToEndOfFile];
-      }
-      if (data) {
-        mov::AtomCollection map;
-        map.Initialize();
-        if (map.Enumerate(static_cast<const uint8_t*>(data.bytes), data.length)) {
-          const mov::SampleDescriptionAtom *sample_description_atom = map.GetSampleDescriptionAtom();
-          uint32_t number_of_descriptions = sample_description_atom->GetCount();
-          const mov::SampleDescription *sample_description = sample_description_atom->GetFirstDescription();
-          do {
-            const mov::FourCC format = sample_description->GetType();
-            if (format == mov::FORMAT_HVC1) {
-              const mov::VideoSampleDescription *video_sample_description = sample_description->GetVideoSampleDescription();
-              _width = video_sample_description->GetWidth();
-              _height = video_sample_description->GetHeight();
-              break;
+    // Read only the header atoms of the QuickTime file (i.e. `mdhd`, `stsd`,
+    // and `stts`) with `pread()` to retrieve its stream information. (This
+    // method skips its `mdat` atom without reading it.)
+    int file = open([[url path] fileSystemRepresentation], O_RDONLY);
+    if (file >= 0) {
+      mov::AtomReader reader;
+      reader.Initialize();
+      if (reader.Read(file)) {
+        // Decode the `hvcC` extension of the sample description to retrieve
+        // the frame size and whether or not the stream has an alpha-channel-
+        // information SEI. (This decoder does not create any resources.)
+        hevc::Decoder decoder;
+        decoder.Initialize();
+        if (decoder.DecodeSampleDescription(reader.GetSampleDescriptionAtom())) {
+          _width = decoder.GetFrameWidth();
+          _height = decoder.GetFrameHeight();
+          _hasAlpha = decoder.HasAlphaChannelInformation() ? YES : NO;
+        }
+        decoder.Destroy();
+
+        // Calculate the duration and the frame rate from the `stts` atom and
+        // the `mdhd` atom.
+        const mov::MediaHeaderAtom *media_header_atom = reader.GetMediaHeaderAtom();
+        const mov::TimeToSampleAtom *time_to_sample_atom = reader.GetTimeToSampleAtom();
+        const uint32_t time_scale = media_header_atom ? media_header_atom->GetTimeScale() : 0;
+        if (time_scale) {
+          uint64_t duration = media_header_atom->GetDuration();
+          if (time_to_sample_atom) {
+            uint64_t frame_count = 0;
+            uint64_t sample_duration = 0;
+            const uint32_t number_of_entries = time_to_sample_atom->GetCount();
+            for (uint32_t i = 0; i < number_of_entries; ++i) {
+              const mov::TimeToSampleAtom::Entry *entry = time_to_sample_atom->GetEntry(i);
+              frame_count += entry->GetCount();
+              sample_duration += (uint64_t)entry->GetCount() * entry->GetDuration();
+            }
+            _frameCount = (NSInteger)frame_count;
+            if (sample_duration) {
+              duration = sample_duration;
             }
-            sample_description = sample_description->GetNextDescription();
-          } while (--number_of_descriptions > 0);
+          }
+          _duration = (NSTimeInterval)duration / time_scale;
+          if (_duration > 0.0) {
+            _fps = (double)_frameCount / _duration;
+          }
         }
       }
+      reader.Destroy();
+      close(file);
     }
   }
   return self;
@@ -0,0 +1,119 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef HEVC_RENDER_PIPELINE_H_
+#define HEVC_RENDER_PIPELINE_H_
+
+#import <CoreVideo/CoreVideo.h>
+#import <Metal/Metal.h>
+
+#include <stdint.h>
+
+/**
+ * The options that select a render pipeline. The lower bits are the function
+ * constants of the fragment shaders except half precision, which depends on the
+ * device. (The values of these options must be compatible with the function
+ * constants defined in "HEVCPlayerView.metal".)
+ */
+typedef NS_OPTIONS(uint32_t, HEVCRenderPipelineOptions) {
+  /**
+   * The images being rendered are full-range ones.
+   */
+  HEVCRenderPipelineFullRange = 1 << 0,
+
+  /**
+   * The images being rendered use the BT.601 matrix. (The pipelines use the
+   * BT.709 matrix when neither this option nor the BT.2020 one is set.)
+   */
+  HEVCRenderPipelineMatrixBT601 = 1 << 1,
+
+  /**
+   * The images being rendered use the BT.2020 matrix.
+   */
+  HEVCRenderPipelineMatrixBT2020 = 1 << 2,
+
+  /**
+   * The images being rendered have premultiplied alpha, i.e. the fragment
+   * shaders do not multiply their colors by their alpha values.
+   */
+  HEVCRenderPipelinePremultipliedAlpha = 1 << 3,
+
+  /**
+   * The pipeline draws sprites of an `HEVCCompositorView` object, i.e. it uses
+   * the compositor shaders and blends sprites with premultiplied alpha.
+   */
+  HEVCRenderPipelineCompositor = 1 << 4,
+};
+
+/**
+ * Returns the options of the pipeline that renders the specified decoded image.
+ * This function reads the color range from the pixel format of the image and
+ * the YCbCr matrix from its attachments. (Video Toolbox attaches color
+ * properties read from the VUI parameters of an HEVC stream to its images.)
+ * @param {CVImageBufferRef} image
+ * @param {BOOL} premultipliedAlpha
+ * @return {HEVCRenderPipelineOptions}
+ */
+HEVCRenderPipelineOptions HEVCGetRenderPipelineOptions(CVImageBufferRef _Nonnull image, BOOL premultipliedAlpha);
+
+/**
+ * The class that shares the Metal resources used by all views of a device: the
+ * shader library, a command queue, and the render pipelines specialized with
+ * function constants. A cache creates a pipeline when a view renders an image
+ * with new options first time, and it keeps the pipeline until the
+ * application exits, i.e. creating a view does not compile shaders. On
+ * iOS 14 or later, a cache also stores its pipelines to a binary archive in the
+ * caches directory so the next launch of the application loads them without
+ * compiling them.
+ */
+@interface HEVCRenderPipelineCache: NSObject
+
+/**
+ * Returns the cache of the specified device. (This method creates the cache
+ * when it is called first time for the device.)
+ * @param {id<MTLDevice>} device
+ * @return {HEVCRenderPipelineCache*}
+ */
++ (HEVCRenderPipelineCache * _Nonnull)cacheWithDevice:(id<MTLDevice> _Nonnull)device;
+
+/**
+ * The command queue shared by all views of the device of this cache. (A command
+ * queue is thread-safe, i.e. worker threads can create command buffers from it
+ * without locking it.)
+ * @type {id<MTLCommandQueue>}
+ */
+@property (readonly, nonatomic) id<MTLCommandQueue> _Nullable commandQueue;
+
+/**
+ * Returns the render pipeline with the specified options. This method returns
+ * nil when the device cannot create the pipeline, and it does not try creating
+ * the pipeline again. (This method is thread-safe.)
+ * @param {HEVCRenderPipelineOptions} options
+ * @return {id<MTLRenderPipelineState>}
+ */
+- (id<MTLRenderPipelineState> _Nullable)pipelineStateWithOptions:(HEVCRenderPipelineOptions)options;
+
+@end
+
+#endif  // HEVC_RENDER_PIPELINE_H_
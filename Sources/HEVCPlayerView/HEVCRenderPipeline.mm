@@ -0,0 +1,369 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#import "HEVCRenderPipeline.h"
+
+#import "HEVCBundleHelper.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "hevc/sample_index.h"
+
+/**
+ * The indices of the function constants defined in "HEVCPlayerView.metal".
+ * @enum {NSUInteger}
+ */
+enum {
+  HEVCFullRangeConstant = 0,
+  HEVCMatrixConstant = 1,
+  HEVCPremultipliedAlphaConstant = 2,
+  HEVCHalfPrecisionConstant = 3,
+};
+
+/**
+ * The number of the combinations of `HEVCRenderPipelineOptions` values.
+ * @const {NSUInteger}
+ */
+static const NSUInteger HEVCMaxRenderPipelines = 32;
+
+/**
+ * The delay before a cache writes its binary archive after adding a pipeline
+ * to it. (Views usually create a couple of pipelines at once when they start
+ * playing files, i.e. a cache writes them at once.)
+ * @const {int64_t}
+ */
+static const int64_t HEVCArchiveWriteDelay = 2 * NSEC_PER_SEC;
+
+HEVCRenderPipelineOptions HEVCGetRenderPipelineOptions(CVImageBufferRef image, BOOL premultipliedAlpha) {
+  HEVCRenderPipelineOptions options = premultipliedAlpha ? HEVCRenderPipelinePremultipliedAlpha : 0;
+  const OSType format = CVPixelBufferGetPixelFormatType(image);
+  if (format == kCVPixelFormatType_420YpCbCr8BiPlanarFullRange ||
+      format == kCVPixelFormatType_420YpCbCr10BiPlanarFullRange) {
+    options |= HEVCRenderPipelineFullRange;
+  }
+  CFTypeRef matrix = CVBufferGetAttachment(image, kCVImageBufferYCbCrMatrixKey, NULL);
+  if (matrix) {
+    if (CFEqual(matrix, kCVImageBufferYCbCrMatrix_ITU_R_601_4)) {
+      options |= HEVCRenderPipelineMatrixBT601;
+    } else if (CFEqual(matrix, kCVImageBufferYCbCrMatrix_ITU_R_2020)) {
+      options |= HEVCRenderPipelineMatrixBT2020;
+    }
+  }
+  return options;
+}
+
+/**
+ * Returns the URL of the binary archive of the specified device. The name of
+ * an archive consists of the hash of the device name and the OS version
+ * because Metal does not use the functions compiled for other GPUs or other OS
+ * versions. (An archive of a previous OS version is garbage, which the system
+ * deletes with other caches.)
+ * @param {id<MTLDevice>} device
+ * @return {NSURL*}
+ */
+static NSURL *HEVCRenderPipelineArchiveURL(id<MTLDevice> device) {
+  NSString *directory = [NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES) firstObject];
+  if (!directory) {
+    return nil;
+  }
+  directory = [directory stringByAppendingPathComponent:@"HEVCRenderPipeline"];
+  [[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:nil];
+  const char *name = [[NSString stringWithFormat:@"%@ %@", device.name, [[NSProcessInfo processInfo] operatingSystemVersionString]] UTF8String];
+  const uint64_t hash = hevc::SampleIndex::Hash(hevc::SampleIndex::HASH_BASIS, name, strlen(name));
+  NSString *path = [directory stringByAppendingPathComponent:[NSString stringWithFormat:@"%016llx.metallib", (unsigned long long)hash]];
+  return [NSURL fileURLWithPath:path];
+}
+
+@implementation HEVCRenderPipelineCache {
+  /**
+   * The device that owns the resources of this cache.
+   * @type {id<MTLDevice>}
+   * @private
+   */
+  id<MTLDevice> _device;
+
+  /**
+   * The shader library loaded from the bundle of this package.
+   * @type {id<MTLLibrary>}
+   * @private
+   */
+  id<MTLLibrary> _library;
+
+  /**
+   * Whether the fragment shaders convert colors with half-precision floats.
+   * (GPUs designed by Apple execute half-precision operations at twice the
+   * rate of single-precision ones, and the shaders average samples in single
+   * precision so converted colors do not lose 8-bit precision.)
+   * @type {BOOL}
+   * @private
+   */
+  BOOL _halfPrecision;
+
+  /**
+   * The mutex that allows only one thread to create pipelines or access the
+   * binary archive.
+   * @type {pthread_mutex_t}
+   * @private
+   */
+  pthread_mutex_t _mutex;
+
+  /**
+   * The pipelines created by this cache, indexed by their options. An entry is
+   * `NSNull` when this cache fails creating its pipeline so it does not compile
+   * the functions of the pipeline again. (A pipeline state is immutable, i.e.
+   * threads can read this array with atomic operations without locking the
+   * mutex.)
+   * @type {void*[]}
+   * @private
+   */
+  void *_pipelines[HEVCMaxRenderPipelines];
+
+  /**
+   * The binary archive that stores the functions of the pipelines. (This
+   * variable is nil before iOS 14.)
+   * @type {id<MTLBinaryArchive>}
+   * @private
+   */
+  id _archive;
+
+  /**
+   * The URL of the binary archive.
+   * @type {NSURL*}
+   * @private
+   */
+  NSURL *_archiveURL;
+
+  /**
+   * Whether this cache has scheduled writing its binary archive.
+   * @type {BOOL}
+   * @private
+   */
+  BOOL _writingArchive;
+}
+
++ (HEVCRenderPipelineCache *)cacheWithDevice:(id<MTLDevice>)device {
+  // Applications usually have only one device, i.e. this method compares the
+  // device with the one of the last cache before searching the others.
+  static pthread_mutex_t cacheMutex = PTHREAD_MUTEX_INITIALIZER;
+  static NSMutableArray<HEVCRenderPipelineCache *> *caches = nil;
+  static HEVCRenderPipelineCache *lastCache = nil;
+  HEVCRenderPipelineCache *cache = nil;
+  pthread_mutex_lock(&cacheMutex);
+  if (lastCache && lastCache->_device == device) {
+    cache = lastCache;
+  } else {
+    for (HEVCRenderPipelineCache *item in caches) {
+      if (item->_device == device) {
+        cache = item;
+        break;
+      }
+    }
+    if (!cache) {
+      cache = [[HEVCRenderPipelineCache alloc] initWithDevice:device];
+      if (!caches) {
+        caches = [NSMutableArray array];
+      }
+      [caches addObject:cache];
+    }
+    lastCache = cache;
+  }
+  pthread_mutex_unlock(&cacheMutex);
+  return cache;
+}
+
+- (id)initWithDevice:(id<MTLDevice>)device {
+  self = [super init];
+  if (self) {
+    _device = device;
+    _library = [device newDefaultLibraryWithBundle:[HEVCBundleHelper getBundle] error:nil];
+    _commandQueue = [device newCommandQueue];
+    _halfPrecision = [device supportsFamily:MTLGPUFamilyApple1];
+    pthread_mutex_init(&_mutex, NULL);
+    memset(_pipelines, 0, sizeof(_pipelines));
+    _archive = nil;
+    _writingArchive = NO;
+
+    // Open the binary archive written by the previous launch of the application
+    // or create an empty one. (Metal fails to open an archive written by a
+    // different GPU or a corrupted one, which this cache replaces.)
+    if (@available(iOS 14.0, *)) {
+      _archiveURL = HEVCRenderPipelineArchiveURL(device);
+      MTLBinaryArchiveDescriptor *descriptor = [MTLBinaryArchiveDescriptor new];
+      if ([[NSFileManager defaultManager] fileExistsAtPath:[_archiveURL path]]) {
+        descriptor.url = _archiveURL;
+        _archive = [device newBinaryArchiveWithDescriptor:descriptor error:nil];
+        descriptor.url = nil;
+      }
+      if (!_archive && _archiveURL) {
+        _archive = [device newBinaryArchiveWithDescriptor:descriptor error:nil];
+      }
+    }
+
+    // Create the pipeline for BT.709 video-range images (the output of Video
+    // Toolbox with its default settings) in the background so the first view
+    // does not compile it on its worker thread.
+    HEVCRenderPipelineCache * __weak weakSelf = self;
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+      [weakSelf pipelineStateWithOptions:0];
+    });
+  }
+  return self;
+}
+
+- (void)dealloc {
+  for (NSUInteger i = 0; i < HEVCMaxRenderPipelines; ++i) {
+    if (_pipelines[i]) {
+      CFRelease(_pipelines[i]);
+    }
+  }
+  pthread_mutex_destroy(&_mutex);
+}
+
+- (id<MTLRenderPipelineState>)pipelineStateWithOptions:(HEVCRenderPipelineOptions)options {
+  if (options >= HEVCMaxRenderPipelines) {
+    return nil;
+  }
+  void *pipeline = __atomic_load_n(&_pipelines[options], __ATOMIC_ACQUIRE);
+  if (!pipeline) {
+    pthread_mutex_lock(&_mutex);
+    pipeline = _pipelines[options];
+    if (!pipeline) {
+      id state = [self createPipelineStateWithOptions:options];
+      if (!state) {
+        // Just write the options to the console. (This cache returns nil for
+        // the options without creating the pipeline again.)
+        NSLog(@"%s:error: options=0x%x\n", __FUNCTION__, (unsigned)options);
+        state = [NSNull null];
+      }
+      pipeline = (__bridge_retained void *)state;
+      __atomic_store_n(&_pipelines[options], pipeline, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&_mutex);
+  }
+  if (pipeline == (__bridge void *)[NSNull null]) {
+    return nil;
+  }
+  return (__bridge id<MTLRenderPipelineState>)pipeline;
+}
+
+#pragma mark - internal methods
+
+/**
+ * Creates the render pipeline with the specified options. This method creates
+ * the pipeline from the binary archive if it has the functions of the
+ * pipeline. Otherwise, it compiles the functions and adds them to the archive.
+ * (The caller must acquire the mutex.)
+ * @param {HEVCRenderPipelineOptions} options
+ * @return {id<MTLRenderPipelineState>}
+ */
+- (id<MTLRenderPipelineState>)createPipelineStateWithOptions:(HEVCRenderPipelineOptions)options {
+  if (!_library) {
+    return nil;
+  }
+  MTLFunctionConstantValues *constants = [MTLFunctionConstantValues new];
+  const BOOL fullRange = (options & HEVCRenderPipelineFullRange) ? YES : NO;
+  const int32_t matrix = (options & HEVCRenderPipelineMatrixBT601) ? 1 : ((options & HEVCRenderPipelineMatrixBT2020) ? 2 : 0);
+  const BOOL premultipliedAlpha = (options & HEVCRenderPipelinePremultipliedAlpha) ? YES : NO;
+  const BOOL halfPrecision = _halfPrecision;
+  [constants setConstantValue:&fullRange type:MTLDataTypeBool atIndex:HEVCFullRangeConstant];
+  [constants setConstantValue:&matrix type:MTLDataTypeInt atIndex:HEVCMatrixConstant];
+  [constants setConstantValue:&premultipliedAlpha type:MTLDataTypeBool atIndex:HEVCPremultipliedAlphaConstant];
+  [constants setConstantValue:&halfPrecision type:MTLDataTypeBool atIndex:HEVCHalfPrecisionConstant];
+
+  // Create a pipeline descriptor for the player shaders or the compositor ones.
+  // The compositor pipelines blend the premultiplied colors output by
+  // `HEVCCompositorFragment`.
+  const BOOL compositor = (options & HEVCRenderPipelineCompositor) ? YES : NO;
+  MTLRenderPipelineDescriptor *descriptor = [MTLRenderPipelineDescriptor new];
+  MTLRenderPipelineColorAttachmentDescriptor *colorAttachment = descriptor.colorAttachments[0];
+  colorAttachment.pixelFormat = MTLPixelFormatBGRA8Unorm;
+  if (compositor) {
+    colorAttachment.blendingEnabled = YES;
+    colorAttachment.sourceRGBBlendFactor = MTLBlendFactorOne;
+    colorAttachment.sourceAlphaBlendFactor = MTLBlendFactorOne;
+    colorAttachment.destinationRGBBlendFactor = MTLBlendFactorOneMinusSourceAlpha;
+    colorAttachment.destinationAlphaBlendFactor = MTLBlendFactorOneMinusSourceAlpha;
+  }
+  descriptor.vertexFunction = [_library newFunctionWithName:compositor ? @"HEVCCompositorVertex" : @"HEVCPlayerVertex"];
+  descriptor.fragmentFunction = [_library newFunctionWithName:compositor ? @"HEVCCompositorFragment" : @"HEVCPlayerFragment" constantValues:constants error:nil];
+  if (!descriptor.vertexFunction || !descriptor.fragmentFunction) {
+    return nil;
+  }
+  if (@available(iOS 14.0, *)) {
+    id<MTLBinaryArchive> archive = _archive;
+    if (archive) {
+      // Look up the functions of the pipeline in the archive without compiling
+      // them. Compile them and add them to the archive when it does not have
+      // them.
+      descriptor.binaryArchives = @[archive];
+      id<MTLRenderPipelineState> state = [_device newRenderPipelineStateWithDescriptor:descriptor options:MTLPipelineOptionFailOnBinaryArchiveMiss reflection:nil error:nil];
+      if (state) {
+        return state;
+      }
+      state = [_device newRenderPipelineStateWithDescriptor:descriptor error:nil];
+      if (state && [archive addRenderPipelineFunctionsWithDescriptor:descriptor error:nil]) {
+        [self scheduleWritingArchive];
+      }
+      return state;
+    }
+  }
+  return [_device newRenderPipelineStateWithDescriptor:descriptor error:nil];
+}
+
+/**
+ * Schedules writing the binary archive of this cache to its file. (The caller
+ * must acquire the mutex.)
+ */
+- (void)scheduleWritingArchive API_AVAILABLE(ios(14.0)) {
+  if (_writingArchive || !_archiveURL) {
+    return;
+  }
+  _writingArchive = YES;
+  HEVCRenderPipelineCache * __weak weakSelf = self;
+  dispatch_after(dispatch_time(DISPATCH_TIME_NOW, HEVCArchiveWriteDelay), dispatch_get_global_queue(QOS_CLASS_BACKGROUND, 0), ^{
+    [weakSelf writeArchive];
+  });
+}
+
+/**
+ * Writes the binary archive of this cache to its file. This method writes the
+ * archive to a temporary file and renames it so the next launch does not read
+ * incomplete archives.
+ */
+- (void)writeArchive API_AVAILABLE(ios(14.0)) {
+  NSString *path = [_archiveURL path];
+  NSString *temporaryPath = [path stringByAppendingFormat:@".%u", arc4random()];
+  pthread_mutex_lock(&_mutex);
+  _writingArchive = NO;
+  id<MTLBinaryArchive> archive = _archive;
+  const BOOL written = [archive serializeToURL:[NSURL fileURLWithPath:temporaryPath] error:nil];
+  pthread_mutex_unlock(&_mutex);
+  if (!written || rename([temporaryPath fileSystemRepresentation], [path fileSystemRepresentation])) {
+    unlink([temporaryPath fileSystemRepresentation]);
+  }
+}
+
+@end
@@ -0,0 +1,131 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef HEVC_THUMBNAIL_EXTRACTOR_H_
+#define HEVC_THUMBNAIL_EXTRACTOR_H_
+
+#import <CoreGraphics/CoreGraphics.h>
+#import <CoreVideo/CoreVideo.h>
+#import <Foundation/Foundation.h>
+
+/**
+ * The class that represents a frame decoded by `HEVCThumbnailExtractor`. The
+ * image is a `kCVPixelFormatType_32BGRA` pixel buffer with premultiplied alpha
+ * (i.e. `kCGImageAlphaPremultipliedFirst` with `kCGBitmapByteOrder32Little`),
+ * which applications can draw with Core Graphics or upload to Metal textures
+ * without conversions.
+ */
+@interface HEVCThumbnail: NSObject
+
+/**
+ * The frame number of this image, i.e. its index in the output order.
+ * @type {NSInteger}
+ */
+@property (readonly, nonatomic) NSInteger frameNumber;
+
+/**
+ * The presentation time of this image in seconds.
+ * @type {NSTimeInterval}
+ */
+@property (readonly, nonatomic) NSTimeInterval presentationTime;
+
+/**
+ * The decoded image. (This object owns the pixel buffer, i.e. an application
+ * that uses it after deleting this object must retain it.)
+ * @type {CVPixelBufferRef}
+ */
+@property (readonly, nonatomic) CVPixelBufferRef _Nonnull pixelBuffer;
+
+/**
+ * Returns the decoded image as a `CGImage` object. This object creates the
+ * `CGImage` object when this method is called first time and owns it.
+ * @return {CGImageRef}
+ */
+- (CGImageRef _Nullable) CGImage;
+@end
+
+/**
+ * The class that decodes frames of HEVC-with-Alpha files without views, e.g.
+ * for creating the poster images of files before playing them. This class
+ * opens a file through the asset cache shared with players, decodes only the
+ * samples required for the requested frames synchronously with a Video
+ * Toolbox session scaled to the requested size, and converts the decoded
+ * images to premultiplied BGRA pixel buffers. An extractor decodes multiple
+ * files in parallel on a concurrent queue, and it limits the number of files
+ * decoded at once so it does not occupy all decoder sessions of the host.
+ */
+@interface HEVCThumbnailExtractor: NSObject
+
+/**
+ * Initializes this extractor with the default number of files decoded at once
+ * (the number of active CPU cores up to four).
+ */
+- (id _Nonnull) init;
+
+/**
+ * Initializes this extractor with the maximum number of files decoded at once.
+ * @param {NSInteger} count
+ */
+- (id _Nonnull) initWithMaxConcurrentCount:(NSInteger)count;
+
+/**
+ * Decodes the specified frames of the specified file synchronously and returns
+ * their images in the ascending order of their frame numbers. This method
+ * decodes only the sync (IRAP) samples of the file, i.e. the ones listed in its
+ * `stss` atom, when `frames` is nil. The size is in pixels, and a zero size
+ * means the frame size of the file. (This method decodes frames on the calling
+ * thread, i.e. it should not be called on the main thread.)
+ * @param {NSURL*} url
+ * @param {NSArray<NSNumber*>*} frames
+ * @param {CGSize} size
+ * @param {NSError**} error
+ * @return {NSArray<HEVCThumbnail*>*}
+ */
+- (NSArray<HEVCThumbnail*>* _Nullable) extractFramesFromURL:(NSURL* _Nonnull)url frames:(NSArray<NSNumber*>* _Nullable)frames size:(CGSize)size error:(NSError* _Nullable * _Nullable)error;
+
+/**
+ * Decodes the specified frames of the specified file asynchronously. This
+ * method calls the completion handler on the main thread.
+ * @param {NSURL*} url
+ * @param {NSArray<NSNumber*>*} frames
+ * @param {CGSize} size
+ * @param {function(NSArray<HEVCThumbnail*>*, NSError*)} completion
+ */
+- (void) extractFramesFromURL:(NSURL* _Nonnull)url frames:(NSArray<NSNumber*>* _Nullable)frames size:(CGSize)size completion:(void (^ _Nonnull)(NSArray<HEVCThumbnail*>* _Nullable thumbnails, NSError* _Nullable error))completion;
+
+/**
+ * Decodes the specified frames of each of the specified files asynchronously,
+ * e.g. the first frames (`@[@0]`) of all files in a catalog. This method
+ * decodes the files in parallel and calls the completion handler on the main
+ * thread once after it decodes all of them. The dictionary given to the
+ * handler does not have the files that this extractor cannot decode.
+ * @param {NSArray<NSURL*>*} urls
+ * @param {NSArray<NSNumber*>*} frames
+ * @param {CGSize} size
+ * @param {function(NSDictionary<NSURL*, NSArray<HEVCThumbnail*>*>*)} completion
+ */
+- (void) extractFramesFromURLs:(NSArray<NSURL*>* _Nonnull)urls frames:(NSArray<NSNumber*>* _Nullable)frames size:(CGSize)size completion:(void (^ _Nonnull)(NSDictionary<NSURL*, NSArray<HEVCThumbnail*>*>* _Nonnull thumbnails))completion;
+@end
+
+#endif  // HEVC_THUMBNAIL_EXTRACTOR_H_
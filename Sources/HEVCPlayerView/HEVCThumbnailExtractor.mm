@@ -0,0 +1,493 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#import "HEVCThumbnailExtractor.h"
+
+#import <Accelerate/Accelerate.h>
+#import <VideoToolbox/VideoToolbox.h>
+#import "HEVCRenderPipeline.h"
+
+#include <errno.h>
+#include "base/trace.h"
+#include "hevc/asset_cache.h"
+#include "hevc/decoder.h"
+#include "hevc/sample_index.h"
+#include "mov/stream.h"
+
+/**
+ * The maximum number of files decoded at once by default. (Hardware decoders
+ * have a limited number of sessions, which players also use.)
+ * @const {NSInteger}
+ */
+static const NSInteger HEVCMaxConcurrentExtractions = 4;
+
+/**
+ * Returns the conversion from the specified decoded image (a `420v` image with
+ * an alpha plane) to ARGB images. This conversion uses the matrix and the range
+ * of the image as the fragment shaders of the players do, i.e. it uses the
+ * BT.709 matrix when the image does not have a matrix attachment.
+ * @param {CVImageBufferRef} image
+ * @return {const vImage_YpCbCrToARGB*}
+ */
+static const vImage_YpCbCrToARGB *HEVCGetYpCbCrConversion(CVImageBufferRef image) {
+  // Generate the conversions for all the combinations of the matrices and the
+  // ranges at once. (vImage does not define the BT.2020 matrix.)
+  static vImage_YpCbCrToARGB conversions[2][3];
+  static dispatch_once_t once;
+  dispatch_once(&once, ^{
+    const vImage_YpCbCrPixelRange ranges[2] = {
+      {16, 128, 235, 240, 235, 16, 240, 16},
+      {0, 128, 255, 255, 255, 0, 255, 0},
+    };
+    static const vImage_YpCbCrToARGBMatrix matrixBT2020 = {1, 1.4746f, -0.571353f, -0.164553f, 1.8814f};
+    const vImage_YpCbCrToARGBMatrix *matrices[3] = {
+      kvImage_YpCbCrToARGBMatrix_ITU_R_709_2,
+      kvImage_YpCbCrToARGBMatrix_ITU_R_601_4,
+      &matrixBT2020,
+    };
+    for (int range = 0; range < 2; ++range) {
+      for (int matrix = 0; matrix < 3; ++matrix) {
+        vImageConvert_YpCbCrToARGB_GenerateConversion(matrices[matrix], &ranges[range], &conversions[range][matrix], kvImage420Yp8_CbCr8, kvImageARGB8888, kvImageNoFlags);
+      }
+    }
+  });
+  const HEVCRenderPipelineOptions options = HEVCGetRenderPipelineOptions(image, NO);
+  const int range = (options & HEVCRenderPipelineFullRange) ? 1 : 0;
+  const int matrix = (options & HEVCRenderPipelineMatrixBT601) ? 1 : ((options & HEVCRenderPipelineMatrixBT2020) ? 2 : 0);
+  return &conversions[range][matrix];
+}
+
+/**
+ * Converts the specified decoded image (consisting of three planes (Y, UV, and
+ * alpha)) to a new BGRA pixel buffer with premultiplied alpha. This function
+ * premultiplies the alpha only when the HEVC-with-Alpha stream does not.
+ * @param {CVImageBufferRef} image
+ * @param {int} premultiplied
+ * @return {CVPixelBufferRef}
+ */
+static CVPixelBufferRef HEVCCreateBGRAImage(CVImageBufferRef image, int premultiplied) {
+  const size_t width = CVPixelBufferGetWidth(image);
+  const size_t height = CVPixelBufferGetHeight(image);
+  NSDictionary *attributes = @{
+    (id)kCVPixelBufferIOSurfacePropertiesKey: @{},
+    (id)kCVPixelBufferMetalCompatibilityKey: @YES,
+    (id)kCVPixelBufferCGImageCompatibilityKey: @YES,
+    (id)kCVPixelBufferCGBitmapContextCompatibilityKey: @YES,
+  };
+  CVPixelBufferRef output = NULL;
+  if (CVPixelBufferCreate(kCFAllocatorDefault, width, height, kCVPixelFormatType_32BGRA, (__bridge CFDictionaryRef)attributes, &output) != kCVReturnSuccess) {
+    return NULL;
+  }
+  CVPixelBufferLockBaseAddress(image, kCVPixelBufferLock_ReadOnly);
+  CVPixelBufferLockBaseAddress(output, 0);
+  const vImage_Buffer planeY = {CVPixelBufferGetBaseAddressOfPlane(image, 0), height, width, CVPixelBufferGetBytesPerRowOfPlane(image, 0)};
+  const vImage_Buffer planeUV = {CVPixelBufferGetBaseAddressOfPlane(image, 1), height / 2, width / 2, CVPixelBufferGetBytesPerRowOfPlane(image, 1)};
+  const vImage_Buffer bgra = {CVPixelBufferGetBaseAddress(output), height, width, CVPixelBufferGetBytesPerRow(output)};
+  // Convert the Y plane and the UV plane to BGRA pixels (i.e. permute the ARGB
+  // output of vImage) and overwrite their alpha channels with the alpha plane.
+  // (`vImageOverwriteChannels_ARGB8888()` uses the lowest bit of its mask for
+  // the last byte of a pixel, i.e. the alpha of a BGRA pixel.)
+  static const uint8_t permuteMap[4] = {3, 2, 1, 0};
+  vImage_Error error = vImageConvert_420Yp8_CbCr8ToARGB8888(&planeY, &planeUV, &bgra, HEVCGetYpCbCrConversion(image), permuteMap, 255, kvImageNoFlags);
+  if (!error && CVPixelBufferGetPlaneCount(image) > 2) {
+    const vImage_Buffer planeA = {CVPixelBufferGetBaseAddressOfPlane(image, 2), height, width, CVPixelBufferGetBytesPerRowOfPlane(image, 2)};
+    error = vImageOverwriteChannels_ARGB8888(&planeA, &bgra, &bgra, 0x1, kvImageNoFlags);
+    if (!error && !premultiplied) {
+      error = vImagePremultiplyData_RGBA8888(&bgra, &bgra, kvImageNoFlags);
+    }
+  }
+  CVPixelBufferUnlockBaseAddress(output, 0);
+  CVPixelBufferUnlockBaseAddress(image, kCVPixelBufferLock_ReadOnly);
+  if (error) {
+    CFRelease(output);
+    return NULL;
+  }
+  return output;
+}
+
+/**
+ * Decodes the specified sample synchronously and returns its image, which the
+ * caller must release. (This function returns NULL when Video Toolbox does not
+ * output the image, e.g. when the flags have `kVTDecodeFrame_DoNotOutputFrame`.)
+ * @param {hevc::Decoder*} decoder
+ * @param {int} sample
+ * @param {VTDecodeFrameFlags} flags
+ * @param {OSStatus*} status
+ * @return {CVImageBufferRef}
+ */
+static CVImageBufferRef HEVCDecodeImage(hevc::Decoder *decoder, int sample, VTDecodeFrameFlags flags, OSStatus *status) {
+  __block CVImageBufferRef image = NULL;
+  __block OSStatus outputStatus = noErr;
+  *status = decoder->DecodeSampleSynchronously(sample, flags, ^(OSStatus decodeStatus,
+                                                                VTDecodeInfoFlags infoFlags,
+                                                                CVImageBufferRef imageBuffer,
+                                                                CMTime timestamp,
+                                                                CMTime duration) {
+    outputStatus = decodeStatus;
+    if (!decodeStatus && imageBuffer) {
+      image = (CVImageBufferRef)CFRetain(imageBuffer);
+    }
+  });
+  if (!*status) {
+    *status = outputStatus;
+  }
+  if (*status && image) {
+    CFRelease(image);
+    image = NULL;
+  }
+  return image;
+}
+
+/**
+ * Reads a progressive stream until the specified sample is resident.
+ * @param {hevc::Decoder*} decoder
+ * @param {int} sample
+ * @return {int}
+ */
+static int HEVCLoadSample(hevc::Decoder *decoder, int sample) {
+  const int lastSample = decoder->GetNumberOfSamples() - 1;
+  sample = sample < lastSample ? sample : lastSample;
+  while (!decoder->IsSampleResident(sample)) {
+    if (decoder->LoadSamples(4) < 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+@interface HEVCThumbnail ()
+- (id)initWithPixelBuffer:(CVPixelBufferRef)pixelBuffer frameNumber:(NSInteger)frameNumber presentationTime:(NSTimeInterval)presentationTime;
+@end
+
+@implementation HEVCThumbnail {
+  /**
+   * The `CGImage` object created from the pixel buffer.
+   * @type {CGImageRef}
+   */
+  CGImageRef _image;
+}
+
+- (id)initWithPixelBuffer:(CVPixelBufferRef)pixelBuffer frameNumber:(NSInteger)frameNumber presentationTime:(NSTimeInterval)presentationTime {
+  self = [super init];
+  if (self) {
+    _pixelBuffer = (CVPixelBufferRef)CFRetain(pixelBuffer);
+    _frameNumber = frameNumber;
+    _presentationTime = presentationTime;
+    _image = NULL;
+  }
+  return self;
+}
+
+- (void)dealloc {
+  if (_image) {
+    CGImageRelease(_image);
+  }
+  CFRelease(_pixelBuffer);
+}
+
+- (CGImageRef)CGImage {
+  @synchronized (self) {
+    if (!_image) {
+      VTCreateCGImageFromCVPixelBuffer(_pixelBuffer, NULL, &_image);
+    }
+    return _image;
+  }
+}
+
+@end
+
+/**
+ * Adds the image of the specified frame to the specified array.
+ * @param {const hevc::Decoder*} decoder
+ * @param {CVImageBufferRef} image
+ * @param {int} frame
+ * @param {NSMutableArray<HEVCThumbnail*>*} thumbnails
+ */
+static void HEVCAddThumbnail(const hevc::Decoder *decoder, CVImageBufferRef image, int frame, NSMutableArray<HEVCThumbnail *> *thumbnails) {
+  CVPixelBufferRef pixelBuffer = HEVCCreateBGRAImage(image, decoder->IsPremultipliedAlpha(frame));
+  if (pixelBuffer) {
+    const uint32_t timeScale = decoder->GetTimeScale();
+    const NSTimeInterval time = timeScale ? (NSTimeInterval)decoder->GetFrameTimestamp(frame) / timeScale : 0.0;
+    [thumbnails addObject:[[HEVCThumbnail alloc] initWithPixelBuffer:pixelBuffer frameNumber:frame presentationTime:time]];
+    CFRelease(pixelBuffer);
+  }
+}
+
+/**
+ * Decodes the sync samples of the stream, which Video Toolbox can decode
+ * without decoding any other samples, and adds their images to the specified
+ * array.
+ * @param {hevc::Decoder*} decoder
+ * @param {NSMutableArray<HEVCThumbnail*>*} thumbnails
+ * @return {OSStatus}
+ */
+static OSStatus HEVCExtractSyncFrames(hevc::Decoder *decoder, NSMutableArray<HEVCThumbnail *> *thumbnails) {
+  const int numberOfSamples = decoder->GetNumberOfSamples();
+  const int reorder = decoder->GetMaxNumReorderPictures();
+  for (int sample = 0; sample < numberOfSamples; ++sample) {
+    if (!HEVCLoadSample(decoder, sample + reorder * 2 + 1)) {
+      return kVTVideoDecoderBadDataErr;
+    }
+    if (decoder->GetSyncSample(sample) != sample) {
+      continue;
+    }
+    if (decoder->LoadSample(sample) != 1) {
+      return kVTVideoDecoderBadDataErr;
+    }
+    OSStatus status;
+    CVImageBufferRef image = HEVCDecodeImage(decoder, sample, 0, &status);
+    if (status) {
+      return status;
+    }
+    if (image) {
+      HEVCAddThumbnail(decoder, image, decoder->GetFrameNumber(sample), thumbnails);
+      CFRelease(image);
+    }
+  }
+  return noErr;
+}
+
+/**
+ * Decodes the specified frames (in the ascending order) and adds their images
+ * to the specified array. This function decodes the samples from the sync
+ * sample preceding each frame to the sample of the frame, except discardable
+ * ones, and it continues decoding from the previous frame when the next frame
+ * follows it in the same GOP.
+ * @param {hevc::Decoder*} decoder
+ * @param {const int*} frames
+ * @param {NSUInteger} numberOfFrames
+ * @param {NSMutableArray<HEVCThumbnail*>*} thumbnails
+ * @return {OSStatus}
+ */
+static OSStatus HEVCExtractFrames(hevc::Decoder *decoder, const int *frames, NSUInteger numberOfFrames, NSMutableArray<HEVCThumbnail *> *thumbnails) {
+  const int numberOfSamples = decoder->GetNumberOfSamples();
+  const int reorder = decoder->GetMaxNumReorderPictures();
+  int position = -1;
+  for (NSUInteger i = 0; i < numberOfFrames; ++i) {
+    // Read the samples until this decoder knows the sample of the frame. (The
+    // sample of a frame is at most `reorder` samples after it in the decoding
+    // order, and this decoder numbers a sample after reading `reorder` more.)
+    const int frame = frames[i];
+    if (!HEVCLoadSample(decoder, frame + reorder * 2 + 1)) {
+      return kVTVideoDecoderBadDataErr;
+    }
+    const int seekSample = decoder->GetSeekSample(frame);
+    if (seekSample < 0) {
+      continue;
+    }
+    int target = -1;
+    for (int sample = seekSample; sample < numberOfSamples && decoder->IsSampleResident(sample); ++sample) {
+      if (decoder->GetFrameNumber(sample) == frame) {
+        target = sample;
+        break;
+      }
+    }
+    if (target < 0) {
+      continue;
+    }
+    // Make each sample readable before reading its slice header. (A windowed
+    // stream keeps only the GOP of the sample and the next one in memory.)
+    // Skip the RASL samples of the sync sample as well, whose references
+    // precede it. (The target sample is never one of them.)
+    int sample = position >= seekSample && position <= target ? position : seekSample;
+    for (; sample < target; ++sample) {
+      if (decoder->LoadSample(sample) != 1) {
+        return kVTVideoDecoderBadDataErr;
+      }
+      if (decoder->GetSyncSample(sample) == seekSample && decoder->IsRandomAccessSkippedSample(sample)) {
+        continue;
+      }
+      if (!decoder->IsDiscardableSample(sample)) {
+        OSStatus status;
+        CVImageBufferRef image = HEVCDecodeImage(decoder, sample, kVTDecodeFrame_DoNotOutputFrame, &status);
+        if (image) {
+          CFRelease(image);
+        }
+        if (status) {
+          return status;
+        }
+      }
+    }
+    if (decoder->LoadSample(target) != 1) {
+      return kVTVideoDecoderBadDataErr;
+    }
+    OSStatus status;
+    CVImageBufferRef image = HEVCDecodeImage(decoder, target, 0, &status);
+    if (status) {
+      return status;
+    }
+    position = target + 1;
+    if (image) {
+      HEVCAddThumbnail(decoder, image, frame, thumbnails);
+      CFRelease(image);
+    }
+  }
+  return noErr;
+}
+
+@implementation HEVCThumbnailExtractor {
+  /**
+   * The semaphore that limits the number of files decoded at once.
+   * @type {dispatch_semaphore_t}
+   */
+  dispatch_semaphore_t _semaphore;
+}
+
+- (id)init {
+  const NSInteger count = (NSInteger)[[NSProcessInfo processInfo] activeProcessorCount];
+  return [self initWithMaxConcurrentCount:count < HEVCMaxConcurrentExtractions ? count : HEVCMaxConcurrentExtractions];
+}
+
+- (id)initWithMaxConcurrentCount:(NSInteger)count {
+  self = [super init];
+  if (self) {
+    _semaphore = dispatch_semaphore_create(count > 0 ? count : 1);
+  }
+  return self;
+}
+
+- (NSArray<HEVCThumbnail *> *)extractFramesFromURL:(NSURL *)url frames:(NSArray<NSNumber *> *)frames size:(CGSize)size error:(NSError **)error {
+  dispatch_semaphore_wait(_semaphore, DISPATCH_TIME_FOREVER);
+  const uint64_t signpostID = Trace::GenerateID();
+  HEVC_TRACE_BEGIN("ExtractFrames", signpostID);
+  NSError *result = nil;
+  NSMutableArray<HEVCThumbnail *> *thumbnails = nil;
+  // Open the file through the asset cache so this extractor shares its stream
+  // data and its sample index with players.
+  mov::Stream stream;
+  stream.Initialize();
+  hevc::SampleIndex index;
+  index.Initialize();
+  hevc::AssetCache::Asset asset;
+  const int openError = hevc::AssetCache::Open([[url path] fileSystemRepresentation], &stream, &index, &asset);
+  if (openError) {
+    result = [NSError errorWithDomain:NSCocoaErrorDomain code:openError == ENOENT ? NSFileNoSuchFileError : NSFileReadUnknownError userInfo:nil];
+  } else {
+    // Create a decoder without output callbacks so it uses a session in the
+    // session pool, and ask Video Toolbox to output images of the requested
+    // size. (The width and the height of a 4:2:0 image must be even, and this
+    // extractor keeps the aspect ratio of the file when one of them is 0.)
+    hevc::Decoder decoder;
+    decoder.Initialize();
+    OSStatus status = decoder.Create(&stream, index.GetNumberOfSamples() ? &index : NULL, NULL, NULL);
+    if (!status) {
+      const int frameWidth = decoder.GetFrameWidth();
+      const int frameHeight = decoder.GetFrameHeight();
+      CGFloat width = size.width;
+      CGFloat height = size.height;
+      if (width <= 0 && height > 0) {
+        width = height * frameWidth / frameHeight;
+      } else if (height <= 0 && width > 0) {
+        height = width * frameHeight / frameWidth;
+      }
+      if (width > 0 && height > 0) {
+        const int outputWidth = (int)width > 2 ? (int)width & ~1 : 2;
+        const int outputHeight = (int)height > 2 ? (int)height & ~1 : 2;
+        status = decoder.SetOutputSize(outputWidth, outputHeight);
+      }
+    }
+    if (!status) {
+      thumbnails = [NSMutableArray array];
+      if (!frames) {
+        status = HEVCExtractSyncFrames(&decoder, thumbnails);
+      } else {
+        // Sort the requested frames and remove invalid or duplicated ones so
+        // this extractor decodes each GOP at most once for consecutive frames.
+        NSMutableIndexSet *frameSet = [NSMutableIndexSet indexSet];
+        for (NSNumber *frame in frames) {
+          const NSInteger frameNumber = [frame integerValue];
+          if (frameNumber >= 0 && frameNumber < decoder.GetNumberOfFrames()) {
+            [frameSet addIndex:(NSUInteger)frameNumber];
+          }
+        }
+        const NSUInteger numberOfFrames = [frameSet count];
+        int *frameNumbers = (int *)malloc((numberOfFrames ? numberOfFrames : 1) * sizeof(int));
+        if (!frameNumbers) {
+          status = kVTAllocationFailedErr;
+        } else {
+          __block NSUInteger count = 0;
+          [frameSet enumerateIndexesUsingBlock:^(NSUInteger frameNumber, BOOL *stop) {
+            frameNumbers[count++] = (int)frameNumber;
+          }];
+          status = HEVCExtractFrames(&decoder, frameNumbers, numberOfFrames, thumbnails);
+          free(frameNumbers);
+        }
+      }
+    }
+    decoder.Destroy();
+    if (asset.id) {
+      hevc::AssetCache::Release(asset.id);
+    }
+    if (status) {
+      thumbnails = nil;
+      result = [NSError errorWithDomain:NSOSStatusErrorDomain code:status userInfo:nil];
+    }
+  }
+  index.Destroy();
+  stream.Destroy();
+  HEVC_TRACE_END("ExtractFrames", signpostID);
+  dispatch_semaphore_signal(_semaphore);
+  if (error) {
+    *error = result;
+  }
+  return thumbnails;
+}
+
+- (void)extractFramesFromURL:(NSURL *)url frames:(NSArray<NSNumber *> *)frames size:(CGSize)size completion:(void (^)(NSArray<HEVCThumbnail *> *, NSError *))completion {
+  NSArray<NSNumber *> *frameList = [frames copy];
+  dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+    NSError *error = nil;
+    NSArray<HEVCThumbnail *> *thumbnails = [self extractFramesFromURL:url frames:frameList size:size error:&error];
+    dispatch_async(dispatch_get_main_queue(), ^{
+      completion(thumbnails, error);
+    });
+  });
+}
+
+- (void)extractFramesFromURLs:(NSArray<NSURL *> *)urls frames:(NSArray<NSNumber *> *)frames size:(CGSize)size completion:(void (^)(NSDictionary<NSURL *, NSArray<HEVCThumbnail *> *> *))completion {
+  // Decode the files with `dispatch_apply()`, which runs at most one iteration
+  // for each CPU core at once on the concurrent queue, and the semaphore of
+  // this extractor limits it further.
+  NSArray<NSURL *> *urlList = [urls copy];
+  NSArray<NSNumber *> *frameList = [frames copy];
+  dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+    NSMutableDictionary<NSURL *, NSArray<HEVCThumbnail *> *> *results = [NSMutableDictionary dictionaryWithCapacity:[urlList count]];
+    dispatch_apply([urlList count], dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t i) {
+      @autoreleasepool {
+        NSURL *url = urlList[i];
+        NSArray<HEVCThumbnail *> *thumbnails = [self extractFramesFromURL:url frames:frameList size:size error:nil];
+        if (thumbnails) {
+          @synchronized (results) {
+            results[url] = thumbnails;
+          }
+        }
+      }
+    });
+    dispatch_async(dispatch_get_main_queue(), ^{
+      completion(results);
+    });
+  });
+}
+
+@end
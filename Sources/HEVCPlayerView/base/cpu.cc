@@ -0,0 +1,86 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "../base/cpu.h"
+
+#if (__i386__ || __x86_64__) && !_MSC_VER
+#include <cpuid.h>
+#endif
+
+#if __i386__ || __x86_64__
+uint8_t CPU::sse4_ = 0;
+uint8_t CPU::avx2_ = 0;
+#elif __arm__
+uint8_t CPU::neon_ = 0;
+#endif
+
+namespace {
+
+/**
+ * The inner class that initializes the static variables of the `CPU` class
+ * before `main()` is called, i.e. before any decoders read them.
+ */
+struct CPUInitializer {
+  CPUInitializer() {
+    CPU::Initialize();
+  }
+};
+
+/**
+ * The initializer of the static variables.
+ * @type {CPUInitializer}
+ */
+CPUInitializer g_cpu_initializer;
+
+}  // namespace
+
+void CPU::Initialize() {
+#if (__i386__ || __x86_64__) && !_MSC_VER
+  // Read the feature flags of the host CPU. (AVX2 also requires the operating
+  // system to save the YMM registers, i.e. the bits 1 and 2 of XCR0.)
+  unsigned int eax = 0;
+  unsigned int ebx = 0;
+  unsigned int ecx = 0;
+  unsigned int edx = 0;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return;
+  }
+  sse4_ = (ecx & bit_SSE4_2) && (ecx & bit_POPCNT);
+  if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX)) {
+    return;
+  }
+  unsigned int xcr0 = 0;
+  unsigned int xcr0_high = 0;
+  __asm__("xgetbv" : "=a" (xcr0), "=d" (xcr0_high) : "c" (0));
+  if ((xcr0 & 6) != 6 || __get_cpuid_max(0, NULL) < 7) {
+    return;
+  }
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  avx2_ = (ebx & bit_AVX2) && (ebx & bit_BMI2) ? 1 : 0;
+#elif __arm__
+#if __ARM_NEON__ || __ARM_NEON
+  neon_ = 1;
+#endif
+#endif
+}
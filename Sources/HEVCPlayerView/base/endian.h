@@ -29,6 +29,19 @@
 
 #include <endian.h>
 
+// Define the byte-order macros used by this library with the ones of glibc,
+// which defines them with two underscores. (An undefined `_BYTE_ORDER` would
+// be equal to an undefined `_BIG_ENDIAN` in `#if` directives.)
+#ifndef _LITTLE_ENDIAN
+#define _LITTLE_ENDIAN __LITTLE_ENDIAN
+#endif
+#ifndef _BIG_ENDIAN
+#define _BIG_ENDIAN __BIG_ENDIAN
+#endif
+#ifndef _BYTE_ORDER
+#define _BYTE_ORDER __BYTE_ORDER
+#endif
+
 #elif _WIN32 || __APPLE__
 /**
  * The byte order of the little-endian format (or the least-significant-byte-
@@ -0,0 +1,105 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BASE_TRACE_H_
+#define BASE_TRACE_H_
+
+#include <stdint.h>
+#if __APPLE__
+#include <os/log.h>
+#include <os/signpost.h>
+#endif
+
+/**
+ * The class that encapsulates the log to which players write `os_signpost`
+ * intervals, i.e. the "Playback" category of the
+ * "com.dena.pokota.HEVCPlayerView" subsystem shown by the os_signpost
+ * instrument. (Writing an interval costs a few instructions while no tools are
+ * recording it.)
+ */
+struct Trace {
+#if __APPLE__
+  /**
+   * Returns the log shared by all players.
+   * @return {os_log_t}
+   */
+  static os_log_t GetLog() {
+    static os_log_t log =
+        os_log_create("com.dena.pokota.HEVCPlayerView", "Playback");
+    return log;
+  }
+
+  /**
+   * Returns a new signpost ID, which matches the beginning and the end of an
+   * interval that overlaps with other intervals of the same name, e.g. an
+   * asynchronous decode.
+   * @return {uint64_t}
+   */
+  static uint64_t GenerateID() {
+    return os_signpost_id_generate(GetLog());
+  }
+#else
+  static uint64_t GenerateID() {
+    return 0;
+  }
+#endif
+};
+
+/**
+ * The signpost ID of an interval that does not overlap with other intervals of
+ * the same name, e.g. a synchronous function call.
+ * @const {uint64_t}
+ */
+#if __APPLE__
+#define HEVC_TRACE_EXCLUSIVE OS_SIGNPOST_ID_EXCLUSIVE
+#else
+#define HEVC_TRACE_EXCLUSIVE 0
+#endif
+
+/**
+ * Begins an interval with the specified name and the specified ID. (The name
+ * must be a string literal.)
+ * @param {const char*} name
+ * @param {uint64_t} id
+ */
+#if __APPLE__
+#define HEVC_TRACE_BEGIN(name, id) \
+    os_signpost_interval_begin(Trace::GetLog(), (id), name)
+#else
+#define HEVC_TRACE_BEGIN(name, id)
+#endif
+
+/**
+ * Ends an interval with the specified name and the specified ID.
+ * @param {const char*} name
+ * @param {uint64_t} id
+ */
+#if __APPLE__
+#define HEVC_TRACE_END(name, id) \
+    os_signpost_interval_end(Trace::GetLog(), (id), name)
+#else
+#define HEVC_TRACE_END(name, id)
+#endif
+
+#endif  // BASE_TRACE_H_
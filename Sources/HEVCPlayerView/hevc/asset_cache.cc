@@ -0,0 +1,499 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "../hevc/asset_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../hevc/sample_index.h"
+#include "../mov/stream.h"
+
+namespace {
+
+/**
+ * The inner class that encapsulates a file shared by players.
+ */
+struct CachedAsset {
+  /**
+   * The path to the file.
+   * @type {char*}
+   */
+  char* path;
+
+  /**
+   * The size of the file.
+   * @type {uint64_t}
+   */
+  uint64_t file_size;
+
+  /**
+   * The modification time of the file.
+   * @type {int64_t}
+   */
+  int64_t modified_time;
+
+  /**
+   * The ID of the file.
+   * @type {uint32_t}
+   */
+  uint32_t id;
+
+  /**
+   * The number of players using the file.
+   * @type {uint32_t}
+   */
+  uint32_t references;
+
+  /**
+   * The stream data shared by the players.
+   * @type {mov::Stream}
+   */
+  mov::Stream stream;
+
+  /**
+   * The sample index of the file. (This index is empty until a player creates
+   * it.)
+   * @type {hevc::SampleIndex}
+   */
+  hevc::SampleIndex index;
+};
+
+/**
+ * The mutex that allows only one thread to access the cache.
+ * @type {pthread_mutex_t}
+ */
+pthread_mutex_t g_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * The files in the cache.
+ * @type {CachedAsset[]}
+ */
+CachedAsset g_assets[hevc::AssetCache::MAX_ASSETS];
+
+/**
+ * The number of the files in the cache.
+ * @type {int}
+ */
+int g_asset_count = 0;
+
+/**
+ * The ID assigned to the next file.
+ * @type {uint32_t}
+ */
+uint32_t g_next_id = 1;
+
+/**
+ * The minimum size of the files opened as windowed streams.
+ * @type {uint64_t}
+ */
+uint64_t g_window_threshold = static_cast<uint64_t>(64) << 20;
+
+/**
+ * Returns the index of the file with the specified ID, or -1 if the cache does
+ * not have it. (The caller must acquire the cache mutex.)
+ * @param {uint32_t} id
+ * @return {int}
+ */
+int FindAsset(uint32_t id) {
+  for (int i = 0; i < g_asset_count; ++i) {
+    if (g_assets[i].id == id) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Makes the specified stream share the stream data of the specified file if
+ * another player is playing it, and copies its sample index to the specified
+ * one if the cache has it. This function returns the ID of the file, or 0 if
+ * the cache does not have it. (A file modified since the player opened it is a
+ * different file. The caller must acquire the cache mutex.)
+ * @param {const char*} path
+ * @param {uint64_t} file_size
+ * @param {int64_t} modified_time
+ * @param {mov::Stream*} stream
+ * @param {hevc::SampleIndex*} index
+ * @return {uint32_t}
+ */
+uint32_t ShareAsset(const char* path,
+                    uint64_t file_size,
+                    int64_t modified_time,
+                    mov::Stream* stream,
+                    hevc::SampleIndex* index) {
+  for (int i = 0; i < g_asset_count; ++i) {
+    CachedAsset* cached = &g_assets[i];
+    if (cached->file_size == file_size &&
+        cached->modified_time == modified_time &&
+        !strcmp(cached->path, path)) {
+      if (!cached->stream.Share(stream)) {
+        return 0;
+      }
+      ++cached->references;
+      if (cached->index.GetNumberOfSamples()) {
+        index->Copy(&cached->index);
+      }
+      return cached->id;
+    }
+  }
+  return 0;
+}
+
+#if __APPLE__
+/**
+ * The inner class that encapsulates a decoded image in the cache.
+ */
+struct CachedFrame {
+  /**
+   * The image.
+   * @type {CVImageBufferRef}
+   */
+  CVImageBufferRef image;
+
+  /**
+   * The size of the image.
+   * @type {size_t}
+   */
+  size_t size;
+
+  /**
+   * The time when a player used the image last time.
+   * @type {uint64_t}
+   */
+  uint64_t last_use;
+
+  /**
+   * The ID of the file.
+   * @type {uint32_t}
+   */
+  uint32_t id;
+
+  /**
+   * The frame number of the image.
+   * @type {uint32_t}
+   */
+  uint32_t frame;
+
+  /**
+   * The width of the image. (Players may decode a file at different sizes.)
+   * @type {uint32_t}
+   */
+  uint32_t width;
+};
+
+/**
+ * The images in the cache.
+ * @type {CachedFrame[]}
+ */
+CachedFrame g_frames[hevc::AssetCache::MAX_FRAMES];
+
+/**
+ * The number of the images in the cache.
+ * @type {int}
+ */
+int g_frame_count = 0;
+
+/**
+ * The total size of the images in the cache.
+ * @type {size_t}
+ */
+size_t g_frame_usage = 0;
+
+/**
+ * The maximum total size of the images in the cache.
+ * @type {size_t}
+ */
+size_t g_frame_budget = 32 << 20;
+
+/**
+ * The clock incremented whenever a player uses an image.
+ * @type {uint64_t}
+ */
+uint64_t g_frame_clock = 0;
+
+/**
+ * Deletes the specified image from the cache. (The caller must acquire the
+ * cache mutex.)
+ * @param {int} index
+ */
+void RemoveFrame(int index) {
+  CFRelease(g_frames[index].image);
+  g_frame_usage -= g_frames[index].size;
+  g_frames[index] = g_frames[--g_frame_count];
+}
+
+/**
+ * Deletes the least recently used image from the cache. (The caller must
+ * acquire the cache mutex.)
+ */
+void RemoveOldestFrame() {
+  int oldest = 0;
+  for (int i = 1; i < g_frame_count; ++i) {
+    if (g_frames[i].last_use < g_frames[oldest].last_use) {
+      oldest = i;
+    }
+  }
+  RemoveFrame(oldest);
+}
+
+/**
+ * Deletes the least recently used images from the cache until their total
+ * size does not exceed the specified one. (The caller must acquire the cache
+ * mutex.)
+ * @param {size_t} budget
+ */
+void TrimFrames(size_t budget) {
+  while (g_frame_count > 0 && g_frame_usage > budget) {
+    RemoveOldestFrame();
+  }
+}
+
+/**
+ * Deletes the images of the specified file from the cache. (The caller must
+ * acquire the cache mutex.)
+ * @param {uint32_t} id
+ */
+void RemoveFrames(uint32_t id) {
+  for (int i = g_frame_count - 1; i >= 0; --i) {
+    if (g_frames[i].id == id) {
+      RemoveFrame(i);
+    }
+  }
+}
+#endif
+
+}  // namespace
+
+namespace hevc {
+
+int AssetCache::Open(const char* path,
+                     mov::Stream* stream,
+                     SampleIndex* index,
+                     Asset* asset) {
+  asset->id = 0;
+  const int file = open(path, O_RDONLY);
+  if (file < 0) {
+    return errno;
+  }
+  // Save the error code of a failed function before cleaning up. (The
+  // `close()` function may overwrite `errno`.)
+  struct stat file_stat;
+  if (fstat(file, &file_stat)) {
+    const int error = errno;
+    close(file);
+    return error;
+  }
+  asset->file_size = static_cast<uint64_t>(file_stat.st_size);
+  asset->modified_time = static_cast<int64_t>(file_stat.st_mtime);
+
+  // Share the stream data of the file if another player is playing it.
+  pthread_mutex_lock(&g_cache_mutex);
+  asset->id = ShareAsset(path, asset->file_size, asset->modified_time, stream,
+                         index);
+  pthread_mutex_unlock(&g_cache_mutex);
+  if (asset->id) {
+    close(file);
+    return 0;
+  }
+
+  // Open the file without holding the mutex and add it to this cache. (A
+  // player plays the file without sharing it when this cache is full. The
+  // players sharing the file use the stream type of the first one.)
+  const int windowed = asset->file_size >= GetWindowThreshold();
+  errno = 0;
+  if (!stream->Open(file, windowed)) {
+    const int error = errno ? errno : EINVAL;
+    close(file);
+    return error;
+  }
+  close(file);
+
+  // Share the stream data of the file instead of adding it when another player
+  // has added it while this function opens it.
+  pthread_mutex_lock(&g_cache_mutex);
+  mov::Stream shared;
+  shared.Initialize();
+  asset->id = ShareAsset(path, asset->file_size, asset->modified_time, &shared,
+                         index);
+  if (asset->id) {
+    pthread_mutex_unlock(&g_cache_mutex);
+    stream->Destroy();
+    *stream = shared;
+    return 0;
+  }
+  if (g_asset_count < MAX_ASSETS) {
+    CachedAsset* cached = &g_assets[g_asset_count];
+    cached->path = strdup(path);
+    cached->stream.Initialize();
+    if (cached->path && stream->Share(&cached->stream)) {
+      cached->file_size = asset->file_size;
+      cached->modified_time = asset->modified_time;
+      cached->id = g_next_id++;
+      g_next_id = g_next_id ? g_next_id : 1;
+      cached->references = 1;
+      cached->index.Initialize();
+      asset->id = cached->id;
+      ++g_asset_count;
+    } else {
+      free(cached->path);
+    }
+  }
+  pthread_mutex_unlock(&g_cache_mutex);
+  return 0;
+}
+
+void AssetCache::SetSampleIndex(uint32_t id, const SampleIndex* index) {
+  pthread_mutex_lock(&g_cache_mutex);
+  const int i = FindAsset(id);
+  if (i >= 0 && !g_assets[i].index.GetNumberOfSamples()) {
+    g_assets[i].index.Copy(index);
+  }
+  pthread_mutex_unlock(&g_cache_mutex);
+}
+
+void AssetCache::Release(uint32_t id) {
+  // Delete the file after releasing the mutex when no players use it. (The
+  // stream deletes its data only when no decoders use it.)
+  CachedAsset released;
+  released.path = NULL;
+  pthread_mutex_lock(&g_cache_mutex);
+  const int i = FindAsset(id);
+  if (i >= 0) {
+    const uint32_t references = --g_assets[i].references;
+#if __APPLE__
+    if (references < 2) {
+      RemoveFrames(id);
+    }
+#endif
+    if (references == 0) {
+      released = g_assets[i];
+      g_assets[i] = g_assets[--g_asset_count];
+    }
+  }
+  pthread_mutex_unlock(&g_cache_mutex);
+  if (released.path) {
+    released.stream.Destroy();
+    released.index.Destroy();
+    free(released.path);
+  }
+}
+
+void AssetCache::SetWindowThreshold(uint64_t threshold) {
+  pthread_mutex_lock(&g_cache_mutex);
+  g_window_threshold = threshold;
+  pthread_mutex_unlock(&g_cache_mutex);
+}
+
+uint64_t AssetCache::GetWindowThreshold() {
+  pthread_mutex_lock(&g_cache_mutex);
+  const uint64_t threshold = g_window_threshold;
+  pthread_mutex_unlock(&g_cache_mutex);
+  return threshold;
+}
+
+#if __APPLE__
+CVImageBufferRef AssetCache::CopyFrame(uint32_t id,
+                                       uint32_t frame,
+                                       uint32_t width) {
+  CVImageBufferRef image = NULL;
+  pthread_mutex_lock(&g_cache_mutex);
+  for (int i = 0; i < g_frame_count; ++i) {
+    CachedFrame* cached = &g_frames[i];
+    if (cached->id == id && cached->frame == frame && cached->width == width) {
+      cached->last_use = ++g_frame_clock;
+      image = cached->image;
+      CFRetain(image);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&g_cache_mutex);
+  return image;
+}
+
+void AssetCache::AddFrame(uint32_t id,
+                          uint32_t frame,
+                          CVImageBufferRef image,
+                          size_t size) {
+  // Add the image only when another player may use it, i.e. when two or more
+  // players are playing the file. Then delete the least recently used images
+  // so the cache does not exceed its budget.
+  const uint32_t width = (uint32_t)CVPixelBufferGetWidth(image);
+  pthread_mutex_lock(&g_cache_mutex);
+  const int i = FindAsset(id);
+  if (i >= 0 && g_assets[i].references >= 2 && size <= g_frame_budget) {
+    int found = 0;
+    for (int j = 0; j < g_frame_count; ++j) {
+      if (g_frames[j].id == id && g_frames[j].frame == frame &&
+          g_frames[j].width == width) {
+        found = 1;
+        break;
+      }
+    }
+    if (!found) {
+      TrimFrames(g_frame_budget - size);
+      if (g_frame_count >= MAX_FRAMES) {
+        RemoveOldestFrame();
+      }
+      CachedFrame* cached = &g_frames[g_frame_count++];
+      cached->image = image;
+      CFRetain(image);
+      cached->size = size;
+      cached->last_use = ++g_frame_clock;
+      cached->id = id;
+      cached->frame = frame;
+      cached->width = width;
+      g_frame_usage += size;
+    }
+  }
+  pthread_mutex_unlock(&g_cache_mutex);
+}
+
+void AssetCache::SetFrameBudget(size_t budget) {
+  pthread_mutex_lock(&g_cache_mutex);
+  g_frame_budget = budget;
+  TrimFrames(budget);
+  pthread_mutex_unlock(&g_cache_mutex);
+}
+
+size_t AssetCache::GetFrameBudget() {
+  pthread_mutex_lock(&g_cache_mutex);
+  const size_t budget = g_frame_budget;
+  pthread_mutex_unlock(&g_cache_mutex);
+  return budget;
+}
+
+void AssetCache::ClearFrames() {
+  pthread_mutex_lock(&g_cache_mutex);
+  TrimFrames(0);
+  pthread_mutex_unlock(&g_cache_mutex);
+}
+#endif
+
+}  // namespace hevc
@@ -0,0 +1,206 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef HEVC_ASSET_CACHE_H_
+#define HEVC_ASSET_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#if __APPLE__
+#include <CoreVideo/CoreVideo.h>
+#endif
+
+namespace mov {
+struct Stream;
+}  // namespace mov
+
+namespace hevc {
+
+struct SampleIndex;
+
+/**
+ * The process-wide cache of the QuickTime files being played. Players of the
+ * same file share its stream data and its sample index through this cache,
+ * i.e. they read the file only once and only the first one of them reads the
+ * slice headers of its samples. This cache also keeps the images decoded by
+ * the players of a file played by two or more players so a player can use an
+ * image decoded by another one instead of decoding it. This cache deletes the
+ * least recently used images when their total size exceeds a budget and
+ * deletes a file when no players use it. All functions of this class are
+ * thread-safe.
+ */
+struct AssetCache {
+  /**
+   * The maximum number of files and the maximum number of images retained by
+   * this cache.
+   * @enum {int}
+   */
+  enum {
+    MAX_ASSETS = 16,
+    MAX_FRAMES = 256,
+  };
+
+  /**
+   * The inner class that encapsulates the key of a file in this cache.
+   * @public
+   */
+  struct Asset {
+    /**
+     * The ID of the file, which is unique in this process. (This value is 0
+     * when this cache cannot share the file.)
+     * @type {uint32_t}
+     * @public
+     */
+    uint32_t id;
+
+    /**
+     * The size of the file.
+     * @type {uint64_t}
+     * @public
+     */
+    uint64_t file_size;
+
+    /**
+     * The modification time of the file, in seconds since the Epoch.
+     * @type {int64_t}
+     * @public
+     */
+    int64_t modified_time;
+  };
+
+  /**
+   * Opens the specified QuickTime file as a progressive stream. This function
+   * shares the stream data of the file with the other players of the file and
+   * copies its sample index to the given one if this cache has it. It opens a
+   * windowed stream when the file is not smaller than the window threshold,
+   * i.e. the players of a large file keep only the chunks around their current
+   * positions in memory. This function returns 0 when it succeeds and the
+   * `errno` value of the failed function otherwise. (The caller owns the given
+   * stream and the given index, and it must call `Release()` when it finishes
+   * playing the file unless the returned ID is 0.)
+   * @param {const char*} path
+   * @param {mov::Stream*} stream
+   * @param {hevc::SampleIndex*} index
+   * @param {hevc::AssetCache::Asset*} asset
+   * @return {int}
+   * @public
+   */
+  static int Open(const char* path,
+                  mov::Stream* stream,
+                  SampleIndex* index,
+                  Asset* asset);
+
+  /**
+   * Stores a copy of the sample index of the specified file so the next player
+   * of the file does not have to create it.
+   * @param {uint32_t} id
+   * @param {const hevc::SampleIndex*} index
+   * @public
+   */
+  static void SetSampleIndex(uint32_t id, const SampleIndex* index);
+
+  /**
+   * Releases the specified file. This function deletes the file and its images
+   * when no players use it.
+   * @param {uint32_t} id
+   * @public
+   */
+  static void Release(uint32_t id);
+
+  /**
+   * Sets the minimum size of the files opened as windowed streams. 0 means
+   * this cache opens all files as windowed streams. (This value does not
+   * affect the files opened before this function is called.)
+   * @param {uint64_t} threshold
+   * @public
+   */
+  static void SetWindowThreshold(uint64_t threshold);
+
+  /**
+   * Returns the minimum size of the files opened as windowed streams.
+   * @return {uint64_t}
+   * @public
+   */
+  static uint64_t GetWindowThreshold();
+
+#if __APPLE__
+  /**
+   * Returns the image of the specified frame of the specified file decoded at
+   * the specified width. This function returns NULL when this cache does not
+   * have the image. (The caller must call the `CFRelease()` function after it
+   * uses the returned image.)
+   * @param {uint32_t} id
+   * @param {uint32_t} frame
+   * @param {uint32_t} width
+   * @return {CVImageBufferRef}
+   * @public
+   */
+  static CVImageBufferRef CopyFrame(uint32_t id,
+                                    uint32_t frame,
+                                    uint32_t width);
+
+  /**
+   * Adds the specified image of the specified frame of the specified file.
+   * This function does nothing unless two or more players are playing the
+   * file.
+   * @param {uint32_t} id
+   * @param {uint32_t} frame
+   * @param {CVImageBufferRef} image
+   * @param {size_t} size
+   * @public
+   */
+  static void AddFrame(uint32_t id,
+                       uint32_t frame,
+                       CVImageBufferRef image,
+                       size_t size);
+
+  /**
+   * Sets the maximum number of bytes used by the images retained by this
+   * cache. 0 means this cache does not retain images.
+   * @param {size_t} budget
+   * @public
+   */
+  static void SetFrameBudget(size_t budget);
+
+  /**
+   * Returns the maximum number of bytes used by the images retained by this
+   * cache.
+   * @return {size_t}
+   * @public
+   */
+  static size_t GetFrameBudget();
+
+  /**
+   * Deletes all images retained by this cache, e.g. when the host application
+   * receives a memory warning.
+   * @public
+   */
+  static void ClearFrames();
+#endif
+};
+
+}  // namespace hevc
+
+#endif  // HEVC_ASSET_CACHE_H_
@@ -25,10 +25,15 @@
 #include "../hevc/decoder.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <memory.h>
 #include "../base/cpu.h"
 #include "../base/log.h"
+#include "../base/trace.h"
 #include "../hevc/bitstream.h"
+#include "../hevc/rbsp.h"
+#include "../hevc/sample_index.h"
+#include "../hevc/session_pool.h"
 #include "../mov/atom.h"
 #include "../mov/atom_collection.h"
 
@@ -70,6 +75,79 @@ enum {
 }  // namespace
 #endif
 
+#if __APPLE__
+namespace {
+
+/**
+ * Adds an integer to the specified dictionary.
+ * @param {CFMutableDictionaryRef} dictionary
+ * @param {CFStringRef} key
+ * @param {int} value
+ * @return {int}
+ */
+int SetDictionaryNumber(CFMutableDictionaryRef dictionary,
+                        CFStringRef key,
+                        int value) {
+  CFNumberRef number =
+      CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &value);
+  if (!number) {
+    return 0;
+  }
+  CFDictionarySetValue(dictionary, key, number);
+  CFRelease(number);
+  return 1;
+}
+
+/**
+ * Asks the specified session to decode samples at the specified resolution.
+ * Some decoders do not support decoding samples at reduced resolutions, i.e.
+ * this function ignores errors and lets the session scale its output images
+ * for them.
+ * @param {VTDecompressionSessionRef} session
+ * @param {int} width
+ * @param {int} height
+ */
+void SetReducedResolution(VTDecompressionSessionRef session,
+                          int width,
+                          int height) {
+  CFMutableDictionaryRef resolution = CFDictionaryCreateMutable(
+      kCFAllocatorDefault,
+      2,
+      &kCFTypeDictionaryKeyCallBacks,
+      &kCFTypeDictionaryValueCallBacks);
+  if (!resolution) {
+    return;
+  }
+  if (SetDictionaryNumber(
+          resolution, kVTDecompressionResolutionKey_Width, width) &&
+      SetDictionaryNumber(
+          resolution, kVTDecompressionResolutionKey_Height, height)) {
+    VTSessionSetProperty(session,
+                         kVTDecompressionPropertyKey_ReducedResolutionDecode,
+                         resolution);
+  }
+  CFRelease(resolution);
+}
+
+}  // namespace
+#endif
+
+namespace {
+
+/**
+ * Compares two presentation timestamps for the `qsort()` function.
+ * @param {const void*} a
+ * @param {const void*} b
+ * @return {int}
+ */
+int CompareTimestamps(const void* a, const void* b) {
+  const int64_t timestamp_a = *static_cast<const int64_t*>(a);
+  const int64_t timestamp_b = *static_cast<const int64_t*>(b);
+  return (timestamp_a > timestamp_b) - (timestamp_a < timestamp_b);
+}
+
+}  // namespace
+
 namespace hevc {
 
 void Decoder::Initialize() {
@@ -87,28 +165,131 @@ int Decoder::Create(const void* data,
   // Create a copy of the given QuickTime stream so Video Toolbox can write its
   // data. (This clone has a 16-byte (32-byte) padding at its end so this
   // decoder can safely read 16 (32) bytes from anywhere in it.)
-  data_ = static_cast<uint8_t*>(malloc(size + __BIGGEST_ALIGNMENT__));
-  if (!data_) {
+  if (!stream_.Copy(data, size)) {
     return kVTAllocationFailedErr;
   }
-  memcpy(data_, data, size);
+  return CreateFromStream(NULL, callback, object);
+}
+
+int Decoder::Create(mov::Stream* stream,
+                    OutputCallback callback,
+                    void* object) {
+  return Create(stream, NULL, callback, object);
+}
+
+int Decoder::Create(mov::Stream* stream,
+                    const SampleIndex* index,
+                    OutputCallback callback,
+                    void* object) {
+  // Move the given stream to this decoder. (A `mov::Stream` object has a
+  // zero-filled padding at its end as the above copy does.)
+  stream_ = *stream;
+  stream->Initialize();
+  return CreateFromStream(index, callback, object);
+}
+
+int Decoder::CreateSampleIndex(uint64_t file_size,
+                               int64_t modified_time,
+                               SampleIndex* index) const {
+  if (!HasAllSamples() || !index->Create(number_of_samples_)) {
+    return 0;
+  }
+  SampleIndex::Header* header = index->GetHeader();
+  header->file_size = file_size;
+  header->modified_time = modified_time;
+  header->hash = sample_table_hash_;
+  header->max_picture_order_count = max_picture_order_count_;
+  SampleIndex::Entry* entries = index->GetEntries();
+  for (uint32_t i = 0; i < number_of_samples_; ++i) {
+    entries[i].offset = samples_[i].offset;
+    entries[i].size = samples_[i].size;
+    entries[i].picture_order_count = samples_[i].picture_order_count;
+    entries[i].frame_number = samples_[i].frame_number;
+  }
+  return 1;
+}
 
+int Decoder::CreateFromStream(const SampleIndex* index,
+                              OutputCallback callback,
+                              void* object) {
   // Parse QuickTime atoms in the stream required for decoding it with Video
   // Toolbox.
   mov::AtomCollection map;
   map.Initialize();
-  if (!map.Enumerate(&data_[0], size)) {
+  HEVC_TRACE_BEGIN("Enumerate", HEVC_TRACE_EXCLUSIVE);
+  const int enumerated = map.Enumerate(stream_.GetData(), stream_.GetSize());
+  HEVC_TRACE_END("Enumerate", HEVC_TRACE_EXCLUSIVE);
+  if (!enumerated) {
     return kVTVideoDecoderUnsupportedDataFormatErr;
   }
   const mov::FileTypeAtom* file_type_atom = map.GetFileTypeAtom();
   if (!file_type_atom->IsValid()) {
     return kVTVideoDecoderUnsupportedDataFormatErr;
   }
-  const mov::SampleDescriptionAtom* sample_description_atom =
-      map.GetSampleDescriptionAtom();
+  const mov::VideoSampleDescriptionExtension* extension =
+      DecodeSampleDescription(map.GetSampleDescriptionAtom());
+  if (!extension) {
+    return kVTVideoDecoderUnsupportedDataFormatErr;
+  }
+
+  // Initialize the `samples_[]` array so this decoder can seek frames in the
+  // QuickTime stream.
+  HEVC_TRACE_BEGIN("InitializeSamples", HEVC_TRACE_EXCLUSIVE);
+  const int initialized = InitializeSamples(&map, index);
+  HEVC_TRACE_END("InitializeSamples", HEVC_TRACE_EXCLUSIVE);
+  if (!initialized) {
+    return kVTAllocationFailedErr;
+  }
+
+  // Set sample durations and decoding timestamps using a `stts` atom and a
+  // `mdhd` atom.
+  time_scale_ = 0;
+  duration_ = 0;
+  if (map.HasSampleDurations()) {
+    const mov::TimeToSampleAtom* time_to_sample_atom =
+        map.GetTimeToSampleAtom();
+    const mov::MediaHeaderAtom* media_header_atom = map.GetMediaHeaderAtom();
+    time_scale_ = media_header_atom->GetTimeScale();
+    uint32_t entry_start = 0;
+    const uint32_t number_of_entries = time_to_sample_atom->GetCount();
+    for (uint32_t i = 0; i < number_of_entries; ++i) {
+      const mov::TimeToSampleAtom::Entry* entry =
+          time_to_sample_atom->GetEntry(i);
+      const uint32_t entry_end = entry_start + entry->GetCount();
+      if (entry_end > number_of_samples_) {
+        return kVTVideoDecoderBadDataErr;
+      }
+      if (entry_start < entry_end) {
+        const uint32_t entry_duration = entry->GetDuration();
+        do {
+          samples_[entry_start].duration = entry_duration;
+          samples_[entry_start].timestamp = duration_;
+          samples_[entry_start].presentation_timestamp = duration_;
+          duration_ += entry_duration;
+        } while (++entry_start < entry_end);
+      }
+    }
+    if (!ApplyCompositionOffsets(map.GetCompositionOffsetAtom())) {
+      return kVTVideoDecoderBadDataErr;
+    }
+  }
+#if __APPLE__
+  // This initializer can get all information required for initializing a
+  // Video Toolbox session.
+  return CreateVideoToolbox(
+      extension, frame_width_, frame_height_, callback, object, 1);
+#else
+  static_cast<void>(callback);
+  static_cast<void>(object);
+  return 0;
+#endif
+}
+
+const mov::VideoSampleDescriptionExtension* Decoder::DecodeSampleDescription(
+    const mov::SampleDescriptionAtom* sample_description_atom) {
   uint32_t number_of_descriptions = sample_description_atom->GetCount();
   if (!number_of_descriptions) {
-    return kVTVideoDecoderUnsupportedDataFormatErr;
+    return NULL;
   }
   const mov::SampleDescription* sample_description =
       sample_description_atom->GetFirstDescription();
@@ -117,12 +298,10 @@ int Decoder::Create(const void* data,
     if (format == mov::FORMAT_HVC1) {
       const mov::VideoSampleDescription* video_sample_description =
           sample_description->GetVideoSampleDescription();
-      const int frame_width = video_sample_description->GetWidth();
-      const int frame_height = video_sample_description->GetHeight();
-      frame_width_ = frame_width;
-      frame_height_ = frame_height;
+      frame_width_ = video_sample_description->GetWidth();
+      frame_height_ = video_sample_description->GetHeight();
       HEVC_LOG_D("%s(): width=%d, height=%d\n",
-          __FUNCTION__, frame_width, frame_height);
+          __FUNCTION__, frame_width_, frame_height_);
 
       // Decode extensions only if it has sufficient space to contain an
       // extension header (8 bytes). (Apple encoders sometimes add a 4-byte
@@ -140,45 +319,9 @@ int Decoder::Create(const void* data,
           // this decoder does not have to do it for now. But it is definitely
           // better for this decoder to decode `hvcC` extensions in the future.
           if (!DecodeHEVCDecoderConfiguration(extension)) {
-            return kVTVideoDecoderUnsupportedDataFormatErr;
+            return NULL;
           }
-
-          // Initialize the `samples_[]` array so this decoder can seek frames
-          // in the QuickTime stream.
-          if (!InitializeSamples(&map)) {
-            return kVTAllocationFailedErr;
-          }
-
-          // Set sample durations using a `stts` atom and a `mdhd` atom.
-          if (map.HasSampleDurations()) {
-            const mov::TimeToSampleAtom* time_to_sample_atom =
-                map.GetTimeToSampleAtom();
-            const mov::MediaHeaderAtom* media_header_atom =
-                map.GetMediaHeaderAtom();
-            time_scale_ = media_header_atom->GetTimeScale();
-            uint32_t entry_start = 0;
-            const uint32_t number_of_entries = time_to_sample_atom->GetCount();
-            for (uint32_t i = 0; i < number_of_entries; ++i) {
-              const mov::TimeToSampleAtom::Entry* entry =
-                  time_to_sample_atom->GetEntry(i);
-              const uint32_t entry_end = entry_start + entry->GetCount();
-              if (entry_end > number_of_samples_) {
-                return kVTVideoDecoderBadDataErr;
-              }
-              if (entry_start < entry_end) {
-                const uint32_t entry_duration = entry->GetDuration();
-                do {
-                  samples_[entry_start].duration = entry_duration;
-                } while (++entry_start < entry_end);
-              }
-            }
-          }
-#if __APPLE__
-          // This initializer can get all information required for initializing
-          // a Video Toolbox session.
-          return CreateVideoToolbox(
-              extension, frame_width, frame_height, callback, object);
-#endif
+          return extension;
         }
         extra_start += extension->GetSize();
       }
@@ -186,12 +329,12 @@ int Decoder::Create(const void* data,
     sample_description = sample_description->GetNextDescription();
   } while (--number_of_descriptions > 0);
 
-  return kVTVideoDecoderUnsupportedDataFormatErr;
+  return NULL;
 }
 
 void Decoder::Destroy() {
 #if __APPLE__
-  DestroyVideoToolbox();
+  DestroyVideoToolbox(1);
   hvcc_extension_ = NULL;
   decoder_callback_ = NULL;
   decoder_object_ = NULL;
@@ -200,10 +343,16 @@ void Decoder::Destroy() {
     free(samples_);
     samples_ = NULL;
   }
-  if (data_) {
-    free(data_);
-    data_ = NULL;
-  }
+  sync_sample_atom_ = NULL;
+  stream_.Unpin(window_offset_, window_size_);
+  stream_.Unpin(parse_offset_, parse_size_);
+  window_start_ = 0;
+  window_next_ = 0;
+  window_offset_ = 0;
+  window_size_ = 0;
+  parse_offset_ = 0;
+  parse_size_ = 0;
+  stream_.Destroy();
 }
 
 int Decoder::Reset() {
@@ -216,23 +365,440 @@ int Decoder::Reset() {
 
 int Decoder::DecodeSample(int sample_number) {
 #if __APPLE__
-  return DecodeSampleVideoToolbox(sample_number);
+  return DecodeSampleVideoToolbox(sample_number, 0, NULL);
 #else
+  static_cast<void>(sample_number);
   return 0;
 #endif
 }
 
-int Decoder::InitializeSamples(const mov::AtomCollection* map) {
+#if __APPLE__
+int Decoder::Prewarm(
+    const mov::SampleDescriptionAtom* sample_description_atom) {
+  // Create a new session instead of re-using an idle one so this decoder adds
+  // a session to the pool when it is destroyed.
+  const mov::VideoSampleDescriptionExtension* extension =
+      DecodeSampleDescription(sample_description_atom);
+  if (!extension) {
+    return kVTVideoDecoderUnsupportedDataFormatErr;
+  }
+  return CreateVideoToolbox(
+      extension, frame_width_, frame_height_, NULL, NULL, 0);
+}
+
+int Decoder::SetOutputSize(int output_width, int output_height) {
+  // Use 0 for the frame size so this decoder shares sessions with decoders
+  // that output images of the frame size.
+  if (output_width == frame_width_ && output_height == frame_height_) {
+    output_width = 0;
+    output_height = 0;
+  }
+  if (output_width == output_width_ && output_height == output_height_) {
+    return 0;
+  }
+  output_width_ = output_width;
+  output_height_ = output_height;
+  if (!hvcc_extension_) {
+    return 0;
+  }
+  DestroyVideoToolbox(1);
+  return CreateVideoToolbox(hvcc_extension_, frame_width_, frame_height_,
+      decoder_callback_, decoder_object_, 1);
+}
+#endif
+
+int Decoder::ApplyCompositionOffsets(
+    const mov::CompositionOffsetAtom* composition_offset_atom) {
+  // Add the composition offsets to the decoding timestamps, sort the sums, and
+  // store them in the output order. Then move them so the first frame is
+  // presented at 0, as an edit list usually does for a stream whose first
+  // frame has a positive offset. (An HEVC stream with B-frames has composition
+  // offsets, and the `frame`-th frame is presented at the `frame`-th smallest
+  // sum. The `mov::AtomCollection` class has verified that the atom contains
+  // all its entries.)
+  if (!composition_offset_atom || number_of_samples_ == 0) {
+    return 1;
+  }
+  const uint32_t number_of_entries = composition_offset_atom->GetCount();
+  int64_t* timestamps = static_cast<int64_t*>(
+      malloc(number_of_samples_ * sizeof(int64_t)));
+  if (!timestamps) {
+    return 0;
+  }
+  uint32_t entry_start = 0;
+  for (uint32_t i = 0; i < number_of_entries; ++i) {
+    const mov::CompositionOffsetAtom::Entry* entry =
+        composition_offset_atom->GetEntry(i);
+    const uint32_t entry_end = entry_start + entry->GetCount();
+    if (entry_end < entry_start || entry_end > number_of_samples_) {
+      free(timestamps);
+      return 0;
+    }
+    const int64_t offset = entry->GetOffset();
+    for (; entry_start < entry_end; ++entry_start) {
+      timestamps[entry_start] =
+          static_cast<int64_t>(samples_[entry_start].timestamp) + offset;
+    }
+  }
+  for (; entry_start < number_of_samples_; ++entry_start) {
+    timestamps[entry_start] =
+        static_cast<int64_t>(samples_[entry_start].timestamp);
+  }
+  qsort(timestamps, number_of_samples_, sizeof(int64_t), CompareTimestamps);
+  for (uint32_t i = 0; i < number_of_samples_; ++i) {
+    samples_[i].presentation_timestamp =
+        static_cast<uint64_t>(timestamps[i] - timestamps[0]);
+  }
+  free(timestamps);
+  return 1;
+}
+
+int Decoder::GetFrame(float presentation_time) const {
+  // Find the last frame whose presentation timestamp is not greater than the
+  // given time with a binary search. (The presentation timestamps of frames
+  // are sorted in the output order.)
+  if (number_of_samples_ == 0) {
+    return 0;
+  }
+  if (time_scale_ == 0 || duration_ == 0 || presentation_time <= 0.0f) {
+    return 0;
+  }
+  const uint64_t timestamp =
+      static_cast<uint64_t>(presentation_time * time_scale_);
+  uint32_t low = 0;
+  uint32_t high = number_of_samples_;
+  while (high - low > 1) {
+    const uint32_t middle = low + (high - low) / 2;
+    if (samples_[middle].presentation_timestamp <= timestamp) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+  return static_cast<int>(low);
+}
+
+int Decoder::GetSyncSample(int sample_number) const {
+  // Find the last sync sample that is not after the given sample with a binary
+  // search. (The `stss` atom lists sync samples in the ascending order and its
+  // sample numbers start from 1.)
+  if (!sync_sample_atom_) {
+    return sample_number;
+  }
+  const uint32_t target = static_cast<uint32_t>(sample_number) + 1;
+  uint32_t low = 0;
+  uint32_t high = sync_sample_atom_->GetCount();
+  if (high == 0 || sync_sample_atom_->GetSyncSample(0) > target) {
+    return 0;
+  }
+  while (high - low > 1) {
+    const uint32_t middle = low + (high - low) / 2;
+    if (sync_sample_atom_->GetSyncSample(middle) <= target) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+  return static_cast<int>(sync_sample_atom_->GetSyncSample(low)) - 1;
+}
+
+uint32_t Decoder::GetNextSyncSample(uint32_t sample_number) const {
+  // Find the first sync sample after the given sample with a binary search as
+  // `GetSyncSample()` does.
+  if (!sync_sample_atom_) {
+    return sample_number + 1 < number_of_samples_ ? sample_number + 1 :
+        number_of_samples_;
+  }
+  const uint32_t target = sample_number + 1;
+  const uint32_t count = sync_sample_atom_->GetCount();
+  uint32_t low = 0;
+  uint32_t high = count;
+  while (low < high) {
+    const uint32_t middle = low + (high - low) / 2;
+    if (sync_sample_atom_->GetSyncSample(middle) <= target) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  if (low >= count) {
+    return number_of_samples_;
+  }
+  const uint32_t next_sample = sync_sample_atom_->GetSyncSample(low) - 1;
+  return next_sample < number_of_samples_ ? next_sample : number_of_samples_;
+}
+
+int Decoder::IsDiscardableSample(int sample_number) const {
+  // Read the NAL header of the first slice of the sample. Sub-layer
+  // non-reference pictures have even NAL unit types less than 16 (Table 7-1),
+  // and pictures of a sub-layer may refer only to those of the same or lower
+  // sub-layers, i.e. no pictures refer to one of the highest sub-layer.
+  //   +-------+------+-----------------------+
+  //   | field | size | name                  |
+  //   +-------+------+-----------------------+
+  //   |       | 1    | forbidden_zero_bit    |
+  //   |       | 6    | nal_unit_type         |
+  //   |       | 6    | nuh_layer_id          |
+  //   |       | 3    | nuh_temporal_id_plus1 |
+  //   +-------+------+-----------------------+
+  const uint8_t* packet_data =
+      static_cast<const uint8_t*>(GetSampleData(&samples_[sample_number]));
+  const uint32_t nal_unit_type = GetNALUnitType(packet_data);
+  if (nal_unit_type > NAL_VCL_N14 || (nal_unit_type & 1)) {
+    return 0;
+  }
+  // A `nuh_temporal_id_plus1` value of 0 is forbidden, i.e. this function
+  // does not discard the sample of a broken stream.
+  const uint32_t data2 = CPU::LoadUINT16BE(&packet_data[4]);
+  const uint32_t temporal_id_plus1 = CPU::BitExtractUINT32(data2, 0, 3);
+  if (temporal_id_plus1 == 0) {
+    return 0;
+  }
+  return temporal_id_plus1 - 1 >= sps_[0].sps_max_sub_layers_minus1;
+}
+
+int Decoder::IsRandomAccessSkippedSample(int sample_number) const {
+  // Read the NAL unit type of the first slice of the sample. (All slices of a
+  // picture have the same NAL unit type.)
+  const uint8_t* packet_data =
+      static_cast<const uint8_t*>(GetSampleData(&samples_[sample_number]));
+  const uint32_t nal_unit_type = GetNALUnitType(packet_data);
+  return nal_unit_type == NAL_RASL_N || nal_unit_type == NAL_RASL_R;
+}
+
+int Decoder::GetSeekSample(int frame_number) const {
+  // Frame numbers of the samples preceding a sync sample in the decoding order
+  // are less than the frame number of the sync sample unless they are leading
+  // pictures of a CRA sample, i.e. this function starts from the last sync
+  // sample not after the sample with the same number as the given frame and
+  // goes back while the frame numbers of sync samples are greater than the
+  // given one. (Samples are resident in the decoding order, i.e. this decoder
+  // knows the frame numbers of these sync samples when the sample with the
+  // same number as the given frame is resident.)
+  if (frame_number < 0 || !IsSampleResident(frame_number)) {
+    return -1;
+  }
+  int sample_number = GetSyncSample(frame_number);
+  while (sample_number > 0 &&
+         samples_[sample_number].frame_number >
+             static_cast<uint32_t>(frame_number)) {
+    sample_number = GetSyncSample(sample_number - 1);
+  }
+  return sample_number;
+}
+
+int Decoder::LoadSamples(int number_of_chunks) {
+  if (stream_.IsWindowed()) {
+    return LoadWindowedSamples(number_of_chunks);
+  }
+  // Read chunks of the stream in order. (A stream that is not progressive has
+  // no chunks to read and all its samples are resident.)
+  while (!HasAllSamples() && number_of_chunks-- > 0) {
+    const int status = stream_.LoadNext();
+    if (status < 0) {
+      return -1;
+    }
+    UpdateResidentSamples();
+    if (status == 0) {
+      // Treat a stream whose samples are out of the stream as a broken one.
+      return HasAllSamples() ? static_cast<int>(number_of_resident_samples_) :
+          -1;
+    }
+  }
+  return static_cast<int>(number_of_resident_samples_);
+}
+
+int Decoder::LoadSample(int sample_number) {
+  // All resident samples of a stream that is not windowed are readable. (A
+  // windowed stream keeps the samples of the window resident, i.e. this
+  // function moves the window only when the given sample is out of its first
+  // GOP.)
+  if (!IsSampleResident(sample_number)) {
+    return 0;
+  }
+  if (!stream_.IsWindowed()) {
+    return 1;
+  }
+  const uint32_t sample = static_cast<uint32_t>(sample_number);
+  if (sample >= window_start_ && sample < window_next_) {
+    return 1;
+  }
+  return PinWindow(sample) ? 1 : -1;
+}
+
+int Decoder::LoadWindowedSamples(int number_of_chunks) {
+  // Pin the samples following the parsed ones, at most the specified number of
+  // chunks, and read their slice headers. Then unpin the samples pinned last
+  // time so the stream releases the chunks behind them. (This function stops
+  // at a sample before the first one, which is not in the pinned range, and it
+  // pins at least one sample so it makes progress.)
+  if (number_of_parsed_samples_ >= number_of_samples_) {
+    return static_cast<int>(number_of_resident_samples_);
+  }
+  const Sample* first_sample = &samples_[number_of_parsed_samples_];
+  const uint64_t begin = first_sample->offset;
+  const uint64_t limit = static_cast<uint64_t>(number_of_chunks) *
+      mov::Stream::CHUNK_SIZE;
+  uint64_t end = begin + first_sample->size;
+  for (uint32_t i = number_of_parsed_samples_ + 1; i < number_of_samples_;
+       ++i) {
+    const Sample* sample = &samples_[i];
+    const uint64_t sample_end = sample->offset + sample->size;
+    if (sample->offset < begin || sample_end - begin > limit) {
+      break;
+    }
+    end = end > sample_end ? end : sample_end;
+  }
+  if (!stream_.Pin(static_cast<size_t>(begin),
+                   static_cast<size_t>(end - begin))) {
+    return -1;
+  }
+  stream_.Unpin(parse_offset_, parse_size_);
+  parse_offset_ = static_cast<size_t>(begin);
+  parse_size_ = static_cast<size_t>(end - begin);
+  UpdateResidentSamples();
+  if (number_of_parsed_samples_ >= number_of_samples_) {
+    stream_.Unpin(parse_offset_, parse_size_);
+    parse_offset_ = 0;
+    parse_size_ = 0;
+  }
+  return static_cast<int>(number_of_resident_samples_);
+}
+
+int Decoder::PinWindow(uint32_t sample_number) {
+  // Pin the GOP of the given sample and the next GOP before unpinning the
+  // current window so their chunks shared with the current window stay
+  // resident. (The sample buffers of the samples Video Toolbox is decoding pin
+  // their own data, i.e. this function can unpin the current window while
+  // Video Toolbox is decoding its samples.)
+  const uint32_t start =
+      static_cast<uint32_t>(GetSyncSample(static_cast<int>(sample_number)));
+  const uint32_t next = GetNextSyncSample(sample_number);
+  const uint32_t end = next < number_of_samples_ ? GetNextSyncSample(next) :
+      next;
+  if (start >= end) {
+    return 1;
+  }
+  uint64_t begin_offset = samples_[start].offset;
+  uint64_t end_offset = begin_offset + samples_[start].size;
+  for (uint32_t i = start + 1; i < end; ++i) {
+    const uint64_t sample_offset = samples_[i].offset;
+    const uint64_t sample_end = sample_offset + samples_[i].size;
+    begin_offset = begin_offset < sample_offset ? begin_offset : sample_offset;
+    end_offset = end_offset > sample_end ? end_offset : sample_end;
+  }
+  if (!stream_.Pin(static_cast<size_t>(begin_offset),
+                   static_cast<size_t>(end_offset - begin_offset))) {
+    return 0;
+  }
+  stream_.Unpin(window_offset_, window_size_);
+  window_start_ = start;
+  window_next_ = next;
+  window_offset_ = static_cast<size_t>(begin_offset);
+  window_size_ = static_cast<size_t>(end_offset - begin_offset);
+  return 1;
+}
+
+int Decoder::IsSampleReadable(const Sample* sample) const {
+  // A sample of a windowed stream is readable only while this decoder pins it
+  // for reading its slice header or as a sample of the window.
+  if (!stream_.IsWindowed()) {
+    return stream_.IsResident(static_cast<size_t>(sample->offset),
+                              sample->size);
+  }
+  const uint64_t sample_end = sample->offset + sample->size;
+  return (sample->offset >= parse_offset_ &&
+          sample_end <= parse_offset_ + parse_size_) ||
+      (sample->offset >= window_offset_ &&
+       sample_end <= window_offset_ + window_size_);
+}
+
+int Decoder::CopySampleIndex(const mov::AtomCollection* map,
+                             const SampleIndex* index) {
+  const SampleIndex::Header* header = index->GetHeader();
+  const SampleIndex::Entry* entries = index->GetEntries();
+  const uint32_t number_of_samples = header->number_of_samples;
+  if (number_of_samples != index->GetNumberOfSamples() ||
+      number_of_samples != map->GetSampleSizeAtom()->GetCount()) {
+    return 0;
+  }
+  samples_ = static_cast<Sample*>(
+      malloc(number_of_samples * sizeof(Sample)));
+  uint32_t* frames = static_cast<uint32_t*>(
+      calloc((number_of_samples + 31) >> 5, sizeof(uint32_t)));
+  int result = samples_ && frames;
+  const uint64_t stream_size = stream_.GetSize();
+  for (uint32_t i = 0; result && i < number_of_samples; ++i) {
+    // Verify the entry and mark its frame number so another entry cannot
+    // use it.
+    const SampleIndex::Entry* entry = &entries[i];
+    const uint32_t frame = entry->frame_number;
+    if (entry->offset > stream_size ||
+        entry->size > stream_size - entry->offset ||
+        frame >= number_of_samples ||
+        ((frames[frame >> 5] >> (frame & 31)) & 1)) {
+      result = 0;
+      break;
+    }
+    frames[frame >> 5] |= 1u << (frame & 31);
+    Sample* sample = &samples_[i];
+    sample->offset = entry->offset;
+    sample->size = entry->size;
+    sample->duration = 0;
+    sample->picture_order_count = entry->picture_order_count;
+    sample->frame_number = frame;
+    sample->timestamp = 0;
+    sample->presentation_timestamp = 0;
+  }
+  free(frames);
+  if (!result) {
+    free(samples_);
+    samples_ = NULL;
+    return 0;
+  }
+  number_of_samples_ = number_of_samples;
+  return 1;
+}
+
+int Decoder::InitializeSamples(const mov::AtomCollection* map,
+                               const SampleIndex* index) {
+  // Copy the samples from the given index when it is one of this stream and
+  // its entries are valid. (The hash of a valid index covers only the
+  // sample-table atoms, i.e. this decoder parses the slice headers of the
+  // stream when the entries of the cache file are corrupted.)
+  sample_table_hash_ = HashSampleTable(map);
+  has_sample_index_ = 0;
+  if (index && index->GetNumberOfSamples() > 0 &&
+      index->GetHeader()->hash == sample_table_hash_ &&
+      CopySampleIndex(map, index)) {
+    const SampleIndex::Header* header = index->GetHeader();
+    if (!LoadFirstGroup(map->GetSyncSampleAtom())) {
+      return 0;
+    }
+    number_of_resident_samples_ = 0;
+    number_of_parsed_samples_ = number_of_samples_;
+    number_of_pending_samples_ = 0;
+    next_frame_number_ = number_of_samples_;
+    max_picture_order_count_ = header->max_picture_order_count;
+    has_sample_index_ = 1;
+    UpdateResidentSamples();
+    return 1;
+  }
+
   // Merge the sample counts in the `stsc` atom of the input QuickTime stream
-  // and the offsets in its `stco` atom into an array of chunks.
+  // and the offsets in its `stco` atom (or its `co64` atom) into an array of
+  // chunks.
   const mov::SampleToChunkAtom* sample_to_chunk_atom =
       map->GetSampleToChunkAtom();
   const mov::ChunkOffsetAtom* chunk_offset_atom =
       map->GetChunkOffsetAtom();
+  const mov::ChunkOffset64Atom* chunk_offset64_atom =
+      map->GetChunkOffset64Atom();
   const mov::SampleSizeAtom* sample_size_atom =
       map->GetSampleSizeAtom();
   const uint32_t number_of_entries = sample_to_chunk_atom->GetCount();
-  const uint32_t number_of_chunks = chunk_offset_atom->GetCount();
+  const uint32_t number_of_chunks = chunk_offset_atom ?
+      chunk_offset_atom->GetCount() : chunk_offset64_atom->GetCount();
   const uint32_t sample_size = sample_size_atom->GetSampleSize();
   if (number_of_entries == 0 || number_of_chunks == 0) {
     return 0;
@@ -240,7 +806,7 @@ int Decoder::InitializeSamples(const mov::AtomCollection* map) {
   struct Chunk {
     uint32_t first_sample;
     uint32_t number_of_samples;
-    uint32_t offset;
+    uint64_t offset;
   };
   Chunk* chunks =
       static_cast<Chunk*>(malloc(number_of_chunks * sizeof(Chunk)));
@@ -288,11 +854,13 @@ int Decoder::InitializeSamples(const mov::AtomCollection* map) {
       goto free_chunks;
     }
 
-    // Retrieve the chunk offsets of the `stco` atom and fill the chunk offsets.
+    // Retrieve the chunk offsets of the `stco` atom (or the `co64` atom) and
+    // fill the chunk offsets.
     for (uint32_t i = 0; i < number_of_chunks; ++i) {
       Chunk* chunk = &chunks[i];
       chunk->first_sample = first_sample;
-      chunk->offset = chunk_offset_atom->GetOffset(i);
+      chunk->offset = chunk_offset_atom ? chunk_offset_atom->GetOffset(i) :
+          chunk_offset64_atom->GetOffset(i);
       first_sample += chunk->number_of_samples;
     }
   }
@@ -307,8 +875,7 @@ int Decoder::InitializeSamples(const mov::AtomCollection* map) {
   {
     const Chunk* chunk = &chunks[0];
     const Chunk* last_chunk = &chunks[number_of_chunks - 1];
-    uint32_t sample_offset = 0;
-    max_picture_order_count_ = 0;
+    uint64_t sample_offset = 0;
     for (uint32_t i = 1; i <= number_of_samples_; ++i) {
       while (i >= chunk->first_sample + chunk->number_of_samples) {
         if (chunk >= last_chunk) {
@@ -324,18 +891,26 @@ int Decoder::InitializeSamples(const mov::AtomCollection* map) {
         sample->size = sample_size ? sample_size :
             sample_size_atom->GetSampleSize(sample_index);
         sample->duration = 0;
-        sample->picture_order_count =
-            DecodeSliceHeader(&data_[sample->offset], sample->size);
-        max_picture_order_count_ =
-            max_picture_order_count_ >= sample->picture_order_count ?
-            max_picture_order_count_ : sample->picture_order_count;
+        sample->picture_order_count = 0;
+        sample->frame_number = 0;
+        sample->timestamp = 0;
+        sample->presentation_timestamp = 0;
         sample_offset += sample->size;
-        HEVC_LOG_D("%s(): samples[%d] = { offset: %x, size: %d, order: %d }\n",
-            __FUNCTION__, sample_index, sample->offset, sample->size,
-            sample->picture_order_count);
       }
     }
   }
+
+  // Read the first GOP of a progressive stream. Then read the picture-order
+  // counts of the resident samples.
+  if (!LoadFirstGroup(map->GetSyncSampleAtom())) {
+    goto free_chunks;
+  }
+  number_of_resident_samples_ = 0;
+  number_of_parsed_samples_ = 0;
+  number_of_pending_samples_ = 0;
+  next_frame_number_ = 0;
+  max_picture_order_count_ = 0;
+  UpdateResidentSamples();
   result = 1;
 
 free_chunks:
@@ -344,6 +919,145 @@ free_chunks:
   return result;
 }
 
+int Decoder::LoadFirstGroup(const mov::SyncSampleAtom* sync_sample_atom) {
+  // Read the first GOP (group of pictures) of a progressive stream and its next
+  // sync sample, i.e. the samples up to its second sync sample, so this decoder
+  // can start decoding it without waiting for the rest of the stream. (A
+  // QuickTime stream without a `stss` atom consists only of sync samples.)
+  uint32_t group_end = 2;
+  sync_sample_atom_ = sync_sample_atom && sync_sample_atom->GetCount() > 0 ?
+      sync_sample_atom : NULL;
+  if (stream_.IsWindowed()) {
+    // Pin the first window of a windowed stream instead, i.e. the first GOP and
+    // the second one.
+    return number_of_samples_ == 0 || PinWindow(0);
+  }
+  if (sync_sample_atom && sync_sample_atom->GetCount() >= 2) {
+    group_end = sync_sample_atom->GetSyncSample(1);
+  }
+  group_end = group_end < 1 ? 1 : group_end;
+  group_end = group_end < number_of_samples_ ? group_end : number_of_samples_;
+  for (uint32_t i = 0; i < group_end; ++i) {
+    if (!stream_.Load(static_cast<size_t>(samples_[i].offset),
+                      samples_[i].size)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+uint64_t Decoder::HashSampleTable(const mov::AtomCollection* map) {
+  const mov::Atom* atoms[] = {
+    reinterpret_cast<const mov::Atom*>(map->GetSampleToChunkAtom()),
+    reinterpret_cast<const mov::Atom*>(map->GetSampleSizeAtom()),
+    reinterpret_cast<const mov::Atom*>(map->GetChunkOffsetAtom()),
+    reinterpret_cast<const mov::Atom*>(map->GetChunkOffset64Atom()),
+    reinterpret_cast<const mov::Atom*>(map->GetSyncSampleAtom()),
+  };
+  uint64_t hash = SampleIndex::HASH_BASIS;
+  for (size_t i = 0; i < sizeof(atoms) / sizeof(atoms[0]); ++i) {
+    if (atoms[i]) {
+      hash = SampleIndex::Hash(hash, atoms[i], atoms[i]->GetSize());
+    }
+  }
+  return hash;
+}
+
+uint32_t Decoder::UpdateResidentSamples() {
+  // A decoder created with a sample index knows the frame numbers of all
+  // samples, i.e. a sample is resident when it and all samples before it have
+  // been read from the stream. (All samples of a windowed stream are resident
+  // in this case because `LoadSample()` reads them on demand.)
+  if (has_sample_index_) {
+    if (stream_.IsWindowed()) {
+      number_of_resident_samples_ = number_of_samples_;
+      return number_of_resident_samples_;
+    }
+    uint32_t resident_end = number_of_resident_samples_;
+    while (resident_end < number_of_samples_ &&
+           IsSampleReadable(&samples_[resident_end])) {
+      ++resident_end;
+    }
+    number_of_resident_samples_ = resident_end;
+    return resident_end;
+  }
+
+  // Read the slice headers of the samples that have become resident. (Samples
+  // become resident in the decoding order, i.e. this function stops at the
+  // first sample that is not resident.) Then assign frame numbers to them in
+  // the output order as an HEVC decoder outputs pictures (Annex C.5.2), i.e.
+  // output all pending samples when this function finds an IDR sample or a BLA
+  // sample, which resets the picture-order count, and output the sample with
+  // the smallest count when the number of pending samples exceeds the reorder
+  // depth of the stream.
+  uint32_t max_pending_samples = GetMaxNumReorderPictures();
+  const uint32_t capacity =
+      sizeof(pending_samples_) / sizeof(pending_samples_[0]) - 1;
+  max_pending_samples =
+      max_pending_samples < capacity ? max_pending_samples : capacity;
+  const uint8_t* data = stream_.GetData();
+  uint32_t sample_index = number_of_parsed_samples_;
+  while (sample_index < number_of_samples_) {
+    Sample* sample = &samples_[sample_index];
+    if (!IsSampleReadable(sample)) {
+      break;
+    }
+    const uint8_t* packet_data = &data[sample->offset];
+    const NALUnitType nal_unit_type = GetNALUnitType(packet_data);
+    if (IsIDR(nal_unit_type) || IsBLA(nal_unit_type)) {
+      while (number_of_pending_samples_ > 0) {
+        OutputPendingSample();
+      }
+    }
+    sample->picture_order_count = DecodeSliceHeader(packet_data, sample->size);
+    max_picture_order_count_ =
+        max_picture_order_count_ >= sample->picture_order_count ?
+        max_picture_order_count_ : sample->picture_order_count;
+    pending_samples_[number_of_pending_samples_++] = sample_index;
+    while (number_of_pending_samples_ > max_pending_samples) {
+      OutputPendingSample();
+    }
+    ++sample_index;
+  }
+  number_of_parsed_samples_ = sample_index;
+  if (sample_index == number_of_samples_) {
+    while (number_of_pending_samples_ > 0) {
+      OutputPendingSample();
+    }
+  }
+
+  // A sample is resident when this decoder has assigned frame numbers to it
+  // and all samples before it.
+  uint32_t resident_end = sample_index;
+  for (uint32_t i = 0; i < number_of_pending_samples_; ++i) {
+    const uint32_t pending_sample = pending_samples_[i];
+    resident_end = resident_end < pending_sample ? resident_end :
+        pending_sample;
+  }
+  number_of_resident_samples_ = resident_end;
+  return resident_end;
+}
+
+void Decoder::OutputPendingSample() {
+  uint32_t output_index = 0;
+  for (uint32_t i = 1; i < number_of_pending_samples_; ++i) {
+    const Sample* sample = &samples_[pending_samples_[i]];
+    const Sample* output_sample = &samples_[pending_samples_[output_index]];
+    if (sample->picture_order_count < output_sample->picture_order_count) {
+      output_index = i;
+    }
+  }
+  const uint32_t sample_index = pending_samples_[output_index];
+  Sample* sample = &samples_[sample_index];
+  sample->frame_number = next_frame_number_++;
+  HEVC_LOG_D("%s(): samples[%d] = { offset: %llx, size: %d, order: %d, "
+      "frame: %d }\n", __FUNCTION__, sample_index,
+      static_cast<unsigned long long>(sample->offset), sample->size,
+      sample->picture_order_count, sample->frame_number);
+  pending_samples_[output_index] =
+      pending_samples_[--number_of_pending_samples_];
+}
+
 int Decoder::DecodeHEVCDecoderConfiguration(
     const mov::VideoSampleDescriptionExtension* extension) {
   // Decode the given `hvcC` configuration and retrieve whether or not this
@@ -398,6 +1112,7 @@ int Decoder::DecodeHEVCDecoderConfiguration(
   //   +-------+------+-------------------------------------+
   // This function finds a VPS in this `hvcC` extension and parses its VPS
   // extension as written in the "HEVC with Alpha compatibility profile".
+  has_alpha_channel_information_ = 0;
   const uint8_t* hvcc_start = extension->GetExtraData();
   const uint8_t* hvcc_end = extension->GetNext();
   if (hvcc_end - hvcc_start < 21 + 1) {
@@ -454,12 +1169,18 @@ int Decoder::DecodeHEVCDecoderConfiguration(
       if (decode_nal_units) {
         // Extract an RBSP (Raw Byte Sequence Payload) required for decoding an
         // HEVC-with-Alpha stream with Video Toolbox, i.e. VPS RBSPs, SPS RBSPs,
-        // PPS RBSPs, and SEI_PREFIX RBSPs. These RBSPs should be smaller than
-        // 256 bytes (the size of the RBSP spool of this decoder).
-        if (nal_unit_size >= sizeof(rbsp_data_)) {
-          return 0;
-        }
+        // PPS RBSPs, and SEI_PREFIX RBSPs. These RBSPs are usually smaller than
+        // 256 bytes (the size of the RBSP spool of this decoder), i.e. this
+        // decoder allocates a buffer only for larger ones, e.g. SEIs with
+        // user data.
         uint8_t* rbsp_data = &rbsp_data_[0];
+        if (nal_unit_size + RBSP::PADDING_SIZE > sizeof(rbsp_data_)) {
+          rbsp_data = static_cast<uint8_t*>(
+              malloc(nal_unit_size + RBSP::PADDING_SIZE));
+          if (!rbsp_data) {
+            return 0;
+          }
+        }
         uintptr_t rbsp_size =
             ExtractRBSP(&nal_unit_start[2], nal_unit_size, rbsp_data);
         int result = 1;
@@ -472,6 +1193,9 @@ int Decoder::DecodeHEVCDecoderConfiguration(
         } else { // nal_unit_type == NAL_SEI_PREFIX
           DecodeSupplementalEnhancementInformation(rbsp_data, rbsp_size);
         }
+        if (rbsp_data != &rbsp_data_[0]) {
+          free(rbsp_data);
+        }
         if (!result) {
           return 0;
         }
@@ -652,7 +1376,7 @@ int Decoder::DecodeVideoParameterSet(const uint8_t* rbsp_data,
 
 int Decoder::DecodeSequenceParameterSet(const uint8_t* rbsp_data,
                                         uintptr_t rbsp_size,
-                                        uintptr_t index) {
+                                        uintptr_t /* index */) {
   if (rbsp_size < 2 + 1 + 12) {
     return 0;
   }
@@ -750,6 +1474,17 @@ int Decoder::DecodeSequenceParameterSet(const uint8_t* rbsp_data,
   sps->bit_depth_chroma = reader.GetGolomb<uint8_t>() + 8;
   sps->log2_max_pic_order_cnt_lsb = reader.GetGolomb<uint8_t>() + 4;
 
+  // Read the decoded-picture-buffer parameters of the highest sub-layer, which
+  // determine how many frames a decoder must buffer.
+  uint8_t sps_sub_layer_ordering_info_present_flag = reader.GetBit<uint8_t>();
+  for (uint8_t i = sps_sub_layer_ordering_info_present_flag ? 0 :
+           sps_max_sub_layers_minus1;
+       i <= sps_max_sub_layers_minus1; ++i) {
+    sps->sps_max_dec_pic_buffering = reader.GetGolomb<uint8_t>() + 1;
+    sps->sps_max_num_reorder_pics = reader.GetGolomb<uint8_t>();
+    reader.SkipGolomb();  // sps_max_latency_increase_plus1[i]
+  }
+
   // TODO(hbono): decode all SPS fields if necessary.
 
   return 1;
@@ -757,7 +1492,7 @@ int Decoder::DecodeSequenceParameterSet(const uint8_t* rbsp_data,
 
 int Decoder::DecodePictureParameterSet(const uint8_t* rbsp_data,
                                        uintptr_t rbsp_size,
-                                       uintptr_t index) {
+                                       uintptr_t /* index */) {
   const uint8_t* rbsp_top = &rbsp_data[2];
   const uint8_t* rbsp_end = &rbsp_data[rbsp_size];
   // Decode H.265 PPS parameters in the extracted RBSP. An H.265 PPS is a
@@ -838,7 +1573,8 @@ int Decoder::DecodeSupplementalEnhancementInformation(const uint8_t* rbsp_data,
       // (8 bytes) at once.)
       uintptr_t payload_word;
       uintptr_t payload_index;
-      while (rbsp_end - payload_data >= sizeof(uintptr_t)) {
+      while (rbsp_end - payload_data >=
+             static_cast<intptr_t>(sizeof(uintptr_t))) {
         payload_word = ~CPU::LoadUPTRLE(payload_data);
         if (payload_word) {
           goto payload_read_last_word;
@@ -885,6 +1621,7 @@ int Decoder::DecodeSupplementalEnhancementInformation(const uint8_t* rbsp_data,
           CPU::BitExtractUINT32(payload_data0, 25 - 9 * 2 - 1, 1);
       alpha->alpha_channel_clip_flag =
           CPU::BitExtractUINT32(payload_data0, 25 - 9 * 2 - 2, 1);
+      has_alpha_channel_information_ = 1;
     }
   }
   return 1;
@@ -894,6 +1631,7 @@ const uint8_t* Decoder::ParseProfileTierLevel(const uint8_t* top,
                                               const uint8_t* end,
                                               uintptr_t max_sub_layers_minus1,
                                               ProfileTierLevel* ptl) const {
+  static_cast<void>(max_sub_layers_minus1);
   // Parse the common profile. When the `max_sub_layers_minus1` value is 0, a
   // PTL is a 12-byte header listed below.
   //   +-------+------+-------------------------------------+
@@ -960,9 +1698,7 @@ uint32_t Decoder::DecodeSliceHeader(const uint8_t* packet_data,
   //   |       | 6    | nal_layer_id                        |
   //   |       | 3    | nuh_temporary_id + 1                |
   //   +-------+------+-------------------------------------+
-  const uint32_t data2 = CPU::LoadUINT16BE(&packet_data[4]);
-  NALUnitType nal_unit_type =
-      static_cast<NALUnitType>(CPU::BitExtractUINT32(data2, 9, 6));
+  NALUnitType nal_unit_type = GetNALUnitType(packet_data);
   // uintptr_t nal_layer_id = CPU::BitExtractUINT32(data2, 3, 4);
   // uintptr_t nuh_temporary_id_plus1 = CPU::BitExtractUINT32(data2, 0, 3);
 
@@ -979,10 +1715,25 @@ uint32_t Decoder::DecodeSliceHeader(const uint8_t* packet_data,
   //   | picture_order_count_lsb | 0000000100 | 4           |
   //     ...
   //   +-------------------------+------------+-------------+
-  const uint8_t* slice_top = &packet_data[4 + 2];
-  const uint8_t* slice_end = &packet_data[packet_size];
+  //
+  // This function removes the emulation-prevention bytes from the beginning of
+  // the slice header before parsing it. (A slice header has `0x00 0x00 0x03`
+  // when its fields have sixteen or more consecutive zero bits. The fields
+  // read by this function fit in 32 bytes.)
+  if (packet_size <= 4 + 2) {
+    return 0;
+  }
+  uintptr_t slice_size = CPU::LoadUINT32BE(&packet_data[0]);
+  slice_size = slice_size < packet_size - 4 ? slice_size : packet_size - 4;
+  if (slice_size <= 2) {
+    return 0;
+  }
+  slice_size = slice_size < 2 + 32 ? slice_size - 2 : 32;
+  alignas(16) uint8_t slice_data[32 + RBSP::PADDING_SIZE + 8] = { 0 };
+  const uintptr_t rbsp_size =
+      ExtractRBSP(&packet_data[4 + 2], slice_size, &slice_data[0]);
   BitStreamReader reader;
-  reader.Initialize(slice_top, slice_end);
+  reader.Initialize(&slice_data[0], &slice_data[rbsp_size]);
   uint8_t first_slice_segment_in_pic_flag = reader.GetBit<uint8_t>();
   if (IsIRAP(nal_unit_type)) {
     reader.SkipBits(1);  // no_output_of_prior_pics_flag
@@ -1025,185 +1776,110 @@ uint32_t Decoder::DecodeSliceHeader(const uint8_t* packet_data,
 uintptr_t Decoder::ExtractRBSP(const uint8_t* data,
                                uintptr_t size,
                                uint8_t* rbsp) const {
-  uint8_t* rbsp_top = rbsp;
-  uint8_t* rbsp_end = rbsp;
-#if __arm__ || __aarch64__
-  if (CPU::HaveNEON()) {
-    // Remove padding bytes with NEON. (This code uses NEON just for comparing
-    // eight bytes at once.)
-    uint64_t last_mask_eq_00 = 0;
-    do {
-      uint64_t data_word = CPU::LoadUINT64LE(data);
-      uintptr_t data_size = sizeof(uint64_t) < size ? sizeof(uint64_t) : size;
-
-   	   // Create a bit-mask representing the third byte of `0x00 0x00 0x03`.
-      uint8x8_t d0 = vcreate_u8(data_word);
-      uint8x8_t d1 = vceq_u8(d0, vdup_n_u8(0));
-      uint8x8_t d2 = vcle_u8(d0, vdup_n_u8(3));
-      uint64_t mask_eq_00 = vget_lane_u64(vreinterpret_u8_u64(d1), 0);
-      uint64_t mask_le_03 = vget_lane_u64(vreinterpret_u8_u64(d2), 0);
-      uint64_t mask_eq_00xxxx =
-          (mask_eq_00 << 16) | (last_mask_eq_00 >> (64 - 16));
-      uint64_t mask_eq_00xx =
-          (mask_eq_00 << 8) | (last_mask_eq_00 >> (64 - 8));
-      uint64_t mask_le_000003 = mask_eq_00xxxx & mask_eq_00xx & mask_le_03;
-      if (data_size < sizeof(uint64_t)) {
-        mask_le_000003 &= (1ULL << (data_size << 3)) - 1ULL;
-      }
-      data += data_size;
-      size -= data_size;
-      last_mask_eq_00 = mask_eq_00;
-      if (!mask_le_000003) {
-        CPU::StoreUINT64LE(rbsp_end, data_word);
-        rbsp_end += data_size;
-      } else {
-        // Write the word except the third byte of `0x00 0x00 0x03`.
-        data_size = sizeof(uint64_t);
-        do {
-          const unsigned int index = __builtin_ctzll(mask_le_000003) >> 3;
-          CPU::StoreUINT64LE(rbsp_end, data_word);
-          rbsp_end += index;
-          const unsigned int shift = index << 3;
-          mask_le_000003 >>= shift;
-          mask_le_000003 >>= 8;
-          data_word >>= shift;
-          data_word >>= 8;
-          data_size -= index + 1;
-        } while (mask_le_000003);
-        if (data_size > 0) {
-          CPU::StoreUINT64LE(rbsp_end, data_word);
-          rbsp_end += data_size;
-        }
-      }
-    } while (size > 0);
-    return static_cast<int>(rbsp_end - rbsp_top);
-  }
-#endif
-#if __SIZEOF_SIZE_T__ == 8
-  // Remove padding bytes on 64-bit CPUs.
-  uint64_t last_mask_eq_00 = 0;
-  do {
-    uint64_t data_word = CPU::LoadUINT64LE(data);
-    uintptr_t data_size = sizeof(uint64_t) < size ? sizeof(uint64_t) : size;
-
-    // Find a byte sequence `0x00 0x00 0x03` in a 64-bit word. This code
-    // consists of three parts:
-    // 1. Create a bit-mask of non-zero bytes in the 64-bit word;
-    // 2. Create a bit-mask of bytes greater than 0x03 in the 64-bit word, and;
-    // 3. Find a byte sequence `0x00, 0x00, 0x03` in the 64-bit word.
-    //
-    // The first step calculates the logical sums of its bits in parallel.
-    //
-    //    b0                      b1 b2    b3 b4          b5 b6    b7
-    //    b1                      b2 b3    b4 b5          b6 b7    0
-    //   -------------------------------------------------------------
-    //    b0|b1                   *  b2|b3 *  b4|b5       *  b6|b7 *
-    //
-    //    b0|b1                   *  b2|b3 *  b4|b5       *  b6|b7 *
-    //    b2|b3                   *  b4|b5 *  b6|b7       *  0     0
-    //   -------------------------------------------------------------
-    //    b0|b1|b2|b3             *  *     *  b4|b5|b6|b7 *  *     *
-    //
-    //    b0|b1|b2|b3             *  *     *  b4|b5|b6|b7 *  *     *
-    //    b4|b5|b6|b7             *  *     *  0           0  0     0
-    //   -------------------------------------------------------------
-    //    b0|b1|b2|b3|b4|b5|b6|b7 *  *     *  *           *  *     *
-    uint64_t mask_eq_00 = data_word | (data_word >> 1);
-    uint64_t mask_le_03 = mask_eq_00 & ~0x0101010101010101ULL;
-    mask_eq_00 = mask_eq_00 | (mask_eq_00 >> 2);
-    mask_le_03 = mask_le_03 | (mask_le_03 >> 2);
-    mask_eq_00 = mask_eq_00 | (mask_eq_00 >> 4);
-    mask_le_03 = mask_le_03 | (mask_le_03 >> 4);
-    mask_eq_00 = ~mask_eq_00;
-    mask_le_03 = ~mask_le_03;
-
-    // Compose the bit-masks into a bit-mask so each byte represents whether or
-    // not it is the third byte of a byte sequence `0x00, 0x00, 0x03`.
-    uint64_t mask_eq_00xxxx =
-        (mask_eq_00 << 16) | (last_mask_eq_00 >> (64 - 16));
-    uint64_t mask_eq_00xx =
-        (mask_eq_00 << 8) | (last_mask_eq_00 >> (64 - 8));
-    uint64_t mask_le_000003 =
-        mask_eq_00xxxx & mask_eq_00xx & mask_le_03 & 0x0101010101010101ULL;
-    if (data_size < sizeof(uint64_t)) {
-      mask_le_000003 &= (1ULL << (data_size << 3)) - 1ULL;
-    }
-    data += data_size;
-    size -= data_size;
-    last_mask_eq_00 = mask_eq_00;
-    if (!mask_le_000003) {
-      CPU::StoreUINT64LE(rbsp_end, data_word);
-      rbsp_end += data_size;
-    } else {
-      // Write the word except the third byte of `0x00 0x00 0x03`.
-      data_size = sizeof(uint64_t);
-      do {
-        const unsigned int index = __builtin_ctzll(mask_le_000003) >> 3;
-        CPU::StoreUINT64LE(rbsp_end, data_word);
-        rbsp_end += index;
-#if __i386__ || __x86_64__ || __arm__ || __aarch64__
-        // Decompose a shift operation into two shift operations to avoid
-        // shifting a 64-bit variable by 64 bits. (It is an undefined
-        // operation.)
-        const unsigned int shift = index << 3;
-        mask_le_000003 >>= shift;
-        mask_le_000003 >>= 8;
-        data_word >>= shift;
-        data_word >>= 8;
-#else
-        const unsigned int shift = (index + 1) << 3;
-        mask_le_000003 >>= shift;
-        data_word >>= shift;
-#endif
-        data_size -= index + 1;
-      } while (mask_le_000003);
-      if (data_size > 0) {
-        CPU::StoreUINT64LE(rbsp_end, data_word);
-        rbsp_end += data_size;
-      }
-    }
-  } while (size > 0);
-  return static_cast<int>(rbsp_end - rbsp_top);
-#endif
+  return RBSP::Extract(data, size, rbsp);
 }
 
 #if __APPLE__
 int Decoder::DecodeSample(int sample_number,
                           VTDecompressionOutputHandler handler) {
+  return DecodeSample(sample_number, 0, handler);
+}
+
+int Decoder::DecodeSample(int sample_number,
+                          VTDecodeFrameFlags flags,
+                          VTDecompressionOutputHandler handler) {
+  CMSampleBufferRef sample_buffer;
+  OSStatus status = CreateSampleBuffer(sample_number, &sample_buffer);
+  if (!status) {
+    status = VTDecompressionSessionDecodeFrameWithOutputHandler(
+        decoder_session_,
+        sample_buffer,
+        kVTDecodeFrame_EnableAsynchronousDecompression | flags,
+        NULL,
+        handler);
+    CFRelease(sample_buffer);
+  }
+  return status;
+}
+
+int Decoder::DecodeSampleSynchronously(int sample_number,
+                                       VTDecodeFrameFlags flags,
+                                       VTDecompressionOutputHandler handler) {
+  return DecodeSampleVideoToolbox(sample_number, flags, handler);
+}
+
+void Decoder::UnpinSampleData(void* object, void* data, size_t size) {
+  mov::Stream* stream = static_cast<mov::Stream*>(object);
+  stream->Unpin(static_cast<size_t>(
+      static_cast<const uint8_t*>(data) - stream->GetData()), size);
+  stream->Destroy();
+  free(stream);
+}
+
+OSStatus Decoder::CreateSampleBuffer(int sample_number,
+                                     CMSampleBufferRef* sample_buffer) {
   // Create a `CMBlockBuffer` object referring to the specified sample. (This
-  // decoder retains the whole input QuickTime stream and Core Media does not
-  // have to create copies of its samples.)
+  // decoder retains the whole input QuickTime stream, which may be a mapped
+  // file, and Core Media does not have to create copies of its samples.) A
+  // block buffer of a windowed stream pins its sample until Video Toolbox
+  // releases it so the sample stays resident after this decoder moves its
+  // window. The block buffer owns a stream sharing the data of this decoder
+  // because it may outlive this decoder (and copies of it).
   const Sample* sample = &samples_[sample_number];
-  HEVC_LOG_V("%s(): samples[%d] = { offset: %x, size: %d }\n", __FUNCTION__,
-             sample_number, sample->offset, sample->size);
-  void* data = static_cast<void*>(&data_[sample->offset]);
+  HEVC_LOG_V("%s(): samples[%d] = { offset: %llx, size: %d }\n",
+             __FUNCTION__, sample_number,
+             static_cast<unsigned long long>(sample->offset), sample->size);
+  void* data = GetSampleData(sample);
   int size = sample->size;
   CMBlockBufferRef block_buffer;
-  OSStatus status = CMBlockBufferCreateWithMemoryBlock(kCFAllocatorDefault,
-      data, size, kCFAllocatorNull, NULL, 0, size, 0, &block_buffer);
+  OSStatus status;
+  if (stream_.IsWindowed()) {
+    mov::Stream* stream =
+        static_cast<mov::Stream*>(malloc(sizeof(mov::Stream)));
+    if (!stream) {
+      return kVTVideoDecoderMalfunctionErr;
+    }
+    stream->Initialize();
+    if (!stream_.Share(stream)) {
+      free(stream);
+      return kVTVideoDecoderMalfunctionErr;
+    }
+    if (!stream->Pin(static_cast<size_t>(sample->offset), sample->size)) {
+      stream->Destroy();
+      free(stream);
+      return kVTVideoDecoderBadDataErr;
+    }
+    CMBlockBufferCustomBlockSource block_source;
+    block_source.version = kCMBlockBufferCustomBlockSourceVersion;
+    block_source.AllocateBlock = NULL;
+    block_source.FreeBlock = UnpinSampleData;
+    block_source.refCon = stream;
+    status = CMBlockBufferCreateWithMemoryBlock(kCFAllocatorDefault,
+        data, size, NULL, &block_source, 0, size, 0, &block_buffer);
+    if (status) {
+      UnpinSampleData(stream, data, size);
+    }
+  } else {
+    status = CMBlockBufferCreateWithMemoryBlock(kCFAllocatorDefault,
+        data, size, kCFAllocatorNull, NULL, 0, size, 0, &block_buffer);
+  }
   if (!status) {
-    // Create a `CMSampleTimingInfo` object representing the sample duration of
-    // the source QuickTime stream so the given handler can use it. (Without
-    // attaching a `CMSampleTimingInfo` object to a `CMSampleBuffer` object,
-    // the `VTDecompressionSessionDecodeFrameWithOutputHandler()` returns an
-    // error on iOS.)
+    // Create a `CMSampleTimingInfo` object representing the presentation
+    // timestamp and the duration of the output frame of this sample so the
+    // given handler can use them. (Without attaching a `CMSampleTimingInfo`
+    // object to a `CMSampleBuffer` object, the
+    // `VTDecompressionSessionDecodeFrameWithOutputHandler()` returns an error
+    // on iOS.)
+    const Sample* frame = &samples_[sample->frame_number];
     CMSampleTimingInfo timing_info;
-    timing_info.duration = CMTimeMake(sample->duration, time_scale_);
+    timing_info.duration = CMTimeMake(frame->duration, time_scale_);
     timing_info.presentationTimeStamp =
-        CMTimeMake(sample_number * sample->duration, time_scale_);
-    timing_info.decodeTimeStamp = kCMTimeInvalid;
-    CMSampleBufferRef sample_buffer;
+        CMTimeMake(static_cast<int64_t>(frame->presentation_timestamp),
+                   time_scale_);
+    timing_info.decodeTimeStamp =
+        CMTimeMake(static_cast<int64_t>(sample->timestamp), time_scale_);
     status = CMSampleBufferCreate(kCFAllocatorDefault, block_buffer, TRUE, 0, 0,
-        format_description_, 1, 1, &timing_info, 0, NULL, &sample_buffer);
-    if (!status) {
-      status = VTDecompressionSessionDecodeFrameWithOutputHandler(
-          decoder_session_,
-          sample_buffer,
-          kVTDecodeFrame_EnableAsynchronousDecompression,
-          NULL,
-          handler);
-      CFRelease(sample_buffer);
-    }
+        format_description_, 1, 1, &timing_info, 0, NULL, sample_buffer);
     CFRelease(block_buffer);
   }
   return status;
@@ -1226,7 +1902,8 @@ int Decoder::CreateVideoToolbox(
     int frame_width,
     int frame_height,
     OutputCallback callback,
-    void* object) {
+    void* object,
+    int use_pool) {
   OSStatus status = kVTParameterErr;
   CFMutableDictionaryRef decoder_config;
 
@@ -1293,6 +1970,19 @@ int Decoder::CreateVideoToolbox(
       goto release_configuration;
     }
 
+    // Re-use an idle session that can accept the above format description.
+    // (Sessions with callbacks are not in the pool.)
+    if (use_pool && !callback) {
+      decoder_session_ = SessionPool::Acquire(
+          format_description_, output_width_, output_height_);
+      if (decoder_session_) {
+        hvcc_extension_ = extension;
+        decoder_callback_ = callback;
+        decoder_object_ = object;
+        goto release_configuration;
+      }
+    }
+
     // Create the attributes of the output `CVPixelBuffer` objects. The code is
     // equivalent to the following swift code.)
     // ```
@@ -1334,6 +2024,18 @@ int Decoder::CreateVideoToolbox(
       CFDictionarySetValue(buffer_attributes,
                            kCVPixelBufferMetalCompatibilityKey,
                            kCFBooleanTrue);
+      if (output_width_ > 0 && output_height_ > 0) {
+        // Ask Video Toolbox to scale the output images when this decoder
+        // outputs images smaller than the frame size.
+        if (!SetDictionaryNumber(buffer_attributes,
+                                 kCVPixelBufferWidthKey,
+                                 output_width_) ||
+            !SetDictionaryNumber(buffer_attributes,
+                                 kCVPixelBufferHeightKey,
+                                 output_height_)) {
+          goto release_attributes;
+        }
+      }
 
       io_surface_properties = CFDictionaryCreateMutable(
           kCFAllocatorDefault,
@@ -1362,16 +2064,21 @@ int Decoder::CreateVideoToolbox(
       // Create a decoder session.
       callback_record.decompressionOutputCallback = callback;
       callback_record.decompressionOutputRefCon = object;
+      HEVC_TRACE_BEGIN("CreateSession", HEVC_TRACE_EXCLUSIVE);
       status = VTDecompressionSessionCreate(NULL,
                                             format_description_,
                                             decoder_config,
                                             buffer_attributes,
                                             callback ? &callback_record : NULL,
                                             &decoder_session_);
+      HEVC_TRACE_END("CreateSession", HEVC_TRACE_EXCLUSIVE);
       if (!status) {
         hvcc_extension_ = extension;
         decoder_callback_ = callback;
         decoder_object_ = object;
+        if (output_width_ > 0 && output_height_ > 0) {
+          SetReducedResolution(decoder_session_, output_width_, output_height_);
+        }
       }
 
  release_attributes:
@@ -1385,9 +2092,15 @@ int Decoder::CreateVideoToolbox(
   return status;
 }
 
-void Decoder::DestroyVideoToolbox() {
+void Decoder::DestroyVideoToolbox(int recycle) {
   if (decoder_session_) {
     VTDecompressionSessionWaitForAsynchronousFrames(decoder_session_);
+    if (recycle && !decoder_callback_ && format_description_) {
+      SessionPool::Release(decoder_session_, format_description_,
+                           output_width_, output_height_);
+    } else {
+      VTDecompressionSessionInvalidate(decoder_session_);
+    }
     CFRelease(decoder_session_);
     decoder_session_ = NULL;
   }
@@ -1398,34 +2111,38 @@ void Decoder::DestroyVideoToolbox() {
 }
 
 int Decoder::ResetVideoToolbox() {
-  DestroyVideoToolbox();
+  // Discard the session and create a new one. (This decoder resets its session
+  // when the session fails decoding a sample, i.e. the session may have been
+  // invalidated by the host OS.)
+  DestroyVideoToolbox(0);
   if (hvcc_extension_) {
     return CreateVideoToolbox(hvcc_extension_, frame_width_, frame_height_,
-        decoder_callback_, decoder_object_);
+        decoder_callback_, decoder_object_, 0);
   }
   return -1;
 }
 
-int Decoder::DecodeSampleVideoToolbox(int sample_number) {
-  const Sample* sample = &samples_[sample_number];
-  void* data = static_cast<void*>(&data_[sample->offset]);
-  int size = sample->size;
-  CMBlockBufferRef block_buffer;
-  OSStatus status = CMBlockBufferCreateWithMemoryBlock(kCFAllocatorDefault,
-      data, size, kCFAllocatorNull, NULL, 0, size, 0, &block_buffer);
+int Decoder::DecodeSampleVideoToolbox(int sample_number,
+                                      VTDecodeFrameFlags flags,
+                                      VTDecompressionOutputHandler handler) {
+  // Decode the sample without `kVTDecodeFrame_EnableAsynchronousDecompression`
+  // and wait for Video Toolbox to output it, i.e. Video Toolbox calls the
+  // output callback (or the given handler) before this function returns.
+  CMSampleBufferRef sample_buffer;
+  OSStatus status = CreateSampleBuffer(sample_number, &sample_buffer);
   if (!status) {
-    CMSampleBufferRef sample_buffer;
-    status = CMSampleBufferCreate(kCFAllocatorDefault, block_buffer, TRUE, 0, 0,
-        format_description_, 1, 0, NULL, 0, NULL, &sample_buffer);
-    if (!status) {
+    if (handler) {
+      status = VTDecompressionSessionDecodeFrameWithOutputHandler(
+          decoder_session_, sample_buffer, flags, NULL, handler);
+    } else {
       status = VTDecompressionSessionDecodeFrame(
-          decoder_session_, sample_buffer, 0, NULL, NULL);
-      if (!status) {
-        status =
-            VTDecompressionSessionWaitForAsynchronousFrames(decoder_session_);
-      }
-      CFRelease(sample_buffer);
+          decoder_session_, sample_buffer, flags, NULL, NULL);
+    }
+    if (!status) {
+      status =
+          VTDecompressionSessionWaitForAsynchronousFrames(decoder_session_);
     }
+    CFRelease(sample_buffer);
   }
   return status;
 }
@@ -30,15 +30,22 @@
 #if __APPLE__
 #include <VideoToolbox/VideoToolbox.h>
 #endif
+#include "../base/cpu.h"
 #include "../base/intrin.h"
+#include "../mov/stream.h"
 
 namespace mov {
 struct VideoSampleDescriptionExtension;
+struct SampleDescriptionAtom;
+struct CompositionOffsetAtom;
+struct SyncSampleAtom;
 struct AtomCollection;
 }  // namespace mov
 
 namespace hevc {
 
+struct SampleIndex;
+
 /**
  * H.265 NAL (Network Abstract Layer) unit types defined in Section 7.4.2.2. 
  * @enum {int}
@@ -548,6 +555,21 @@ struct SequenceParameterSet {
    */
   uint8_t log2_max_pic_order_cnt_lsb;
 
+  /**
+   * The maximum number of pictures in the decoded picture buffer of the
+   * highest sub-layer, i.e. `sps_max_dec_pic_buffering_minus1` + 1.
+   * @type {uint8_t}
+   */
+  uint8_t sps_max_dec_pic_buffering;
+
+  /**
+   * The maximum number of pictures that can precede a picture in the decoding
+   * order and follow it in the output order, i.e. `sps_max_num_reorder_pics`
+   * of the highest sub-layer.
+   * @type {uint8_t}
+   */
+  uint8_t sps_max_num_reorder_pics;
+
   // uint8_t scaling_list_enable_flag;
   // uint8_t amp_enabled_flag;
   // uint8_t sample_adaptive_offset_enabled_flag;
@@ -670,11 +692,12 @@ struct Decoder {
    */
   struct Sample {
     /**
-     * The offset from the beginning of the QuickTime stream.
-     * @type {uint32_t}
+     * The offset from the beginning of the QuickTime stream. (A QuickTime
+     * stream with a `co64` atom may be larger than 4 GB.)
+     * @type {uint64_t}
      * @public
      */
-    uint32_t offset;
+    uint64_t offset;
 
     /**
      * The sample size.
@@ -697,6 +720,34 @@ struct Decoder {
      * @public
      */
     uint32_t picture_order_count;
+
+    /**
+     * The frame number of this sample, i.e. its index in the output (display)
+     * order.
+     * @type {uint32_t}
+     * @public
+     */
+    uint32_t frame_number;
+
+    /**
+     * The decoding timestamp of this sample, i.e. the sum of the durations of
+     * its preceding samples, in the time coordinate system declared in the
+     * `mdhd` atom.
+     * @type {uint64_t}
+     * @public
+     */
+    uint64_t timestamp;
+
+    /**
+     * The presentation timestamp of the frame whose frame number is the same
+     * as the sample number of this sample, i.e. the presentation timestamps
+     * are sorted in the output order. (This decoder applies the composition
+     * offsets of the `ctts` atom to the decoding timestamps and moves them so
+     * the first frame is presented at 0.)
+     * @type {uint64_t}
+     * @public
+     */
+    uint64_t presentation_timestamp;
   };
 
   /**
@@ -705,7 +756,8 @@ struct Decoder {
   void Initialize();
 
   /**
-   * Creates resources used by this decoder.
+   * Creates resources used by this decoder. This function creates a copy of
+   * the given QuickTime stream.
    * @param {const void*} data
    * @param {size_t} size
    * @param {hevc::Decoder::OutputCallback} callback
@@ -717,6 +769,61 @@ struct Decoder {
              OutputCallback callback,
              void* object);
 
+  /**
+   * Creates resources used by this decoder from a QuickTime stream (e.g. a
+   * QuickTime file opened with `mov::Stream::Open()`). This decoder takes the
+   * ownership of the stream data and reads samples directly from it, i.e. it
+   * does not create copies of the stream. (The given stream is empty after
+   * this function returns.)
+   * @param {mov::Stream*} stream
+   * @param {hevc::Decoder::OutputCallback} callback
+   * @param {void*} object
+   * @return {int}
+   */
+  int Create(mov::Stream* stream,
+             OutputCallback callback,
+             void* object);
+
+  /**
+   * Creates resources used by this decoder from a QuickTime stream and a
+   * sample index created by `CreateSampleIndex()`. This decoder copies the
+   * picture-order counts and the frame numbers of the samples from the index
+   * instead of reading their slice headers, i.e. it does not read samples
+   * until it decodes them. (This decoder ignores the index when its hash is not
+   * the one of the stream, e.g. when the index is stale.)
+   * @param {mov::Stream*} stream
+   * @param {const hevc::SampleIndex*} index
+   * @param {hevc::Decoder::OutputCallback} callback
+   * @param {void*} object
+   * @return {int}
+   */
+  int Create(mov::Stream* stream,
+             const SampleIndex* index,
+             OutputCallback callback,
+             void* object);
+
+  /**
+   * Creates a sample index of the QuickTime stream, which is keyed with the
+   * specified size and the specified modification time of its file. This
+   * function fails until this decoder assigns frame numbers to all samples,
+   * i.e. until `HasAllSamples()` returns a non-zero value.
+   * @param {uint64_t} file_size
+   * @param {int64_t} modified_time
+   * @param {hevc::SampleIndex*} index
+   * @return {int}
+   */
+  int CreateSampleIndex(uint64_t file_size,
+                        int64_t modified_time,
+                        SampleIndex* index) const;
+
+  /**
+   * Returns whether or not this decoder has been created with a sample index.
+   * @return {int}
+   */
+  int HasSampleIndex() const {
+    return has_sample_index_;
+  }
+
   /**
    * Deletes all resources owned by this decoder.
    */
@@ -746,8 +853,51 @@ struct Decoder {
     return static_cast<int>(number_of_samples_);
   }
 
+  /**
+   * Returns whether or not the specified sample has been read from the
+   * QuickTime stream, i.e. whether or not this decoder can decode it. (All
+   * samples are resident unless the stream is a progressive one.)
+   * @param {int} sample_number
+   * @return {int}
+   */
+  int IsSampleResident(int sample_number) const {
+    return static_cast<uint32_t>(sample_number) < number_of_resident_samples_;
+  }
+
+  /**
+   * Returns whether or not all samples have been read from the QuickTime
+   * stream.
+   * @return {int}
+   */
+  int HasAllSamples() const {
+    return number_of_resident_samples_ == number_of_samples_;
+  }
+
+  /**
+   * Reads the specified number of chunks from a progressive QuickTime stream
+   * and updates the resident samples. This function returns the number of the
+   * resident samples or -1 when it cannot read the stream.
+   * @param {int} number_of_chunks
+   * @return {int}
+   */
+  int LoadSamples(int number_of_chunks);
+
+  /**
+   * Makes the data of the specified resident sample readable so this decoder
+   * can decode it. A windowed stream keeps only the data of a window resident,
+   * i.e. the GOP being decoded and the next one, and this function moves the
+   * window to the GOP of the sample when the sample is out of its first GOP.
+   * (All resident samples of a stream that is not windowed are readable.) This
+   * function returns 1 when the sample is readable, 0 when it is not resident,
+   * and -1 when it cannot read the stream.
+   * @param {int} sample_number
+   * @return {int}
+   */
+  int LoadSample(int sample_number);
+
   /**
    * Returns the maximum picture-order count in the HEVC-with-Alpha stream.
+   * (This value may increase while this decoder reads a progressive stream.)
    * @return {int}
    */
   int GetMaxPictureOrderCount() const {
@@ -763,22 +913,232 @@ struct Decoder {
     return samples_[sample].picture_order_count;
   }
 
+  /**
+   * Returns the frame number (the index in the output order) of the specified
+   * sample. (This value is valid only for resident samples.)
+   * @param {int} sample
+   * @return {int}
+   */
+  int GetFrameNumber(int sample) const {
+    return samples_[sample].frame_number;
+  }
+
+  /**
+   * Returns the time scale of the HEVC-with-Alpha stream, i.e. the number of
+   * time units in a second. (This value is 0 when the stream does not have
+   * sample durations.)
+   * @return {uint32_t}
+   */
+  uint32_t GetTimeScale() const {
+    return time_scale_;
+  }
+
+  /**
+   * Returns the duration of the HEVC-with-Alpha stream in time-scale units.
+   * @return {uint64_t}
+   */
+  uint64_t GetDuration() const {
+    return duration_;
+  }
+
+  /**
+   * Returns the presentation timestamp of the specified frame (in the output
+   * order) in time-scale units. A QuickTime stream without composition
+   * offsets presents its frames at the decoding timestamps of its samples in
+   * the ascending order, i.e. the `frame`-th frame is presented at the decoding
+   * timestamp of the `frame`-th sample. A stream with composition offsets
+   * presents its `frame`-th frame at the `frame`-th smallest sum of a decoding
+   * timestamp and a composition offset.
+   * @param {int} frame
+   * @return {uint64_t}
+   */
+  uint64_t GetFrameTimestamp(int frame) const {
+    return samples_[frame].presentation_timestamp;
+  }
+
+  /**
+   * Returns the duration of the specified frame (in the output order) in
+   * time-scale units.
+   * @param {int} frame
+   * @return {uint32_t}
+   */
+  uint32_t GetFrameDuration(int frame) const {
+    return samples_[frame].duration;
+  }
+
+  /**
+   * Returns the maximum number of frames that can precede a frame in the
+   * decoding order and follow it in the output order.
+   * @return {int}
+   */
+  int GetMaxNumReorderPictures() const {
+    const int reorder0 = sps_[0].sps_max_num_reorder_pics;
+    const int reorder1 = sps_[1].sps_max_num_reorder_pics;
+    return reorder0 >= reorder1 ? reorder0 : reorder1;
+  }
+
+  /**
+   * Returns the maximum number of frames that the HEVC-with-Alpha stream
+   * requires its decoder to buffer.
+   * @return {int}
+   */
+  int GetMaxDecodedPictureBuffering() const {
+    const int buffering0 = sps_[0].sps_max_dec_pic_buffering;
+    const int buffering1 = sps_[1].sps_max_dec_pic_buffering;
+    return buffering0 >= buffering1 ? buffering0 : buffering1;
+  }
+
   /**
    * Returns whether this HEVC-with-Alpha stream premultiplies alpha pixels.
    * @return {int}
    */
-  int IsPremultipliedAlpha(int sample) const {
+  int IsPremultipliedAlpha(int /* sample */) const {
     return alpha_.alpha_channel_use_idc == 1;
   }
 
   /**
-   * Returns the frame number of the QuickTime stream. (The returned frame
-   * number may not represent a key frame.)
+   * Returns whether or not the HEVC-with-Alpha stream has an alpha-channel-
+   * information SEI.
+   * @return {int}
+   */
+  int HasAlphaChannelInformation() const {
+    return has_alpha_channel_information_;
+  }
+
+  /**
+   * Returns the frame width of the HEVC-with-Alpha stream.
+   * @return {int}
+   */
+  int GetFrameWidth() const {
+    return frame_width_;
+  }
+
+  /**
+   * Returns the frame height of the HEVC-with-Alpha stream.
+   * @return {int}
+   */
+  int GetFrameHeight() const {
+    return frame_height_;
+  }
+
+  /**
+   * Finds an HEVC sample description in the specified `stsd` atom and decodes
+   * its `hvcC` extension. This function decodes only the parameter sets and
+   * the SEI messages in the extension, i.e. it does not create any resources,
+   * so applications can use it for retrieving the stream information without
+   * creating a decoder. This function returns the decoded `hvcC` extension or
+   * NULL when the atom does not have a valid one.
+   * @param {const mov::SampleDescriptionAtom*} sample_description_atom
+   * @return {const mov::VideoSampleDescriptionExtension*}
+   */
+  const mov::VideoSampleDescriptionExtension* DecodeSampleDescription(
+      const mov::SampleDescriptionAtom* sample_description_atom);
+
+#if __APPLE__
+  /**
+   * Creates a Video Toolbox session for the QuickTime stream described by the
+   * specified `stsd` atom without reading its samples. Destroying this decoder
+   * adds the created session to the `hevc::SessionPool` object so a decoder
+   * created for the stream later can start decoding it without creating a
+   * session, i.e. this function prewarms a session.
+   * @param {const mov::SampleDescriptionAtom*} sample_description_atom
+   * @return {int}
+   */
+  int Prewarm(const mov::SampleDescriptionAtom* sample_description_atom);
+
+  /**
+   * Changes the size of the images output by this decoder. This function
+   * re-creates the Video Toolbox session when the size changes, i.e. the caller
+   * should call this function before it decodes a sync sample. This decoder
+   * asks Video Toolbox to decode samples at a reduced resolution when it can,
+   * and it scales the output images otherwise. (0 means the frame size of the
+   * QuickTime stream.)
+   * @param {int} output_width
+   * @param {int} output_height
+   * @return {int}
+   */
+  int SetOutputSize(int output_width, int output_height);
+
+  /**
+   * Returns the width of the images output by this decoder.
+   * @return {int}
+   */
+  int GetOutputWidth() const {
+    return output_width_ ? output_width_ : frame_width_;
+  }
+
+  /**
+   * Returns the height of the images output by this decoder.
+   * @return {int}
+   */
+  int GetOutputHeight() const {
+    return output_height_ ? output_height_ : frame_height_;
+  }
+#endif
+
+  /**
+   * Returns the frame presented at the specified time (in seconds) of the
+   * QuickTime stream, i.e. the last frame whose presentation timestamp is not
+   * greater than the time. (The returned frame number may not represent a key
+   * frame.)
    * @param {float} presentation_time
    * @return {int}
    */
   int GetFrame(float presentation_time) const;
 
+  /**
+   * Returns the last sync sample (i.e. an IRAP sample) that is not after the
+   * specified sample in the decoding order. (All samples are sync samples when
+   * the QuickTime stream does not have a `stss` atom.)
+   * @param {int} sample_number
+   * @return {int}
+   */
+  int GetSyncSample(int sample_number) const;
+
+  /**
+   * Returns the first sync sample after the specified sample in the decoding
+   * order, or the number of samples when the specified sample is in the last
+   * GOP.
+   * @param {uint32_t} sample_number
+   * @return {uint32_t}
+   */
+  uint32_t GetNextSyncSample(uint32_t sample_number) const;
+
+  /**
+   * Returns the sample from which this decoder decodes the QuickTime stream to
+   * output the specified frame, i.e. the last sync sample whose frame number
+   * is not greater than the specified one. Decoding a stream from this sample
+   * outputs the frame after decoding at most one GOP. (This function returns
+   * -1 when this decoder has not read the samples required for finding it.)
+   * @param {int} frame_number
+   * @return {int}
+   */
+  int GetSeekSample(int frame_number) const;
+
+  /**
+   * Returns whether or not the specified sample is discardable, i.e. whether or
+   * not it is a sub-layer non-reference picture (Section 3.132) of the highest
+   * temporal sub-layer, which no other pictures use as a reference. Skipping a
+   * discardable sample does not break decoding the following samples. (This
+   * value is valid only for readable samples, i.e. the caller must make a
+   * sample readable with `LoadSample()` before calling this function.)
+   * @param {int} sample_number
+   * @return {int}
+   */
+  int IsDiscardableSample(int sample_number) const;
+
+  /**
+   * Returns whether or not the specified sample is a RASL (random access
+   * skipped leading) picture, which refers to the pictures preceding its
+   * associated CRA picture in the decoding order. A player that starts
+   * decoding at a CRA picture must skip its RASL pictures (clause 8.1.3). (The
+   * caller must make the sample readable with `LoadSample()` before calling
+   * this function.)
+   * @param {int} sample_number
+   * @return {int}
+   */
+  int IsRandomAccessSkippedSample(int sample_number) const;
+
   /**
    * Decodes the specified sample synchronously.
    * @param {int} sample_number
@@ -794,8 +1154,50 @@ struct Decoder {
    * @return {int}
    */
   int DecodeSample(int frame_number, VTDecompressionOutputHandler handler);
+
+  /**
+   * Decodes the specified sample asynchronously with the specified flags, e.g.
+   * `kVTDecodeFrame_DoNotOutputFrame` for decoding a sample only as a reference
+   * of the following samples.
+   * @param {int} sample_number
+   * @param {VTDecodeFrameFlags} flags
+   * @param {VTDecompressionOutputHandler} handler
+   * @return {int}
+   */
+  int DecodeSample(int sample_number,
+                   VTDecodeFrameFlags flags,
+                   VTDecompressionOutputHandler handler);
+
+  /**
+   * Decodes the specified sample synchronously with the specified flags, i.e.
+   * this function returns after the given handler receives the output image.
+   * Tools that decode only a few samples of a stream (e.g. thumbnail
+   * extractors) can use this function without creating decoders with output
+   * callbacks, i.e. with sessions in the `hevc::SessionPool` object. (Video
+   * Toolbox outputs the images of synchronously-decoded samples in the
+   * decoding order.)
+   * @param {int} sample_number
+   * @param {VTDecodeFrameFlags} flags
+   * @param {VTDecompressionOutputHandler} handler
+   * @return {int}
+   */
+  int DecodeSampleSynchronously(int sample_number,
+                                VTDecodeFrameFlags flags,
+                                VTDecompressionOutputHandler handler);
 #endif
 
+  /**
+   * Returns the NAL unit type of the specified NAL packet. (A NAL packet in a
+   * QuickTime sample starts with a 4-byte size and a 2-byte NAL header.)
+   * @param {const uint8_t*} packet_data
+   * @return {hevc::NALUnitType}
+   * @private
+   */
+  static NALUnitType GetNALUnitType(const uint8_t* packet_data) {
+    const uint32_t data2 = CPU::LoadUINT16BE(&packet_data[4]);
+    return static_cast<NALUnitType>(CPU::BitExtractUINT32(data2, 9, 6));
+  }
+
   /**
    * Returns whether the specified NAL packet is an H.265 IDR (Instantaneous
    * Decoding Refresh) packet.
@@ -832,13 +1234,126 @@ struct Decoder {
     return n - NAL_BLA_W_LP <= NAL_RSV_IRAP_VCL23 - NAL_BLA_W_LP;
   }
 
+  /**
+   * Parses the QuickTime stream owned by this decoder and creates resources
+   * required for decoding it.
+   * @param {const hevc::SampleIndex*} index
+   * @param {hevc::Decoder::OutputCallback} callback
+   * @param {void*} object
+   * @return {int}
+   * @private
+   */
+  int CreateFromStream(const SampleIndex* index,
+                       OutputCallback callback,
+                       void* object);
+
+  /**
+   * Returns the data of the specified sample. (Core Media requires writable
+   * pointers to create `CMBlockBuffer` objects even though they do not write
+   * the sample data.)
+   * @param {const hevc::Decoder::Sample*} sample
+   * @return {void*}
+   * @private
+   */
+  void* GetSampleData(const Sample* sample) const {
+    return const_cast<uint8_t*>(&stream_.GetData()[sample->offset]);
+  }
+
   /**
    * Initializes the `frames_[]` array so this decoder can decode them.
    * @param {const mov::AtomCollection*} map
+   * @param {const hevc::SampleIndex*} index
    * @return {int}
    * @private
    */
-  int InitializeSamples(const mov::AtomCollection* map);
+  int InitializeSamples(const mov::AtomCollection* map,
+                        const SampleIndex* index);
+
+  /**
+   * Initializes the `samples_[]` array with the entries of the specified
+   * sample index. This function verifies the entries because the index is read
+   * from a cache file, i.e. it fails (and deletes the array) when the number
+   * of the entries is not the one of the `stsz` atom, when a sample is out of
+   * the stream, or when the frame numbers are not a permutation of the sample
+   * numbers.
+   * @param {const mov::AtomCollection*} map
+   * @param {const hevc::SampleIndex*} index
+   * @return {int}
+   * @private
+   */
+  int CopySampleIndex(const mov::AtomCollection* map,
+                      const SampleIndex* index);
+
+  /**
+   * Sets the presentation timestamps of the frames from the decoding
+   * timestamps of the samples and the specified composition-offset atom, which
+   * may be NULL. This function returns 0 when the atom is broken.
+   * @param {const mov::CompositionOffsetAtom*} composition_offset_atom
+   * @return {int}
+   * @private
+   */
+  int ApplyCompositionOffsets(
+      const mov::CompositionOffsetAtom* composition_offset_atom);
+
+  /**
+   * Reads the first GOP of the QuickTime stream, i.e. the samples up to its
+   * second sync sample.
+   * @param {const mov::SyncSampleAtom*} sync_sample_atom
+   * @return {int}
+   * @private
+   */
+  int LoadFirstGroup(const mov::SyncSampleAtom* sync_sample_atom);
+
+  /**
+   * Reads the slice headers of the samples of a windowed stream following the
+   * parsed ones, at most the specified number of chunks.
+   * @param {int} number_of_chunks
+   * @return {int}
+   * @private
+   */
+  int LoadWindowedSamples(int number_of_chunks);
+
+  /**
+   * Moves the window of a windowed stream to the GOP of the specified sample,
+   * i.e. pins the GOP and the next one and unpins the current window.
+   * @param {uint32_t} sample_number
+   * @return {int}
+   * @private
+   */
+  int PinWindow(uint32_t sample_number);
+
+  /**
+   * Returns whether or not this decoder can read the data of the specified
+   * sample.
+   * @param {const hevc::Decoder::Sample*} sample
+   * @return {int}
+   * @private
+   */
+  int IsSampleReadable(const Sample* sample) const;
+
+  /**
+   * Calculates the hash of the sample-table atoms of the QuickTime stream,
+   * which identifies its sample index.
+   * @param {const mov::AtomCollection*} map
+   * @return {uint64_t}
+   * @private
+   */
+  static uint64_t HashSampleTable(const mov::AtomCollection* map);
+
+  /**
+   * Reads the picture-order counts of the samples that have become resident
+   * since the last call and assigns frame numbers to them.
+   * @return {uint32_t}
+   * @private
+   */
+  uint32_t UpdateResidentSamples();
+
+  /**
+   * Assigns the next frame number to the pending sample with the smallest
+   * picture-order count and removes it from the pending samples.
+   * @private
+   */
+  void OutputPendingSample();
 
   /**
    * Decodes an HEVC Decoder (`hvcC`) configuration.
@@ -944,10 +1459,16 @@ struct Decoder {
   void InitializeVideoToolbox();
 
   /**
-   * Creates the Video Toolbox decoder.
+   * Creates the Video Toolbox decoder. This function re-uses an idle session
+   * in the `hevc::SessionPool` object when `use_pool` is not 0 and this decoder
+   * does not have callbacks. The session outputs images of the output size of
+   * this decoder.
    * @param {const mov::VideoSampleDescriptionExtension*} extension
    * @param {int} farme_width
    * @param {int} farme_height
+   * @param {hevc::Decoder::OutputCallback} callback
+   * @param {void*} object
+   * @param {int} use_pool
    * @return {int}
    * @private
    */
@@ -956,13 +1477,17 @@ struct Decoder {
       int frame_width,
       int frame_height,
       OutputCallback callback,
-      void* object);
+      void* object,
+      int use_pool);
 
   /**
-   * Destroys the Video Toolbox decoder.
+   * Destroys the Video Toolbox decoder. This function returns its session to
+   * the `hevc::SessionPool` object when `recycle` is not 0 and this decoder
+   * does not have callbacks. (A session with callbacks cannot be shared.)
+   * @param {int} recycle
    * @private
    */
-  void DestroyVideoToolbox();
+  void DestroyVideoToolbox(int recycle);
 
   /**
    * Resets the Video Toolbox decoder.
@@ -971,13 +1496,41 @@ struct Decoder {
    */
   int ResetVideoToolbox();
 
+  /**
+   * Creates a `CMSampleBuffer` object referring to the specified sample with
+   * the timestamps of its output frame.
+   * @param {int} sample_number
+   * @param {CMSampleBufferRef*} sample_buffer
+   * @return {OSStatus}
+   * @private
+   */
+  OSStatus CreateSampleBuffer(int sample_number,
+                              CMSampleBufferRef* sample_buffer);
+
+  /**
+   * Called by Core Media when it deletes a block buffer of a windowed stream.
+   * This function unpins the sample pinned by `CreateSampleBuffer()` and
+   * deletes the stream owned by the block buffer.
+   * @param {void*} object
+   * @param {void*} data
+   * @param {size_t} size
+   * @private
+   */
+  static void UnpinSampleData(void* object, void* data, size_t size);
+
   /**
    * Decodes the specified sample synchronously using the Video Toolbox decoder.
+   * This function uses the output callback of this decoder when `handler` is
+   * NULL.
    * @param {int} sample_number
+   * @param {VTDecodeFrameFlags} flags
+   * @param {VTDecompressionOutputHandler} handler
    * @return {int}
    * @private
    */
-  int DecodeSampleVideoToolbox(int sample_number);
+  int DecodeSampleVideoToolbox(int sample_number,
+                               VTDecodeFrameFlags flags,
+                               VTDecompressionOutputHandler handler);
 #endif
 
 #if __APPLE__
@@ -1015,21 +1568,30 @@ struct Decoder {
    * @private
    */
   void* decoder_object_;
-#endif
 
   /**
-   * The data of the QuickTime stream.
-   * @type {uint8_t*}
+   * The width of the images output by the decompression session. (0 means the
+   * frame width of the QuickTime stream.)
+   * @type {int}
    * @private
    */
-  uint8_t* data_;
+  int output_width_;
 
   /**
-   * The size of the QuickTime stream.
-   * @type {size_t}
+   * The height of the images output by the decompression session. (0 means the
+   * frame height of the QuickTime stream.)
+   * @type {int}
    * @private
    */
-  size_t size_;
+  int output_height_;
+#endif
+
+  /**
+   * The data of the QuickTime stream.
+   * @type {mov::Stream}
+   * @private
+   */
+  mov::Stream stream_;
 
   /**
    * The information of the samples of this QuickTime stream.
@@ -1038,6 +1600,14 @@ struct Decoder {
    */
   Sample* samples_;
 
+  /**
+   * The sync-sample table of this QuickTime stream. (This value is NULL when
+   * all samples are sync samples.)
+   * @type {const mov::SyncSampleAtom*}
+   * @private
+   */
+  const mov::SyncSampleAtom* sync_sample_atom_;
+
   /**
    * The number of `Sample` objects in the `samples_` array.
    * @type {uint32_t}
@@ -1045,6 +1615,45 @@ struct Decoder {
    */
   uint32_t number_of_samples_;
 
+  /**
+   * The number of samples that have been read from the QuickTime stream.
+   * (Samples become resident in the decoding order.)
+   * @type {uint32_t}
+   * @private
+   */
+  uint32_t number_of_resident_samples_;
+
+  /**
+   * The number of samples whose picture-order counts have been read.
+   * @type {uint32_t}
+   * @private
+   */
+  uint32_t number_of_parsed_samples_;
+
+  /**
+   * The samples whose frame numbers have not been assigned yet. (This array
+   * emulates the output process of an HEVC decoder, which outputs the picture
+   * with the smallest picture-order count when the number of pictures waiting
+   * for output exceeds `sps_max_num_reorder_pics`.)
+   * @type {uint32_t[]}
+   * @private
+   */
+  uint32_t pending_samples_[16];
+
+  /**
+   * The number of the samples in the above array.
+   * @type {uint32_t}
+   * @private
+   */
+  uint32_t number_of_pending_samples_;
+
+  /**
+   * The frame number assigned to the next output sample.
+   * @type {uint32_t}
+   * @private
+   */
+  uint32_t next_frame_number_;
+
   /**
    * The maximum picture-order count.
    * @type {uint32_t}
@@ -1052,6 +1661,65 @@ struct Decoder {
    */
   uint32_t max_picture_order_count_;
 
+  /**
+   * The hash of the sample-table atoms of this QuickTime stream.
+   * @type {uint64_t}
+   * @private
+   */
+  uint64_t sample_table_hash_;
+
+  /**
+   * Whether or not this decoder has copied the picture-order counts and the
+   * frame numbers of the samples from a sample index.
+   * @type {int}
+   * @private
+   */
+  int has_sample_index_;
+
+  /**
+   * The first sample of the window of a windowed stream, a sync sample.
+   * @type {uint32_t}
+   * @private
+   */
+  uint32_t window_start_;
+
+  /**
+   * The first sample of the second GOP of the window.
+   * @type {uint32_t}
+   * @private
+   */
+  uint32_t window_next_;
+
+  /**
+   * The offset of the bytes pinned for the window.
+   * @type {size_t}
+   * @private
+   */
+  size_t window_offset_;
+
+  /**
+   * The size of the bytes pinned for the window. (This value is 0 when this
+   * decoder does not pin a window.)
+   * @type {size_t}
+   * @private
+   */
+  size_t window_size_;
+
+  /**
+   * The offset of the bytes pinned for reading the slice headers of the
+   * samples of a windowed stream.
+   * @type {size_t}
+   * @private
+   */
+  size_t parse_offset_;
+
+  /**
+   * The size of the bytes pinned for reading slice headers.
+   * @type {size_t}
+   * @private
+   */
+  size_t parse_size_;
+
   /**
    * The time scale for this QuickTime stream, the number of time units. (This
    * value is the denominator for sample durations.)
@@ -1060,6 +1728,13 @@ struct Decoder {
    */
   uint32_t time_scale_;
 
+  /**
+   * The duration of this QuickTime stream, the sum of its sample durations.
+   * @type {uint64_t}
+   * @private
+   */
+  uint64_t duration_;
+
   /**
    * The frame width of the QuickTime stream.
    * @type {int}
@@ -1104,6 +1779,13 @@ struct Decoder {
    */
   sei::AlphaChannelInformation alpha_;
 
+  /**
+   * Whether or not this decoder has decoded an alpha-channel-information SEI.
+   * @type {int}
+   * @private
+   */
+  int has_alpha_channel_information_;
+
   /**
    * The cache that stores an RBSP (Raw-Byte Sequence Payload) fragment.
    * @type {uint8_t[256]}
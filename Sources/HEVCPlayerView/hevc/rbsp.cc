@@ -0,0 +1,426 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "../hevc/rbsp.h"
+
+#include "../base/cpu.h"
+#include "../base/intrin.h"
+
+/**
+ * The attribute that allows a function to use AVX2 intrinsics without
+ * compiling the whole file for AVX2 CPUs.
+ * @define {attribute}
+ */
+#if _MSC_VER
+#define HEVC_TARGET_AVX2
+#else
+#define HEVC_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace {
+
+/**
+ * Copies bytes one by one except the bytes `0x03` following two `0x00` bytes
+ * and returns the end of the output. The `zeros` parameter is the number of
+ * `0x00` bytes preceding the data. (An emulation-prevention byte does not
+ * count as a `0x00` byte of the next byte sequence.)
+ * @param {const uint8_t*} data
+ * @param {uintptr_t} size
+ * @param {uintptr_t} zeros
+ * @param {uint8_t*} rbsp
+ * @return {uint8_t*}
+ */
+uint8_t* ExtractBytes(const uint8_t* data,
+                      uintptr_t size,
+                      uintptr_t zeros,
+                      uint8_t* rbsp) {
+  for (uintptr_t i = 0; i < size; ++i) {
+    const uint8_t data_byte = data[i];
+    if (zeros >= 2 && data_byte == 0x03) {
+      zeros = 0;
+      continue;
+    }
+    *rbsp++ = data_byte;
+    zeros = data_byte ? 0 : zeros + 1;
+  }
+  return rbsp;
+}
+
+/**
+ * Copies a block except the bytes marked in the specified bit-mask, i.e. the
+ * emulation-prevention bytes, and returns the end of the output. The bit-mask
+ * has `BITS` bits for each byte and sets only the lowest one of them. (This
+ * function writes whole words as `RBSP::ExtractSWAR()` does, i.e. it may write
+ * `RBSP::PADDING_SIZE` bytes past the end of the output.)
+ * @param {const uint8_t*} data
+ * @param {uintptr_t} size
+ * @param {uint64_t} mask
+ * @param {uint8_t*} rbsp
+ * @return {uint8_t*}
+ */
+template <int BITS>
+uint8_t* CopyBlock(const uint8_t* data,
+                   uintptr_t size,
+                   uint64_t mask,
+                   uint8_t* rbsp) {
+  for (uintptr_t i = 0; i < size; i += sizeof(uint64_t)) {
+    uint64_t data_word = CPU::LoadUINT64LE(&data[i]);
+    uint64_t word_mask = (mask >> (i * BITS)) & ((1ULL << (8 * BITS)) - 1ULL);
+    uintptr_t data_size = sizeof(uint64_t);
+    while (word_mask) {
+      const unsigned int index = __builtin_ctzll(word_mask) / BITS;
+      CPU::StoreUINT64LE(rbsp, data_word);
+      rbsp += index;
+      const unsigned int shift = index << 3;
+      data_word >>= shift;
+      data_word >>= 8;
+      word_mask >>= index * BITS;
+      word_mask >>= BITS;
+      data_size -= index + 1;
+    }
+    if (data_size > 0) {
+      CPU::StoreUINT64LE(rbsp, data_word);
+      rbsp += data_size;
+    }
+  }
+  return rbsp;
+}
+
+/**
+ * Returns the number of `0x00` bytes at the end of a block, i.e. the number of
+ * `0x00` bytes preceding the next block, from the bit-mask of its `0x00` bytes.
+ * (This function returns two when the block ends with two or more `0x00`
+ * bytes.)
+ * @param {uint64_t} mask_eq_00
+ * @return {uintptr_t}
+ */
+template <int BITS, int SIZE>
+uintptr_t GetTrailingZeros(uint64_t mask_eq_00) {
+  if (!((mask_eq_00 >> (BITS * (SIZE - 1))) & 1)) {
+    return 0;
+  }
+  return ((mask_eq_00 >> (BITS * (SIZE - 2))) & 1) ? 2 : 1;
+}
+
+}  // namespace
+
+namespace hevc {
+
+uintptr_t RBSP::Extract(const uint8_t* data, uintptr_t size, uint8_t* rbsp) {
+#if __arm__ || __aarch64__
+  if (CPU::HaveNEON()) {
+    return ExtractNEON16(data, size, rbsp);
+  }
+#endif
+#if __i386__ || __x86_64__
+  if (CPU::HaveAVX2()) {
+    return ExtractAVX2(data, size, rbsp);
+  }
+#endif
+#if __SSE2__
+  return ExtractSSE2(data, size, rbsp);
+#elif __SIZEOF_SIZE_T__ == 8
+  return ExtractSWAR(data, size, rbsp);
+#else
+  return ExtractScalar(data, size, rbsp);
+#endif
+}
+
+uintptr_t RBSP::ExtractScalar(const uint8_t* data,
+                              uintptr_t size,
+                              uint8_t* rbsp) {
+  uint8_t* rbsp_end = ExtractBytes(data, size, 0, rbsp);
+  return static_cast<uintptr_t>(rbsp_end - rbsp);
+}
+
+#if __SIZEOF_SIZE_T__ == 8
+uintptr_t RBSP::ExtractSWAR(const uint8_t* data,
+                            uintptr_t size,
+                            uint8_t* rbsp) {
+  uint8_t* rbsp_top = rbsp;
+  uint8_t* rbsp_end = rbsp;
+  // Remove padding bytes on 64-bit CPUs.
+  uint64_t last_mask_eq_00 = 0;
+  do {
+    uint64_t data_word = CPU::LoadUINT64LE(data);
+    uintptr_t data_size = sizeof(uint64_t) < size ? sizeof(uint64_t) : size;
+
+    // Find a byte sequence `0x00 0x00 0x03` in a 64-bit word. This code
+    // consists of three parts:
+    // 1. Create a bit-mask of non-zero bytes in the 64-bit word;
+    // 2. Create a bit-mask of bytes greater than 0x03 in the 64-bit word, and;
+    // 3. Find a byte sequence `0x00, 0x00, 0x03` in the 64-bit word.
+    //
+    // The first step calculates the logical sums of its bits in parallel.
+    //
+    //    b0                      b1 b2    b3 b4          b5 b6    b7
+    //    b1                      b2 b3    b4 b5          b6 b7    0
+    //   -------------------------------------------------------------
+    //    b0|b1                   *  b2|b3 *  b4|b5       *  b6|b7 *
+    //
+    //    b0|b1                   *  b2|b3 *  b4|b5       *  b6|b7 *
+    //    b2|b3                   *  b4|b5 *  b6|b7       *  0     0
+    //   -------------------------------------------------------------
+    //    b0|b1|b2|b3             *  *     *  b4|b5|b6|b7 *  *     *
+    //
+    //    b0|b1|b2|b3             *  *     *  b4|b5|b6|b7 *  *     *
+    //    b4|b5|b6|b7             *  *     *  0           0  0     0
+    //   -------------------------------------------------------------
+    //    b0|b1|b2|b3|b4|b5|b6|b7 *  *     *  *           *  *     *
+    uint64_t mask_eq_00 = data_word | (data_word >> 1);
+    uint64_t mask_le_03 = mask_eq_00 & ~0x0101010101010101ULL;
+    mask_eq_00 = mask_eq_00 | (mask_eq_00 >> 2);
+    mask_le_03 = mask_le_03 | (mask_le_03 >> 2);
+    mask_eq_00 = mask_eq_00 | (mask_eq_00 >> 4);
+    mask_le_03 = mask_le_03 | (mask_le_03 >> 4);
+    mask_eq_00 = ~mask_eq_00;
+    mask_le_03 = ~mask_le_03;
+
+    // Compose the bit-masks into a bit-mask so each byte represents whether or
+    // not it is the third byte of a byte sequence `0x00, 0x00, 0x03`.
+    uint64_t mask_eq_00xxxx =
+        (mask_eq_00 << 16) | (last_mask_eq_00 >> (64 - 16));
+    uint64_t mask_eq_00xx =
+        (mask_eq_00 << 8) | (last_mask_eq_00 >> (64 - 8));
+    uint64_t mask_le_000003 =
+        mask_eq_00xxxx & mask_eq_00xx & mask_le_03 & 0x0101010101010101ULL;
+    if (data_size < sizeof(uint64_t)) {
+      mask_le_000003 &= (1ULL << (data_size << 3)) - 1ULL;
+    }
+    data += data_size;
+    size -= data_size;
+    last_mask_eq_00 = mask_eq_00;
+    if (!mask_le_000003) {
+      CPU::StoreUINT64LE(rbsp_end, data_word);
+      rbsp_end += data_size;
+    } else {
+      // Write the word except the third byte of `0x00 0x00 0x03`.
+      data_size = sizeof(uint64_t);
+      do {
+        const unsigned int index = __builtin_ctzll(mask_le_000003) >> 3;
+        CPU::StoreUINT64LE(rbsp_end, data_word);
+        rbsp_end += index;
+#if __i386__ || __x86_64__ || __arm__ || __aarch64__
+        // Decompose a shift operation into two shift operations to avoid
+        // shifting a 64-bit variable by 64 bits. (It is an undefined
+        // operation.)
+        const unsigned int shift = index << 3;
+        mask_le_000003 >>= shift;
+        mask_le_000003 >>= 8;
+        data_word >>= shift;
+        data_word >>= 8;
+#else
+        const unsigned int shift = (index + 1) << 3;
+        mask_le_000003 >>= shift;
+        data_word >>= shift;
+#endif
+        data_size -= index + 1;
+      } while (mask_le_000003);
+      if (data_size > 0) {
+        CPU::StoreUINT64LE(rbsp_end, data_word);
+        rbsp_end += data_size;
+      }
+    }
+  } while (size > 0);
+  return static_cast<uintptr_t>(rbsp_end - rbsp_top);
+}
+#endif
+
+#if __arm__ || __aarch64__
+uintptr_t RBSP::ExtractNEON(const uint8_t* data,
+                            uintptr_t size,
+                            uint8_t* rbsp) {
+  uint8_t* rbsp_top = rbsp;
+  uint8_t* rbsp_end = rbsp;
+  // Remove padding bytes with NEON. (This code uses NEON just for comparing
+  // eight bytes at once.)
+  uint64_t last_mask_eq_00 = 0;
+  do {
+    uint64_t data_word = CPU::LoadUINT64LE(data);
+    uintptr_t data_size = sizeof(uint64_t) < size ? sizeof(uint64_t) : size;
+
+ 	   // Create a bit-mask representing the third byte of `0x00 0x00 0x03`.
+    uint8x8_t d0 = vcreate_u8(data_word);
+    uint8x8_t d1 = vceq_u8(d0, vdup_n_u8(0));
+    uint8x8_t d2 = vcle_u8(d0, vdup_n_u8(3));
+    uint64_t mask_eq_00 = vget_lane_u64(vreinterpret_u64_u8(d1), 0);
+    uint64_t mask_le_03 = vget_lane_u64(vreinterpret_u64_u8(d2), 0);
+    uint64_t mask_eq_00xxxx =
+        (mask_eq_00 << 16) | (last_mask_eq_00 >> (64 - 16));
+    uint64_t mask_eq_00xx =
+        (mask_eq_00 << 8) | (last_mask_eq_00 >> (64 - 8));
+    uint64_t mask_le_000003 = mask_eq_00xxxx & mask_eq_00xx & mask_le_03;
+    if (data_size < sizeof(uint64_t)) {
+      mask_le_000003 &= (1ULL << (data_size << 3)) - 1ULL;
+    }
+    data += data_size;
+    size -= data_size;
+    last_mask_eq_00 = mask_eq_00;
+    if (!mask_le_000003) {
+      CPU::StoreUINT64LE(rbsp_end, data_word);
+      rbsp_end += data_size;
+    } else {
+      // Write the word except the third byte of `0x00 0x00 0x03`.
+      data_size = sizeof(uint64_t);
+      do {
+        const unsigned int index = __builtin_ctzll(mask_le_000003) >> 3;
+        CPU::StoreUINT64LE(rbsp_end, data_word);
+        rbsp_end += index;
+        const unsigned int shift = index << 3;
+        mask_le_000003 >>= shift;
+        mask_le_000003 >>= 8;
+        data_word >>= shift;
+        data_word >>= 8;
+        data_size -= index + 1;
+      } while (mask_le_000003);
+      if (data_size > 0) {
+        CPU::StoreUINT64LE(rbsp_end, data_word);
+        rbsp_end += data_size;
+      }
+    }
+  } while (size > 0);
+  return static_cast<uintptr_t>(rbsp_end - rbsp_top);
+}
+
+uintptr_t RBSP::ExtractNEON16(const uint8_t* data,
+                              uintptr_t size,
+                              uint8_t* rbsp) {
+  uint8_t* rbsp_end = rbsp;
+  // Compare sixteen bytes at once and narrow the results to 64-bit masks, each
+  // nibble of which represents a byte. (NEON does not have an instruction that
+  // creates a bit-mask from a vector as `pmovmskb` does.)
+  const uint8x16_t eq_00 = vdupq_n_u8(0);
+  const uint8x16_t eq_03 = vdupq_n_u8(3);
+  uint64_t last_mask_eq_00 = 0;
+  while (size >= 16) {
+    const uint8x16_t block = vld1q_u8(data);
+    const uint8x8_t d0 =
+        vshrn_n_u16(vreinterpretq_u16_u8(vceqq_u8(block, eq_00)), 4);
+    const uint8x8_t d1 =
+        vshrn_n_u16(vreinterpretq_u16_u8(vceqq_u8(block, eq_03)), 4);
+    const uint64_t mask_eq_00 = vget_lane_u64(vreinterpret_u64_u8(d0), 0);
+    const uint64_t mask_eq_03 = vget_lane_u64(vreinterpret_u64_u8(d1), 0);
+    const uint64_t mask_eq_00xxxx =
+        (mask_eq_00 << 8) | (last_mask_eq_00 >> (64 - 8));
+    const uint64_t mask_eq_00xx =
+        (mask_eq_00 << 4) | (last_mask_eq_00 >> (64 - 4));
+    const uint64_t mask_eq_000003 =
+        mask_eq_00xxxx & mask_eq_00xx & mask_eq_03 & 0x1111111111111111ULL;
+    if (!mask_eq_000003) {
+      vst1q_u8(rbsp_end, block);
+      rbsp_end += 16;
+    } else {
+      rbsp_end = CopyBlock<4>(data, 16, mask_eq_000003, rbsp_end);
+    }
+    last_mask_eq_00 = mask_eq_00;
+    data += 16;
+    size -= 16;
+  }
+  rbsp_end = ExtractBytes(data, size,
+                          GetTrailingZeros<4, 16>(last_mask_eq_00), rbsp_end);
+  return static_cast<uintptr_t>(rbsp_end - rbsp);
+}
+#endif
+
+#if __SSE2__
+uintptr_t RBSP::ExtractSSE2(const uint8_t* data,
+                            uintptr_t size,
+                            uint8_t* rbsp) {
+  uint8_t* rbsp_end = rbsp;
+  // Create 16-bit masks of the `0x00` bytes and the `0x03` bytes in a 16-byte
+  // block and compose them into a bit-mask of the third bytes of `0x00 0x00
+  // 0x03`. (The bit-mask of the previous block provides the first bytes of
+  // this block with their preceding bytes.)
+  const __m128i eq_00 = _mm_setzero_si128();
+  const __m128i eq_03 = _mm_set1_epi8(3);
+  uint64_t last_mask_eq_00 = 0;
+  while (size >= 16) {
+    const __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    const uint64_t mask_eq_00 = static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(block, eq_00)));
+    const uint64_t mask_eq_03 = static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(block, eq_03)));
+    const uint64_t mask_eq_00xxxx =
+        (mask_eq_00 << 2) | (last_mask_eq_00 >> (16 - 2));
+    const uint64_t mask_eq_00xx =
+        (mask_eq_00 << 1) | (last_mask_eq_00 >> (16 - 1));
+    const uint64_t mask_eq_000003 = mask_eq_00xxxx & mask_eq_00xx & mask_eq_03;
+    if (!mask_eq_000003) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(rbsp_end), block);
+      rbsp_end += 16;
+    } else {
+      rbsp_end = CopyBlock<1>(data, 16, mask_eq_000003, rbsp_end);
+    }
+    last_mask_eq_00 = mask_eq_00;
+    data += 16;
+    size -= 16;
+  }
+  rbsp_end = ExtractBytes(data, size,
+                          GetTrailingZeros<1, 16>(last_mask_eq_00), rbsp_end);
+  return static_cast<uintptr_t>(rbsp_end - rbsp);
+}
+#endif
+
+#if __i386__ || __x86_64__
+HEVC_TARGET_AVX2
+uintptr_t RBSP::ExtractAVX2(const uint8_t* data,
+                            uintptr_t size,
+                            uint8_t* rbsp) {
+  uint8_t* rbsp_end = rbsp;
+  // Find `0x00 0x00 0x03` in a 32-byte block as `ExtractSSE2()` does. (Most
+  // blocks of a slice payload do not have it, i.e. this loop usually copies
+  // them with one load and one store.)
+  const __m256i eq_00 = _mm256_setzero_si256();
+  const __m256i eq_03 = _mm256_set1_epi8(3);
+  uint64_t last_mask_eq_00 = 0;
+  while (size >= 32) {
+    const __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+    const uint64_t mask_eq_00 = static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, eq_00)));
+    const uint64_t mask_eq_03 = static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, eq_03)));
+    const uint64_t mask_eq_00xxxx =
+        (mask_eq_00 << 2) | (last_mask_eq_00 >> (32 - 2));
+    const uint64_t mask_eq_00xx =
+        (mask_eq_00 << 1) | (last_mask_eq_00 >> (32 - 1));
+    const uint64_t mask_eq_000003 = mask_eq_00xxxx & mask_eq_00xx & mask_eq_03;
+    if (!mask_eq_000003) {
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(rbsp_end), block);
+      rbsp_end += 32;
+    } else {
+      rbsp_end = CopyBlock<1>(data, 32, mask_eq_000003, rbsp_end);
+    }
+    last_mask_eq_00 = mask_eq_00;
+    data += 32;
+    size -= 32;
+  }
+  rbsp_end = ExtractBytes(data, size,
+                          GetTrailingZeros<1, 32>(last_mask_eq_00), rbsp_end);
+  return static_cast<uintptr_t>(rbsp_end - rbsp);
+}
+#endif
+
+}  // namespace hevc
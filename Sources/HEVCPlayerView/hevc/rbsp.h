@@ -0,0 +1,137 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef HEVC_RBSP_H_
+#define HEVC_RBSP_H_
+
+#include <stdint.h>
+
+namespace hevc {
+
+/**
+ * The class that extracts RBSPs (Raw Byte Sequence Payloads) from NAL units,
+ * i.e. removes the emulation-prevention bytes (the third bytes of byte
+ * sequences `0x00 0x00 0x03`) from them. This class provides the functions for
+ * each instruction set so benchmarks can compare them. (These functions write
+ * whole words, i.e. the output buffer must have `PADDING_SIZE` bytes of
+ * padding at its end. The word-at-a-time functions also read whole words, i.e.
+ * the input data must have the same padding at its end.)
+ */
+struct RBSP {
+  enum {
+    PADDING_SIZE = 8,
+  };
+
+  /**
+   * Extracts an RBSP from the specified data with the fastest function
+   * available on the host CPU and returns its size.
+   * @param {const uint8_t*} data
+   * @param {uintptr_t} size
+   * @param {uint8_t*} rbsp
+   * @return {uintptr_t}
+   */
+  static uintptr_t Extract(const uint8_t* data, uintptr_t size, uint8_t* rbsp);
+
+  /**
+   * Extracts an RBSP one byte at a time.
+   * @param {const uint8_t*} data
+   * @param {uintptr_t} size
+   * @param {uint8_t*} rbsp
+   * @return {uintptr_t}
+   */
+  static uintptr_t ExtractScalar(const uint8_t* data,
+                                 uintptr_t size,
+                                 uint8_t* rbsp);
+
+#if __SIZEOF_SIZE_T__ == 8
+  /**
+   * Extracts an RBSP eight bytes at a time with 64-bit integer operations.
+   * @param {const uint8_t*} data
+   * @param {uintptr_t} size
+   * @param {uint8_t*} rbsp
+   * @return {uintptr_t}
+   */
+  static uintptr_t ExtractSWAR(const uint8_t* data,
+                               uintptr_t size,
+                               uint8_t* rbsp);
+#endif
+
+#if __arm__ || __aarch64__
+  /**
+   * Extracts an RBSP eight bytes at a time with NEON.
+   * @param {const uint8_t*} data
+   * @param {uintptr_t} size
+   * @param {uint8_t*} rbsp
+   * @return {uintptr_t}
+   */
+  static uintptr_t ExtractNEON(const uint8_t* data,
+                               uintptr_t size,
+                               uint8_t* rbsp);
+
+  /**
+   * Extracts an RBSP sixteen bytes at a time with NEON. This function copies a
+   * 16-byte block as it is when the block does not have `0x00 0x00 0x03`.
+   * @param {const uint8_t*} data
+   * @param {uintptr_t} size
+   * @param {uint8_t*} rbsp
+   * @return {uintptr_t}
+   */
+  static uintptr_t ExtractNEON16(const uint8_t* data,
+                                 uintptr_t size,
+                                 uint8_t* rbsp);
+#endif
+
+#if __SSE2__
+  /**
+   * Extracts an RBSP sixteen bytes at a time with SSE2. This function copies a
+   * 16-byte block as it is when the block does not have `0x00 0x00 0x03`.
+   * @param {const uint8_t*} data
+   * @param {uintptr_t} size
+   * @param {uint8_t*} rbsp
+   * @return {uintptr_t}
+   */
+  static uintptr_t ExtractSSE2(const uint8_t* data,
+                               uintptr_t size,
+                               uint8_t* rbsp);
+#endif
+
+#if __i386__ || __x86_64__
+  /**
+   * Extracts an RBSP thirty-two bytes at a time with AVX2. This function copies
+   * a 32-byte block as it is when the block does not have `0x00 0x00 0x03`.
+   * (The caller must verify the host CPU supports AVX2.)
+   * @param {const uint8_t*} data
+   * @param {uintptr_t} size
+   * @param {uint8_t*} rbsp
+   * @return {uintptr_t}
+   */
+  static uintptr_t ExtractAVX2(const uint8_t* data,
+                               uintptr_t size,
+                               uint8_t* rbsp);
+#endif
+};
+
+}  // namespace hevc
+
+#endif  // HEVC_RBSP_H_
@@ -0,0 +1,156 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "../hevc/sample_index.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../mov/stream.h"
+
+namespace {
+
+/**
+ * Writes the specified bytes to the specified position of a file.
+ * @param {int} file
+ * @param {const void*} data
+ * @param {size_t} size
+ * @param {uint64_t} offset
+ * @return {int}
+ */
+int WriteFile(int file, const void* data, size_t size, uint64_t offset) {
+  const uint8_t* top = static_cast<const uint8_t*>(data);
+  while (size > 0) {
+    const ssize_t write_size =
+        pwrite(file, top, size, static_cast<off_t>(offset));
+    if (write_size <= 0) {
+      if (write_size < 0 && errno == EINTR) {
+        continue;
+      }
+      return 0;
+    }
+    top += write_size;
+    size -= static_cast<size_t>(write_size);
+    offset += static_cast<uint64_t>(write_size);
+  }
+  return 1;
+}
+
+}  // namespace
+
+namespace hevc {
+
+void SampleIndex::Initialize() {
+  data_ = NULL;
+  size_ = 0;
+}
+
+int SampleIndex::Create(uint32_t number_of_samples) {
+  Destroy();
+  const size_t size = sizeof(Header) + number_of_samples * sizeof(Entry);
+  data_ = static_cast<uint8_t*>(malloc(size));
+  if (!data_) {
+    return 0;
+  }
+  memset(data_, 0, sizeof(Header));
+  size_ = size;
+  Header* header = GetHeader();
+  header->magic = MAGIC;
+  header->version = VERSION;
+  header->number_of_samples = number_of_samples;
+  return 1;
+}
+
+int SampleIndex::Copy(const SampleIndex* index) {
+  if (!Create(index->GetNumberOfSamples())) {
+    return 0;
+  }
+  memcpy(data_, index->data_, size_);
+  return 1;
+}
+
+int SampleIndex::Read(int file, uint64_t file_size, int64_t modified_time) {
+  // Read the header of the index and verify it before reading its entries.
+  struct stat file_stat;
+  if (fstat(file, &file_stat) ||
+      file_stat.st_size < static_cast<off_t>(sizeof(Header))) {
+    return 0;
+  }
+  Header header;
+  if (!mov::Stream::ReadFile(file, &header, sizeof(header), 0)) {
+    return 0;
+  }
+  if (header.magic != MAGIC || header.version != VERSION ||
+      header.file_size != file_size || header.modified_time != modified_time) {
+    return 0;
+  }
+  const uint64_t size =
+      sizeof(Header) + static_cast<uint64_t>(header.number_of_samples) *
+      sizeof(Entry);
+  if (header.number_of_samples == 0 ||
+      size != static_cast<uint64_t>(file_stat.st_size)) {
+    return 0;
+  }
+  if (!Create(header.number_of_samples)) {
+    return 0;
+  }
+  if (!mov::Stream::ReadFile(file, data_, size_, 0)) {
+    Destroy();
+    return 0;
+  }
+  return 1;
+}
+
+int SampleIndex::Write(int file) const {
+  if (!data_) {
+    return 0;
+  }
+  if (!WriteFile(file, data_, size_, 0)) {
+    return 0;
+  }
+  return ftruncate(file, static_cast<off_t>(size_)) == 0;
+}
+
+void SampleIndex::Destroy() {
+  if (data_) {
+    free(data_);
+    data_ = NULL;
+  }
+  size_ = 0;
+}
+
+uint64_t SampleIndex::Hash(uint64_t hash, const void* data, size_t size) {
+  const uint8_t* top = static_cast<const uint8_t*>(data);
+  const uint8_t* end = top + size;
+  while (top < end) {
+    hash ^= *top++;
+    hash *= 0x00000100000001b3ULL;
+  }
+  return hash;
+}
+
+}  // namespace hevc
@@ -0,0 +1,268 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef HEVC_SAMPLE_INDEX_H_
+#define HEVC_SAMPLE_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace hevc {
+
+/**
+ * The class that encapsulates a persistent index of the samples of a
+ * QuickTime stream, i.e. their offsets, their sizes, their picture-order
+ * counts, and their frame numbers (the output order). A decoder has to read
+ * the slice header of every sample to calculate these values, which reads the
+ * first bytes of all samples in the `mdat` atom. A decoder created with an
+ * index copies them instead of reading the samples. An index is a header
+ * followed by an array of entries listed below and it is keyed with the size
+ * and the modification time of its QuickTime file and with the hash of the
+ * sample-table atoms (i.e. `stsc`, `stsz`, `stco`, and `stss`) of the file.
+ *   +--------+-----------------------+
+ *   | offset | field                 |
+ *   +--------+-----------------------+
+ *   | 0      | header                |
+ *   +--------+-----------------------+
+ *   | 40     | entry #0              |
+ *   | 64     | entry #1              |
+ *     ...
+ *   +--------+-----------------------+
+ */
+struct SampleIndex {
+  /**
+   * The constants of the index format.
+   * @enum {uint32_t}
+   */
+  enum {
+    // The magic number 'HVSI' of an index.
+    MAGIC = 0x49535648,
+    // The version of the index format. (Version 2 stores 64-bit offsets.)
+    VERSION = 2,
+  };
+
+  /**
+   * The inner class that encapsulates the header of an index.
+   * @public
+   */
+  struct Header {
+    /**
+     * The magic number, which is equal to `MAGIC`.
+     * @type {uint32_t}
+     * @public
+     */
+    uint32_t magic;
+
+    /**
+     * The version, which is equal to `VERSION`.
+     * @type {uint32_t}
+     * @public
+     */
+    uint32_t version;
+
+    /**
+     * The size of the QuickTime file.
+     * @type {uint64_t}
+     * @public
+     */
+    uint64_t file_size;
+
+    /**
+     * The modification time of the QuickTime file, in seconds since the Epoch.
+     * @type {int64_t}
+     * @public
+     */
+    int64_t modified_time;
+
+    /**
+     * The hash of the sample-table atoms of the QuickTime file.
+     * @type {uint64_t}
+     * @public
+     */
+    uint64_t hash;
+
+    /**
+     * The number of entries following this header.
+     * @type {uint32_t}
+     * @public
+     */
+    uint32_t number_of_samples;
+
+    /**
+     * The maximum picture-order count of the samples.
+     * @type {uint32_t}
+     * @public
+     */
+    uint32_t max_picture_order_count;
+  };
+
+  /**
+   * The inner class that encapsulates an entry of an index, the information
+   * of a sample.
+   * @public
+   */
+  struct Entry {
+    /**
+     * The offset from the beginning of the QuickTime stream.
+     * @type {uint64_t}
+     * @public
+     */
+    uint64_t offset;
+
+    /**
+     * The sample size.
+     * @type {uint32_t}
+     * @public
+     */
+    uint32_t size;
+
+    /**
+     * The picture-order count.
+     * @type {uint32_t}
+     * @public
+     */
+    uint32_t picture_order_count;
+
+    /**
+     * The frame number, i.e. the index in the output order.
+     * @type {uint32_t}
+     * @public
+     */
+    uint32_t frame_number;
+  };
+
+  /**
+   * Initializes this index.
+   * @public
+   */
+  void Initialize();
+
+  /**
+   * Creates an empty index with the specified number of entries. The caller
+   * fills the header and the entries.
+   * @param {uint32_t} number_of_samples
+   * @return {int}
+   * @public
+   */
+  int Create(uint32_t number_of_samples);
+
+  /**
+   * Creates a copy of the specified index.
+   * @param {const hevc::SampleIndex*} index
+   * @return {int}
+   * @public
+   */
+  int Copy(const SampleIndex* index);
+
+  /**
+   * Reads an index from the specified file. This function fails when the
+   * index is not one for the QuickTime file with the specified size and the
+   * specified modification time. (A decoder verifies the hash of the index.)
+   * @param {int} file
+   * @param {uint64_t} file_size
+   * @param {int64_t} modified_time
+   * @return {int}
+   * @public
+   */
+  int Read(int file, uint64_t file_size, int64_t modified_time);
+
+  /**
+   * Writes this index to the specified file.
+   * @param {int} file
+   * @return {int}
+   * @public
+   */
+  int Write(int file) const;
+
+  /**
+   * Deletes the resources owned by this index.
+   * @public
+   */
+  void Destroy();
+
+  /**
+   * Returns the header of this index.
+   * @return {hevc::SampleIndex::Header*}
+   * @public
+   */
+  Header* GetHeader() const {
+    return reinterpret_cast<Header*>(data_);
+  }
+
+  /**
+   * Returns the entries of this index.
+   * @return {hevc::SampleIndex::Entry*}
+   * @public
+   */
+  Entry* GetEntries() const {
+    return reinterpret_cast<Entry*>(data_ + sizeof(Header));
+  }
+
+  /**
+   * Returns the number of entries of this index.
+   * @return {uint32_t}
+   * @public
+   */
+  uint32_t GetNumberOfSamples() const {
+    return data_ ? GetHeader()->number_of_samples : 0;
+  }
+
+  /**
+   * Calculates the hash of the specified bytes, a 64-bit FNV-1a hash. This
+   * function continues the given hash so it can calculate the hash of
+   * multiple blocks.
+   * @param {uint64_t} hash
+   * @param {const void*} data
+   * @param {size_t} size
+   * @return {uint64_t}
+   * @public
+   */
+  static uint64_t Hash(uint64_t hash, const void* data, size_t size);
+
+  /**
+   * The initial value of `Hash()`.
+   * @const {uint64_t}
+   * @public
+   */
+  static const uint64_t HASH_BASIS = 0xcbf29ce484222325ULL;
+
+  /**
+   * The header and the entries of this index.
+   * @type {uint8_t*}
+   * @private
+   */
+  uint8_t* data_;
+
+  /**
+   * The size of the above data.
+   * @type {size_t}
+   * @private
+   */
+  size_t size_;
+};
+
+}  // namespace hevc
+
+#endif  // HEVC_SAMPLE_INDEX_H_
@@ -0,0 +1,200 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "../hevc/session_pool.h"
+
+#if __APPLE__
+#include <pthread.h>
+
+namespace {
+
+/**
+ * The inner class that encapsulates an idle session and its format
+ * description.
+ */
+struct PooledSession {
+  /**
+   * The session.
+   * @type {VTDecompressionSessionRef}
+   */
+  VTDecompressionSessionRef session;
+
+  /**
+   * The format description used for creating the session.
+   * @type {CMFormatDescriptionRef}
+   */
+  CMFormatDescriptionRef format_description;
+
+  /**
+   * The width of the images output by the session. (0 means the frame width.)
+   * @type {int}
+   */
+  int output_width;
+
+  /**
+   * The height of the images output by the session. (0 means the frame
+   * height.)
+   * @type {int}
+   */
+  int output_height;
+};
+
+/**
+ * The mutex that allows only one thread to access the pool.
+ * @type {pthread_mutex_t}
+ */
+pthread_mutex_t g_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * The idle sessions, sorted from the oldest one.
+ * @type {PooledSession[]}
+ */
+PooledSession g_pool[hevc::SessionPool::MAX_SESSIONS];
+
+/**
+ * The number of the idle sessions.
+ * @type {int}
+ */
+int g_pool_count = 0;
+
+/**
+ * Removes the specified session from the pool and returns it. (The caller must
+ * acquire the pool mutex.)
+ * @param {int} index
+ * @return {PooledSession}
+ */
+PooledSession RemoveSession(int index) {
+  const PooledSession pooled = g_pool[index];
+  for (int i = index + 1; i < g_pool_count; ++i) {
+    g_pool[i - 1] = g_pool[i];
+  }
+  --g_pool_count;
+  return pooled;
+}
+
+/**
+ * Invalidates the specified pooled session and deletes it.
+ * @param {PooledSession*} pooled
+ */
+void DestroySession(PooledSession* pooled) {
+  VTDecompressionSessionInvalidate(pooled->session);
+  CFRelease(pooled->session);
+  CFRelease(pooled->format_description);
+}
+
+}  // namespace
+
+namespace hevc {
+
+VTDecompressionSessionRef SessionPool::Acquire(
+    CMFormatDescriptionRef format_description,
+    int output_width,
+    int output_height) {
+  // Prefer the most recent session created with the same format description
+  // and then fall back to a session that can accept the given one, e.g. a
+  // session created for a stream with the same frame size and different
+  // parameter sets.
+  PooledSession pooled = {NULL, NULL, 0, 0};
+  pthread_mutex_lock(&g_pool_mutex);
+  for (int i = g_pool_count - 1; i >= 0; --i) {
+    if (g_pool[i].output_width != output_width ||
+        g_pool[i].output_height != output_height) {
+      continue;
+    }
+    if (CMFormatDescriptionEqual(g_pool[i].format_description,
+                                 format_description)) {
+      pooled = RemoveSession(i);
+      break;
+    }
+  }
+  if (!pooled.session) {
+    for (int i = g_pool_count - 1; i >= 0; --i) {
+      if (g_pool[i].output_width != output_width ||
+          g_pool[i].output_height != output_height) {
+        continue;
+      }
+      if (VTDecompressionSessionCanAcceptFormatDescription(
+              g_pool[i].session, format_description)) {
+        pooled = RemoveSession(i);
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&g_pool_mutex);
+  if (!pooled.session) {
+    return NULL;
+  }
+  CFRelease(pooled.format_description);
+  return pooled.session;
+}
+
+void SessionPool::Release(VTDecompressionSessionRef session,
+                          CMFormatDescriptionRef format_description,
+                          int output_width,
+                          int output_height) {
+  // Evict the oldest session when the pool is full. (This function deletes
+  // the evicted session after releasing the mutex because invalidating a
+  // session may wait for Video Toolbox.)
+  PooledSession evicted = {NULL, NULL, 0, 0};
+  CFRetain(session);
+  CFRetain(format_description);
+  pthread_mutex_lock(&g_pool_mutex);
+  if (g_pool_count >= MAX_SESSIONS) {
+    evicted = RemoveSession(0);
+  }
+  g_pool[g_pool_count].session = session;
+  g_pool[g_pool_count].format_description = format_description;
+  g_pool[g_pool_count].output_width = output_width;
+  g_pool[g_pool_count].output_height = output_height;
+  ++g_pool_count;
+  pthread_mutex_unlock(&g_pool_mutex);
+  if (evicted.session) {
+    DestroySession(&evicted);
+  }
+}
+
+void SessionPool::Clear() {
+  PooledSession sessions[MAX_SESSIONS];
+  pthread_mutex_lock(&g_pool_mutex);
+  const int count = g_pool_count;
+  for (int i = 0; i < count; ++i) {
+    sessions[i] = g_pool[i];
+  }
+  g_pool_count = 0;
+  pthread_mutex_unlock(&g_pool_mutex);
+  for (int i = 0; i < count; ++i) {
+    DestroySession(&sessions[i]);
+  }
+}
+
+int SessionPool::GetCount() {
+  pthread_mutex_lock(&g_pool_mutex);
+  const int count = g_pool_count;
+  pthread_mutex_unlock(&g_pool_mutex);
+  return count;
+}
+
+}  // namespace hevc
+#endif
@@ -0,0 +1,104 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef HEVC_SESSION_POOL_H_
+#define HEVC_SESSION_POOL_H_
+
+#if __APPLE__
+#include <VideoToolbox/VideoToolbox.h>
+#endif
+
+namespace hevc {
+
+#if __APPLE__
+/**
+ * The process-wide pool of idle Video Toolbox decompression sessions. Creating
+ * a `VTDecompressionSession` object takes tens of milliseconds, i.e. a decoder
+ * returns its session to this pool when it finishes decoding a stream and the
+ * next decoder re-uses it. This pool finds a session for a format description
+ * either with the same format description (i.e. the same frame size and the
+ * same `hvcC` parameter sets) or with a session that can accept it. (This pool
+ * returns only a session that outputs images of the requested size.) All
+ * functions of this class are thread-safe.
+ */
+struct SessionPool {
+  /**
+   * The maximum number of idle sessions retained by this pool.
+   * @enum {int}
+   */
+  enum {
+    MAX_SESSIONS = 4,
+  };
+
+  /**
+   * Removes a session that can decode samples with the specified format
+   * description to images of the specified size from this pool. This function
+   * returns NULL when this pool does not have such sessions. (The caller owns
+   * the returned session. 0 means the frame size of the format description.)
+   * @param {CMFormatDescriptionRef} format_description
+   * @param {int} output_width
+   * @param {int} output_height
+   * @return {VTDecompressionSessionRef}
+   * @public
+   */
+  static VTDecompressionSessionRef Acquire(
+      CMFormatDescriptionRef format_description,
+      int output_width,
+      int output_height);
+
+  /**
+   * Adds the specified idle session to this pool. This pool retains the
+   * session and its format description, and it invalidates the oldest session
+   * when it has `MAX_SESSIONS` sessions.
+   * @param {VTDecompressionSessionRef} session
+   * @param {CMFormatDescriptionRef} format_description
+   * @param {int} output_width
+   * @param {int} output_height
+   * @public
+   */
+  static void Release(VTDecompressionSessionRef session,
+                      CMFormatDescriptionRef format_description,
+                      int output_width,
+                      int output_height);
+
+  /**
+   * Invalidates all sessions in this pool, e.g. when the host application
+   * becomes inactive and the host OS may invalidate them.
+   * @public
+   */
+  static void Clear();
+
+  /**
+   * Returns the number of idle sessions in this pool.
+   * @return {int}
+   * @public
+   */
+  static int GetCount();
+};
+#endif
+
+}  // namespace hevc
+
+#endif  // HEVC_SESSION_POOL_H_
@@ -22,5 +22,7 @@
  * SOFTWARE.
  */
 
+#import "../HEVCCompositorView.h"
 #import "../HEVCPlayerView.h"
 #import "../HEVCQuickTimeAsset.h"
+#import "../HEVCThumbnailExtractor.h"
@@ -107,6 +107,7 @@ enum FourCC {
   TYPE_STSC = MOV_FOURCC('s', 't', 's', 'c'),        // Sample-to-chunk
   TYPE_STSZ = MOV_FOURCC('s', 't', 's', 'z'),        // Sample size
   TYPE_STCO = MOV_FOURCC('s', 't', 'c', 'o'),        // Chunk offset
+  TYPE_CO64 = MOV_FOURCC('c', 'o', '6', '4'),        // 64-bit chunk offset
   TYPE_SDTP = MOV_FOURCC('s', 'd', 't', 'p'),        // Sample Dependency Flags
   TYPE_STSH = MOV_FOURCC('s', 't', 's', 'h'),        // Shadow sync
 
@@ -175,8 +176,30 @@ enum FourCC {
  *   +------+----------------------+
  *   |      | type-specific data   |
  *   +------+----------------------+
+ * An atom larger than 4 GB (e.g. the `mdat` atom of a long clip) sets 1 to its
+ * size and stores its 64-bit size after its type, i.e. it starts with the
+ * sixteen-byte header listed below. An atom whose size is 0 extends to the end
+ * of its container.
+ *   +------+----------------------+
+ *   | size | field                |
+ *   +------+----------------------+
+ *   | 4    | size = 1             |
+ *   | 4    | type                 |
+ *   | 8    | extended size        |
+ *   +------+----------------------+
+ *   |      | type-specific data   |
+ *   +------+----------------------+
  */
 struct Atom {
+  /**
+   * The sizes of atom headers.
+   * @enum {uint32_t}
+   */
+  enum {
+    HEADER_SIZE = 8,
+    EXTENDED_HEADER_SIZE = 16,
+  };
+
   /**
    * Returns the start of this atom.
    * @return {uint32_t}
@@ -204,6 +227,28 @@ struct Atom {
     return static_cast<FourCC>(CPU::LoadUINT32(&type_));
   }
 
+  /**
+   * Returns the size of the header of this atom, i.e. the offset to its
+   * type-specific data.
+   * @return {uint32_t}
+   * @public
+   */
+  uint32_t GetHeaderSize() const {
+    return GetSize() == 1 ? EXTENDED_HEADER_SIZE : HEADER_SIZE;
+  }
+
+  /**
+   * Returns the 64-bit size of this atom. This function returns 0 for an atom
+   * extending to the end of its container. (The caller must guarantee that the
+   * extended size is readable when the size of this atom is 1.)
+   * @return {uint64_t}
+   * @public
+   */
+  uint64_t GetExtendedSize() const {
+    const uint32_t size = GetSize();
+    return size == 1 ? CPU::LoadUINT64BE(&GetData()[HEADER_SIZE]) : size;
+  }
+
   /**
    * Returns the next atom.
    * @return {uint8_t*}
@@ -1270,6 +1315,128 @@ struct TimeToSampleAtom {
   Entry entries_[0];
 };
 
+/**
+ * The class that represents a QuickTime Composition Offset atom, a
+ * variable-length QuickTime atom representing the differences between the
+ * presentation timestamps and the decoding timestamps of samples as listed
+ * below. (This class reads the offsets as signed integers regardless of the
+ * version of the atom, as QuickTime does.)
+ *   +------+----------------------+
+ *   | size | field                |
+ *   +------+----------------------+
+ *   | 4    | size                 |
+ *   | 4    | type = 'ctts'        |
+ *   +------+----------------------+
+ *   | 1    | version              |
+ *   | 3    | flags                |
+ *   | 4    | number of entries    |
+ *   +------+----------------------+
+ *   | 8    | composition offset #1|
+ *   +------+----------------------+
+ *    ...
+ *   +------+----------------------+
+ *   | 8    | composition offset #n|
+ *   +------+----------------------+
+ * @extends {mov::Atom}
+ */
+struct CompositionOffsetAtom {
+  /**
+   * The class encapsulating a composition-offset table entry.
+   */
+  struct Entry {
+    /**
+     * Returns the number of consecutive samples.
+     * @return {uint32_t}
+     * @public
+     */
+    uint32_t GetCount() const {
+      return CPU::LoadUINT32BE(&sample_count_);
+    }
+
+    /**
+     * Returns the composition offset of the samples.
+     * @return {int32_t}
+     * @public
+     */
+    int32_t GetOffset() const {
+      return static_cast<int32_t>(CPU::LoadUINT32BE(&sample_offset_));
+    }
+
+    /**
+     * The number of consecutive samples that have the same offset.
+     * @type {uint32_t}
+     * @private
+     */
+    uint32_t sample_count_;
+
+    /**
+     * The composition offset of these samples.
+     * @type {uint32_t}
+     * @private
+     */
+    uint32_t sample_offset_;
+  };
+
+  // mov::Atom methods.
+  const uint8_t* GetData() const { return base_.GetData(); }
+  uint32_t GetSize() const { return base_.GetSize(); }
+  FourCC GetType() const { return base_.GetType(); }
+  const uint8_t* GetNext() const { return base_.GetNext(); }
+
+  /**
+   * Returns the number of entries in the composition-offset table.
+   * @return {uint32_t}
+   * @public
+   */
+  uint32_t GetCount() const {
+    return CPU::LoadUINT32BE(&number_of_entries_);
+  }
+
+  /**
+   * Returns the `index`-th entry of the composition-offset table.
+   * @return {const mov::CompositionOffsetAtom::Entry*}
+   * @public
+   */
+  const Entry* GetEntry(int index) const {
+    return &entries_[index];
+  }
+
+  /**
+   * The base object.
+   * @type {mov::Atom}
+   * @private
+   */
+  Atom base_;
+
+  /**
+   * The version of this composition-offset atom.
+   * @type {uint8_t}
+   * @private
+   */
+  uint8_t version_;
+
+  /**
+   * Reserved. (This field must be zero.)
+   * @type {uint8_t[3]}
+   * @private
+   */
+  uint8_t flags_[3];
+
+  /**
+   * The number of entries in the composition-offset table.
+   * @type {uint32_t}
+   * @private
+   */
+  uint32_t number_of_entries_;
+
+  /**
+   * The composition-offset table.
+   * @type {mov::CompositionOffsetAtom::Entry[]}
+   * @private
+   */
+  Entry entries_[0];
+};
+
 /**
  * The class that represents a QuickTime Sync Sample atom, a variable-length
  * QuickTime atom representing an array of key frames as listed below.
@@ -1678,6 +1845,90 @@ struct ChunkOffsetAtom {
   uint32_t chunk_offsets_[0];
 };
 
+/**
+ * The class that represents a QuickTime 64-bit chunk-offset atom, a
+ * variable-length QuickTime atom representing an array of 64-bit chunk offsets
+ * as listed below. (A QuickTime file larger than 4 GB uses this atom instead of
+ * the `stco` atom.)
+ *   +------+----------------------+
+ *   | size | field                |
+ *   +------+----------------------+
+ *   | 4    | size                 |
+ *   | 4    | type = 'co64'        |
+ *   +------+----------------------+
+ *   | 1    | version              |
+ *   | 3    | flags                |
+ *   | 4    | number of entries    |
+ *   +------+----------------------+
+ *   | 8    | chunk offset #1      |
+ *   +------+----------------------+
+ *    ...
+ *   +------+----------------------+
+ *   | 8    | chunk offset #n      |
+ *   +------+----------------------+
+ * @extends {mov::Atom}
+ */
+struct ChunkOffset64Atom {
+  // mov::Atom methods.
+  const uint8_t* GetData() const { return base_.GetData(); }
+  uint32_t GetSize() const { return base_.GetSize(); }
+  FourCC GetType() const { return base_.GetType(); }
+  const uint8_t* GetNext() const { return base_.GetNext(); }
+
+  /**
+   * Returns the number of chunk offsets in the chunk-offset table.
+   * @return {uint32_t}
+   * @public
+   */
+  uint32_t GetCount() const {
+    return CPU::LoadUINT32BE(&number_of_entries_);
+  }
+
+  /**
+   * Returns the `index`-th offset of the chunk-offset table.
+   * @return {uint64_t}
+   * @public
+   */
+  uint64_t GetOffset(int index) const {
+    return CPU::LoadUINT64BE(&chunk_offsets_[index]);
+  }
+
+  /**
+   * The base object.
+   * @type {mov::Atom}
+   * @private
+   */
+  Atom base_;
+
+  /**
+   * The version of this atom.
+   * @type {uint8_t}
+   * @private
+   */
+  uint8_t version_;
+
+  /**
+   * Reserved. (This field must be zero.)
+   * @type {uint8_t[3]}
+   * @private
+   */
+  uint8_t flags_[3];
+
+  /**
+   * The number of entries in the chunk-offset table.
+   * @type {uint32_t}
+   * @private
+   */
+  uint32_t number_of_entries_;
+
+  /**
+   * The chunk-offset table.
+   * @type {uint64_t[]}
+   * @private
+   */
+  uint64_t chunk_offsets_[0];
+};
+
 #pragma pack(pop)
 
 }  // namespace mov
@@ -37,10 +37,12 @@ void AtomCollection::Initialize() {
 int AtomCollection::Enumerate(const uint8_t* __restrict data, size_t size) {
   enum {
     REQUIRED_ATOMS = (1 << ID_FTYP) | (1 << ID_MDAT) | (1 << ID_STSD) |
-        (1 << ID_STSC) | (1 << ID_STSZ) | (1 << ID_STCO),
+        (1 << ID_STSC) | (1 << ID_STSZ),
+    CHUNK_OFFSET_ATOMS = (1 << ID_STCO) | (1 << ID_CO64),
   };
   mask_ = EnumerateChildAtoms(data, 0, size);
-  return (mask_ & (REQUIRED_ATOMS | (1 << ID_ERROR))) == REQUIRED_ATOMS;
+  return (mask_ & (REQUIRED_ATOMS | (1 << ID_ERROR))) == REQUIRED_ATOMS &&
+      (mask_ & CHUNK_OFFSET_ATOMS);
 }
 
 uint32_t AtomCollection::EnumerateChildAtoms(
@@ -50,12 +52,23 @@ uint32_t AtomCollection::EnumerateChildAtoms(
   uint32_t atom_mask = 0;
   const uint8_t* start = &data[offset];
   const uint8_t* end = &data[size];
-  while (start < end) {
+  while (start + sizeof(mov::Atom) <= end) {
+    // Read the 64-bit size of an atom larger than 4 GB and substitute the rest
+    // of the container for the size of an atom extending to its end. (An atom
+    // smaller than its header is a broken one, which would stop this loop.)
     const mov::Atom* atom = reinterpret_cast<const mov::Atom*>(start);
-    const uint32_t atom_size = atom->GetSize();
-    if (start + atom_size > end) {
+    const size_t available = static_cast<size_t>(end - start);
+    const uint32_t header_size = atom->GetHeaderSize();
+    if (header_size > available) {
       return 1 << ID_ERROR;
     }
+    const uint64_t extended_size = atom->GetExtendedSize();
+    if ((extended_size && extended_size < header_size) ||
+        extended_size > available) {
+      return 1 << ID_ERROR;
+    }
+    const size_t atom_size = extended_size ?
+        static_cast<size_t>(extended_size) : available;
     const mov::FourCC atom_type = atom->GetType();
     switch (atom_type) {
     case mov::TYPE_FTYP:
@@ -71,7 +84,7 @@ uint32_t AtomCollection::EnumerateChildAtoms(
     case mov::TYPE_MDIA:
     case mov::TYPE_MINF:
     case mov::TYPE_STBL:
-      atom_mask |= EnumerateChildAtoms(start, 8, atom_size);
+      atom_mask |= EnumerateChildAtoms(start, header_size, atom_size);
       break;
     case mov::TYPE_MDHD:
       if (!atoms_[ID_MDHD]) {
@@ -91,6 +104,21 @@ uint32_t AtomCollection::EnumerateChildAtoms(
         atom_mask |= 1 << ID_STTS;
       }
       break;
+    case mov::TYPE_CTTS:
+      // Verify that a `ctts` atom contains all its entries because the decoder
+      // reads them without knowing the size of the atom. (A `ctts` atom with
+      // a 64-bit size does not have its entries at the offsets of this class.)
+      if (!atoms_[ID_CTTS]) {
+        const mov::CompositionOffsetAtom* composition_offset_atom =
+            reinterpret_cast<const mov::CompositionOffsetAtom*>(atom);
+        if (header_size != mov::Atom::HEADER_SIZE || atom_size < 16 ||
+            composition_offset_atom->GetCount() > (atom_size - 16) / 8) {
+          return 1 << ID_ERROR;
+        }
+        atoms_[ID_CTTS] = atom;
+        atom_mask |= 1 << ID_CTTS;
+      }
+      break;
     case mov::TYPE_STSS:
       if (!atoms_[ID_STSS]) {
         atoms_[ID_STSS] = atom;
@@ -110,11 +138,19 @@ uint32_t AtomCollection::EnumerateChildAtoms(
       }
       break;
     case mov::TYPE_STCO:
-      if (!atoms_[ID_STCO]) {
+      // Use only the chunk-offset atom of the first track, which may be either
+      // a `stco` atom or a `co64` atom.
+      if (!atoms_[ID_STCO] && !atoms_[ID_CO64]) {
         atoms_[ID_STCO] = atom;
         atom_mask |= 1 << ID_STCO;
       }
       break;
+    case mov::TYPE_CO64:
+      if (!atoms_[ID_STCO] && !atoms_[ID_CO64]) {
+        atoms_[ID_CO64] = atom;
+        atom_mask |= 1 << ID_CO64;
+      }
+      break;
     default:
       break;
     }
@@ -38,10 +38,12 @@ struct SampleDescription;
 struct VideoSampleDescription;
 struct VideoSampleDescriptionExtension;
 struct TimeToSampleAtom;
+struct CompositionOffsetAtom;
 struct SyncSampleAtom;
 struct SampleToChunkAtom;
 struct SampleSizeAtom;
 struct ChunkOffsetAtom;
+struct ChunkOffset64Atom;
 
 /**
  * The class implementing a mapping table from an atom ID to an atom object.
@@ -69,7 +71,7 @@ struct AtomCollection {
     // ID_STBL,
     ID_STSD,
     ID_STTS,
-    // ID_CTTS,
+    ID_CTTS,
     // ID_CSLG,
     // ID_STSS,
     // ID_STPS,
@@ -82,6 +84,7 @@ struct AtomCollection {
     ID_STSC,
     ID_STSZ,
     ID_STCO,
+    ID_CO64,
     // ID_UDTA,
     ID_ERROR,
   };
@@ -150,6 +153,18 @@ struct AtomCollection {
     return GetAtom<mov::TimeToSampleAtom>(ID_STTS);
   }
 
+  /**
+   * Retrieves the composition-offset atom found by this enumerator. (This
+   * function returns NULL when the stream presents its samples in the decoding
+   * order, i.e. when it does not have a `ctts` atom. This enumerator fails
+   * when the `ctts` atom is too small for its entries.)
+   * @return {const mov::CompositionOffsetAtom*}
+   * @public
+   */
+  const mov::CompositionOffsetAtom* GetCompositionOffsetAtom() const {
+    return GetAtom<mov::CompositionOffsetAtom>(ID_CTTS);
+  }
+
   /**
    * Retrieves the sync-sample atom found by this enumerator.
    * @return {const mov::SyncSampleAtom*}
@@ -186,6 +201,16 @@ struct AtomCollection {
     return GetAtom<mov::ChunkOffsetAtom>(ID_STCO);
   }
 
+  /**
+   * Retrieves the 64-bit chunk-offset atom found by this enumerator. (A stream
+   * has either a `stco` atom or a `co64` atom.)
+   * @return {const mov::ChunkOffset64Atom*}
+   * @public
+   */
+  const mov::ChunkOffset64Atom* GetChunkOffset64Atom() const {
+    return GetAtom<mov::ChunkOffset64Atom>(ID_CO64);
+  }
+
   /**
    * Retrieves the media-data atom found by this enumerator.
    * @return {const mov::Atom*}
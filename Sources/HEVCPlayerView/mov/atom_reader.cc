@@ -0,0 +1,170 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "../mov/atom_reader.h"
+
+#include <stdlib.h>
+#include <memory.h>
+#include <sys/stat.h>
+#include "../mov/atom.h"
+#include "../mov/stream.h"
+
+namespace {
+
+/**
+ * The minimum sizes of the atoms read by `mov::AtomReader`, i.e. the sizes of
+ * their fixed fields including their 8-byte headers, indexed by their IDs.
+ * @const {uint32_t[]}
+ */
+const uint32_t MIN_ATOM_SIZES[mov::AtomReader::ID_MAX] = {
+  32,  // ID_MDHD
+  16,  // ID_STSD
+  16,  // ID_STTS
+};
+
+}  // namespace
+
+namespace mov {
+
+void AtomReader::Initialize() {
+  memset(&atoms_[0], 0, sizeof(atoms_));
+}
+
+int AtomReader::Read(int file) {
+  struct stat file_stat;
+  if (fstat(file, &file_stat) || file_stat.st_size <= 0) {
+    return 0;
+  }
+  if (!ReadChildAtoms(file, 0, static_cast<uint64_t>(file_stat.st_size))) {
+    return 0;
+  }
+  return atoms_[ID_STSD] != NULL;
+}
+
+void AtomReader::Destroy() {
+  for (int i = 0; i < ID_MAX; ++i) {
+    if (atoms_[i]) {
+      free(atoms_[i]);
+      atoms_[i] = NULL;
+    }
+  }
+}
+
+int AtomReader::ReadChildAtoms(int file, uint64_t offset, uint64_t end) {
+  // Read only the header of each atom and descend into the atoms on the path
+  // to the sample table, i.e. `moov/trak/mdia/minf/stbl`. (This function skips
+  // the other atoms, including `mdat` atoms, without reading them.)
+  // (This function reads the 64-bit size of an atom larger than 4 GB and
+  // substitutes the rest of the container for the size of an atom extending to
+  // its end.)
+  while (offset + sizeof(mov::Atom) <= end) {
+    uint8_t header_data[mov::Atom::EXTENDED_HEADER_SIZE];
+    const mov::Atom* header = reinterpret_cast<mov::Atom*>(&header_data[0]);
+    if (!mov::Stream::ReadFile(file, &header_data[0], sizeof(mov::Atom), offset)) {
+      return 0;
+    }
+    const uint32_t header_size = header->GetHeaderSize();
+    if (header_size > end - offset) {
+      return 0;
+    }
+    if (header_size > sizeof(mov::Atom) &&
+        !mov::Stream::ReadFile(file, &header_data[sizeof(mov::Atom)],
+                  header_size - sizeof(mov::Atom),
+                  offset + sizeof(mov::Atom))) {
+      return 0;
+    }
+    const uint64_t extended_size = header->GetExtendedSize();
+    const uint64_t atom_size = extended_size ? extended_size : end - offset;
+    if (atom_size < header_size || atom_size > end - offset) {
+      return 0;
+    }
+    switch (header->GetType()) {
+    case mov::TYPE_MOOV:
+    case mov::TYPE_TRAK:
+    case mov::TYPE_MDIA:
+    case mov::TYPE_MINF:
+    case mov::TYPE_STBL:
+      if (!ReadChildAtoms(file, offset + header_size, offset + atom_size)) {
+        return 0;
+      }
+      break;
+    case mov::TYPE_MDHD:
+      if (!ReadAtom(file, ID_MDHD, offset, atom_size)) {
+        return 0;
+      }
+      break;
+    case mov::TYPE_STSD:
+      if (!ReadAtom(file, ID_STSD, offset, atom_size)) {
+        return 0;
+      }
+      break;
+    case mov::TYPE_STTS:
+      if (!ReadAtom(file, ID_STTS, offset, atom_size)) {
+        return 0;
+      }
+      break;
+    default:
+      break;
+    }
+    offset += atom_size;
+  }
+  return 1;
+}
+
+int AtomReader::ReadAtom(int file, int id, uint64_t offset, uint64_t size) {
+  if (atoms_[id]) {
+    return 1;
+  }
+  if (size > 0xffffffffu || size < MIN_ATOM_SIZES[id]) {
+    return 0;
+  }
+  uint8_t* atom = static_cast<uint8_t*>(malloc(size + __BIGGEST_ALIGNMENT__));
+  if (!atom) {
+    return 0;
+  }
+  if (!mov::Stream::ReadFile(file, atom, size, offset)) {
+    free(atom);
+    return 0;
+  }
+  memset(&atom[size], 0, __BIGGEST_ALIGNMENT__);
+
+  // Verify the atom so its readers can read its fields and its entries without
+  // knowing its size. (The fields of an atom with a 64-bit size are not at the
+  // offsets of its class.)
+  int valid = reinterpret_cast<const mov::Atom*>(atom)->GetHeaderSize() ==
+      mov::Atom::HEADER_SIZE;
+  if (valid && id == ID_STTS) {
+    const uint64_t number_of_entries =
+        reinterpret_cast<const mov::TimeToSampleAtom*>(atom)->GetCount();
+    valid = number_of_entries * 8 + 16 <= size;
+  }
+  if (!valid) {
+    free(atom);
+    return 0;
+  }
+  atoms_[id] = atom;
+  return 1;
+}
+
+}  // namespace mov
@@ -0,0 +1,151 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef MOV_ATOM_READER_H_
+#define MOV_ATOM_READER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace mov {
+
+struct Atom;
+struct MediaHeaderAtom;
+struct SampleDescriptionAtom;
+struct TimeToSampleAtom;
+
+/**
+ * The class that reads the header atoms of a QuickTime file without reading
+ * the whole file. This class reads the headers of atoms with `pread()`, skips
+ * atoms not used for describing the QuickTime stream (e.g. `mdat` atoms and
+ * `stco` atoms) without reading them, and reads only the atoms required for
+ * describing the stream (i.e. `mdhd` atoms, `stsd` atoms, and `stts` atoms).
+ */
+struct AtomReader {
+  /**
+   * Atom IDs.
+   * @enum
+   */
+  enum AtomID {
+    ID_MDHD = 0,
+    ID_STSD,
+    ID_STTS,
+    ID_MAX,
+  };
+
+  /**
+   * Initializes this reader.
+   * @public
+   */
+  void Initialize();
+
+  /**
+   * Reads the header atoms of the specified QuickTime file.
+   * @param {int} file
+   * @return {int}
+   * @public
+   */
+  int Read(int file);
+
+  /**
+   * Deletes the atoms read by this reader.
+   * @public
+   */
+  void Destroy();
+
+  /**
+   * Retrieves the media-header atom read by this reader.
+   * @return {const mov::MediaHeaderAtom*}
+   * @public
+   */
+  const mov::MediaHeaderAtom* GetMediaHeaderAtom() const {
+    return GetAtom<mov::MediaHeaderAtom>(ID_MDHD);
+  }
+
+  /**
+   * Retrieves the sample-description atom read by this reader.
+   * @return {const mov::SampleDescriptionAtom*}
+   * @public
+   */
+  const mov::SampleDescriptionAtom* GetSampleDescriptionAtom() const {
+    return GetAtom<mov::SampleDescriptionAtom>(ID_STSD);
+  }
+
+  /**
+   * Retrieves the time-to-sample atom read by this reader.
+   * @return {const mov::TimeToSampleAtom*}
+   * @public
+   */
+  const mov::TimeToSampleAtom* GetTimeToSampleAtom() const {
+    return GetAtom<mov::TimeToSampleAtom>(ID_STTS);
+  }
+
+  /**
+   * Reads the child atoms in the specified range of a QuickTime file.
+   * @param {int} file
+   * @param {uint64_t} offset
+   * @param {uint64_t} end
+   * @return {int}
+   * @private
+   */
+  int ReadChildAtoms(int file, uint64_t offset, uint64_t end);
+
+  /**
+   * Reads the specified atom of a QuickTime file unless this reader has read
+   * another atom with the same ID. This function fails for an atom smaller than
+   * its fixed fields and for an `stts` atom too small for its entries. (It also
+   * fails for an atom larger than 4 GB, which is not a valid sample-table
+   * atom.)
+   * @param {int} file
+   * @param {int} id
+   * @param {uint64_t} offset
+   * @param {uint64_t} size
+   * @return {int}
+   * @private
+   */
+  int ReadAtom(int file, int id, uint64_t offset, uint64_t size);
+
+  /**
+   * Returns the specified atom.
+   * @param {int} id
+   * @return {const T*}
+   * @private
+   */
+  template <typename T>
+  const T* GetAtom(int id) const {
+    return reinterpret_cast<const T*>(atoms_[id]);
+  }
+
+  /**
+   * The atoms read by this reader. Each atom is followed by a zero-filled
+   * padding of `__BIGGEST_ALIGNMENT__` bytes.
+   * @type {uint8_t*[]}
+   * @private
+   */
+  uint8_t* atoms_[ID_MAX];
+};
+
+}  // namespace mov
+
+#endif  // MOV_ATOM_READER_H_
@@ -0,0 +1,384 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "../mov/stream.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../base/intrin.h"
+#include "../mov/atom.h"
+
+namespace mov {
+
+void Stream::Initialize() {
+  data_ = NULL;
+  size_ = 0;
+  mapped_size_ = 0;
+  resident_ = NULL;
+  pins_ = NULL;
+  references_ = NULL;
+  number_of_chunks_ = 0;
+  next_chunk_ = 0;
+  file_ = -1;
+}
+
+int Stream::Open(int file, int windowed) {
+  struct stat file_stat;
+  if (fstat(file, &file_stat) || file_stat.st_size <= 0) {
+    return 0;
+  }
+  const size_t size = static_cast<size_t>(file_stat.st_size);
+
+  // Reserve an anonymous region for the whole file. (The host OS does not
+  // allocate physical pages for this region, and this stream maps the chunks
+  // of the file over it.) Then create bit-masks representing the chunks read
+  // into the region and the chunks being read, the pin counts of a windowed
+  // stream, and a duplicate of the file so this stream can read the chunks
+  // after the caller closes the file.
+  if (!Reserve(size)) {
+    return 0;
+  }
+  number_of_chunks_ = (size + CHUNK_SIZE - 1) >> CHUNK_SHIFT;
+  const size_t number_of_words = (number_of_chunks_ + 31) >> 5;
+  resident_ = static_cast<uint32_t*>(
+      calloc(number_of_words * 2 + (windowed ? number_of_chunks_ : 0),
+             sizeof(uint32_t)));
+  if (!resident_) {
+    Destroy();
+    return 0;
+  }
+  if (windowed) {
+    pins_ = &resident_[number_of_words * 2];
+  }
+  file_ = dup(file);
+  if (file_ < 0) {
+    Destroy();
+    return 0;
+  }
+
+  // Read the headers of the top-level atoms and read all atoms except `mdat`
+  // atoms so a `mov::AtomCollection` object can enumerate the atoms in the
+  // `moov` atom wherever it is. (This function reads only the header of an
+  // `mdat` atom, which is enough for enumerating top-level atoms. A windowed
+  // stream pins them until it is destroyed.)
+  size_t offset = 0;
+  while (offset + sizeof(mov::Atom) <= size) {
+    if (!Pin(offset, sizeof(mov::Atom))) {
+      Destroy();
+      return 0;
+    }
+    const mov::Atom* atom = reinterpret_cast<const mov::Atom*>(&data_[offset]);
+    const size_t header_size = atom->GetHeaderSize();
+    if (header_size > size - offset ||
+        (header_size > sizeof(mov::Atom) && !Pin(offset, header_size))) {
+      Destroy();
+      return 0;
+    }
+    const uint64_t extended_size = atom->GetExtendedSize();
+    const size_t atom_size = extended_size ?
+        static_cast<size_t>(extended_size) : size - offset;
+    if (atom_size < header_size || atom_size > size - offset) {
+      Destroy();
+      return 0;
+    }
+    if (atom->GetType() != mov::TYPE_MDAT) {
+      if (!Pin(offset, atom_size)) {
+        Destroy();
+        return 0;
+      }
+    }
+    offset += atom_size;
+  }
+  return 1;
+}
+
+int Stream::Load(size_t offset, size_t size) {
+  if (!resident_) {
+    return IsResident(offset, size);
+  }
+  if (offset > size_ || size > size_ - offset) {
+    return 0;
+  }
+  if (size == 0) {
+    return 1;
+  }
+  const size_t last_chunk = (offset + size - 1) >> CHUNK_SHIFT;
+  for (size_t chunk = offset >> CHUNK_SHIFT; chunk <= last_chunk; ++chunk) {
+    if (!IsChunkResident(chunk) && !LoadChunk(chunk)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int Stream::LoadNext() {
+  if (!resident_) {
+    return 0;
+  }
+  while (next_chunk_ < number_of_chunks_ && IsChunkResident(next_chunk_)) {
+    ++next_chunk_;
+  }
+  if (next_chunk_ >= number_of_chunks_) {
+    return 0;
+  }
+  return LoadChunk(next_chunk_++) ? 1 : -1;
+}
+
+int Stream::Pin(size_t offset, size_t size) {
+  if (!pins_) {
+    return Load(offset, size);
+  }
+  if (offset > size_ || size > size_ - offset) {
+    return 0;
+  }
+  if (size == 0) {
+    return 1;
+  }
+  // Pin the chunks before reading them. A stream evicting a chunk claims it as
+  // a stream reading it does and evicts it only when it has no pins, i.e. this
+  // function waits for the claim of a chunk to be released after pinning it so
+  // it never reads a chunk being evicted as a resident one. (The sequentially
+  // consistent operations guarantee that either this function sees the claim
+  // or the evicting stream sees the pin.)
+  const size_t first_chunk = offset >> CHUNK_SHIFT;
+  const size_t last_chunk = (offset + size - 1) >> CHUNK_SHIFT;
+  const size_t number_of_words = (number_of_chunks_ + 31) >> 5;
+  for (size_t chunk = first_chunk; chunk <= last_chunk; ++chunk) {
+    __atomic_fetch_add(&pins_[chunk], 1, __ATOMIC_SEQ_CST);
+  }
+  for (size_t chunk = first_chunk; chunk <= last_chunk; ++chunk) {
+    const uint32_t bit = 1u << (chunk & 31);
+    const uint32_t* loading = &resident_[number_of_words + (chunk >> 5)];
+    while (__atomic_load_n(loading, __ATOMIC_SEQ_CST) & bit) {
+      sched_yield();
+    }
+    if (!IsChunkResident(chunk) && !LoadChunk(chunk)) {
+      Unpin(offset, size);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+void Stream::Unpin(size_t offset, size_t size) {
+  if (!pins_ || offset > size_ || size > size_ - offset || size == 0) {
+    return;
+  }
+  const size_t last_chunk = (offset + size - 1) >> CHUNK_SHIFT;
+  for (size_t chunk = offset >> CHUNK_SHIFT; chunk <= last_chunk; ++chunk) {
+    if (__atomic_sub_fetch(&pins_[chunk], 1, __ATOMIC_SEQ_CST) == 0) {
+      EvictChunk(chunk);
+    }
+  }
+}
+
+int Stream::IsResident(size_t offset, size_t size) const {
+  if (offset > size_ || size > size_ - offset) {
+    return 0;
+  }
+  if (!resident_ || size == 0) {
+    return 1;
+  }
+  const size_t last_chunk = (offset + size - 1) >> CHUNK_SHIFT;
+  for (size_t chunk = offset >> CHUNK_SHIFT; chunk <= last_chunk; ++chunk) {
+    if (!IsChunkResident(chunk)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int Stream::ReadFile(int file, void* data, size_t size, uint64_t offset) {
+  uint8_t* top = static_cast<uint8_t*>(data);
+  while (size > 0) {
+    const ssize_t read_size =
+        pread(file, top, size, static_cast<off_t>(offset));
+    if (read_size <= 0) {
+      if (read_size < 0 && errno == EINTR) {
+        continue;
+      }
+      return 0;
+    }
+    top += read_size;
+    size -= static_cast<size_t>(read_size);
+    offset += static_cast<uint64_t>(read_size);
+  }
+  return 1;
+}
+
+int Stream::Copy(const void* data, size_t size) {
+  uint8_t* copy = static_cast<uint8_t*>(malloc(size + __BIGGEST_ALIGNMENT__));
+  if (!copy) {
+    return 0;
+  }
+  memcpy(copy, data, size);
+  memset(&copy[size], 0, __BIGGEST_ALIGNMENT__);
+
+  data_ = copy;
+  size_ = size;
+  mapped_size_ = 0;
+  return 1;
+}
+
+int Stream::Share(Stream* stream) {
+  if (!data_) {
+    return 0;
+  }
+  if (!references_) {
+    references_ = static_cast<uint32_t*>(malloc(sizeof(uint32_t)));
+    if (!references_) {
+      return 0;
+    }
+    *references_ = 1;
+  }
+  __atomic_fetch_add(references_, 1, __ATOMIC_RELAXED);
+  *stream = *this;
+  stream->next_chunk_ = 0;
+  return 1;
+}
+
+void Stream::Destroy() {
+  // Release a reference to the stream data. (The acquire-release operation
+  // guarantees that the last stream observes all writes of the other ones.)
+  if (references_) {
+    if (__atomic_sub_fetch(references_, 1, __ATOMIC_ACQ_REL) > 0) {
+      Initialize();
+      return;
+    }
+    free(references_);
+  }
+  if (resident_) {
+    free(resident_);
+    if (file_ >= 0) {
+      close(file_);
+    }
+  }
+  if (data_) {
+    if (mapped_size_) {
+      munmap(data_, mapped_size_);
+    } else {
+      free(data_);
+    }
+  }
+  Initialize();
+}
+
+int Stream::LoadChunk(size_t chunk) {
+  // Claim the specified chunk so only one of the streams sharing the data reads
+  // it, and wait for the stream reading (or evicting) the chunk when another
+  // one has claimed it. (The stream releases its claim when it finishes reading
+  // the chunk, i.e. a claim represents an operation in progress.)
+  const uint32_t bit = 1u << (chunk & 31);
+  const size_t number_of_words = (number_of_chunks_ + 31) >> 5;
+  uint32_t* loading = &resident_[number_of_words + (chunk >> 5)];
+  while (__atomic_fetch_or(loading, bit, __ATOMIC_ACQUIRE) & bit) {
+    sched_yield();
+  }
+  if (IsChunkResident(chunk)) {
+    __atomic_fetch_and(loading, ~bit, __ATOMIC_RELEASE);
+    return 1;
+  }
+
+  // Map the specified chunk of the file over the reserved region and touch its
+  // pages so the host OS reads them on this thread, and mark the chunk as
+  // resident. (The pages after the end of the file stay anonymous, i.e. the
+  // padding is readable and is filled with zeros. The release store guarantees
+  // that a thread observing the bit also observes the chunk data.) This
+  // function maps the chunk as a private copy-on-write mapping so the file is
+  // not modified even if Video Toolbox writes the sample data, and it reads
+  // the chunk into the anonymous pages only when the host OS cannot map the
+  // file.
+  const size_t chunk_offset = chunk << CHUNK_SHIFT;
+  const size_t chunk_end = chunk_offset + CHUNK_SIZE < size_ ?
+      chunk_offset + CHUNK_SIZE : size_;
+  size_t offset = chunk_offset;
+  if (mmap(&data_[chunk_offset], chunk_end - chunk_offset,
+           PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, file_,
+           static_cast<off_t>(chunk_offset)) != MAP_FAILED) {
+    const size_t page_size = static_cast<size_t>(getpagesize());
+    const volatile uint8_t* data = data_;
+    for (; offset < chunk_end; offset += page_size) {
+      data[offset];
+    }
+  }
+  if (offset < chunk_end &&
+      !ReadFile(file_, &data_[offset], chunk_end - offset, offset)) {
+    __atomic_fetch_and(loading, ~bit, __ATOMIC_RELEASE);
+    return 0;
+  }
+  __atomic_fetch_or(&resident_[chunk >> 5], 1u << (chunk & 31),
+                    __ATOMIC_RELEASE);
+  __atomic_fetch_and(loading, ~bit, __ATOMIC_RELEASE);
+  return 1;
+}
+
+void Stream::EvictChunk(size_t chunk) {
+  // Claim the specified chunk and evict it only when no readers have pinned it
+  // since they unpinned it. (This function leaves the chunk resident when
+  // another stream has claimed it, i.e. when the stream is reading it for a
+  // reader pinning it.) This function replaces the pages of the chunk with new
+  // anonymous ones, which releases their memory immediately and fills them
+  // with zeros as `Reserve()` does.
+  const uint32_t bit = 1u << (chunk & 31);
+  const size_t number_of_words = (number_of_chunks_ + 31) >> 5;
+  uint32_t* loading = &resident_[number_of_words + (chunk >> 5)];
+  if (__atomic_fetch_or(loading, bit, __ATOMIC_SEQ_CST) & bit) {
+    return;
+  }
+  if (__atomic_load_n(&pins_[chunk], __ATOMIC_SEQ_CST) == 0 &&
+      IsChunkResident(chunk)) {
+    // Keep the chunk resident when the host OS fails replacing its pages.
+    __atomic_fetch_and(&resident_[chunk >> 5], ~bit, __ATOMIC_RELAXED);
+    const size_t chunk_offset = chunk << CHUNK_SHIFT;
+    const size_t chunk_size = chunk_offset + CHUNK_SIZE < mapped_size_ ?
+        static_cast<size_t>(CHUNK_SIZE) : mapped_size_ - chunk_offset;
+    if (mmap(&data_[chunk_offset], chunk_size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANON | MAP_FIXED, -1, 0) == MAP_FAILED) {
+      __atomic_fetch_or(&resident_[chunk >> 5], bit, __ATOMIC_RELEASE);
+    }
+  }
+  __atomic_fetch_and(loading, ~bit, __ATOMIC_RELEASE);
+}
+
+void* Stream::Reserve(size_t size) {
+  const size_t page_size = static_cast<size_t>(getpagesize());
+  const size_t mapped_size =
+      (size + __BIGGEST_ALIGNMENT__ + page_size - 1) & ~(page_size - 1);
+  void* region = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANON, -1, 0);
+  if (region == MAP_FAILED) {
+    return NULL;
+  }
+  data_ = static_cast<uint8_t*>(region);
+  size_ = size;
+  mapped_size_ = mapped_size;
+  return region;
+}
+
+}  // namespace mov
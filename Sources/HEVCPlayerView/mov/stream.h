@@ -0,0 +1,343 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 DeNA Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef MOV_STREAM_H_
+#define MOV_STREAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace mov {
+
+/**
+ * The class that encapsulates the bytes of a QuickTime stream. This class
+ * either reads a QuickTime file progressively or owns a copy of a QuickTime
+ * stream. A progressive stream maps the chunks it reads from the file, i.e.
+ * the page cache of the host OS is the only copy of the stream data (and the
+ * host OS can discard its clean pages under memory pressure). In all cases,
+ * the stream data is followed by a zero-filled padding of at least
+ * `__BIGGEST_ALIGNMENT__` bytes so its readers can safely read 16 (32) bytes
+ * from anywhere in it. Streams can share their data with `Share()`, in which
+ * case the last one deletes the data and any of them can read the chunks of a
+ * progressive stream on any thread.
+ * A windowed stream is a progressive stream whose chunks are resident only
+ * while its readers pin them, i.e. its readers pin the bytes they read with
+ * `Pin()` and the stream releases the memory of a chunk when the last of them
+ * unpins it with `Unpin()`. (The region reserved for a windowed stream is
+ * address space, and its memory usage depends on the bytes pinned by its
+ * readers rather than the size of the file.)
+ */
+struct Stream {
+  /**
+   * The size of the chunks read by a progressive stream.
+   * @enum {size_t}
+   */
+  enum {
+    CHUNK_SHIFT = 18,
+    CHUNK_SIZE = 1 << CHUNK_SHIFT,
+  };
+
+  /**
+   * Initializes an empty stream.
+   * @public
+   */
+  void Initialize();
+
+  /**
+   * Opens the specified QuickTime file as a progressive stream. This function
+   * reserves address space for the whole file and reads only its atoms except
+   * the `mdat` atom, i.e. the `moov` atom is available when this function
+   * returns regardless of whether it is before or after the `mdat` atom. Its
+   * readers read the rest of the file in `CHUNK_SIZE`-byte chunks with `Load()`
+   * or `LoadNext()`. (This function creates a duplicate of the given file and the
+   * caller can close it after this function returns.)
+   * @param {int} file
+   * @return {int}
+   * @public
+   */
+  int Open(int file) {
+    return Open(file, 0);
+  }
+
+  /**
+   * Opens the specified QuickTime file as a progressive stream or a windowed
+   * one. A windowed stream pins the atoms read by this function so they stay
+   * resident while it is open.
+   * @param {int} file
+   * @param {int} windowed
+   * @return {int}
+   * @public
+   */
+  int Open(int file, int windowed);
+
+  /**
+   * Reads the chunks of a progressive stream overlapping the specified range
+   * if they have not been read yet.
+   * @param {size_t} offset
+   * @param {size_t} size
+   * @return {int}
+   * @public
+   */
+  int Load(size_t offset, size_t size);
+
+  /**
+   * Reads the first chunk of a progressive stream that has not been read yet.
+   * This function returns 1 when it reads a chunk, 0 when all chunks have been
+   * read, and -1 when it fails reading a chunk.
+   * @return {int}
+   * @public
+   */
+  int LoadNext();
+
+  /**
+   * Returns whether or not the specified range of this stream has been read.
+   * (This function always returns 1 for a stream that is not progressive
+   * unless the range is out of the stream.)
+   * @param {size_t} offset
+   * @param {size_t} size
+   * @return {int}
+   * @public
+   */
+  int IsResident(size_t offset, size_t size) const;
+
+  /**
+   * Reads the chunks overlapping the specified range and pins them so they stay
+   * resident until the caller unpins them with `Unpin()`. (This function is
+   * equivalent to `Load()` for a stream that is not windowed.)
+   * @param {size_t} offset
+   * @param {size_t} size
+   * @return {int}
+   * @public
+   */
+  int Pin(size_t offset, size_t size);
+
+  /**
+   * Unpins the chunks overlapping the specified range, which the caller has
+   * pinned with `Pin()`, and releases the memory of the chunks no readers pin.
+   * (This function does nothing for a stream that is not windowed.)
+   * @param {size_t} offset
+   * @param {size_t} size
+   * @public
+   */
+  void Unpin(size_t offset, size_t size);
+
+  /**
+   * Reads the specified number of bytes from the specified position of a file.
+   * This function retries reads interrupted by signals, and it fails when the
+   * file ends before the bytes.
+   * @param {int} file
+   * @param {void*} data
+   * @param {size_t} size
+   * @param {uint64_t} offset
+   * @return {int}
+   * @public
+   */
+  static int ReadFile(int file, void* data, size_t size, uint64_t offset);
+
+  /**
+   * Creates a copy of the specified QuickTime stream.
+   * @param {const void*} data
+   * @param {size_t} size
+   * @return {int}
+   * @public
+   */
+  int Copy(const void* data, size_t size);
+
+  /**
+   * Makes the specified stream share the data of this stream. Both streams own
+   * a reference to the data and the data is deleted when the last one of them
+   * is destroyed. (The specified stream must be empty.)
+   * @param {mov::Stream*} stream
+   * @return {int}
+   * @public
+   */
+  int Share(Stream* stream);
+
+  /**
+   * Deletes the stream data owned by this object. (This function only releases
+   * a reference to the data when it is shared with other streams.)
+   * @public
+   */
+  void Destroy();
+
+  /**
+   * Returns the beginning of the stream data.
+   * @return {const uint8_t*}
+   * @public
+   */
+  const uint8_t* GetData() const {
+    return data_;
+  }
+
+  /**
+   * Returns the size of the stream data.
+   * @return {size_t}
+   * @public
+   */
+  size_t GetSize() const {
+    return size_;
+  }
+
+  /**
+   * Returns whether or not this stream is mapped from a file.
+   * @return {int}
+   * @public
+   */
+  int IsMapped() const {
+    return mapped_size_ != 0;
+  }
+
+  /**
+   * Returns whether or not this stream is read progressively from a file.
+   * @return {int}
+   * @public
+   */
+  int IsProgressive() const {
+    return resident_ != NULL;
+  }
+
+  /**
+   * Returns whether or not this stream is a windowed one.
+   * @return {int}
+   * @public
+   */
+  int IsWindowed() const {
+    return pins_ != NULL;
+  }
+
+  /**
+   * Returns whether or not the specified chunk of this progressive stream has
+   * been read.
+   * @param {size_t} chunk
+   * @return {int}
+   * @private
+   */
+  int IsChunkResident(size_t chunk) const {
+    const uint32_t mask = __atomic_load_n(&resident_[chunk >> 5],
+                                          __ATOMIC_ACQUIRE);
+    return (mask >> (chunk & 31)) & 1;
+  }
+
+  /**
+   * Reads the specified chunk of this progressive stream. This function reads
+   * the chunk only when no other streams sharing the data are reading it, and
+   * waits for them otherwise.
+   * @param {size_t} chunk
+   * @return {int}
+   * @private
+   */
+  int LoadChunk(size_t chunk);
+
+  /**
+   * Releases the memory of the specified chunk of this windowed stream unless a
+   * reader pins it or another stream sharing the data is reading it.
+   * @param {size_t} chunk
+   * @private
+   */
+  void EvictChunk(size_t chunk);
+
+  /**
+   * Reserves a virtual-memory region that can contain the specified number of
+   * bytes and a zero-filled padding.
+   * @param {size_t} size
+   * @return {void*}
+   * @private
+   */
+  void* Reserve(size_t size);
+
+  /**
+   * The stream data.
+   * @type {uint8_t*}
+   * @private
+   */
+  uint8_t* data_;
+
+  /**
+   * The size of the stream data.
+   * @type {size_t}
+   * @private
+   */
+  size_t size_;
+
+  /**
+   * The size of the virtual-memory region mapped by this object, including its
+   * zero-filled padding. (This value is 0 when this object owns a copy
+   * allocated with `malloc()`.)
+   * @type {size_t}
+   * @private
+   */
+  size_t mapped_size_;
+
+  /**
+   * The bit-mask representing the chunks of a progressive stream that have been
+   * read, followed by the bit-mask representing the chunks being read. (This
+   * value is NULL when this stream is not progressive.)
+   * @type {uint32_t*}
+   * @private
+   */
+  uint32_t* resident_;
+
+  /**
+   * The number of pins of each chunk of a windowed stream, which follows the
+   * bit-masks of `resident_`. (This value is NULL when this stream is not
+   * windowed.)
+   * @type {uint32_t*}
+   * @private
+   */
+  uint32_t* pins_;
+
+  /**
+   * The number of streams sharing the stream data. (This value is NULL when
+   * this stream does not share its data.)
+   * @type {uint32_t*}
+   * @private
+   */
+  uint32_t* references_;
+
+  /**
+   * The number of chunks in a progressive stream.
+   * @type {size_t}
+   * @private
+   */
+  size_t number_of_chunks_;
+
+  /**
+   * The first chunk that may not have been read yet.
+   * @type {size_t}
+   * @private
+   */
+  size_t next_chunk_;
+
+  /**
+   * The file read by a progressive stream. (This value is valid only when
+   * `resident_` is not NULL.)
+   * @type {int}
+   * @private
+   */
+  int file_;
+};
+
+}  // namespace mov
+
+#endif  // MOV_STREAM_H_